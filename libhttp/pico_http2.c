@@ -0,0 +1,1725 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+#include "pico_stack.h"
+#include "pico_http2.h"
+
+/*
+ * One connection is one pico_http2. Incoming bytes go through a small
+ * frame parser that never needs a whole frame in memory: DATA goes
+ * straight into the receive buffer of its stream, only header blocks
+ * are collected until they are complete. Outgoing frames are assembled
+ * in a single buffer, control frames first, then the streams in turn,
+ * so one busy stream does not starve the others.
+ *
+ * Not supported: server push, priorities (PRIORITY is parsed and
+ * ignored) and Huffman coding of the response headers, which are sent
+ * as plain literals.
+ */
+
+#define HTTP2_FRAME_HDR         9u
+#define HTTP2_DEFAULT_WINDOW    65535
+#define HTTP2_MAX_WINDOW        0x7fffffff
+#define HTTP2_DEFAULT_FRAME     16384u
+#define HTTP2_MAX_FRAME         16777215u
+#define HTTP2_CTL_MAX           8u      /* longest control payload used, PING */
+#define HTTP2_SETTING_LEN       6u
+#define HTTP2_OUR_SETTINGS      4u      /* sent in our SETTINGS frame */
+#define HTTP2_RST_QUEUE         (2u * HTTP2_MAX_STREAMS)
+#define HTTP2_WINDOW_STEP       (HTTP2_STREAM_WINDOW / 2u)  /* window given back in pieces of at least this */
+
+/* Frame types */
+#define HTTP2_DATA              0x0
+#define HTTP2_HEADERS           0x1
+#define HTTP2_PRIORITY          0x2
+#define HTTP2_RST_STREAM        0x3
+#define HTTP2_SETTINGS          0x4
+#define HTTP2_PUSH_PROMISE      0x5
+#define HTTP2_PING              0x6
+#define HTTP2_GOAWAY            0x7
+#define HTTP2_WINDOW_UPDATE     0x8
+#define HTTP2_CONTINUATION      0x9
+
+/* Frame flags */
+#define HTTP2_FLAG_END_STREAM   0x01u
+#define HTTP2_FLAG_ACK          0x01u
+#define HTTP2_FLAG_END_HEADERS  0x04u
+#define HTTP2_FLAG_PADDED       0x08u
+#define HTTP2_FLAG_PRIORITY     0x20u
+
+/* Settings */
+#define HTTP2_SET_HEADER_TABLE_SIZE     0x1
+#define HTTP2_SET_ENABLE_PUSH           0x2
+#define HTTP2_SET_MAX_CONCURRENT        0x3
+#define HTTP2_SET_INITIAL_WINDOW        0x4
+#define HTTP2_SET_MAX_FRAME             0x5
+#define HTTP2_SET_MAX_HEADER_LIST       0x6
+
+/* Error codes */
+#define HTTP2_NO_ERROR          0x0
+#define HTTP2_PROTOCOL_ERROR    0x1
+#define HTTP2_INTERNAL_ERROR    0x2
+#define HTTP2_FLOW_CONTROL      0x3
+#define HTTP2_STREAM_CLOSED     0x5
+#define HTTP2_FRAME_SIZE        0x6
+#define HTTP2_REFUSED_STREAM    0x7
+#define HTTP2_CANCEL            0x8
+#define HTTP2_COMPRESSION       0x9
+#define HTTP2_ENHANCE_CALM      0xb
+
+/* Receive states */
+#define HTTP2_RX_PREFACE        0
+#define HTTP2_RX_HEADER         1
+#define HTTP2_RX_PAYLOAD        2
+#define HTTP2_RX_DEAD           3   /* connection error, GOAWAY is on its way */
+
+/* Connection level frames waiting to go out */
+#define HTTP2_OUT_SETTINGS      0x01u
+#define HTTP2_OUT_SETTINGS_ACK  0x02u
+#define HTTP2_OUT_PING_ACK      0x04u
+#define HTTP2_OUT_GOAWAY        0x08u
+
+/* Stream flags */
+#define HTTP2_S_REMOTE_CLOSED   0x01u   /* the peer sent END_STREAM */
+#define HTTP2_S_RESPONDED       0x02u
+#define HTTP2_S_END             0x04u   /* END_STREAM goes with the last queued output */
+
+#define HTTP2_HPACK_STATIC      61u
+#define HTTP2_HPACK_OVERHEAD    32u
+#define HTTP2_HPACK_DEFAULT_SIZE    4096u   /* what the peer starts with, before it knows ours */
+#if HTTP2_HPACK_TABLE_SIZE > HTTP2_HPACK_DEFAULT_SIZE
+#define HTTP2_HPACK_MAX_SIZE    HTTP2_HPACK_TABLE_SIZE
+#else
+#define HTTP2_HPACK_MAX_SIZE    HTTP2_HPACK_DEFAULT_SIZE
+#endif
+#define HTTP2_HPACK_ENTRIES     (HTTP2_HPACK_MAX_SIZE / HTTP2_HPACK_OVERHEAD)
+#define HTTP2_HPACK_CACHE_CONTROL   "public, max-age=86400"
+
+struct http2_stream
+{
+    uint32_t id;            /* 0 for a free slot */
+    uint8_t flags;
+    int32_t send_window;
+    int32_t recv_window;
+    uint8_t *hdr;           /* encoded response header waiting to go out */
+    uint16_t hdr_len;
+    const uint8_t *data;    /* application data being sent */
+    uint32_t data_len;
+    uint32_t data_sent;
+    uint8_t *rx;            /* request body not read yet, allocated on the first DATA */
+    uint32_t rx_len;
+    uint32_t rx_size;
+    uint32_t rx_unacked;    /* read by the application, not given back to the peer yet */
+};
+
+struct http2_hpack_entry
+{
+    uint32_t name_len;
+    uint32_t value_len;
+    char *name;             /* name and value live right after the entry */
+    char *value;
+};
+
+struct http2_hpack
+{
+    struct http2_hpack_entry *entry[HTTP2_HPACK_ENTRIES];
+    uint32_t head;          /* slot of the newest entry */
+    uint32_t count;
+    uint32_t size;
+    uint32_t max_size;
+    uint32_t limit;         /* largest size the peer may ask for */
+};
+
+struct http2_request
+{
+    uint8_t has_method;
+    uint16_t method;
+    char *path;
+    uint32_t content_length;
+};
+
+struct pico_http2
+{
+    struct pico_http2_cb cb;
+    void *arg;
+
+    /* frame being received */
+    uint8_t rx_state;
+    uint8_t fhdr[HTTP2_FRAME_HDR];
+    uint32_t rx_pos;
+    uint32_t flen;
+    uint8_t ftype;
+    uint8_t fflags;
+    uint32_t fsid;
+    uint32_t fstart;        /* payload part after the pad length and priority fields */
+    uint32_t fend;          /* and before the padding */
+    struct http2_stream *fstream;   /* DATA destination, NULL to drop */
+    uint8_t ctl[HTTP2_CTL_MAX];
+    uint32_t ctl_len;
+
+    /* header block being collected */
+    uint8_t *block;
+    uint32_t block_len;
+    uint32_t block_sid;
+    uint8_t block_open;
+    uint8_t block_end_stream;
+
+    uint32_t last_sid;
+    uint8_t settings_acked; /* until then the peer may use the default stream window */
+    int32_t send_window;
+    int32_t recv_window;
+    uint32_t rx_unacked;
+    int32_t peer_window;    /* initial stream window of the peer */
+    uint32_t peer_frame;
+    struct http2_hpack hpack;
+    struct http2_stream stream[HTTP2_MAX_STREAMS];
+    uint8_t rr;             /* stream that goes first in the next round */
+
+    uint8_t pending;
+    uint8_t ping[HTTP2_CTL_MAX];
+    uint32_t goaway_code;
+    uint32_t rst_sid[HTTP2_RST_QUEUE];
+    uint32_t rst_code[HTTP2_RST_QUEUE];
+    uint8_t rst_count;
+
+    uint8_t busy;           /* nesting depth of the API, output runs at the outermost level */
+    uint8_t destroyed;
+    uint32_t out_len;
+    uint8_t out[HTTP2_OUT_BUF_SIZE];
+};
+
+struct http2_static_entry
+{
+    const char *name;
+    const char *value;
+};
+
+static const struct http2_static_entry http2_static_table[HTTP2_HPACK_STATIC] = {
+    { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+    { ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+    { ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+    { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+    { "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+    { "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+    { "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+    { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+    { "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+    { "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+    { "link", "" }, { "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+    { "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+    { "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+    { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+    { "www-authenticate", "" }
+};
+
+/* static table indexes used by the encoder */
+#define HTTP2_IDX_STATUS_200    8u
+#define HTTP2_IDX_CACHE_CONTROL 24u
+#define HTTP2_IDX_CONTENT_TYPE  31u
+
+/*
+ * Huffman code of RFC 7541 appendix B in canonical form: the number of
+ * codes of every length, and the symbols ordered by code. EOS is the
+ * last code of length 30 and not in the symbol list.
+ */
+static const uint8_t http2_huff_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const uint8_t http2_huff_sym[256] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22
+};
+
+static void http2_output(struct pico_http2 *h2);
+
+static inline uint32_t http2_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void http2_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/*
+ * Every API entry point runs between enter and leave. Callbacks may
+ * call back into the API; only the outermost leave writes frames, and
+ * a destroy from within a callback is carried out there as well.
+ */
+static void http2_free(struct pico_http2 *h2);
+
+static inline void http2_enter(struct pico_http2 *h2)
+{
+    h2->busy++;
+}
+
+static void http2_leave(struct pico_http2 *h2)
+{
+    if (h2->busy == 1u && !h2->destroyed)
+        http2_output(h2);
+
+    if (--h2->busy == 0u && h2->destroyed)
+        http2_free(h2);
+}
+
+/*
+ * HPACK decoding
+ */
+static int8_t hpack_int(const uint8_t *p, uint32_t len, uint32_t *pos, uint8_t prefix, uint32_t *value)
+{
+    uint32_t mask = (1u << prefix) - 1u;
+    uint32_t shift = 0;
+    uint8_t b;
+
+    if (*pos >= len)
+        return HTTP_RETURN_ERROR;
+
+    *value = p[(*pos)++] & mask;
+    if (*value < mask)
+        return HTTP_RETURN_OK;
+
+    do
+    {
+        if (*pos >= len || shift > 21u)
+            return HTTP_RETURN_ERROR;
+
+        b = p[(*pos)++];
+        *value += (uint32_t)(b & 0x7fu) << shift;
+        shift += 7u;
+    } while (b & 0x80u);
+
+    return HTTP_RETURN_OK;
+}
+
+/* canonical decoding, one bit at a time; returns the decoded length */
+static int32_t hpack_huffman(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap)
+{
+    uint32_t code = 0, first = 0, index = 0, bits = 0, out = 0;
+    uint32_t i;
+    int8_t b;
+
+    for (i = 0; i < len; i++)
+    {
+        for (b = 7; b >= 0; b--)
+        {
+            code = (code << 1) | ((uint32_t)(src[i] >> b) & 1u);
+            bits++;
+            if (code - first < http2_huff_count[bits])
+            {
+                index += code - first;
+                if (index >= sizeof(http2_huff_sym) || out >= cap)
+                    return HTTP_RETURN_ERROR; /* EOS in the string, or no room */
+
+                dst[out++] = http2_huff_sym[index];
+                code = first = index = bits = 0;
+            }
+            else
+            {
+                index += http2_huff_count[bits];
+                first = (first + http2_huff_count[bits]) << 1;
+                if (bits >= 30u)
+                    return HTTP_RETURN_ERROR;
+            }
+        }
+    }
+
+    /* padding is the start of EOS: at most 7 bits, all ones */
+    if (bits > 7u || code != (1u << bits) - 1u)
+        return HTTP_RETURN_ERROR;
+
+    return (int32_t)out;
+}
+
+/* string literal, Huffman coded ones are decoded into the scratch buffer */
+static int8_t hpack_string(const uint8_t *p, uint32_t len, uint32_t *pos, const char **str, uint32_t *str_len,
+                           uint8_t *scratch, uint32_t *scratch_used, uint32_t scratch_size)
+{
+    uint8_t huffman;
+    uint32_t slen;
+    int32_t ret;
+
+    if (*pos >= len)
+        return HTTP_RETURN_ERROR;
+
+    huffman = p[*pos] & 0x80u;
+    if (hpack_int(p, len, pos, 7u, &slen) < 0 || slen > len - *pos)
+        return HTTP_RETURN_ERROR;
+
+    if (!huffman)
+    {
+        *str = (const char *)p + *pos;
+        *str_len = slen;
+    }
+    else
+    {
+        ret = hpack_huffman(p + *pos, slen, scratch + *scratch_used, scratch_size - *scratch_used);
+        if (ret < 0)
+            return HTTP_RETURN_ERROR;
+
+        *str = (const char *)scratch + *scratch_used;
+        *str_len = (uint32_t)ret;
+        *scratch_used += (uint32_t)ret;
+    }
+
+    *pos += slen;
+    return HTTP_RETURN_OK;
+}
+
+static void hpack_evict(struct http2_hpack *hp, uint32_t max_size)
+{
+    while (hp->count && hp->size > max_size)
+    {
+        struct http2_hpack_entry *e = hp->entry[(hp->head + hp->count - 1u) % HTTP2_HPACK_ENTRIES];
+
+        hp->size -= e->name_len + e->value_len + HTTP2_HPACK_OVERHEAD;
+        PICO_FREE(e);
+        hp->count--;
+    }
+}
+
+static int8_t hpack_insert(struct http2_hpack *hp, const char *name, uint32_t name_len, const char *value, uint32_t value_len)
+{
+    uint32_t size = name_len + value_len + HTTP2_HPACK_OVERHEAD;
+    struct http2_hpack_entry *e;
+
+    if (size > hp->max_size)
+    {
+        /* too large for the table, which ends up empty */
+        hpack_evict(hp, 0);
+        return HTTP_RETURN_OK;
+    }
+
+    /* copied before evicting, the name may be the one of an evicted entry */
+    e = PICO_ZALLOC(sizeof(struct http2_hpack_entry) + name_len + value_len);
+    if (!e)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    e->name = (char *)(e + 1);
+    e->value = e->name + name_len;
+    e->name_len = name_len;
+    e->value_len = value_len;
+    memcpy(e->name, name, name_len);
+    memcpy(e->value, value, value_len);
+
+    hpack_evict(hp, hp->max_size - size);
+    hp->head = (hp->head + HTTP2_HPACK_ENTRIES - 1u) % HTTP2_HPACK_ENTRIES;
+    hp->entry[hp->head] = e;
+    hp->count++;
+    hp->size += size;
+    return HTTP_RETURN_OK;
+}
+
+static int8_t hpack_lookup(struct http2_hpack *hp, uint32_t index, const char **name, uint32_t *name_len,
+                           const char **value, uint32_t *value_len)
+{
+    struct http2_hpack_entry *e;
+
+    if (!index)
+        return HTTP_RETURN_ERROR;
+
+    if (index <= HTTP2_HPACK_STATIC)
+    {
+        *name = http2_static_table[index - 1u].name;
+        *name_len = (uint32_t)strlen(*name);
+        *value = http2_static_table[index - 1u].value;
+        *value_len = (uint32_t)strlen(*value);
+        return HTTP_RETURN_OK;
+    }
+
+    index -= HTTP2_HPACK_STATIC + 1u;
+    if (index >= hp->count)
+        return HTTP_RETURN_ERROR;
+
+    e = hp->entry[(hp->head + index) % HTTP2_HPACK_ENTRIES];
+    *name = e->name;
+    *name_len = e->name_len;
+    *value = e->value;
+    *value_len = e->value_len;
+    return HTTP_RETURN_OK;
+}
+
+static void hpack_clear(struct http2_hpack *hp)
+{
+    hpack_evict(hp, 0);
+}
+
+#define HTTP2_FIELD_IS(name, len, lit) ((len) == sizeof(lit) - 1u && !memcmp(name, lit, sizeof(lit) - 1u))
+
+/* keeps what the server needs, names and values may not outlive the call */
+static int8_t hpack_field(struct http2_request *req, const char *name, uint32_t name_len, const char *value, uint32_t value_len)
+{
+    uint32_t i;
+
+    if (HTTP2_FIELD_IS(name, name_len, ":method"))
+    {
+        req->has_method = 1;
+        req->method = 0;
+        if (HTTP2_FIELD_IS(value, value_len, "GET"))
+            req->method = HTTP_METHOD_GET;
+        else if (HTTP2_FIELD_IS(value, value_len, "POST"))
+            req->method = HTTP_METHOD_POST;
+        else if (HTTP2_FIELD_IS(value, value_len, "HEAD"))
+            req->method = HTTP_METHOD_HEAD;
+        else if (HTTP2_FIELD_IS(value, value_len, "OPTIONS"))
+            req->method = HTTP_METHOD_OPTIONS;
+    }
+    else if (HTTP2_FIELD_IS(name, name_len, ":path"))
+    {
+        if (req->path)
+            PICO_FREE(req->path);
+
+        req->path = PICO_ZALLOC(value_len + 1u);
+        if (!req->path)
+        {
+            pico_err = PICO_ERR_ENOMEM;
+            return HTTP_RETURN_ERROR;
+        }
+
+        memcpy(req->path, value, value_len);
+    }
+    else if (HTTP2_FIELD_IS(name, name_len, "content-length"))
+    {
+        req->content_length = 0;
+        for (i = 0; i < value_len && value[i] >= '0' && value[i] <= '9'; i++)
+            req->content_length = req->content_length * 10u + (uint32_t)(value[i] - '0');
+    }
+
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Decodes a complete header block. Every representation is processed,
+ * including the ones for fields the server does not use, so the dynamic
+ * table stays in sync with the encoder of the peer.
+ */
+static int8_t hpack_decode(struct http2_hpack *hp, const uint8_t *blk, uint32_t len, struct http2_request *req)
+{
+    uint32_t scratch_size = (len * 8u) / 5u + 1u;   /* shortest code has 5 bits */
+    uint8_t *scratch = PICO_ZALLOC(scratch_size);
+    uint32_t pos = 0;
+    int8_t ret = HTTP_RETURN_OK;
+
+    if (!scratch)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    while (pos < len && ret == HTTP_RETURN_OK)
+    {
+        const char *name = NULL, *value = NULL;
+        uint32_t name_len = 0, value_len = 0, index = 0;
+        uint32_t scratch_used = 0;
+        uint8_t b = blk[pos];
+        uint8_t prefix;
+
+        if (b & 0x80u)
+        {
+            /* indexed field */
+            if (hpack_int(blk, len, &pos, 7u, &index) < 0 ||
+                hpack_lookup(hp, index, &name, &name_len, &value, &value_len) < 0)
+                ret = HTTP_RETURN_ERROR;
+            else
+                ret = hpack_field(req, name, name_len, value, value_len);
+
+            continue;
+        }
+
+        if ((b & 0xe0u) == 0x20u)
+        {
+            /* dynamic table size update */
+            if (hpack_int(blk, len, &pos, 5u, &index) < 0 || index > hp->limit)
+            {
+                ret = HTTP_RETURN_ERROR;
+            }
+            else
+            {
+                hp->max_size = index;
+                hpack_evict(hp, index);
+            }
+
+            continue;
+        }
+
+        /* literal: with incremental indexing, without indexing or never indexed */
+        prefix = ((b & 0xc0u) == 0x40u) ? 6u : 4u;
+        if (hpack_int(blk, len, &pos, prefix, &index) < 0)
+        {
+            ret = HTTP_RETURN_ERROR;
+            continue;
+        }
+
+        if (index)
+            ret = hpack_lookup(hp, index, &name, &name_len, &value, &value_len);
+        else
+            ret = hpack_string(blk, len, &pos, &name, &name_len, scratch, &scratch_used, scratch_size);
+
+        if (ret == HTTP_RETURN_OK)
+            ret = hpack_string(blk, len, &pos, &value, &value_len, scratch, &scratch_used, scratch_size);
+
+        if (ret == HTTP_RETURN_OK)
+            ret = hpack_field(req, name, name_len, value, value_len);
+
+        if (ret == HTTP_RETURN_OK && prefix == 6u)
+            ret = hpack_insert(hp, name, name_len, value, value_len);
+    }
+
+    PICO_FREE(scratch);
+    return ret;
+}
+
+/*
+ * HPACK encoding, literals without indexing and without Huffman coding
+ */
+static uint32_t hpack_put_int(uint8_t *p, uint8_t first, uint8_t prefix, uint32_t value)
+{
+    uint32_t mask = (1u << prefix) - 1u;
+    uint32_t n = 0;
+
+    if (value < mask)
+    {
+        p[n++] = (uint8_t)(first | value);
+        return n;
+    }
+
+    p[n++] = (uint8_t)(first | mask);
+    value -= mask;
+    while (value >= 0x80u)
+    {
+        p[n++] = (uint8_t)((value & 0x7fu) | 0x80u);
+        value >>= 7;
+    }
+    p[n++] = (uint8_t)value;
+    return n;
+}
+
+static uint32_t hpack_put_field(uint8_t *p, uint32_t name_index, const char *value, uint32_t value_len)
+{
+    uint32_t n = hpack_put_int(p, 0x00u, 4u, name_index);
+
+    n += hpack_put_int(p + n, 0x00u, 7u, value_len);
+    memcpy(p + n, value, value_len);
+    return n + value_len;
+}
+
+static uint32_t hpack_put_status(uint8_t *p, uint16_t status)
+{
+    static const uint16_t indexed[] = {
+        200u, 204u, 206u, 304u, 400u, 404u, 500u
+    };
+    char digits[3];
+    uint32_t i;
+
+    for (i = 0; i < sizeof(indexed) / sizeof(indexed[0]); i++)
+    {
+        if (indexed[i] == status)
+            return hpack_put_int(p, 0x80u, 7u, HTTP2_IDX_STATUS_200 + i);
+    }
+
+    digits[0] = (char)('0' + (status / 100u) % 10u);
+    digits[1] = (char)('0' + (status / 10u) % 10u);
+    digits[2] = (char)('0' + status % 10u);
+    return hpack_put_field(p, HTTP2_IDX_STATUS_200, digits, 3u);
+}
+
+/*
+ * Streams
+ */
+static struct http2_stream *http2_find_stream(struct pico_http2 *h2, uint32_t sid)
+{
+    uint32_t i;
+
+    if (!sid)
+        return NULL;
+
+    for (i = 0; i < HTTP2_MAX_STREAMS; i++)
+    {
+        if (h2->stream[i].id == sid)
+            return &h2->stream[i];
+    }
+    return NULL;
+}
+
+static void http2_queue_rst(struct pico_http2 *h2, uint32_t sid, uint32_t code)
+{
+    /* a full queue drops the reset, the peer then times the stream out */
+    if (h2->rst_count >= HTTP2_RST_QUEUE)
+        return;
+
+    h2->rst_sid[h2->rst_count] = sid;
+    h2->rst_code[h2->rst_count] = code;
+    h2->rst_count++;
+}
+
+static void http2_conn_error(struct pico_http2 *h2, uint32_t code)
+{
+    dbg("HTTP/2 connection error %u\n", (unsigned)code);
+    h2->rx_state = HTTP2_RX_DEAD;
+    h2->goaway_code = code;
+    h2->pending |= HTTP2_OUT_GOAWAY;
+}
+
+static void http2_free_stream(struct pico_http2 *h2, struct http2_stream *s, uint8_t notify)
+{
+    uint32_t sid = s->id;
+
+    if (s->hdr)
+        PICO_FREE(s->hdr);
+
+    if (s->rx)
+        PICO_FREE(s->rx);
+
+    /* body that was never read still counts against the connection window */
+    h2->rx_unacked += s->rx_len;
+    if (h2->fstream == s)
+        h2->fstream = NULL;
+
+    memset(s, 0, sizeof(struct http2_stream));
+    if (notify && !h2->destroyed && h2->cb.closed)
+        h2->cb.closed(h2->arg, sid);
+}
+
+static void http2_stream_error(struct pico_http2 *h2, struct http2_stream *s, uint32_t code)
+{
+    http2_queue_rst(h2, s->id, code);
+    http2_free_stream(h2, s, 1u);
+}
+
+/* the response is complete */
+static void http2_stream_done(struct pico_http2 *h2, struct http2_stream *s)
+{
+    /* not interested in the rest of the request body */
+    if (!(s->flags & HTTP2_S_REMOTE_CLOSED))
+        http2_queue_rst(h2, s->id, HTTP2_NO_ERROR);
+
+    http2_free_stream(h2, s, 1u);
+}
+
+/*
+ * Receiving
+ */
+static void http2_header_block(struct pico_http2 *h2)
+{
+    struct http2_request req;
+    struct http2_stream *s;
+    uint32_t sid = h2->block_sid;
+    uint32_t i;
+
+    memset(&req, 0, sizeof(req));
+    if (hpack_decode(&h2->hpack, h2->block, h2->block_len, &req) < 0)
+    {
+        if (req.path)
+            PICO_FREE(req.path);
+
+        http2_conn_error(h2, HTTP2_COMPRESSION);
+        return;
+    }
+
+    s = http2_find_stream(h2, sid);
+    if (s)
+    {
+        /* trailers, they end the request body */
+        if (!h2->block_end_stream || (s->flags & HTTP2_S_REMOTE_CLOSED))
+        {
+            http2_stream_error(h2, s, HTTP2_PROTOCOL_ERROR);
+        }
+        else
+        {
+            s->flags |= HTTP2_S_REMOTE_CLOSED;
+            if (h2->cb.body)
+                h2->cb.body(h2->arg, sid);
+        }
+    }
+    else if (!(sid & 1u))
+    {
+        http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+    }
+    else if (sid <= h2->last_sid)
+    {
+        /* trailers of a stream that is gone already, only decoded for the table */
+    }
+    else
+    {
+        h2->last_sid = sid;
+        for (i = 0; i < HTTP2_MAX_STREAMS && !s; i++)
+        {
+            if (!h2->stream[i].id)
+                s = &h2->stream[i];
+        }
+
+        if (!req.has_method || !req.path)
+        {
+            http2_queue_rst(h2, sid, HTTP2_PROTOCOL_ERROR);
+        }
+        else if (!s)
+        {
+            http2_queue_rst(h2, sid, HTTP2_REFUSED_STREAM);
+        }
+        else
+        {
+            s->id = sid;
+            s->send_window = h2->peer_window;
+            s->recv_window = h2->settings_acked ? (int32_t)HTTP2_STREAM_WINDOW : HTTP2_DEFAULT_WINDOW;
+            if (h2->block_end_stream)
+                s->flags |= HTTP2_S_REMOTE_CLOSED;
+
+            if (!req.method)
+                pico_http2_respond(h2, sid, HTTP_METH_NOT_ALLOWED, NULL, 0, 1u);
+            else if (h2->cb.request(h2->arg, sid, req.method, req.path, req.content_length) < 0 && s->id == sid)
+                http2_stream_error(h2, s, HTTP2_REFUSED_STREAM);
+        }
+    }
+
+    if (req.path)
+        PICO_FREE(req.path);
+}
+
+static void http2_setting(struct pico_http2 *h2, const uint8_t *p)
+{
+    uint16_t id = (uint16_t)((p[0] << 8) | p[1]);
+    uint32_t value = http2_get32(p + 2);
+    uint32_t i;
+
+    if (id == HTTP2_SET_INITIAL_WINDOW)
+    {
+        if (value > HTTP2_MAX_WINDOW)
+        {
+            http2_conn_error(h2, HTTP2_FLOW_CONTROL);
+            return;
+        }
+
+        /* applies to the open streams as well */
+        for (i = 0; i < HTTP2_MAX_STREAMS; i++)
+        {
+            if (h2->stream[i].id)
+                h2->stream[i].send_window += (int32_t)value - h2->peer_window;
+        }
+        h2->peer_window = (int32_t)value;
+    }
+    else if (id == HTTP2_SET_MAX_FRAME)
+    {
+        if (value < HTTP2_DEFAULT_FRAME || value > HTTP2_MAX_FRAME)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else
+            h2->peer_frame = value;
+    }
+    else if (id == HTTP2_SET_ENABLE_PUSH && value > 1u)
+    {
+        http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+    }
+    /* the rest limits what the peer accepts, which is less than it could be anyway */
+}
+
+/* the peer has applied our SETTINGS */
+static void http2_settings_acked(struct pico_http2 *h2)
+{
+    uint32_t i;
+
+    if (h2->settings_acked)
+        return;
+
+    h2->settings_acked = 1u;
+    h2->hpack.limit = HTTP2_HPACK_TABLE_SIZE;
+    /* the windows of open streams shrink by the difference, they may go below zero */
+    for (i = 0; i < HTTP2_MAX_STREAMS; i++)
+    {
+        if (h2->stream[i].id)
+            h2->stream[i].recv_window -= HTTP2_DEFAULT_WINDOW - (int32_t)HTTP2_STREAM_WINDOW;
+    }
+}
+
+static void http2_window_update(struct pico_http2 *h2)
+{
+    uint32_t inc = http2_get32(h2->ctl) & 0x7fffffffu;
+    struct http2_stream *s;
+
+    if (!h2->fsid)
+    {
+        if (!inc)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else if (inc > (uint32_t)(HTTP2_MAX_WINDOW - h2->send_window))
+            http2_conn_error(h2, HTTP2_FLOW_CONTROL);
+        else
+            h2->send_window += (int32_t)inc;
+
+        return;
+    }
+
+    s = http2_find_stream(h2, h2->fsid);
+    if (!s)
+        return;
+
+    if (!inc)
+        http2_stream_error(h2, s, HTTP2_PROTOCOL_ERROR);
+    else if (s->send_window > 0 && inc > (uint32_t)(HTTP2_MAX_WINDOW - s->send_window))
+        http2_stream_error(h2, s, HTTP2_FLOW_CONTROL);
+    else
+        s->send_window += (int32_t)inc;
+}
+
+static void http2_data_begin(struct pico_http2 *h2)
+{
+    struct http2_stream *s = http2_find_stream(h2, h2->fsid);
+
+    if ((int32_t)h2->flen > h2->recv_window)
+    {
+        http2_conn_error(h2, HTTP2_FLOW_CONTROL);
+        return;
+    }
+
+    h2->recv_window -= (int32_t)h2->flen;
+    if (!s)
+    {
+        if (h2->fsid > h2->last_sid)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else
+            h2->rx_unacked += h2->flen; /* for a stream that is gone, dropped */
+
+        return;
+    }
+
+    if (s->flags & HTTP2_S_REMOTE_CLOSED)
+    {
+        h2->rx_unacked += h2->flen;
+        http2_stream_error(h2, s, HTTP2_STREAM_CLOSED);
+        return;
+    }
+
+    if ((int32_t)h2->flen > s->recv_window)
+    {
+        h2->rx_unacked += h2->flen;
+        http2_stream_error(h2, s, HTTP2_FLOW_CONTROL);
+        return;
+    }
+
+    /* more than our window only comes before the peer has our SETTINGS */
+    if (s->rx_len + h2->flen > s->rx_size)
+    {
+        uint32_t size = s->rx_len + h2->flen;
+        uint8_t *rx;
+
+        if (size < HTTP2_STREAM_WINDOW)
+            size = HTTP2_STREAM_WINDOW;
+
+        rx = PICO_ZALLOC(size);
+        if (!rx)
+        {
+            pico_err = PICO_ERR_ENOMEM;
+            h2->rx_unacked += h2->flen;
+            http2_stream_error(h2, s, HTTP2_INTERNAL_ERROR);
+            return;
+        }
+
+        if (s->rx)
+        {
+            memcpy(rx, s->rx, s->rx_len);
+            PICO_FREE(s->rx);
+        }
+
+        s->rx = rx;
+        s->rx_size = size;
+    }
+
+    s->recv_window -= (int32_t)h2->flen;
+    h2->fstream = s;
+}
+
+/* checks a frame header and prepares for its payload */
+static void http2_frame_begin(struct pico_http2 *h2)
+{
+    h2->flen = ((uint32_t)h2->fhdr[0] << 16) | ((uint32_t)h2->fhdr[1] << 8) | h2->fhdr[2];
+    h2->ftype = h2->fhdr[3];
+    h2->fflags = h2->fhdr[4];
+    h2->fsid = http2_get32(h2->fhdr + 5) & 0x7fffffffu;
+    h2->fstart = 0;
+    h2->fend = h2->flen;
+    h2->fstream = NULL;
+    h2->ctl_len = 0;
+
+    if (h2->flen > HTTP2_DEFAULT_FRAME)
+    {
+        http2_conn_error(h2, HTTP2_FRAME_SIZE);
+        return;
+    }
+
+    /* a header block may not be interleaved with other frames */
+    if (h2->block_open && (h2->ftype != HTTP2_CONTINUATION || h2->fsid != h2->block_sid))
+    {
+        http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        return;
+    }
+
+    switch (h2->ftype)
+    {
+    case HTTP2_DATA:
+        if (!h2->fsid)
+        {
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+            return;
+        }
+
+        if (h2->fflags & HTTP2_FLAG_PADDED)
+            h2->fstart = 1u;
+
+        /* the Pad Length octet does not fit in the frame */
+        if (h2->fstart > h2->flen)
+        {
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+            return;
+        }
+
+        http2_data_begin(h2);
+        break;
+
+    case HTTP2_HEADERS:
+        if (h2->fflags & HTTP2_FLAG_PADDED)
+            h2->fstart = 1u;
+
+        if (h2->fflags & HTTP2_FLAG_PRIORITY)
+            h2->fstart += 5u;
+
+        if (!h2->fsid || h2->fstart > h2->flen)
+        {
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+            return;
+        }
+
+        if (!h2->block)
+        {
+            h2->block = PICO_ZALLOC(HTTP2_HEADER_BLOCK_MAX);
+            if (!h2->block)
+            {
+                pico_err = PICO_ERR_ENOMEM;
+                http2_conn_error(h2, HTTP2_INTERNAL_ERROR);
+                return;
+            }
+        }
+
+        h2->block_open = 1u;
+        h2->block_sid = h2->fsid;
+        h2->block_len = 0;
+        h2->block_end_stream = h2->fflags & HTTP2_FLAG_END_STREAM;
+        break;
+
+    case HTTP2_CONTINUATION:
+        if (!h2->block_open)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        break;
+
+    case HTTP2_SETTINGS:
+        if (h2->fsid)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else if ((h2->fflags & HTTP2_FLAG_ACK) ? h2->flen : (h2->flen % HTTP2_SETTING_LEN))
+            http2_conn_error(h2, HTTP2_FRAME_SIZE);
+        break;
+
+    case HTTP2_PING:
+        if (h2->fsid)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else if (h2->flen != 8u)
+            http2_conn_error(h2, HTTP2_FRAME_SIZE);
+        break;
+
+    case HTTP2_GOAWAY:
+        if (h2->fsid)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else if (h2->flen < 8u)
+            http2_conn_error(h2, HTTP2_FRAME_SIZE);
+        break;
+
+    case HTTP2_RST_STREAM:
+        if (!h2->fsid || h2->fsid > h2->last_sid)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else if (h2->flen != 4u)
+            http2_conn_error(h2, HTTP2_FRAME_SIZE);
+        break;
+
+    case HTTP2_WINDOW_UPDATE:
+        /* on an idle stream, like RST_STREAM */
+        if (h2->fsid > h2->last_sid)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else if (h2->flen != 4u)
+            http2_conn_error(h2, HTTP2_FRAME_SIZE);
+        break;
+
+    case HTTP2_PRIORITY:
+        if (!h2->fsid)
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        else if (h2->flen != 5u)
+            http2_conn_error(h2, HTTP2_FRAME_SIZE);
+        break;
+
+    case HTTP2_PUSH_PROMISE:
+        /* clients do not push */
+        http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+        break;
+
+    default:
+        /* unknown frame types are ignored */
+        break;
+    }
+}
+
+static void http2_frame_content(struct pico_http2 *h2, const uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+
+    switch (h2->ftype)
+    {
+    case HTTP2_DATA:
+        if (h2->fstream)
+        {
+            memcpy(h2->fstream->rx + h2->fstream->rx_len, data, len);
+            h2->fstream->rx_len += len;
+        }
+        break;
+
+    case HTTP2_HEADERS:
+    case HTTP2_CONTINUATION:
+        if (h2->block_len + len > HTTP2_HEADER_BLOCK_MAX)
+        {
+            /* cannot be decoded, so the header table would go out of sync */
+            http2_conn_error(h2, HTTP2_ENHANCE_CALM);
+            return;
+        }
+
+        memcpy(h2->block + h2->block_len, data, len);
+        h2->block_len += len;
+        break;
+
+    case HTTP2_SETTINGS:
+        for (i = 0; i < len && h2->rx_state != HTTP2_RX_DEAD; i++)
+        {
+            h2->ctl[h2->ctl_len++] = data[i];
+            if (h2->ctl_len == HTTP2_SETTING_LEN)
+            {
+                http2_setting(h2, h2->ctl);
+                h2->ctl_len = 0;
+            }
+        }
+        break;
+
+    default:
+        for (i = 0; i < len && h2->ctl_len < HTTP2_CTL_MAX; i++)
+            h2->ctl[h2->ctl_len++] = data[i];
+        break;
+    }
+}
+
+static void http2_frame_payload(struct pico_http2 *h2, const uint8_t *data, uint32_t len)
+{
+    uint32_t off = h2->rx_pos;
+    uint32_t start, end;
+
+    if ((h2->fflags & HTTP2_FLAG_PADDED) && off == 0 && (h2->ftype == HTTP2_DATA || h2->ftype == HTTP2_HEADERS))
+    {
+        if (data[0] > h2->flen - h2->fstart)
+        {
+            http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+            return;
+        }
+
+        h2->fend = h2->flen - data[0];
+    }
+
+    start = (off > h2->fstart) ? off : h2->fstart;
+    end = (off + len < h2->fend) ? off + len : h2->fend;
+    if (start < end)
+        http2_frame_content(h2, data + (start - off), end - start);
+}
+
+static void http2_frame_end(struct pico_http2 *h2)
+{
+    struct http2_stream *s;
+    uint32_t sid;
+
+    switch (h2->ftype)
+    {
+    case HTTP2_DATA:
+        s = h2->fstream;
+        if (!s)
+            break;
+
+        /* padding is given back right away */
+        h2->rx_unacked += h2->flen - (h2->fend - h2->fstart);
+        s->rx_unacked += h2->flen - (h2->fend - h2->fstart);
+        h2->fstream = NULL;
+        sid = s->id;
+        if (h2->fflags & HTTP2_FLAG_END_STREAM)
+            s->flags |= HTTP2_S_REMOTE_CLOSED;
+
+        if ((h2->fend > h2->fstart || (h2->fflags & HTTP2_FLAG_END_STREAM)) && h2->cb.body)
+            h2->cb.body(h2->arg, sid);
+        break;
+
+    case HTTP2_HEADERS:
+    case HTTP2_CONTINUATION:
+        if (h2->fflags & HTTP2_FLAG_END_HEADERS)
+        {
+            h2->block_open = 0;
+            http2_header_block(h2);
+        }
+        break;
+
+    case HTTP2_SETTINGS:
+        if (!(h2->fflags & HTTP2_FLAG_ACK))
+            h2->pending |= HTTP2_OUT_SETTINGS_ACK;
+        else
+            http2_settings_acked(h2);
+        break;
+
+    case HTTP2_PING:
+        if (!(h2->fflags & HTTP2_FLAG_ACK))
+        {
+            memcpy(h2->ping, h2->ctl, sizeof(h2->ping));
+            h2->pending |= HTTP2_OUT_PING_ACK;
+        }
+        break;
+
+    case HTTP2_RST_STREAM:
+        s = http2_find_stream(h2, h2->fsid);
+        if (s)
+            http2_free_stream(h2, s, 1u);
+        break;
+
+    case HTTP2_WINDOW_UPDATE:
+        http2_window_update(h2);
+        break;
+
+    default:
+        /* GOAWAY: the peer does not start new streams, the current ones go on */
+        break;
+    }
+}
+
+/*
+ * Sending
+ */
+static uint8_t *http2_out_frame(struct pico_http2 *h2, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid)
+{
+    uint8_t *f = h2->out + h2->out_len;
+
+    f[0] = (uint8_t)(len >> 16);
+    f[1] = (uint8_t)(len >> 8);
+    f[2] = (uint8_t)len;
+    f[3] = type;
+    f[4] = flags;
+    http2_put32(f + 5, sid);
+    h2->out_len += HTTP2_FRAME_HDR + len;
+    return f + HTTP2_FRAME_HDR;
+}
+
+static inline uint32_t http2_out_room(struct pico_http2 *h2)
+{
+    return HTTP2_OUT_BUF_SIZE - h2->out_len;
+}
+
+static uint8_t http2_out_window_update(struct pico_http2 *h2, uint32_t sid, uint32_t *unacked, int32_t *window)
+{
+    if (http2_out_room(h2) < HTTP2_FRAME_HDR + 4u)
+        return 0;
+
+    http2_put32(http2_out_frame(h2, 4u, HTTP2_WINDOW_UPDATE, 0, sid), *unacked);
+    *window += (int32_t)*unacked;
+    *unacked = 0;
+    return 1u;
+}
+
+static uint8_t http2_out_control(struct pico_http2 *h2)
+{
+    uint8_t built = 0;
+    uint8_t *p;
+    uint32_t i;
+
+    if ((h2->pending & HTTP2_OUT_SETTINGS) && http2_out_room(h2) >= HTTP2_FRAME_HDR + HTTP2_OUR_SETTINGS * HTTP2_SETTING_LEN)
+    {
+        static const uint16_t ids[HTTP2_OUR_SETTINGS] = {
+            HTTP2_SET_MAX_CONCURRENT, HTTP2_SET_INITIAL_WINDOW, HTTP2_SET_MAX_FRAME, HTTP2_SET_HEADER_TABLE_SIZE
+        };
+        const uint32_t values[HTTP2_OUR_SETTINGS] = {
+            HTTP2_MAX_STREAMS, HTTP2_STREAM_WINDOW, HTTP2_DEFAULT_FRAME, HTTP2_HPACK_TABLE_SIZE
+        };
+
+        p = http2_out_frame(h2, HTTP2_OUR_SETTINGS * HTTP2_SETTING_LEN, HTTP2_SETTINGS, 0, 0);
+        for (i = 0; i < HTTP2_OUR_SETTINGS; i++)
+        {
+            p[i * HTTP2_SETTING_LEN] = (uint8_t)(ids[i] >> 8);
+            p[i * HTTP2_SETTING_LEN + 1u] = (uint8_t)ids[i];
+            http2_put32(p + i * HTTP2_SETTING_LEN + 2u, values[i]);
+        }
+        h2->pending &= (uint8_t)~HTTP2_OUT_SETTINGS;
+        built = 1u;
+    }
+
+    if ((h2->pending & HTTP2_OUT_SETTINGS_ACK) && http2_out_room(h2) >= HTTP2_FRAME_HDR)
+    {
+        http2_out_frame(h2, 0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0);
+        h2->pending &= (uint8_t)~HTTP2_OUT_SETTINGS_ACK;
+        built = 1u;
+    }
+
+    if ((h2->pending & HTTP2_OUT_PING_ACK) && http2_out_room(h2) >= HTTP2_FRAME_HDR + sizeof(h2->ping))
+    {
+        memcpy(http2_out_frame(h2, sizeof(h2->ping), HTTP2_PING, HTTP2_FLAG_ACK, 0), h2->ping, sizeof(h2->ping));
+        h2->pending &= (uint8_t)~HTTP2_OUT_PING_ACK;
+        built = 1u;
+    }
+
+    while (h2->rst_count && http2_out_room(h2) >= HTTP2_FRAME_HDR + 4u)
+    {
+        http2_put32(http2_out_frame(h2, 4u, HTTP2_RST_STREAM, 0, h2->rst_sid[0]), h2->rst_code[0]);
+        h2->rst_count--;
+        memmove(h2->rst_sid, h2->rst_sid + 1, h2->rst_count * sizeof(uint32_t));
+        memmove(h2->rst_code, h2->rst_code + 1, h2->rst_count * sizeof(uint32_t));
+        built = 1u;
+    }
+
+    if ((h2->pending & HTTP2_OUT_GOAWAY) && http2_out_room(h2) >= HTTP2_FRAME_HDR + 8u)
+    {
+        p = http2_out_frame(h2, 8u, HTTP2_GOAWAY, 0, 0);
+        http2_put32(p, h2->last_sid);
+        http2_put32(p + 4, h2->goaway_code);
+        h2->pending &= (uint8_t)~HTTP2_OUT_GOAWAY;
+        built = 1u;
+    }
+
+    /* the receive windows are given back once a fair piece was read */
+    for (i = 0; i < HTTP2_MAX_STREAMS; i++)
+    {
+        struct http2_stream *s = &h2->stream[i];
+
+        if (s->id && s->rx_unacked && !(s->flags & HTTP2_S_REMOTE_CLOSED) &&
+            (s->rx_unacked >= HTTP2_WINDOW_STEP || !s->rx_len))
+            built |= http2_out_window_update(h2, s->id, &s->rx_unacked, &s->recv_window);
+    }
+
+    if (h2->rx_unacked >= HTTP2_WINDOW_STEP)
+        built |= http2_out_window_update(h2, 0, &h2->rx_unacked, &h2->recv_window);
+
+    return built;
+}
+
+/* one frame per stream per round */
+static uint8_t http2_out_streams(struct pico_http2 *h2)
+{
+    uint8_t built = 0;
+    uint32_t i;
+
+    for (i = 0; i < HTTP2_MAX_STREAMS; i++)
+    {
+        struct http2_stream *s = &h2->stream[(h2->rr + i) % HTTP2_MAX_STREAMS];
+        uint32_t sid = s->id;
+        uint32_t len, sent;
+        uint8_t flags = 0;
+
+        if (!sid)
+            continue;
+
+        if (s->hdr)
+        {
+            if (http2_out_room(h2) < HTTP2_FRAME_HDR + s->hdr_len)
+                continue;
+
+            if ((s->flags & HTTP2_S_END) && !s->data)
+                flags = HTTP2_FLAG_END_STREAM;
+
+            memcpy(http2_out_frame(h2, s->hdr_len, HTTP2_HEADERS, (uint8_t)(flags | HTTP2_FLAG_END_HEADERS), sid), s->hdr, s->hdr_len);
+            PICO_FREE(s->hdr);
+            s->hdr = NULL;
+            built = 1u;
+            if (flags)
+                http2_stream_done(h2, s);
+
+            continue;
+        }
+
+        if (!s->data && !(s->flags & HTTP2_S_END))
+            continue;
+
+        len = s->data_len - s->data_sent;
+        if ((int32_t)len > s->send_window)
+            len = (s->send_window > 0) ? (uint32_t)s->send_window : 0u;
+
+        if ((int32_t)len > h2->send_window)
+            len = (h2->send_window > 0) ? (uint32_t)h2->send_window : 0u;
+
+        if (len > h2->peer_frame)
+            len = h2->peer_frame;
+
+        if (http2_out_room(h2) <= HTTP2_FRAME_HDR)
+            continue;
+
+        if (len > http2_out_room(h2) - HTTP2_FRAME_HDR)
+            len = http2_out_room(h2) - HTTP2_FRAME_HDR;
+
+        /* nothing fits the windows, unless only END_STREAM is left */
+        if (!len && s->data_sent < s->data_len)
+            continue;
+
+        if ((s->flags & HTTP2_S_END) && s->data_sent + len == s->data_len)
+            flags = HTTP2_FLAG_END_STREAM;
+
+        if (len)
+            memcpy(http2_out_frame(h2, len, HTTP2_DATA, flags, sid), s->data + s->data_sent, len);
+        else
+            http2_out_frame(h2, 0, HTTP2_DATA, flags, sid);
+
+        s->send_window -= (int32_t)len;
+        h2->send_window -= (int32_t)len;
+        s->data_sent += len;
+        sent = s->data_sent;
+        built = 1u;
+        if (s->data_sent == s->data_len)
+        {
+            s->data = NULL;
+            s->data_len = 0;
+            s->data_sent = 0;
+        }
+
+        if (len && !h2->destroyed && h2->cb.sent)
+            h2->cb.sent(h2->arg, sid, sent);
+
+        /* the callback may have reset the stream */
+        if (flags && s->id == sid)
+            http2_stream_done(h2, s);
+    }
+
+    h2->rr = (uint8_t)((h2->rr + 1u) % HTTP2_MAX_STREAMS);
+    return built;
+}
+
+static uint8_t http2_out_flush(struct pico_http2 *h2)
+{
+    int32_t ret;
+
+    if (!h2->out_len)
+        return 0;
+
+    ret = h2->cb.write(h2->arg, h2->out, h2->out_len);
+    if (ret <= 0)
+        return 0;
+
+    h2->out_len -= (uint32_t)ret;
+    memmove(h2->out, h2->out + ret, h2->out_len);
+    return 1u;
+}
+
+static void http2_output(struct pico_http2 *h2)
+{
+    uint8_t progress;
+
+    do
+    {
+        progress = http2_out_control(h2);
+        progress |= http2_out_streams(h2);
+        progress |= http2_out_flush(h2);
+    } while (progress && !h2->destroyed);
+}
+
+/*
+ * API
+ */
+
+/*
+ * Creates the engine for a new connection, our SETTINGS are the first
+ * thing to be sent. cb is copied.
+ */
+struct pico_http2 *pico_http2_create(const struct pico_http2_cb *cb, void *arg)
+{
+    struct pico_http2 *h2;
+
+    if (!cb || !cb->write || !cb->request)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    h2 = PICO_ZALLOC(sizeof(struct pico_http2));
+    if (!h2)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+
+    h2->cb = *cb;
+    h2->arg = arg;
+    h2->rx_state = HTTP2_RX_PREFACE;
+    h2->send_window = HTTP2_DEFAULT_WINDOW;
+    h2->recv_window = HTTP2_DEFAULT_WINDOW;
+    h2->peer_window = HTTP2_DEFAULT_WINDOW;
+    h2->peer_frame = HTTP2_DEFAULT_FRAME;
+    /* the default table until the peer has our SETTINGS, a smaller one only after its size update */
+    h2->hpack.max_size = HTTP2_HPACK_DEFAULT_SIZE;
+    h2->hpack.limit = HTTP2_HPACK_MAX_SIZE;
+    h2->pending = HTTP2_OUT_SETTINGS;
+    return h2;
+}
+
+static void http2_free(struct pico_http2 *h2)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP2_MAX_STREAMS; i++)
+    {
+        if (h2->stream[i].id)
+            http2_free_stream(h2, &h2->stream[i], 0);
+    }
+
+    hpack_clear(&h2->hpack);
+    if (h2->block)
+        PICO_FREE(h2->block);
+
+    PICO_FREE(h2);
+}
+
+/*
+ * Frees the engine, no callbacks are made anymore. Safe to call from
+ * within a callback.
+ */
+void pico_http2_destroy(struct pico_http2 *h2)
+{
+    if (!h2)
+        return;
+
+    if (h2->busy)
+        h2->destroyed = 1u;
+    else
+        http2_free(h2);
+}
+
+/*
+ * Processes bytes received from the peer, starting with the client
+ * connection preface. Returns len, or -1 after a connection error: a
+ * GOAWAY was queued and the connection should be closed once it is
+ * flushed.
+ */
+int32_t pico_http2_feed(struct pico_http2 *h2, const uint8_t *data, uint32_t len)
+{
+    uint32_t pos = 0;
+    uint32_t n;
+    int32_t ret;
+
+    if (!h2 || (!data && len))
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    http2_enter(h2);
+    while (pos < len && h2->rx_state != HTTP2_RX_DEAD && !h2->destroyed)
+    {
+        switch (h2->rx_state)
+        {
+        case HTTP2_RX_PREFACE:
+            if (data[pos++] != (uint8_t)HTTP2_PREFACE[h2->rx_pos++])
+                http2_conn_error(h2, HTTP2_PROTOCOL_ERROR);
+            else if (h2->rx_pos == HTTP2_PREFACE_LEN)
+            {
+                h2->rx_state = HTTP2_RX_HEADER;
+                h2->rx_pos = 0;
+            }
+            break;
+
+        case HTTP2_RX_HEADER:
+            h2->fhdr[h2->rx_pos++] = data[pos++];
+            if (h2->rx_pos < HTTP2_FRAME_HDR)
+                break;
+
+            h2->rx_pos = 0;
+            http2_frame_begin(h2);
+            if (h2->rx_state == HTTP2_RX_DEAD)
+                break;
+
+            if (h2->flen)
+                h2->rx_state = HTTP2_RX_PAYLOAD;
+            else
+                http2_frame_end(h2);
+            break;
+
+        default:
+            n = h2->flen - h2->rx_pos;
+            if (n > len - pos)
+                n = len - pos;
+
+            http2_frame_payload(h2, data + pos, n);
+            pos += n;
+            h2->rx_pos += n;
+            if (h2->rx_state != HTTP2_RX_DEAD && h2->rx_pos == h2->flen)
+            {
+                h2->rx_state = HTTP2_RX_HEADER;
+                h2->rx_pos = 0;
+                http2_frame_end(h2);
+            }
+            break;
+        }
+    }
+
+    ret = (h2->rx_state == HTTP2_RX_DEAD) ? HTTP_RETURN_ERROR : (int32_t)len;
+    http2_leave(h2);
+    return ret;
+}
+
+/*
+ * Writes out what is pending, to be called when the transport can take
+ * data again. Returns -1 once the connection is in error.
+ */
+int8_t pico_http2_flush(struct pico_http2 *h2)
+{
+    int8_t ret;
+
+    if (!h2)
+        return HTTP_RETURN_ERROR;
+
+    http2_enter(h2);
+    ret = (h2->rx_state == HTTP2_RX_DEAD) ? HTTP_RETURN_ERROR : HTTP_RETURN_OK;
+    http2_leave(h2);
+    return ret;
+}
+
+/*
+ * Queues the response header of a stream. With end set the response
+ * has no body, otherwise pico_http2_send follows.
+ */
+int8_t pico_http2_respond(struct pico_http2 *h2, uint32_t stream, uint16_t status, const char *mimetype,
+                          uint8_t cacheable, uint8_t end)
+{
+    struct http2_stream *s = h2 ? http2_find_stream(h2, stream) : NULL;
+    uint32_t mime_len = mimetype ? (uint32_t)strlen(mimetype) : 0u;
+    uint32_t max = 1u + 5u + 2u + 5u + mime_len + 2u + 1u + sizeof(HTTP2_HPACK_CACHE_CONTROL);
+    uint8_t *hdr;
+    uint32_t len;
+
+    if (!s || (s->flags & HTTP2_S_RESPONDED) || status < 100u || status > 999u)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (HTTP2_FRAME_HDR + max > HTTP2_OUT_BUF_SIZE)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    hdr = PICO_ZALLOC(max);
+    if (!hdr)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    len = hpack_put_status(hdr, status);
+    if (mimetype)
+        len += hpack_put_field(hdr + len, HTTP2_IDX_CONTENT_TYPE, mimetype, mime_len);
+
+    if (cacheable)
+        len += hpack_put_field(hdr + len, HTTP2_IDX_CACHE_CONTROL, HTTP2_HPACK_CACHE_CONTROL, sizeof(HTTP2_HPACK_CACHE_CONTROL) - 1u);
+
+    http2_enter(h2);
+    s->hdr = hdr;
+    s->hdr_len = (uint16_t)len;
+    s->flags |= HTTP2_S_RESPONDED;
+    if (end)
+        s->flags |= HTTP2_S_END;
+
+    http2_leave(h2);
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Queues response body for a stream. The data is not copied: it has to
+ * stay valid until the sent callback reports all of it. end marks the
+ * last data of the response, data may be NULL then.
+ */
+int8_t pico_http2_send(struct pico_http2 *h2, uint32_t stream, const uint8_t *data, uint32_t len, uint8_t end)
+{
+    struct http2_stream *s = h2 ? http2_find_stream(h2, stream) : NULL;
+
+    if (!s || !(s->flags & HTTP2_S_RESPONDED) || (s->flags & HTTP2_S_END) || s->data || (!data && len))
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    http2_enter(h2);
+    s->data = len ? data : NULL;
+    s->data_len = len;
+    s->data_sent = 0;
+    if (end)
+        s->flags |= HTTP2_S_END;
+
+    http2_leave(h2);
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Takes up to len bytes of request body of a stream. The window of the
+ * peer is opened again as the body is read. Returns the number of
+ * bytes copied, or -1 if the stream does not exist.
+ */
+int32_t pico_http2_read_body(struct pico_http2 *h2, uint32_t stream, uint8_t *buf, uint32_t len)
+{
+    struct http2_stream *s = h2 ? http2_find_stream(h2, stream) : NULL;
+
+    if (!s || !buf)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (len > s->rx_len)
+        len = s->rx_len;
+
+    if (!len)
+        return 0;
+
+    http2_enter(h2);
+    memcpy(buf, s->rx, len);
+    s->rx_len -= len;
+    memmove(s->rx, s->rx + len, s->rx_len);
+    s->rx_unacked += len;
+    h2->rx_unacked += len;
+    http2_leave(h2);
+    return (int32_t)len;
+}
+
+/*
+ * Abandons a stream, the peer is told with RST_STREAM. No closed
+ * callback is made for it.
+ */
+void pico_http2_reset(struct pico_http2 *h2, uint32_t stream)
+{
+    struct http2_stream *s = h2 ? http2_find_stream(h2, stream) : NULL;
+
+    if (!s)
+        return;
+
+    http2_enter(h2);
+    http2_queue_rst(h2, stream, HTTP2_CANCEL);
+    http2_free_stream(h2, s, 0);
+    http2_leave(h2);
+}
@@ -0,0 +1,69 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP2_H_
+#define PICO_HTTP2_H_
+
+#include <stdint.h>
+#include "pico_http_util.h"
+
+#define HTTP2_PREFACE               "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN           24u
+
+#ifndef HTTP2_MAX_STREAMS
+#define HTTP2_MAX_STREAMS           8u      /* concurrent streams per connection */
+#endif
+#ifndef HTTP2_STREAM_WINDOW
+#define HTTP2_STREAM_WINDOW         2048u   /* request body buffered per stream, once the peer has our SETTINGS */
+#endif
+#ifndef HTTP2_HPACK_TABLE_SIZE
+#define HTTP2_HPACK_TABLE_SIZE      4096u   /* dynamic table of the header decoder */
+#endif
+#ifndef HTTP2_HEADER_BLOCK_MAX
+#define HTTP2_HEADER_BLOCK_MAX      2048u   /* encoded request header, CONTINUATIONs included */
+#endif
+#ifndef HTTP2_OUT_BUF_SIZE
+#define HTTP2_OUT_BUF_SIZE          1460u   /* frames are assembled here before being written */
+#endif
+
+/*
+ * HTTP/2 server side connection engine (RFC 7540, header compression
+ * RFC 7541). The engine only sees bytes: what came from the peer is
+ * passed to pico_http2_feed, frames for the peer go out through the
+ * write callback. All streams of the connection share that one
+ * transport; every stream is one request/response exchange.
+ *
+ * Callbacks, arg is the one given to pico_http2_create:
+ *  write:   writes up to len bytes, returns how many were taken.
+ *  request: a complete request header arrived on a new stream.
+ *           method is one of HTTP_METHOD_*, content_length 0 if not given.
+ *           Return a negative value to refuse the stream.
+ *  body:    request body for the stream can be read with pico_http2_read_body.
+ *  sent:    sent bytes of the data handed to pico_http2_send are framed,
+ *           the data may be reused once sent equals its length.
+ *  closed:  the stream is gone, reset by the peer or completely answered.
+ */
+struct pico_http2_cb
+{
+    int32_t (*write)(void *arg, const void *buf, uint32_t len);
+    int8_t (*request)(void *arg, uint32_t stream, uint16_t method, const char *path, uint32_t content_length);
+    void (*body)(void *arg, uint32_t stream);
+    void (*sent)(void *arg, uint32_t stream, uint32_t sent);
+    void (*closed)(void *arg, uint32_t stream);
+};
+
+struct pico_http2;
+
+struct pico_http2 *pico_http2_create(const struct pico_http2_cb *cb, void *arg);
+void pico_http2_destroy(struct pico_http2 *h2);
+int32_t pico_http2_feed(struct pico_http2 *h2, const uint8_t *data, uint32_t len);
+int8_t pico_http2_flush(struct pico_http2 *h2);
+int8_t pico_http2_respond(struct pico_http2 *h2, uint32_t stream, uint16_t status, const char *mimetype,
+                          uint8_t cacheable, uint8_t end);
+int8_t pico_http2_send(struct pico_http2 *h2, uint32_t stream, const uint8_t *data, uint32_t len, uint8_t end);
+int32_t pico_http2_read_body(struct pico_http2 *h2, uint32_t stream, uint8_t *buf, uint32_t len);
+void pico_http2_reset(struct pico_http2 *h2, uint32_t stream);
+
+#endif /* PICO_HTTP2_H_ */
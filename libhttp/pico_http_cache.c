@@ -0,0 +1,744 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+#include <string.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_client.h"
+#include "pico_http_util.h"
+#include "pico_http_cache.h"
+
+/* Request states */
+#define CACHE_REQ_LOCAL         0   /* body is served from the cache by the timer */
+#define CACHE_REQ_CONNECTING    1   /* client opened, the GET goes out with EV_HTTP_CON */
+#define CACHE_REQ_HEADER        2   /* waiting for the response header */
+#define CACHE_REQ_BODY          3   /* body of a 200 coming in */
+#define CACHE_REQ_CHECKED       4   /* 304 received, waiting for the end of the response */
+#define CACHE_REQ_DONE          5   /* done is called from the timer */
+
+struct http_cache_entry
+{
+    char *uri;              /* NULL if the entry is free */
+    char etag[HTTP_CACHE_VALIDATOR_MAX];
+    char last_modified[HTTP_CACHE_VALIDATOR_MAX];
+    pico_time expires;
+    uint8_t *body;          /* without a store */
+    uint32_t len;           /* body bytes */
+    uint32_t size;          /* bytes taken from the budget */
+    uint32_t used;          /* for dropping the least recently used one */
+    uint8_t users;          /* requests serving or filling it, it is not freed under them */
+    uint8_t filling;        /* body still coming in */
+    uint8_t dropped;        /* no longer found, freed when the last user is gone */
+};
+
+struct pico_http_cache_request
+{
+    struct pico_http_cache_request *next;
+    char *uri;
+    int32_t conn;                       /* client, -1 if none */
+    struct http_cache_entry *entry;     /* copy that is served or checked, NULL if none */
+    struct http_cache_entry *fill;      /* copy the response is stored in, NULL if none */
+    uint32_t offset;                    /* body bytes passed to data */
+    uint8_t state;
+    int8_t result;
+    void (*data)(struct pico_http_cache_request *req, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg);
+    void (*done)(struct pico_http_cache_request *req, int8_t result, void *arg);
+    void *arg;
+    char headers[2u * HTTP_CACHE_VALIDATOR_MAX + 40u];  /* If-None-Match and If-Modified-Since lines */
+};
+
+static struct http_cache_entry cache_entries[HTTP_CACHE_ENTRIES];
+static struct pico_http_cache_store cache_store;
+static uint8_t cache_has_store = 0;
+static uint32_t cache_bytes = 0;
+static uint32_t cache_clock = 0;
+static struct pico_http_cache_request *cache_requests = NULL;
+static uint8_t cache_kick_pending = 0;
+
+static void cache_wakeup(uint16_t ev, uint16_t conn);
+static void cache_sink(uint16_t conn, const uint8_t *data, uint32_t len, void *arg);
+static void cache_kick(pico_time now, void *arg);
+
+static uint8_t entry_slot(struct http_cache_entry *e)
+{
+    return (uint8_t)(e - cache_entries);
+}
+
+static void entry_free(struct http_cache_entry *e)
+{
+    if (cache_has_store)
+    {
+        cache_store.erase(entry_slot(e), cache_store.arg);
+    }
+    else if (e->body)
+    {
+        PICO_FREE(e->body);
+    }
+    PICO_FREE(e->uri);
+    cache_bytes -= e->size;
+    memset(e, 0, sizeof(struct http_cache_entry));
+}
+
+static void entry_drop(struct http_cache_entry *e)
+{
+    if (e->users)
+    {
+        e->dropped = 1;
+        return;
+    }
+    entry_free(e);
+}
+
+static void entry_release(struct http_cache_entry *e)
+{
+    if (e->users)
+    {
+        e->users--;
+    }
+    if (!e->users && e->dropped)
+    {
+        entry_free(e);
+    }
+}
+
+static struct http_cache_entry *cache_find(const char *uri)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        struct http_cache_entry *e = &cache_entries[i];
+
+        if (e->uri && !e->dropped && !strcmp(e->uri, uri))
+        {
+            e->used = ++cache_clock;
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* the least recently used entry nobody is using, NULL if there is none */
+static struct http_cache_entry *cache_victim(void)
+{
+    struct http_cache_entry *victim = NULL;
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        struct http_cache_entry *e = &cache_entries[i];
+
+        if (e->uri && !e->users && (!victim || (int32_t)(e->used - victim->used) < 0))
+        {
+            victim = e;
+        }
+    }
+    return victim;
+}
+
+/* drops entries until need more bytes fit in the budget */
+static int8_t cache_make_room(uint32_t need)
+{
+    struct http_cache_entry *victim;
+
+    if (need > HTTP_CACHE_BUDGET)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    while (cache_bytes + need > HTTP_CACHE_BUDGET)
+    {
+        victim = cache_victim();
+        if (!victim)
+        {
+            return HTTP_RETURN_ERROR;
+        }
+        entry_free(victim);
+    }
+    return HTTP_RETURN_OK;
+}
+
+static int fresh(struct http_cache_entry *e)
+{
+    return (int64_t)(e->expires - PICO_TIME_MS()) > 0;
+}
+
+static void validator_store(char *to, const char *value)
+{
+    if (value && strlen(value) < HTTP_CACHE_VALIDATOR_MAX)
+    {
+        strcpy(to, value);
+    }
+    else
+    {
+        to[0] = '\0';
+    }
+}
+
+/* what the response says about its validators and how long it stays fresh */
+static void entry_update(struct http_cache_entry *e, struct pico_http_header *header)
+{
+    if (header->etag)
+    {
+        validator_store(e->etag, header->etag);
+    }
+    if (header->last_modified)
+    {
+        validator_store(e->last_modified, header->last_modified);
+    }
+    e->expires = PICO_TIME_MS();
+    if ((header->cache_control & (HTTP_CACHE_CONTROL_MAX_AGE | HTTP_CACHE_CONTROL_NO_CACHE)) == HTTP_CACHE_CONTROL_MAX_AGE)
+    {
+        e->expires += (pico_time)header->max_age * 1000u;
+    }
+}
+
+static int cacheable(struct pico_http_header *header)
+{
+    if (header->cache_control & HTTP_CACHE_CONTROL_NO_STORE)
+    {
+        return 0;
+    }
+    if (header->transfer_coding == HTTP_TRANSFER_FULL && header->content_length_or_chunk > HTTP_CACHE_BUDGET)
+    {
+        return 0;
+    }
+    return header->etag || header->last_modified ||
+           ((header->cache_control & HTTP_CACHE_CONTROL_MAX_AGE) && header->max_age);
+}
+
+/* a new entry for the response that starts coming in, the one it replaces is dropped */
+static struct http_cache_entry *fill_start(struct pico_http_cache_request *req, struct pico_http_header *header)
+{
+    struct http_cache_entry *e, *old = cache_find(req->uri);
+    uint32_t size = (header->transfer_coding == HTTP_TRANSFER_FULL) ? header->content_length_or_chunk : 0u;
+    uint32_t i;
+
+    if (old)
+    {
+        entry_drop(old);
+    }
+    if (cache_make_room(size) < 0)
+    {
+        return NULL;
+    }
+    e = NULL;
+    for (i = 0; i < HTTP_CACHE_ENTRIES && !e; i++)
+    {
+        if (!cache_entries[i].uri)
+        {
+            e = &cache_entries[i];
+        }
+    }
+    if (!e)
+    {
+        e = cache_victim();
+        if (!e)
+        {
+            return NULL;
+        }
+        entry_free(e);
+    }
+
+    e->uri = PICO_ZALLOC(strlen(req->uri) + 1u);
+    if (!e->uri)
+    {
+        return NULL;
+    }
+    strcpy(e->uri, req->uri);
+    if (size && !cache_has_store)
+    {
+        e->body = PICO_ZALLOC(size);
+        if (!e->body)
+        {
+            PICO_FREE(e->uri);
+            e->uri = NULL;
+            return NULL;
+        }
+    }
+    e->size = size;
+    cache_bytes += size;
+    e->used = ++cache_clock;
+    e->users = 1;
+    e->filling = 1;
+    entry_update(e, header);
+    return e;
+}
+
+/* a chunked body is stored in a buffer that doubles */
+static int8_t fill_grow(struct http_cache_entry *e, uint32_t need)
+{
+    uint32_t size = e->size ? e->size : HTTP_CACHE_READ_SIZE;
+    uint8_t *body;
+
+    while (size < need)
+    {
+        size *= 2u;
+    }
+    if (cache_has_store || size > HTTP_CACHE_BUDGET)
+    {
+        /* a store is only written at the end, nothing to allocate ahead */
+        size = need;
+    }
+    if (cache_make_room(size - e->size) < 0)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    if (!cache_has_store)
+    {
+        body = PICO_ZALLOC(size);
+        if (!body)
+        {
+            return HTTP_RETURN_ERROR;
+        }
+        if (e->body)
+        {
+            memcpy(body, e->body, e->len);
+            PICO_FREE(e->body);
+        }
+        e->body = body;
+    }
+    cache_bytes += size - e->size;
+    e->size = size;
+    return HTTP_RETURN_OK;
+}
+
+static int8_t fill_append(struct http_cache_entry *e, const uint8_t *data, uint32_t len)
+{
+    if (e->len + len > e->size && fill_grow(e, e->len + len) < 0)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    if (cache_has_store)
+    {
+        if (cache_store.write(entry_slot(e), e->len, data, len, cache_store.arg) != (int32_t)len)
+        {
+            return HTTP_RETURN_ERROR;
+        }
+    }
+    else
+    {
+        memcpy(e->body + e->len, data, len);
+    }
+    e->len += len;
+    return HTTP_RETURN_OK;
+}
+
+/* the response is not (or no longer) stored */
+static void fill_cancel(struct pico_http_cache_request *req)
+{
+    if (req->fill)
+    {
+        req->fill->dropped = 1;
+        entry_release(req->fill);
+        req->fill = NULL;
+    }
+}
+
+static void schedule_kick(void)
+{
+    if (!cache_kick_pending && pico_timer_add(0, cache_kick, NULL))
+    {
+        cache_kick_pending = 1;
+    }
+}
+
+/* the client is closed and done is called from the timer, not from within the wakeup */
+static void request_finish(struct pico_http_cache_request *req, int8_t result)
+{
+    fill_cancel(req);
+    req->state = CACHE_REQ_DONE;
+    req->result = result;
+    schedule_kick();
+}
+
+static char *put_header(char *p, const char *name, const char *value)
+{
+    strcpy(p, name);
+    p += strlen(name);
+    strcpy(p, value);
+    p += strlen(value);
+    memcpy(p, "\r\n", 3u);
+    return p + 2;
+}
+
+static int8_t request_open(struct pico_http_cache_request *req)
+{
+    char *p = req->headers;
+    int32_t conn;
+
+    if (req->entry)
+    {
+        if (req->entry->etag[0])
+        {
+            p = put_header(p, "If-None-Match: ", req->entry->etag);
+        }
+        if (req->entry->last_modified[0])
+        {
+            p = put_header(p, "If-Modified-Since: ", req->entry->last_modified);
+        }
+    }
+    *p = '\0';
+
+    conn = pico_http_client_open(req->uri, cache_wakeup);
+    if (conn < 0)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    req->conn = conn;
+    req->state = CACHE_REQ_CONNECTING;
+    pico_http_client_set_headers((uint16_t)conn, req->headers);
+    pico_http_client_set_body_sink((uint16_t)conn, cache_sink, NULL);
+    return HTTP_RETURN_OK;
+}
+
+static struct pico_http_cache_request *request_find(uint16_t conn)
+{
+    struct pico_http_cache_request *req;
+
+    for (req = cache_requests; req; req = req->next)
+    {
+        if (req->conn == (int32_t)conn && req->state >= CACHE_REQ_CONNECTING && req->state < CACHE_REQ_DONE)
+        {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static int request_alive(struct pico_http_cache_request *req)
+{
+    struct pico_http_cache_request *r;
+
+    for (r = cache_requests; r; r = r->next)
+    {
+        if (r == req)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void request_response(struct pico_http_cache_request *req, uint16_t conn)
+{
+    struct pico_http_header *header = pico_http_client_read_header(conn);
+
+    if (!header)
+    {
+        request_finish(req, HTTP_CACHE_FAILED);
+        return;
+    }
+
+    if (header->response_code == HTTP_NOT_MODIFIED && req->entry)
+    {
+        if (!req->entry->dropped)
+        {
+            entry_update(req->entry, header);
+        }
+        req->state = CACHE_REQ_CHECKED;
+    }
+    else if (header->response_code == HTTP_OK)
+    {
+        if (req->entry)
+        {
+            entry_release(req->entry);
+            req->entry = NULL;
+        }
+        if (cacheable(header))
+        {
+            req->fill = fill_start(req, header);
+        }
+        req->state = CACHE_REQ_BODY;
+    }
+    else
+    {
+        request_finish(req, HTTP_CACHE_FAILED);
+    }
+}
+
+static void cache_wakeup(uint16_t ev, uint16_t conn)
+{
+    struct pico_http_cache_request *req = request_find(conn);
+
+    if (!req)
+    {
+        return;
+    }
+
+    if ((ev & EV_HTTP_CON) && req->state == CACHE_REQ_CONNECTING)
+    {
+        /* keep-alive, the connection goes to the pool for the next poll */
+        if (pico_http_client_send_get(conn, NULL, HTTP_CONN_KEEP_ALIVE) < 0)
+        {
+            request_finish(req, HTTP_CACHE_FAILED);
+            return;
+        }
+        req->state = CACHE_REQ_HEADER;
+    }
+    if ((ev & EV_HTTP_REQ) && req->state == CACHE_REQ_HEADER)
+    {
+        request_response(req, conn);
+    }
+    if (ev & EV_HTTP_DONE)
+    {
+        if (req->state == CACHE_REQ_BODY)
+        {
+            if (req->fill)
+            {
+                req->fill->filling = 0;
+                entry_release(req->fill);
+                req->fill = NULL;
+            }
+            request_finish(req, HTTP_CACHE_FETCHED);
+        }
+        else if (req->state == CACHE_REQ_CHECKED)
+        {
+            req->state = CACHE_REQ_LOCAL;
+            req->result = HTTP_CACHE_REVALIDATED;
+            schedule_kick();
+        }
+    }
+    if ((ev & (EV_HTTP_ERROR | EV_HTTP_CLOSE)) && req->state >= CACHE_REQ_CONNECTING && req->state < CACHE_REQ_DONE)
+    {
+        request_finish(req, HTTP_CACHE_FAILED);
+    }
+}
+
+static void cache_sink(uint16_t conn, const uint8_t *data, uint32_t len, void *arg)
+{
+    struct pico_http_cache_request *req = request_find(conn);
+    uint32_t offset;
+
+    (void)arg;
+    if (!req || req->state != CACHE_REQ_BODY || !len)
+    {
+        return;
+    }
+
+    if (req->fill && fill_append(req->fill, data, len) < 0)
+    {
+        /* too big for the cache after all, it still goes to the user */
+        fill_cancel(req);
+    }
+    offset = req->offset;
+    req->offset += len;
+    /* the request may be aborted from the callback, nothing is touched after it */
+    req->data(req, offset, data, len, req->arg);
+}
+
+/* passes the cached body to the user, the entry can not be freed meanwhile */
+static void request_serve(struct pico_http_cache_request *req)
+{
+    struct http_cache_entry *e = req->entry;
+    uint8_t buf[HTTP_CACHE_READ_SIZE];
+    const uint8_t *data;
+    uint32_t offset;
+    int32_t len;
+
+    while (req->offset < e->len)
+    {
+        len = (int32_t)(e->len - req->offset);
+        if (cache_has_store)
+        {
+            if (len > (int32_t)sizeof(buf))
+            {
+                len = (int32_t)sizeof(buf);
+            }
+            len = cache_store.read(entry_slot(e), req->offset, buf, (uint32_t)len, cache_store.arg);
+            if (len <= 0)
+            {
+                /* the store lost it */
+                entry_drop(e);
+                req->result = HTTP_CACHE_FAILED;
+                break;
+            }
+            data = buf;
+        }
+        else
+        {
+            data = e->body + req->offset;
+        }
+        offset = req->offset;
+        req->offset += (uint32_t)len;
+        req->data(req, offset, data, (uint32_t)len, req->arg);
+        if (!request_alive(req))
+        {
+            return;
+        }
+    }
+    req->state = CACHE_REQ_DONE;
+}
+
+static void request_free(struct pico_http_cache_request *req)
+{
+    if (req->conn >= 0)
+    {
+        pico_http_client_close((uint16_t)req->conn);
+    }
+    fill_cancel(req);
+    if (req->entry)
+    {
+        entry_release(req->entry);
+    }
+    PICO_FREE(req->uri);
+    PICO_FREE(req);
+}
+
+/*
+ * Serves the requests that can be answered from the cache and finishes
+ * the ones that are done. The callbacks may start or abort requests,
+ * so the list is searched again after each one.
+ */
+static void cache_kick(pico_time now, void *arg)
+{
+    struct pico_http_cache_request *req, **prev;
+
+    (void)now;
+    (void)arg;
+    cache_kick_pending = 0;
+    do
+    {
+        for (prev = &cache_requests; (req = *prev) != NULL; prev = &req->next)
+        {
+            if (req->state == CACHE_REQ_LOCAL || req->state == CACHE_REQ_DONE)
+            {
+                break;
+            }
+        }
+        if (!req)
+        {
+            return;
+        }
+
+        if (req->state == CACHE_REQ_LOCAL)
+        {
+            if (req->conn >= 0)
+            {
+                pico_http_client_close((uint16_t)req->conn);
+                req->conn = -1;
+            }
+            request_serve(req);
+        }
+        else
+        {
+            *prev = req->next;
+            req->done(req, req->result, req->arg);
+            request_free(req);
+        }
+    } while (1);
+}
+
+/*
+ * API to fetch a resource through the cache, see pico_http_cache.h.
+ * Returns NULL if the uri can not be opened.
+ */
+struct pico_http_cache_request *pico_http_cache_get(const char *uri,
+                                                    void (*data)(struct pico_http_cache_request *req, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg),
+                                                    void (*done)(struct pico_http_cache_request *req, int8_t result, void *arg),
+                                                    void *arg)
+{
+    struct pico_http_cache_request *req;
+    struct http_cache_entry *e;
+
+    if (!uri || !data || !done)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    req = PICO_ZALLOC(sizeof(struct pico_http_cache_request));
+    if (!req)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+    req->uri = PICO_ZALLOC(strlen(uri) + 1u);
+    if (!req->uri)
+    {
+        PICO_FREE(req);
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+    strcpy(req->uri, uri);
+    req->conn = -1;
+    req->data = data;
+    req->done = done;
+    req->arg = arg;
+
+    e = cache_find(uri);
+    if (e && !e->filling)
+    {
+        req->entry = e;
+        e->users++;
+    }
+    if (req->entry && fresh(e))
+    {
+        req->state = CACHE_REQ_LOCAL;
+        req->result = HTTP_CACHE_FRESH;
+        schedule_kick();
+    }
+    else if (request_open(req) < 0)
+    {
+        request_free(req);
+        return NULL;
+    }
+    req->next = cache_requests;
+    cache_requests = req;
+    return req;
+}
+
+/* stops the request, the done callback is not called */
+void pico_http_cache_abort(struct pico_http_cache_request *req)
+{
+    struct pico_http_cache_request **prev;
+
+    for (prev = &cache_requests; *prev; prev = &(*prev)->next)
+    {
+        if (*prev == req)
+        {
+            *prev = req->next;
+            request_free(req);
+            return;
+        }
+    }
+}
+
+/* forgets all cached resources, the ones being served go once they are done */
+void pico_http_cache_flush(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        if (cache_entries[i].uri)
+        {
+            entry_drop(&cache_entries[i]);
+        }
+    }
+}
+
+/*
+ * Keeps the bodies in the store from now on, or in RAM again with NULL.
+ * The cache is flushed; it fails while requests are running.
+ */
+int8_t pico_http_cache_set_store(const struct pico_http_cache_store *store)
+{
+    if (cache_requests)
+    {
+        pico_err = PICO_ERR_EBUSY;
+        return HTTP_RETURN_ERROR;
+    }
+    if (store && (!store->write || !store->read || !store->erase))
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    pico_http_cache_flush();
+    if (store)
+    {
+        cache_store = *store;
+    }
+    cache_has_store = (store != NULL);
+    return HTTP_RETURN_OK;
+}
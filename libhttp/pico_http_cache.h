@@ -0,0 +1,74 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP_CACHE_H_
+#define PICO_HTTP_CACHE_H_
+
+#include <stdint.h>
+
+#ifndef HTTP_CACHE_ENTRIES
+#define HTTP_CACHE_ENTRIES          8u      /* resources kept */
+#endif
+#ifndef HTTP_CACHE_BUDGET
+#define HTTP_CACHE_BUDGET           16384u  /* body bytes kept, all resources together */
+#endif
+#ifndef HTTP_CACHE_READ_SIZE
+#define HTTP_CACHE_READ_SIZE        128u    /* piece read from the store at a time, on the stack */
+#endif
+#define HTTP_CACHE_VALIDATOR_MAX    64u
+
+/* Result passed to the done callback: where the body came from */
+#define HTTP_CACHE_FAILED           (-1)
+#define HTTP_CACHE_FETCHED          0       /* from the server */
+#define HTTP_CACHE_FRESH            1       /* from the cache, nothing was sent */
+#define HTTP_CACHE_REVALIDATED      2       /* from the cache, the server answered 304 */
+
+/*
+ * Where the cached bodies are kept, e.g. in flash instead of RAM. Every
+ * resource has a slot 0 .. HTTP_CACHE_ENTRIES - 1. The body is written
+ * in order from offset 0, read may be asked for any part of it, erase
+ * empties the slot. write and read return the bytes done, -1 on failure.
+ */
+struct pico_http_cache_store
+{
+    int32_t (*write)(uint8_t slot, uint32_t offset, const uint8_t *data, uint32_t len, void *arg);
+    int32_t (*read)(uint8_t slot, uint32_t offset, uint8_t *buf, uint32_t len, void *arg);
+    void (*erase)(uint8_t slot, void *arg);
+    void *arg;
+};
+
+/*
+ * Client side cache of GET responses, keyed by URI.
+ *
+ * pico_http_cache_get passes the body of uri to the data callback, then
+ * calls done with one of the results above. A fresh copy is served
+ * without sending anything. A stale one is asked for again with
+ * If-None-Match and If-Modified-Since, after a 304 its body is served
+ * from the cache and it is fresh for the new max-age.
+ *
+ * A 200 response is stored when it has an ETag, a Last-Modified or a
+ * max-age, is not no-store and its body fits in HTTP_CACHE_BUDGET; the
+ * least recently used resources make room for it. Freshness comes from
+ * Cache-Control max-age only, no-cache responses are checked each time.
+ * Any other response fails the request.
+ *
+ * The callbacks are called from the stack, never from within
+ * pico_http_cache_get. The request is freed after done returns,
+ * pico_http_cache_abort stops it without calling done.
+ *
+ * The bodies are kept in RAM unless a store is set. Only the bodies go
+ * there, the index of the cache is in RAM and starts empty after a reset.
+ */
+struct pico_http_cache_request;
+
+int8_t pico_http_cache_set_store(const struct pico_http_cache_store *store);
+struct pico_http_cache_request *pico_http_cache_get(const char *uri,
+                                                    void (*data)(struct pico_http_cache_request *req, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg),
+                                                    void (*done)(struct pico_http_cache_request *req, int8_t result, void *arg),
+                                                    void *arg);
+void pico_http_cache_abort(struct pico_http_cache_request *req);
+void pico_http_cache_flush(void);
+
+#endif /* PICO_HTTP_CACHE_H_ */
@@ -20,28 +20,19 @@
 #include "pico_dns_client.h"
 #include "pico_http_client.h"
 #include "pico_http_util.h"
+#include "pico_http_dns.h"
+#include "pico_http_inflate.h"
 #include "pico_ipv4.h"
 #include "pico_stack.h"
 
-/*
- * This is the size of the following header
- *
- * GET <resource> HTTP/1.1<CRLF>
- * Host: <host>:<port><CRLF>
- * User-Agent: picoTCP<CRLF>
- * Connection: Close/Keep-Alive<CRLF>
- * <CRLF>
- *
- * where <resource>,<host> and <port> will be added later.
- */
-
-#define HTTP_GET_BASIC_SIZE                 100u   //70u
-#define HTTP_POST_BASIC_SIZE                256u
-#define HTTP_POST_MULTIPART_BASIC_SIZE      80u
-#define HTTP_POST_HEADER_BASIC_SIZE         160u
-#define HTTP_DELETE_BASIC_SIZE              70u
-#define HTTP_HEADER_LINE_SIZE               50u
+#define HTTP_REQUEST_FRAGMENTS              24u    /* pieces a request header is assembled from */
+#ifndef HTTP_HEADER_LINE_SIZE
+#define HTTP_HEADER_LINE_SIZE               128u   /* longer response header lines are truncated */
+#endif
+#define HTTP_CLIENT_RX_SIZE                 256u   /* response bytes fetched per socket read */
+#define HTTP_CLIENT_TX_SIZE                 536u   /* request parts shorter than this (the default MSS) are gathered */
 #define HTTP_MAX_FIXED_POST_MULTIPART_CHUNK 100u
+#define HTTP_UPLOAD_FRAME                   10u    /* room for the size line in front of an upload chunk */
 #define RESPONSE_INDEX                      9u
 
 #define HTTP_CHUNK_ERROR    0xFFFFFFFFu
@@ -54,16 +45,14 @@
 
 #define nop() do {} while(0)
 
-#define consume_char(c)                          (pico_socket_read(client->sck, &c, 1u))
-#define is_location(line)                        (memcmp(line, "Location", 8u) == 0)
-#define is_content_length(line)           (memcmp(line, "Content-Length", 14u) == 0u)
-#define is_transfer_encoding(line)        (memcmp(line, "Transfer-Encoding", 17u) == 0u)
-#define is_chunked(line)                         (memcmp(line, " chunked", 8u) == 0u)
+#define consume_char(c)                          (client_getc(client, &c))
 #define is_not_HTTPv1(line)                       (memcmp(line, "HTTP/1.", 7u))
 #define is_hex_digit(x) ((('0' <= x) && (x <= '9')) || (('a' <= x) && (x <= 'f')))
 #define hex_digit_to_dec(x) ((('0' <= x) && (x <= '9')) ? (x - '0') : ((('a' <= x) && (x <= 'f')) ? (x - 'a' + 10) : (-1)))
 
 static uint16_t global_client_conn_ID = 0;
+/* only used within one socket_write_request_parts call, shared by all clients */
+static uint8_t tx_gather[HTTP_CLIENT_TX_SIZE];
 
 struct request_part
 {
@@ -72,6 +61,7 @@ struct request_part
     uint32_t buf_len_done;
     uint8_t copy;
     uint8_t mem;
+    uint8_t last;   /* final part of its request */
 };
 
 struct pico_http_client
@@ -92,6 +82,69 @@ struct pico_http_client
     uint8_t long_polling_state;
     uint8_t conn_state;
     uint8_t connection_type;
+    uint8_t body_write_pending;  /* pico_http_client_write_body could not write everything */
+    /*
+     * The response is read from the socket HTTP_CLIENT_RX_SIZE bytes at a
+     * time, the header parser and the chunk parser work from this buffer.
+     * Body bytes that came in together with the header stay here until
+     * pico_http_client_read_body picks them up.
+     */
+    uint8_t rx_buf[HTTP_CLIENT_RX_SIZE];
+    uint16_t rx_len;
+    uint16_t rx_pos;
+    /* header line being assembled, kept when it spans two segments */
+    char line[HTTP_HEADER_LINE_SIZE];
+    uint16_t line_len;
+    uint8_t line_cut;       /* the line did not fit */
+    uint8_t server_close;   /* the server will close the connection after the response */
+    uint8_t con_pending;    /* took over a pooled connection, EV_HTTP_CON not given yet */
+    uint8_t pipeline_depth; /* requests that may be outstanding, see pico_http_client_set_pipeline */
+    uint8_t in_flight;      /* requests written whose response has not been read completely */
+    uint8_t next_pending;   /* the next pipelined response may be waiting already */
+    const char *headers;    /* extra header lines of the user, see pico_http_client_set_headers */
+    /* takes the body instead of pico_http_client_read_body, see pico_http_client_set_body_sink */
+    void (*body_sink)(uint16_t conn, const uint8_t *data, uint32_t len, void *arg);
+    void *body_sink_arg;
+    /* gets the lines of the response header, see pico_http_client_set_field_sink */
+    void (*field_sink)(uint16_t conn, const char *line, void *arg);
+    void *field_sink_arg;
+    uint8_t decoding;       /* asks for gzip and deflate, see pico_http_client_set_decoding */
+    uint8_t coding;         /* Content-Encoding of the response, HTTP_INFLATE_* or 0 */
+    struct pico_http_inflate *inflate;  /* decoder of the body being read */
+    /* streamed request body, see pico_http_client_send_post_stream */
+    int32_t (*producer)(uint16_t conn, uint8_t *buf, uint32_t size, void *arg);
+    void *producer_arg;
+    uint8_t *upload;        /* the chunk being written, framed */
+    uint16_t upload_len;
+    uint16_t upload_pos;
+    uint8_t upload_last;    /* the closing empty chunk is in upload */
+    uint8_t upload_chunked; /* chunk framing, or a body with a Content-Length */
+    struct multipart_upload *multipart; /* producer state of a streamed multipart body */
+    uint8_t redirect_max;   /* redirects to follow per request, see pico_http_client_set_redirects */
+    uint8_t redirect_hops;  /* redirects followed for the current request */
+    uint8_t redirect_get;   /* the response being read answers a GET */
+    uint8_t redirecting;    /* skipping the body of a redirect */
+    uint8_t redirect_send;  /* the GET goes out once connected to the redirect target */
+    struct pico_http_timeouts timeouts; /* see pico_http_client_set_timeouts */
+    pico_time connect_by;   /* deadlines, 0 if not running */
+    pico_time first_byte_by;
+    pico_time idle_by;
+    pico_time total_by;
+    pico_time wheel_at;     /* deadline the client is filed in the wheel under, 0 if not in it */
+    struct pico_http_client *wheel_next;
+    uint8_t timed_out;      /* EV_HTTP_TIMEOUT was given, the connection is gone */
+    pico_time reconnect_at; /* the long poll connects again, 0 if not waiting */
+    uint8_t long_poll_retries;  /* reconnects since the last response */
+    uint8_t long_poll_resend;   /* the long poll GET goes out once connected */
+};
+
+struct http_client_pool_entry
+{
+    char *host;
+    uint16_t port;
+    struct pico_socket *sck;
+    struct pico_ip4 ip;
+    pico_time idle_since;
 };
 
 /* HTTP Client internal states */
@@ -125,8 +178,16 @@ struct pico_http_client
 #define HTTP_PROTO_LEN      7u
 
 static int8_t free_uri(struct pico_http_client *to_be_removed);
+static int32_t client_fill(struct pico_http_client *client);
+static int32_t client_getc(struct pico_http_client *client, uint8_t *c);
+static int32_t client_recv(struct pico_http_client *client, uint8_t *data, uint32_t size);
 static int32_t client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn), int32_t connID, int (*encoding)(char *out_buffer, char *in_buffer));
 static void free_header(struct pico_http_client *to_be_removed);
+static void upload_stop(struct pico_http_client *client);
+static void deadline_set(struct pico_http_client *client, pico_time *deadline, uint32_t ms);
+static void deadlines_stop(struct pico_http_client *client);
+static void deadline_received(struct pico_http_client *client);
+static void wheel_unlink(struct pico_http_client *client);
 
 struct request_part *request_part_create(char *buf, uint32_t buf_len, uint8_t copy, uint8_t mem)
 {
@@ -182,6 +243,15 @@ static void print_request_part_info(struct pico_http_client *client)
 }
 */
 //User memory buffers will not be freed
+static void request_part_free(struct request_part *part)
+{
+    if (part->copy == HTTP_COPY_TO_HEAP || part->mem == HTTP_NO_USER_MEM)
+    {
+        PICO_FREE(part->buf);
+    }
+    PICO_FREE(part);
+}
+
 static int8_t request_parts_destroy(struct pico_http_client *client)
 {
     uint32_t i = 0;
@@ -192,11 +262,7 @@ static int8_t request_parts_destroy(struct pico_http_client *client)
 
     for (i=0; i<client->request_parts_len; i++)
     {
-        if (client->request_parts[i]->copy == HTTP_COPY_TO_HEAP || client->request_parts[i]->mem == HTTP_NO_USER_MEM)
-        {
-            PICO_FREE(client->request_parts[i]->buf);
-        }
-        PICO_FREE(client->request_parts[i]);
+        request_part_free(client->request_parts[i]);
     }
     PICO_FREE(client->request_parts);
     client->request_parts = NULL;
@@ -206,55 +272,228 @@ static int8_t request_parts_destroy(struct pico_http_client *client)
     return HTTP_RETURN_OK;
 }
 
+/*
+ * Makes room for n more request parts. A pipelined request is appended
+ * behind the parts that are still being written.
+ */
+static int8_t request_parts_reserve(struct pico_http_client *client, uint32_t n)
+{
+    struct request_part **parts = PICO_ZALLOC((client->request_parts_len + n) * sizeof(struct request_part *));
+
+    if (!parts)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (client->request_parts)
+    {
+        memcpy(parts, client->request_parts, client->request_parts_len * sizeof(struct request_part *));
+        PICO_FREE(client->request_parts);
+    }
+    else
+    {
+        client->request_parts_len = 0;
+        client->request_parts_len_done = 0;
+    }
+    client->request_parts = parts;
+    return HTTP_RETURN_OK;
+}
+
+/* drops the parts of a request that could not be built, the ones queued before it stay */
+static void request_parts_abort(struct pico_http_client *client, uint32_t first)
+{
+    if (!first)
+    {
+        request_parts_destroy(client);
+        return;
+    }
+
+    while (client->request_parts_len > first)
+    {
+        client->request_parts_len--;
+        if (client->request_parts[client->request_parts_len])
+        {
+            request_part_free(client->request_parts[client->request_parts_len]);
+            client->request_parts[client->request_parts_len] = NULL;
+        }
+    }
+}
+
+/* requests that are written or queued, and not answered yet */
+static uint32_t requests_outstanding(struct pico_http_client *client)
+{
+    uint32_t i, n = client->in_flight;
+
+    for (i = client->request_parts_len_done; i < client->request_parts_len; i++)
+    {
+        if (client->request_parts[i]->last)
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * A new request may be sent when the connection is idle or, with
+ * pipelining, while fewer than pipeline_depth requests are outstanding.
+ */
+static int client_can_send(struct pico_http_client *client)
+{
+    if (client->redirect_send || client->timed_out)
+    {
+        return 0;
+    }
+
+    if (client->state == HTTP_CONN_IDLE)
+    {
+        return 1;
+    }
+
+    if (client->pipeline_depth < 2 || client->long_polling_state || client->body_write_pending || client->upload)
+    {
+        return 0;
+    }
+
+    return requests_outstanding(client) < client->pipeline_depth;
+}
+
+/* the last part of n requests is out, their responses are next in line */
+static void requests_written(struct pico_http_client *client, uint32_t n)
+{
+    if (!client->in_flight)
+    {
+        deadline_set(client, &client->first_byte_by, client->timeouts.first_byte);
+    }
+    client->in_flight = (uint8_t)(client->in_flight + n);
+    if (client->state == HTTP_WRITING_REQUEST)
+    {
+        client->state = HTTP_START_READING_HEADER;
+        client->line_len = 0;
+    }
+    if (client->long_polling_state == HTTP_LONG_POLL_CONN_CLOSE)
+    {
+        client->conn_state = HTTP_CONNECTION_WAITING_FOR_NEW_CONN;
+    }
+    client->wakeup(EV_HTTP_WRITE_SUCCESS, client->connectionID);
+}
+
+/*
+ * Number of parts, starting at first, whose unwritten bytes fit in the
+ * gather buffer together.
+ */
+static uint32_t request_parts_gather(struct pico_http_client *client, uint32_t first)
+{
+    uint32_t size = 0;
+    uint32_t i;
+
+    for (i = first; i < client->request_parts_len; i++)
+    {
+        struct request_part *part = client->request_parts[i];
+        uint32_t pending = part->buf_len - part->buf_len_done;
+
+        if (pending > HTTP_CLIENT_TX_SIZE - size)
+            break;
+
+        size += pending;
+    }
+    return i - first;
+}
+
+/*
+ * Writes the request parts that are not out yet. Small adjacent parts
+ * (the header, multipart preambles, closing boundaries, short bodies)
+ * are copied together into one write so they share TCP segments; a part
+ * that does not fit in the gather buffer is written from its own memory.
+ * The parts keep track of how far they got, bytes the socket did not
+ * take are gathered again on the next write event.
+ */
 static int32_t socket_write_request_parts(struct pico_http_client *client)
 {
-    uint32_t bytes_written = 0;
-    uint32_t i = 0;
+    int32_t total = 0;
+    int32_t bytes_written = 0;
     uint32_t bytes_to_write = 0;
-    uint32_t idx = 0;
+    uint32_t requests_done = 0;
+    uint32_t count, i;
+    const void *buf;
 
-    client->state = HTTP_WRITING_REQUEST;
-    for (i = client->request_parts_len_done; i<client->request_parts_len; i++)
+    /* with pipelining, responses to earlier requests may be read meanwhile */
+    if (client->state == HTTP_CONN_IDLE)
+    {
+        client->state = HTTP_WRITING_REQUEST;
+        deadline_set(client, &client->total_by, client->timeouts.total);
+    }
+    while (client->request_parts_len_done < client->request_parts_len)
     {
-        bytes_to_write = client->request_parts[i]->buf_len - client->request_parts[i]->buf_len_done;
-        idx = client->request_parts[i]->buf_len_done;
-        bytes_written = pico_socket_write(client->sck, (void *)&client->request_parts[i]->buf[idx], bytes_to_write);
-        client->request_parts[i]->buf_len_done += bytes_written;
-        /*uint32_t x = 0;
-        for (x=0; x<bytes_to_write; x++)
+        struct request_part *part = client->request_parts[client->request_parts_len_done];
+
+        count = request_parts_gather(client, client->request_parts_len_done);
+        if (count > 1)
         {
-            printf("client->request_parts[i]->buf[%d] = %c\n", x, client->request_parts[i]->buf[x]);
+            bytes_to_write = 0;
+            for (i = client->request_parts_len_done; i < client->request_parts_len_done + count; i++)
+            {
+                struct request_part *p = client->request_parts[i];
+
+                memcpy(&tx_gather[bytes_to_write], &p->buf[p->buf_len_done], p->buf_len - p->buf_len_done);
+                bytes_to_write += p->buf_len - p->buf_len_done;
+            }
+            buf = tx_gather;
         }
-*/
+        else
+        {
+            bytes_to_write = part->buf_len - part->buf_len_done;
+            buf = &part->buf[part->buf_len_done];
+        }
+
+        bytes_written = bytes_to_write ? pico_socket_write(client->sck, buf, (int)bytes_to_write) : 0;
         dbg("Bytes written: %d bytes_to_write: %d\n", bytes_written, bytes_to_write);
         if (bytes_written < 0)
         {
             request_parts_destroy(client);
+            upload_stop(client);
             client->state = HTTP_CONN_IDLE;
+            client->in_flight = 0;
             client->wakeup(EV_HTTP_WRITE_FAILED, client->connectionID);
+            return -1;
         }
-        else if (bytes_written == bytes_to_write)
+        total += bytes_written;
+
+        /* hand the written bytes to the parts they came from */
+        i = (uint32_t)bytes_written;
+        while (client->request_parts_len_done < client->request_parts_len)
         {
+            struct request_part *p = client->request_parts[client->request_parts_len_done];
+            uint32_t pending = p->buf_len - p->buf_len_done;
+
+            if (pending > i)
+            {
+                p->buf_len_done += i;
+                break;
+            }
+            p->buf_len_done = p->buf_len;
+            i -= pending;
             client->request_parts_len_done += 1;
+            requests_done += p->last;
         }
-        else
+
+        if ((uint32_t)bytes_written < bytes_to_write)
         {
             dbg("Could not fully write complete request.\n");
             break;
         }
-        if (client->request_parts_len_done==client->request_parts_len)
-        {
-            dbg("Write success\n");
-            request_parts_destroy(client);
-            client->state = HTTP_START_READING_HEADER;
-            if (client->long_polling_state == HTTP_LONG_POLL_CONN_CLOSE)
-            {
-                client->conn_state = HTTP_CONNECTION_WAITING_FOR_NEW_CONN;
-            }
-            client->wakeup(EV_HTTP_WRITE_SUCCESS, client->connectionID);
-        }
     }
-    return bytes_written;
+    if (client->request_parts && client->request_parts_len_done == client->request_parts_len)
+    {
+        dbg("Write success\n");
+        request_parts_destroy(client);
+    }
+    if (requests_done)
+    {
+        requests_written(client, requests_done);
+    }
+    return total;
 }
 
 static int8_t pico_http_uri_destroy(struct pico_http_uri *urikey)
@@ -286,38 +525,38 @@ static int8_t pico_http_uri_destroy(struct pico_http_uri *urikey)
     return HTTP_RETURN_OK;
 }
 
+/* sets the resource of the uri, on failure the uri is left as it was */
 static int8_t pico_process_resource(const char *resource, struct pico_http_uri *urikey)
 {
+    char *copy;
+
     dbg("Start pico_process_resource(..) %s\n", resource);
     if (!resource || !urikey || resource[0] != '/')
     {
         pico_err = PICO_ERR_EINVAL;
-        pico_http_uri_destroy(urikey);
         return HTTP_RETURN_ERROR;
     }
     if (urikey->resource && strcmp(urikey->resource, resource) == 0)
     {
         return HTTP_RETURN_OK;
     }
-    if (urikey->resource)
-    {
-        PICO_FREE(urikey->resource);
-        urikey->resource = NULL;
-    }
 
     /* cpy the resource */
-    urikey->resource = PICO_ZALLOC(strlen(resource)+1);
+    copy = PICO_ZALLOC(strlen(resource)+1);
 
-    if (!urikey->resource)
+    if (!copy)
     {
         /* no memory */
         pico_err = PICO_ERR_ENOMEM;
-        pico_http_uri_destroy(urikey);
         return HTTP_RETURN_ERROR;
     }
 
-    //strcpy(urikey->resource, resource);
-    memcpy(urikey->resource, resource, strlen(resource)+1);
+    memcpy(copy, resource, strlen(resource)+1);
+    if (urikey->resource)
+    {
+        PICO_FREE(urikey->resource);
+    }
+    urikey->resource = copy;
     dbg("Stop pico_process_resource(..) %s\n", urikey->resource);
     return HTTP_RETURN_OK;
 }
@@ -487,7 +726,12 @@ static int8_t pico_process_uri(const char *uri, struct pico_http_uri *urikey, in
     }
 
     dbg("End: pico_process_uri(..) index: %d\n", index);
-    return pico_process_resource(&uri[index], urikey);
+    if (pico_process_resource(&uri[index], urikey) < 0)
+    {
+        pico_http_uri_destroy(urikey);
+        return HTTP_RETURN_ERROR;
+    }
+    return HTTP_RETURN_OK;
  }
 
 static int32_t compare_clients(void *ka, void *kb)
@@ -497,9 +741,26 @@ static int32_t compare_clients(void *ka, void *kb)
 
 PICO_TREE_DECLARE(pico_client_list, compare_clients);
 
+static struct pico_http_client *find_client(uint16_t conn)
+{
+    struct pico_http_client search = {
+        .connectionID = conn
+    };
+    return pico_tree_findKey(&pico_client_list, &search);
+}
+
 /* Local functions */
 static int8_t parse_header_from_server(struct pico_http_client *client, struct pico_http_header *header);
 static int8_t read_chunk_line(struct pico_http_client *client);
+static void response_done(struct pico_http_client *client);
+static void treat_long_polling(struct pico_http_client *client, uint16_t ev);
+static void body_push(struct pico_http_client *client);
+static int32_t body_slice(struct pico_http_client *client, uint8_t **data);
+static void body_decoder_stop(struct pico_http_client *client);
+static int redirect_wanted(struct pico_http_client *client);
+static void redirect_skip(struct pico_http_client *client);
+static void client_connected(struct pico_http_client *client);
+static int8_t send_get(struct pico_http_client *http, uint8_t connection_type);
 /*  */
 /*
 void print_header(struct pico_http_header * header)
@@ -523,7 +784,8 @@ static inline void wait_for_header(struct pico_http_client *client)
     }
     else if (http_ret == HTTP_RETURN_BUSY)
     {
-        client->state = HTTP_READING_HEADER;
+        /* the rest of the header is in a later segment, the parser resumes there */
+        nop();
     }
     /*else if (http_ret == HTTP_RETURN_NOT_FOUND)
     {
@@ -533,10 +795,17 @@ static inline void wait_for_header(struct pico_http_client *client)
         client->wakeup(EV_HTTP_REQ, client->connectionID);
     }
     else*/
+    else
     {
-        /* call wakeup */
+        /* call wakeup, once the whole header is in */
         if (client->header->response_code != HTTP_CONTINUE)
         {
+            if (redirect_wanted(client))
+            {
+                /* the user only gets to see the response at the end of the redirects */
+                redirect_skip(client);
+                return;
+            }
             /*if (client->header->response_code == HTTP_OK)
             {
                 client->wakeup((EV_HTTP_REQ | EV_HTTP_BODY), client->connectionID);
@@ -547,14 +816,165 @@ static inline void wait_for_header(struct pico_http_client *client)
                 client->body_read = 0;
                 client->wakeup(EV_HTTP_REQ, client->connectionID);
             }*/
-            if (client->header->content_length_or_chunk)
+            if (client->body_sink)
+            {
+                uint16_t conn = client->connectionID;
+                client->wakeup(EV_HTTP_REQ, conn);
+                /* the body bytes that came with the header go out right away */
+                client = find_client(conn);
+                if (client && client->body_sink)
+                {
+                    body_push(client);
+                }
+            }
+            else if (client->header->content_length_or_chunk)
             {
                 client->wakeup((EV_HTTP_REQ | EV_HTTP_BODY), client->connectionID);
             }
             else
             {
-                client->wakeup(EV_HTTP_REQ, client->connectionID);
+                uint16_t conn = client->connectionID;
+                client->wakeup(EV_HTTP_REQ, conn);
+                /* with pipelining nobody reads an empty body, the response is complete */
+                client = find_client(conn);
+                if (client && client->pipeline_depth > 1 && client->state == HTTP_READING_BODY &&
+                    client->header->transfer_coding == HTTP_TRANSFER_FULL && !client->header->content_length_or_chunk)
+                {
+                    client->body_read_done = 1;
+                    response_done(client);
+                    client->wakeup(EV_HTTP_DONE, conn);
+                }
+            }
+        }
+    }
+}
+
+/* Streamed request bodies */
+static void upload_stop(struct pico_http_client *client)
+{
+    if (client->upload)
+    {
+        PICO_FREE(client->upload);
+        client->upload = NULL;
+    }
+    if (client->multipart)
+    {
+        PICO_FREE(client->multipart);
+        client->multipart = NULL;
+    }
+    client->producer = NULL;
+    client->producer_arg = NULL;
+    client->upload_last = 0;
+}
+
+static void upload_failed(struct pico_http_client *client)
+{
+    upload_stop(client);
+    client->state = HTTP_CONN_IDLE;
+    client->in_flight = 0;
+    client->wakeup(EV_HTTP_WRITE_FAILED, client->connectionID);
+}
+
+/*
+ * Puts the size line in front of the len bytes the producer wrote at
+ * HTTP_UPLOAD_FRAME, and the CRLF behind them. Without data this is the
+ * last chunk, "0\r\n\r\n". A body with a Content-Length goes out as is.
+ */
+static void upload_frame(struct pico_http_client *client, uint16_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint16_t pos = HTTP_UPLOAD_FRAME - 2u;
+    uint16_t n = len;
+
+    if (!client->upload_chunked)
+    {
+        client->upload_pos = HTTP_UPLOAD_FRAME;
+        client->upload_len = (uint16_t)(HTTP_UPLOAD_FRAME + len);
+        client->upload_last = (uint8_t)!len;
+        return;
+    }
+
+    client->upload[HTTP_UPLOAD_FRAME - 2u] = '\r';
+    client->upload[HTTP_UPLOAD_FRAME - 1u] = '\n';
+    do
+    {
+        client->upload[--pos] = (uint8_t)hex[n & 0xFu];
+        n = (uint16_t)(n >> 4);
+    } while (n);
+
+    client->upload_pos = pos;
+    client->upload_len = (uint16_t)(HTTP_UPLOAD_FRAME + len);
+    client->upload[client->upload_len++] = '\r';
+    client->upload[client->upload_len++] = '\n';
+    client->upload_last = (uint8_t)!len;
+}
+
+static int8_t upload_start(struct pico_http_client *client, int32_t (*producer)(uint16_t conn, uint8_t *buf, uint32_t size, void *arg), void *arg, uint8_t chunked)
+{
+    client->upload = PICO_ZALLOC(HTTP_UPLOAD_FRAME + HTTP_CLIENT_UPLOAD_CHUNK + 2u);
+    if (!client->upload)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+    client->upload_pos = 0;
+    client->upload_len = 0;
+    client->upload_last = 0;
+    client->upload_chunked = chunked;
+    client->producer = producer;
+    client->producer_arg = arg;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Writes the streamed body for as long as the socket takes it. Only one
+ * chunk is in memory: the producer is asked for the next one when the
+ * previous one is out.
+ */
+static void upload_pump(struct pico_http_client *client)
+{
+    uint16_t conn = client->connectionID;
+    int32_t len;
+
+    while (client->upload)
+    {
+        if (client->upload_pos == client->upload_len)
+        {
+            if (client->upload_last)
+            {
+                upload_stop(client);
+                requests_written(client, 1);
+                return;
+            }
+
+            len = client->producer(conn, &client->upload[HTTP_UPLOAD_FRAME], HTTP_CLIENT_UPLOAD_CHUNK, client->producer_arg);
+            /* the producer may have closed the client */
+            client = find_client(conn);
+            if (!client || !client->upload)
+            {
+                return;
             }
+            if (len < 0 || len > (int32_t)HTTP_CLIENT_UPLOAD_CHUNK)
+            {
+                upload_failed(client);
+                return;
+            }
+            upload_frame(client, (uint16_t)len);
+            continue;
+        }
+
+        len = pico_socket_write(client->sck, &client->upload[client->upload_pos], client->upload_len - client->upload_pos);
+        dbg("Upload bytes written: %d\n", len);
+        if (len < 0)
+        {
+            upload_failed(client);
+            return;
+        }
+        client->upload_pos = (uint16_t)(client->upload_pos + len);
+        if (client->upload_pos < client->upload_len)
+        {
+            /* the rest goes on the next write event */
+            return;
         }
     }
 }
@@ -563,16 +983,38 @@ static void treat_write_event(struct pico_http_client *client)
 {
     /* write request parts if not everything has been written allready */
     dbg("treat write event, client state: %d\n", client->state);
-    uint32_t bytes_written = 0;
+    int32_t bytes_written = 0;
     if (client->request_parts_len_done != client->request_parts_len)
     {
         bytes_written = socket_write_request_parts(client);
         dbg("Bytes written: %d\n", bytes_written);
-        if (bytes_written && !client->long_polling_state)
+        if (bytes_written < 0)
+        {
+            return;
+        }
+        if (client->upload)
+        {
+            /* the header of a streamed request may be out now */
+            if (client->request_parts_len_done == client->request_parts_len)
+            {
+                upload_pump(client);
+            }
+        }
+        else if (bytes_written > 0 && !client->long_polling_state)
         {
             client->wakeup(EV_HTTP_WRITE_PROGRESS_MADE, client->connectionID);
         }
     }
+    else if (client->upload)
+    {
+        upload_pump(client);
+    }
+    else if (client->body_write_pending)
+    {
+        /* room again for the request body, see pico_http_client_write_body */
+        client->body_write_pending = 0;
+        client->wakeup(EV_HTTP_WRITE_PROGRESS_MADE, client->connectionID);
+    }
     else
     {
         //dbg("No request parts to write.\n");
@@ -588,6 +1030,7 @@ static void treat_read_event(struct pico_http_client *client)
         /* wait for header */
         dbg("Wait for header\n");
         free_header(client); //when using keep alive, we create a new one
+        client->body_read_done = 0;
         client->header = PICO_ZALLOC(sizeof(struct pico_http_header));
         if (!client->header)
         {
@@ -602,6 +1045,14 @@ static void treat_read_event(struct pico_http_client *client)
     {
         wait_for_header(client);
     }
+    else if (client->redirecting)
+    {
+        redirect_skip(client);
+    }
+    else if (client->body_sink)
+    {
+        body_push(client);
+    }
     else
     {
         /* just let the user know that data has arrived, if chunked data comes,
@@ -610,300 +1061,1309 @@ static void treat_read_event(struct pico_http_client *client)
     }
 }
 
-static void treat_long_polling(struct pico_http_client *client, uint16_t ev)
-{
-    uint32_t conn = 0;
-    char *raw_uri = NULL;
-    char *resource = NULL;
-    //void *wakeup = NULL;
-    void (*wakeup)(uint16_t ev, uint16_t conn) = NULL;
-    uint8_t cpy_long_polling_state = 0;
-    uint8_t cpy_body_read_done = 0;
-    dbg("TREAT LONG POLLING\n");
-    conn = client->connectionID;
+/* Pipelining */
+static uint8_t pipeline_kick_pending = 0;
 
-    dbg("client->body_read_done: %d client->conn_state: %d\n", client->body_read_done, client->conn_state);
+/* parses the responses that follow a completed one, see response_done */
+static void pipeline_kick(pico_time now, void *arg)
+{
+    struct pico_tree_node *index;
+    struct pico_http_client *client;
 
-    if (client->body_read_done && client->conn_state == HTTP_CONNECTION_CONNECTED)
+    (void)now;
+    (void)arg;
+    pipeline_kick_pending = 0;
+    /* the wakeups may close clients, so the search starts over after each one */
+    do
     {
-        client->body_read_done = 0;
-        if(client->long_polling_state == HTTP_LONG_POLL_CONN_KEEP_ALIVE)
+        client = NULL;
+        pico_tree_foreach(index, &pico_client_list)
         {
-            pico_http_client_long_poll_send_get(conn, client->urikey->resource, HTTP_CONN_KEEP_ALIVE);
+            if (((struct pico_http_client *)index->keyValue)->next_pending)
+            {
+                client = index->keyValue;
+                break;
+            }
         }
-        else
+        if (client)
         {
-            pico_http_client_long_poll_send_get(conn, client->urikey->resource, HTTP_CONN_CLOSE);
+            client->next_pending = 0;
+            if (client->state == HTTP_START_READING_HEADER)
+            {
+                treat_read_event(client);
+            }
         }
+    } while (client);
+}
+
+/*
+ * The response has been read completely. With pipelining the next
+ * response follows right behind it: it can be in the receive buffer or
+ * in the socket already, without a read event to come, so it is parsed
+ * from a timer rather than from within the wakeup of this one.
+ */
+static void response_done(struct pico_http_client *client)
+{
+    client->body_read = 0;
+    client->redirect_get = 0;
+    body_decoder_stop(client);
+    if (client->in_flight)
+    {
+        client->in_flight--;
     }
-    else if(client->body_read_done && client->conn_state == HTTP_CONNECTION_NOT_CONNECTED)
+
+    if (client->in_flight)
     {
-        if (client->long_polling_state != HTTP_LONG_POLL_CONN_CLOSE)
+        client->state = HTTP_START_READING_HEADER;
+        client->line_len = 0;
+        client->next_pending = 1;
+        if (!pipeline_kick_pending && pico_timer_add(0, pipeline_kick, NULL))
         {
-            dbg("Connection: Keep-Alive, but still got close ev, setup new connection.");
-        }
-        raw_uri = PICO_ZALLOC(strlen(client->urikey->raw_uri)+1);
-        if (!raw_uri)
-        {
-            pico_err = PICO_ERR_ENOMEM;
-            client->wakeup(EV_HTTP_ERROR | EV_HTTP_CLOSE, client->connectionID);
-            return;
-        }
-        strcpy(raw_uri, client->urikey->raw_uri);
-        resource = PICO_ZALLOC(strlen(client->urikey->resource) + 1);
-        if (!resource)
-        {
-            PICO_FREE(raw_uri);
-            pico_err = PICO_ERR_ENOMEM;
-            client->wakeup(EV_HTTP_ERROR | EV_HTTP_CLOSE, client->connectionID);
-            return;
+            pipeline_kick_pending = 1;
         }
-        strcpy(resource, client->urikey->resource);
-        wakeup = client->wakeup;
-        cpy_long_polling_state = client->long_polling_state;
-        cpy_body_read_done = client->body_read_done;
-        pico_http_client_close(client->connectionID);
-        dbg("treat_long_polling before client_open\n");
-        conn = client_open(raw_uri, wakeup, conn, NULL);
-        dbg("treat_long_polling after client_open\n");
-        if (conn < 0)
-        {
-            wakeup(EV_HTTP_ERROR | EV_HTTP_CLOSE, conn);
-            PICO_FREE(raw_uri);
-            PICO_FREE(resource);
+        /* the next response has its own */
+        deadline_set(client, &client->total_by, client->timeouts.total);
+    }
+    else if (client->request_parts || client->upload)
+    {
+        client->state = HTTP_WRITING_REQUEST;
+        client->idle_by = 0;
+        deadline_set(client, &client->total_by, client->timeouts.total);
+    }
+    else
+    {
+        client->state = HTTP_CONN_IDLE;
+        deadlines_stop(client);
+    }
+}
+
+/*
+ * The socket of a client leads back to it through its priv field, so
+ * socket events find their client without a search. A socket that goes
+ * to the pool or is closed no longer does.
+ */
+static void client_socket_close(struct pico_http_client *client)
+{
+    client->sck->priv = NULL;
+    pico_socket_close(client->sck);
+    client->sck = NULL;
+}
+
+/*
+ * Deadlines
+ *
+ * A client with a deadline running hangs in one of the lists of the
+ * wheel, the one of the tick its earliest deadline falls in. One timer
+ * turns the wheel a list per HTTP_CLIENT_WHEEL_TICK_MS and only looks at
+ * the clients of that list. A deadline that moves later (the idle one
+ * does on every read) leaves the client where it is, it is filed again
+ * when its list comes up; only a deadline that comes closer moves it.
+ */
+static struct pico_http_client *wheel[HTTP_CLIENT_WHEEL_SLOTS];
+static uint32_t wheel_count = 0;
+static pico_time wheel_tick = 0;        /* next tick to look at */
+static uint8_t wheel_turn_pending = 0;
+
+static void wheel_turn(pico_time now, void *arg);
+static void long_poll_connect(struct pico_http_client *client);
+
+static uint32_t wheel_slot(pico_time at)
+{
+    /* rounded up, a deadline never passes early */
+    return (uint32_t)(((at + HTTP_CLIENT_WHEEL_TICK_MS - 1u) / HTTP_CLIENT_WHEEL_TICK_MS) % HTTP_CLIENT_WHEEL_SLOTS);
+}
+
+/* earliest deadline (or reconnect) of the client, 0 if none is running */
+static pico_time deadline_next(struct pico_http_client *client)
+{
+    pico_time at = client->connect_by;
+
+    if (client->reconnect_at && (!at || client->reconnect_at < at))
+    {
+        at = client->reconnect_at;
+    }
+    if (client->first_byte_by && (!at || client->first_byte_by < at))
+    {
+        at = client->first_byte_by;
+    }
+    if (client->idle_by && (!at || client->idle_by < at))
+    {
+        at = client->idle_by;
+    }
+    if (client->total_by && (!at || client->total_by < at))
+    {
+        at = client->total_by;
+    }
+    return at;
+}
+
+static void wheel_unlink(struct pico_http_client *client)
+{
+    struct pico_http_client **prev;
+
+    if (!client->wheel_at)
+    {
+        return;
+    }
+    for (prev = &wheel[wheel_slot(client->wheel_at)]; *prev; prev = &(*prev)->wheel_next)
+    {
+        if (*prev == client)
+        {
+            *prev = client->wheel_next;
+            break;
+        }
+    }
+    client->wheel_next = NULL;
+    client->wheel_at = 0;
+    wheel_count--;
+}
+
+static void wheel_file(struct pico_http_client *client)
+{
+    pico_time at = deadline_next(client);
+    uint32_t slot;
+
+    if (!at || (client->wheel_at && client->wheel_at <= at))
+    {
+        /* none, or later than the one it is filed under: sorted out when that comes up */
+        return;
+    }
+    wheel_unlink(client);
+    slot = wheel_slot(at);
+    client->wheel_next = wheel[slot];
+    wheel[slot] = client;
+    client->wheel_at = at;
+    wheel_count++;
+    if (!wheel_turn_pending && pico_timer_add(HTTP_CLIENT_WHEEL_TICK_MS, wheel_turn, NULL))
+    {
+        wheel_turn_pending = 1;
+        wheel_tick = PICO_TIME_MS() / HTTP_CLIENT_WHEEL_TICK_MS;
+    }
+}
+
+static void deadline_set(struct pico_http_client *client, pico_time *deadline, uint32_t ms)
+{
+    *deadline = ms ? PICO_TIME_MS() + ms : 0;
+    wheel_file(client);
+}
+
+static void deadlines_stop(struct pico_http_client *client)
+{
+    client->connect_by = 0;
+    client->first_byte_by = 0;
+    client->idle_by = 0;
+    client->total_by = 0;
+}
+
+static void deadline_received(struct pico_http_client *client)
+{
+    client->first_byte_by = 0;
+    if (client->in_flight)
+    {
+        deadline_set(client, &client->idle_by, client->timeouts.idle);
+    }
+}
+
+/* the connection and what the request holds are let go before the user hears of it */
+static void client_expire(struct pico_http_client *client, pico_time now)
+{
+    dbg("Client %d: %s deadline passed\n", client->connectionID,
+        (client->connect_by && client->connect_by <= now) ? "connect" :
+        (client->first_byte_by && client->first_byte_by <= now) ? "first byte" :
+        (client->idle_by && client->idle_by <= now) ? "idle" : "total");
+    deadlines_stop(client);
+    pico_http_dns_cancel(client);
+    if (client->sck)
+    {
+        client_socket_close(client);
+    }
+    if (client->request_parts)
+    {
+        request_parts_destroy(client);
+    }
+    upload_stop(client);
+    body_decoder_stop(client);
+    client->state = HTTP_CONN_IDLE;
+    client->conn_state = HTTP_CONNECTION_NOT_CONNECTED;
+    client->timed_out = 1;
+    client->reconnect_at = 0;
+    client->in_flight = 0;
+    client->rx_len = 0;
+    client->rx_pos = 0;
+    client->line_len = 0;
+    client->body_write_pending = 0;
+    client->con_pending = 0;
+    client->next_pending = 0;
+    client->redirecting = 0;
+    client->redirect_send = 0;
+    client->wakeup(EV_HTTP_TIMEOUT, client->connectionID);
+}
+
+/*
+ * Looks at the clients of one list: the ones whose deadline passed
+ * expire, the ones filed under a deadline that moved go to their new
+ * list. An expiring client may close any client, so the list is
+ * searched again after each one.
+ */
+static void wheel_turn_slot(uint32_t slot, pico_time now)
+{
+    struct pico_http_client **prev = &wheel[slot];
+    struct pico_http_client *client;
+    pico_time at;
+
+    while ((client = *prev) != NULL)
+    {
+        at = deadline_next(client);
+        if (at > now && wheel_slot(at) == slot)
+        {
+            client->wheel_at = at;
+            prev = &client->wheel_next;
+            continue;
+        }
+        *prev = client->wheel_next;
+        client->wheel_next = NULL;
+        client->wheel_at = 0;
+        wheel_count--;
+        if (at > now)
+        {
+            wheel_file(client);
+        }
+        else if (client->reconnect_at && client->reconnect_at <= now)
+        {
+            client->reconnect_at = 0;
+            long_poll_connect(client);
+            prev = &wheel[slot];
+        }
+        else if (at)
+        {
+            client_expire(client, now);
+            prev = &wheel[slot];
+        }
+    }
+}
+
+static void wheel_turn(pico_time now, void *arg)
+{
+    pico_time tick;
+    uint32_t n = 0;
+
+    (void)arg;
+    wheel_turn_pending = 0;
+    now = PICO_TIME_MS();
+    tick = now / HTTP_CLIENT_WHEEL_TICK_MS;
+    /* a late timer catches up, once around is enough for all of them */
+    while (wheel_tick <= tick && n < HTTP_CLIENT_WHEEL_SLOTS)
+    {
+        wheel_turn_slot((uint32_t)(wheel_tick % HTTP_CLIENT_WHEEL_SLOTS), now);
+        wheel_tick++;
+        n++;
+    }
+    wheel_tick = tick + 1u;
+    if (wheel_count && pico_timer_add(HTTP_CLIENT_WHEEL_TICK_MS, wheel_turn, NULL))
+    {
+        wheel_turn_pending = 1;
+    }
+}
+
+/* the long poll connects again after a backoff, the first time at once */
+static void long_poll_retry(struct pico_http_client *client)
+{
+    uint32_t delay = 0;
+    uint8_t n = client->long_poll_retries;
+
+    if (n)
+    {
+        delay = HTTP_CLIENT_LONG_POLL_RETRY_MS;
+        while (--n && delay < HTTP_CLIENT_LONG_POLL_RETRY_MAX_MS)
+        {
+            delay *= 2u;
+        }
+        if (delay > HTTP_CLIENT_LONG_POLL_RETRY_MAX_MS)
+        {
+            delay = HTTP_CLIENT_LONG_POLL_RETRY_MAX_MS;
+        }
+        /* clients that lost the same server do not all come back at once */
+        delay += pico_rand() % (delay / 2u + 1u);
+    }
+    if (client->long_poll_retries < 0xFFu)
+    {
+        client->long_poll_retries++;
+    }
+    dbg("Long poll: connecting again in %u ms\n", (unsigned int)delay);
+    /* past now, the wheel does not look back */
+    client->reconnect_at = PICO_TIME_MS() + delay + 1u;
+    wheel_file(client);
+}
+
+/*
+ * Keeps a long poll going. As soon as a response has been read the next
+ * GET goes out on the same connection. A lost connection is set up again
+ * for the same client once nothing of it is left to read, see
+ * long_poll_connect. ev is the socket event that brought us here, 0 when
+ * a response has been read.
+ */
+static void treat_long_polling(struct pico_http_client *client, uint16_t ev)
+{
+    dbg("client->body_read_done: %d client->conn_state: %d\n", client->body_read_done, client->conn_state);
+
+    if (!ev)
+    {
+        client->long_poll_retries = 0;
+    }
+    if (client->conn_state == HTTP_CONNECTION_CONNECTED)
+    {
+        if (client->body_read_done)
+        {
+            client->body_read_done = 0;
+            pico_http_client_long_poll_send_get(client->connectionID, client->urikey->resource,
+                                                client->long_polling_state == HTTP_LONG_POLL_CONN_KEEP_ALIVE ? HTTP_CONN_KEEP_ALIVE : HTTP_CONN_CLOSE);
+        }
+    }
+    else if (client->conn_state == HTTP_CONNECTION_NOT_CONNECTED && !client->reconnect_at &&
+             (client->body_read_done || client->state < HTTP_READING_BODY || client->state == HTTP_WRITING_REQUEST))
+    {
+        if (client->long_polling_state != HTTP_LONG_POLL_CONN_CLOSE)
+        {
+            dbg("Connection: Keep-Alive, but still got close ev, setup new connection.\n");
+        }
+        long_poll_retry(client);
+    }
+}
+
+/* Keep-alive pool */
+static struct http_client_pool_entry client_pool[HTTP_CLIENT_POOL_SIZE];
+static uint8_t pool_evict_pending = 0;
+static uint8_t pool_con_pending = 0;
+
+static void pool_entry_close(struct http_client_pool_entry *entry)
+{
+    pico_socket_close(entry->sck);
+    PICO_FREE(entry->host);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static void pool_evict(pico_time now, void *arg);
+
+static void pool_schedule_evict(void)
+{
+    uint32_t i;
+
+    if (pool_evict_pending)
+        return;
+
+    for (i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+    {
+        if (client_pool[i].sck)
+        {
+            if (pico_timer_add(HTTP_CLIENT_POOL_IDLE_MS, pool_evict, NULL))
+                pool_evict_pending = 1;
+
+            return;
+        }
+    }
+}
+
+/* closes the connections that have been idle for HTTP_CLIENT_POOL_IDLE_MS */
+static void pool_evict(pico_time now, void *arg)
+{
+    uint32_t i;
+
+    (void)arg;
+    pool_evict_pending = 0;
+    for (i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+    {
+        if (client_pool[i].sck && (now - client_pool[i].idle_since) >= HTTP_CLIENT_POOL_IDLE_MS)
+        {
+            dbg("Pool: closing idle connection to %s:%d\n", client_pool[i].host, client_pool[i].port);
+            pool_entry_close(&client_pool[i]);
+        }
+    }
+    pool_schedule_evict();
+}
+
+/* an idle pooled socket is not expected to say anything, any event ends it */
+static int8_t pool_socket_event(uint16_t ev, struct pico_socket *s)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+    {
+        if (client_pool[i].sck == s)
+        {
+            if (ev & (PICO_SOCK_EV_RD | PICO_SOCK_EV_CLOSE | PICO_SOCK_EV_FIN | PICO_SOCK_EV_ERR))
+            {
+                dbg("Pool: connection to %s:%d dropped (%d)\n", client_pool[i].host, client_pool[i].port, ev);
+                pool_entry_close(&client_pool[i]);
+            }
+
+            return HTTP_RETURN_OK;
+        }
+    }
+    return HTTP_RETURN_NOT_FOUND;
+}
+
+/*
+ * The connection can serve another request when the last response has
+ * been read completely and neither side asked to close it.
+ */
+static int client_reusable(struct pico_http_client *client)
+{
+    if (!client->sck || client->conn_state != HTTP_CONNECTION_CONNECTED || !client->header)
+        return 0;
+
+    if (client->connection_type != HTTP_CONN_KEEP_ALIVE || client->server_close ||
+        client->long_polling_state || client->request_parts || client->rx_pos != client->rx_len)
+        return 0;
+
+    if (client->state == HTTP_CONN_IDLE)
+        return 1;
+
+    /* nobody reads an empty body, the header alone completes the response */
+    return (client->state == HTTP_READING_BODY && client->header->transfer_coding == HTTP_TRANSFER_FULL &&
+            client->body_read == client->header->content_length_or_chunk);
+}
+
+/* parks the socket of a closing client, returns 0 if it must be closed instead */
+static int8_t pool_put(struct pico_http_client *client)
+{
+    struct http_client_pool_entry *slot = NULL;
+    uint32_t i, same_host = 0;
+
+    if (!client_reusable(client))
+        return 0;
+
+    for (i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+    {
+        struct http_client_pool_entry *entry = &client_pool[i];
+
+        if (!entry->sck)
+        {
+            if (!slot)
+                slot = entry;
+
+            continue;
+        }
+
+        if (entry->port == client->urikey->port && !strcmp(entry->host, client->urikey->host))
+            same_host++;
+
+        /* when full, the connection that has been idle the longest makes room */
+        if (!slot || (slot->sck && entry->idle_since < slot->idle_since))
+            slot = entry;
+    }
+
+    if (same_host >= HTTP_CLIENT_POOL_PER_HOST)
+        return 0;
+
+    if (slot->sck)
+        pool_entry_close(slot);
+
+    slot->host = PICO_ZALLOC(strlen(client->urikey->host) + 1u);
+    if (!slot->host)
+        return 0;
+
+    strcpy(slot->host, client->urikey->host);
+    slot->port = client->urikey->port;
+    slot->sck = client->sck;
+    slot->sck->priv = NULL;
+    slot->ip = client->ip;
+    slot->idle_since = PICO_TIME_MS();
+    dbg("Pool: keeping connection to %s:%d\n", slot->host, slot->port);
+    pool_schedule_evict();
+    return 1;
+}
+
+/* the clients that took over a pooled connection get their EV_HTTP_CON here */
+static void pool_notify(pico_time now, void *arg)
+{
+    struct pico_tree_node *index;
+    struct pico_http_client *client;
+
+    (void)now;
+    (void)arg;
+    pool_con_pending = 0;
+    /* the wakeups may close any client, so the search starts over after each one */
+    do
+    {
+        client = NULL;
+        pico_tree_foreach(index, &pico_client_list)
+        {
+            if (((struct pico_http_client *)index->keyValue)->con_pending)
+            {
+                client = index->keyValue;
+                break;
+            }
+        }
+        if (client)
+        {
+            client->con_pending = 0;
+            client_connected(client);
+        }
+    } while (client);
+}
+
+/* hands the most recently used idle connection to host:port over to the client */
+static int8_t pool_get(struct pico_http_client *client)
+{
+    struct http_client_pool_entry *found = NULL;
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+    {
+        struct http_client_pool_entry *entry = &client_pool[i];
+
+        if (entry->sck && entry->port == client->urikey->port && !strcmp(entry->host, client->urikey->host) &&
+            (!found || entry->idle_since > found->idle_since))
+            found = entry;
+    }
+
+    if (!found)
+        return HTTP_RETURN_NOT_FOUND;
+
+    /* like a fresh connect, EV_HTTP_CON comes from the stack and not from within open */
+    if (!pool_con_pending)
+    {
+        if (!pico_timer_add(0, pool_notify, NULL))
+            return HTTP_RETURN_NOT_FOUND;
+
+        pool_con_pending = 1;
+    }
+
+    dbg("Pool: reusing connection to %s:%d\n", found->host, found->port);
+    client->sck = found->sck;
+    client->sck->priv = client;
+    client->ip = found->ip;
+    client->conn_state = HTTP_CONNECTION_CONNECTED;
+    client->con_pending = 1;
+    PICO_FREE(found->host);
+    memset(found, 0, sizeof(*found));
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Closes all idle connections of the pool.
+ */
+void pico_http_client_pool_flush(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CLIENT_POOL_SIZE; i++)
+    {
+        if (client_pool[i].sck)
+            pool_entry_close(&client_pool[i]);
+    }
+}
+
+/* the wakeups may close the client, or give it another socket */
+static struct pico_http_client *socket_client(uint16_t conn, struct pico_socket *s)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client || client->sck != s)
+    {
+        return NULL;
+    }
+    return client;
+}
+
+static void tcp_callback(uint16_t ev, struct pico_socket *s)
+{
+    /* pooled sockets lead to no client */
+    struct pico_http_client *client = s->priv;
+    uint16_t conn;
+    int16_t r_ev = 0;
+    dbg("tcp callback (%d)\n", ev);
+    dbg("Client_ptr: %p\n", client);
+    if (!client && pool_socket_event(ev, s) == HTTP_RETURN_OK)
+    {
+        return;
+    }
+    if (!client)
+    {
+        dbg("Client not found...Something went wrong !\n");
+        return;
+    }
+    conn = client->connectionID;
+
+    if (ev & PICO_SOCK_EV_CONN)
+    {
+        client->conn_state = HTTP_CONNECTION_CONNECTED;
+        client_connected(client);
+        client = socket_client(conn, s);
+        if (!client)
+        {
             return;
         }
-        //refresh client with the new one but same connectionID
-        struct pico_http_client search = {
-            .connectionID = conn
-        };
-        client = pico_tree_findKey(&pico_client_list, &search);
+    }
+
+    if (ev & PICO_SOCK_EV_ERR)
+    {
+        r_ev = EV_HTTP_ERROR;
+        client->conn_state = HTTP_CONNECTION_NOT_CONNECTED;
+        if (client->long_polling_state)
+        {
+            treat_long_polling(client, PICO_SOCK_EV_ERR);
+            client = socket_client(conn, s);
+            if (!client)
+            {
+                return;
+            }
+        }
+        if (client->request_parts)
+        {
+            request_parts_destroy(client);
+            client->wakeup(EV_HTTP_WRITE_FAILED, conn);
+            client = socket_client(conn, s);
+            if (!client)
+            {
+                return;
+            }
+            r_ev = r_ev | EV_HTTP_WRITE_FAILED;
+        }
+        client->state = HTTP_CONN_IDLE;
+        client->in_flight = 0;
+        deadlines_stop(client);
+        client->wakeup(r_ev, conn);
+        client = socket_client(conn, s);
         if (!client)
         {
-            PICO_FREE(raw_uri);
-            PICO_FREE(resource);
-            dbg("treat_long_polling Client not found!\n");
-            wakeup(EV_HTTP_ERROR | EV_HTTP_CLOSE, conn);
             return;
         }
-        //
-        client->body_read_done = cpy_body_read_done;
-        //put back the long polling state
-        client->long_polling_state = cpy_long_polling_state;
-        //put the correct resource back
-        pico_process_resource(resource, client->urikey);
-        PICO_FREE(raw_uri);
-        PICO_FREE(resource);
+    }
+
+    if ((ev & PICO_SOCK_EV_CLOSE) || (ev & PICO_SOCK_EV_FIN))
+    {
+        client->conn_state = HTTP_CONNECTION_NOT_CONNECTED;
+        r_ev = EV_HTTP_CLOSE;
+        if (client->long_polling_state)
+        {
+            treat_long_polling(client, PICO_SOCK_EV_CLOSE);
+            client = socket_client(conn, s);
+            if (!client)
+            {
+                return;
+            }
+        }
+        if (client->request_parts)
+        {
+            request_parts_destroy(client);
+            client->wakeup(EV_HTTP_WRITE_FAILED, conn);
+            client = socket_client(conn, s);
+            if (!client)
+            {
+                return;
+            }
+            r_ev = r_ev | EV_HTTP_WRITE_FAILED;
+        }
+        client->state = HTTP_CONN_IDLE;
+        client->in_flight = 0;
+        deadlines_stop(client);
+        dbg("long polling state %d\n", client->long_polling_state);
+        client->wakeup(r_ev, conn);
+        client = socket_client(conn, s);
+        if (!client)
+        {
+            return;
+        }
+    }
+
+    if (ev & PICO_SOCK_EV_WR)
+    {
+        treat_write_event(client);
+        client = socket_client(conn, s);
+        if (!client)
+        {
+            return;
+        }
+    }
+
+    if (ev & PICO_SOCK_EV_RD)
+    {
+        treat_read_event(client);
     }
 }
 
-static void tcp_callback(uint16_t ev, struct pico_socket *s)
+static void dns_callback(char *ip, void *ptr);
+
+/* connects the client to the server of its uri */
+static int8_t client_connect(struct pico_http_client *client)
+{
+    uint32_t ip = 0;
+
+    deadline_set(client, &client->connect_by, client->timeouts.connect);
+
+    /* an idle connection to the same server saves the dns query and the handshake */
+    if (pool_get(client) == HTTP_RETURN_OK)
+    {
+        return HTTP_RETURN_OK;
+    }
+
+    /* dns query */
+    if (pico_string_to_ipv4(client->urikey->host, &ip) == -1)
+    {
+        dbg("Querying : %s \n", client->urikey->host);
+        if (pico_http_dns_getaddr(client->urikey->host, dns_callback, client) < 0)
+        {
+            return HTTP_RETURN_ERROR;
+        }
+    }
+    else
+    {
+        dbg("host already and ip address, no dns required\n");
+        dns_callback(client->urikey->host, client);
+    }
+    return HTTP_RETURN_OK;
+}
+
+/* opens the tcp socket to the address of the client */
+static int8_t client_socket_connect(struct pico_http_client *client)
+{
+    uint32_t val = 0;
+
+    client->sck = pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_TCP, &tcp_callback);
+    if (!client->sck)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    client->sck->priv = client;
+    val = 60000;
+    pico_socket_setoption(client->sck, PICO_SOCKET_OPT_KEEPIDLE, &val);
+    pico_socket_setoption(client->sck, PICO_SOCKET_OPT_KEEPINTVL, &val);
+    val = 7;
+    pico_socket_setoption(client->sck, PICO_SOCKET_OPT_KEEPCNT, &val);
+    dbg("client->sck: %p\n", client->sck);
+    if (pico_socket_connect(client->sck, &client->ip, short_be(client->urikey->port)) < 0)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Sets up the lost connection of a long poll again, for the same client:
+ * the uri stays parsed, a pooled connection or the address of the last
+ * one saves the dns query. The GET goes out from client_connected.
+ */
+static void long_poll_connect(struct pico_http_client *client)
+{
+    if (client->sck)
+    {
+        client_socket_close(client);
+    }
+    client->state = HTTP_CONN_IDLE;
+    client->in_flight = 0;
+    client->rx_len = 0;
+    client->rx_pos = 0;
+    client->line_len = 0;
+    client->server_close = 0;
+    client->body_read_done = 0;
+    client->long_poll_resend = 1;
+    if (!client->ip.addr)
+    {
+        /* never got as far as an address */
+        if (client_connect(client) < 0)
+        {
+            long_poll_retry(client);
+        }
+        return;
+    }
+    deadline_set(client, &client->connect_by, client->timeouts.connect);
+    if (pool_get(client) == HTTP_RETURN_OK)
+    {
+        return;
+    }
+    if (client_socket_connect(client) < 0)
+    {
+        if (client->sck)
+        {
+            client_socket_close(client);
+        }
+        long_poll_retry(client);
+    }
+}
+
+/* used for getting a response from DNS servers */
+static void dns_callback(char *ip, void *ptr)
+{
+    struct pico_http_client *client = (struct pico_http_client *)ptr;
+    if (!client)
+    {
+        dbg("Who made the request ?!\n");
+        return;
+    }
+
+    if (ip)
+    {
+        client->wakeup(EV_HTTP_DNS, client->connectionID);
+
+        /* add the ip address to the client, and start a tcp connection socket */
+        pico_string_to_ipv4(ip, &client->ip.addr);
+        if (client_socket_connect(client) < 0)
+        {
+            client->wakeup(EV_HTTP_ERROR, client->connectionID);
+            return;
+        }
+    }
+    else
+    {
+        /* wakeup client and let know error occured */
+        client->wakeup(EV_HTTP_ERROR, client->connectionID);
+
+        /* close the client (free used heap) */
+        pico_http_client_close(client->connectionID);
+    }
+}
+
+/*
+ * Request headers are put together from pieces of known length: the
+ * literals of the format, the fields of the uri and the numbers. The
+ * exact size is known before anything is copied, the header ends up in
+ * one allocation (or the buffer of the caller) with one memcpy per piece.
+ */
+struct request_writer
+{
+    const char *str[HTTP_REQUEST_FRAGMENTS];
+    uint32_t len[HTTP_REQUEST_FRAGMENTS];
+    uint32_t count;
+    uint32_t size;
+};
+
+static void writer_add(struct request_writer *w, const char *str, uint32_t len)
+{
+    if (w->count < HTTP_REQUEST_FRAGMENTS)
+    {
+        w->str[w->count] = str;
+        w->len[w->count] = len;
+    }
+    w->count++;
+    w->size += len;
+}
+
+#define writer_lit(w, lit)  writer_add(w, lit, sizeof(lit) - 1u)
+
+static void writer_str(struct request_writer *w, const char *str)
+{
+    writer_add(w, str, (uint32_t)strlen(str));
+}
+
+/* digits must hold 11 bytes */
+static void writer_num(struct request_writer *w, uint32_t value, char *digits)
+{
+    if (!value)
+    {
+        writer_lit(w, "0");
+        return;
+    }
+    writer_add(w, digits, pico_itoa(value, digits));
+}
+
+static void writer_host(struct request_writer *w, const struct pico_http_uri *uri_data, char *digits)
+{
+    writer_lit(w, "Host: ");
+    writer_str(w, uri_data->host);
+    writer_lit(w, ":");
+    writer_num(w, uri_data->port, digits);
+    writer_lit(w, "\r\n");
+}
+
+static void writer_connection(struct request_writer *w, uint8_t connection_type)
+{
+    if (connection_type == HTTP_CONN_CLOSE)
+        writer_lit(w, "Connection: Close\r\n");
+    else
+        writer_lit(w, "Connection: Keep-Alive\r\n");
+}
+
+/* the extra lines of the user and the empty line closing the header */
+static void writer_end(struct request_writer *w, const char *headers, uint8_t decoding)
+{
+    if (decoding)
+        writer_lit(w, "Accept-Encoding: gzip, deflate\r\n");
+
+    if (headers)
+        writer_str(w, headers);
+
+    writer_lit(w, "\r\n");
+}
+
+/*
+ * Copies the pieces into buf, or into a new allocation when buf is NULL.
+ * Returns the length without the terminating \0, or -1 if the header
+ * does not fit.
+ */
+static int32_t writer_finish(struct request_writer *w, char **buf, uint32_t size)
+{
+    char *out;
+    uint32_t i;
+
+    if (w->count > HTTP_REQUEST_FRAGMENTS)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return -1;
+    }
+
+    if (!*buf)
+    {
+        *buf = PICO_ZALLOC(w->size + 1u);
+        if (!*buf)
+        {
+            pico_err = PICO_ERR_ENOMEM;
+            return -1;
+        }
+    }
+    else if (size < w->size + 1u)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return -1;
+    }
+
+    out = *buf;
+    for (i = 0; i < w->count; i++)
+    {
+        memcpy(out, w->str[i], w->len[i]);
+        out += w->len[i];
+    }
+    *out = '\0';
+    return (int32_t)w->size;
+}
+
+/* Redirects */
+struct http_redirect_entry
+{
+    char *host;
+    char *resource;
+    char *target;   /* absolute uri the resource moved to */
+    uint16_t port;
+    uint32_t used;  /* the least recently used entry makes room */
+};
+
+static struct http_redirect_entry redirect_cache[HTTP_CLIENT_REDIRECT_CACHE];
+static uint32_t redirect_cache_clock = 0;
+
+static char *redirect_strdup(const char *str)
+{
+    char *copy = PICO_ZALLOC(strlen(str) + 1u);
+
+    if (copy)
+    {
+        strcpy(copy, str);
+    }
+    return copy;
+}
+
+static void redirect_entry_free(struct http_redirect_entry *entry)
+{
+    PICO_FREE(entry->host);
+    PICO_FREE(entry->resource);
+    PICO_FREE(entry->target);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static struct http_redirect_entry *redirect_cache_find(const struct pico_http_uri *urikey)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CLIENT_REDIRECT_CACHE; i++)
+    {
+        struct http_redirect_entry *entry = &redirect_cache[i];
+
+        if (entry->target && entry->port == urikey->port && !strcmp(entry->host, urikey->host) &&
+            !strcmp(entry->resource, urikey->resource))
+        {
+            entry->used = ++redirect_cache_clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* remembers that the resource of urikey moved to target for good */
+static void redirect_cache_put(const struct pico_http_uri *urikey, const char *target)
 {
-    struct pico_http_client *client = NULL;
-    struct pico_tree_node *index;
-    int16_t r_ev = 0;
-    dbg("tcp callback (%d)\n", ev);
-    /* find http_client */
-    pico_tree_foreach(index, &pico_client_list)
+    struct http_redirect_entry *slot = redirect_cache_find(urikey);
+    uint32_t i;
+
+    if (!slot)
     {
-        if (((struct pico_http_client *)index->keyValue)->sck == s )
+        slot = &redirect_cache[0];
+        for (i = 1; i < HTTP_CLIENT_REDIRECT_CACHE && slot->target; i++)
         {
-            client = (struct pico_http_client *)index->keyValue;
-            break;
+            if (!redirect_cache[i].target || redirect_cache[i].used < slot->used)
+            {
+                slot = &redirect_cache[i];
+            }
         }
     }
-    dbg("Client_ptr: %p\n", client);
-    if (!client)
+    if (slot->target)
     {
-        dbg("Client not found...Something went wrong !\n");
+        redirect_entry_free(slot);
+    }
+
+    slot->host = redirect_strdup(urikey->host);
+    slot->resource = redirect_strdup(urikey->resource);
+    slot->target = redirect_strdup(target);
+    if (!slot->host || !slot->resource || !slot->target)
+    {
+        redirect_entry_free(slot);
         return;
     }
+    slot->port = urikey->port;
+    slot->used = ++redirect_cache_clock;
+}
 
-    if (ev & PICO_SOCK_EV_CONN)
+/*
+ * Forgets the permanent redirects the clients have seen.
+ */
+void pico_http_client_redirect_cache_flush(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_CLIENT_REDIRECT_CACHE; i++)
     {
-        client->conn_state = HTTP_CONNECTION_CONNECTED;
-        if (client->long_polling_state)
+        if (redirect_cache[i].target)
         {
-            treat_long_polling(client, 0);
+            redirect_entry_free(&redirect_cache[i]);
         }
-        client->wakeup(EV_HTTP_CON, client->connectionID);
     }
+}
 
-    if (ev & PICO_SOCK_EV_ERR)
+/*
+ * A redirect is followed for a GET whose client asked for it, as long as
+ * no other response is expected on the connection and the Location is
+ * an http uri or a path.
+ */
+static int redirect_wanted(struct pico_http_client *client)
+{
+    uint16_t code = client->header->response_code;
+    const char *location = client->header->location;
+
+    if (client->redirect_hops >= client->redirect_max || !client->redirect_get || client->long_polling_state)
     {
-        r_ev = EV_HTTP_ERROR;
-        client->conn_state = HTTP_CONNECTION_NOT_CONNECTED;
-        if (client->long_polling_state)
-        {
-            treat_long_polling(client, 0);
-        }
-        if (client->request_parts)
-        {
-            request_parts_destroy(client);
-            client->wakeup(EV_HTTP_WRITE_FAILED, client->connectionID);
-            r_ev = r_ev | EV_HTTP_WRITE_FAILED;
-        }
-        client->state = HTTP_CONN_IDLE;
-        client->wakeup(r_ev, client->connectionID);
+        return 0;
+    }
+    if (code != HTTP_MOVED_PERMANENT && code != HTTP_FOUND && code != HTTP_SEE_OTHER &&
+        code != HTTP_TEMP_REDIRECT && code != HTTP_PERM_REDIRECT)
+    {
+        return 0;
+    }
+    if (client->in_flight != 1 || client->request_parts || client->upload)
+    {
+        return 0;
+    }
+    /* a Location that filled the header line may have been cut */
+    if (!location || strlen(location) >= HTTP_HEADER_LINE_SIZE - sizeof("Location: "))
+    {
+        return 0;
     }
+    return !strncmp(location, "http://", 7u) || location[0] == '/';
+}
 
-    if ((ev & PICO_SOCK_EV_CLOSE) || (ev & PICO_SOCK_EV_FIN))
+/* the absolute uri the Location of the response points to */
+static char *redirect_target(struct pico_http_client *client)
+{
+    struct request_writer w = { .count = 0, .size = 0 };
+    const char *location = client->header->location;
+    char port[11u];
+    char *uri = NULL;
+
+    if (location[0] == '/' && location[1] == '/')
     {
-        client->conn_state = HTTP_CONNECTION_NOT_CONNECTED;
-        r_ev = EV_HTTP_CLOSE;
-        if (client->long_polling_state)
-        {
-            treat_long_polling(client, 0);
-        }
-        if (client->request_parts)
-        {
-            request_parts_destroy(client);
-            client->wakeup(EV_HTTP_WRITE_FAILED, client->connectionID);
-            r_ev = r_ev | EV_HTTP_WRITE_FAILED;
-        }
-        client->state = HTTP_CONN_IDLE;
-        dbg("long polling state %d\n", client->long_polling_state);
-        client->wakeup(r_ev, client->connectionID);
+        writer_lit(&w, "http:");
+    }
+    else if (location[0] == '/')
+    {
+        writer_lit(&w, "http://");
+        writer_str(&w, client->urikey->host);
+        writer_lit(&w, ":");
+        writer_num(&w, client->urikey->port, port);
+    }
+    writer_str(&w, location);
+    if (writer_finish(&w, &uri, 0) < 0)
+    {
+        return NULL;
     }
+    return uri;
+}
 
-    if (ev & PICO_SOCK_EV_WR)
+/*
+ * Sends the GET again, to uri: over the same connection when that goes
+ * to the same server and stays open, over a pooled or new one otherwise.
+ */
+static int8_t redirect_to(struct pico_http_client *client, const char *uri)
+{
+    struct pico_http_uri *urikey = PICO_ZALLOC(sizeof(struct pico_http_uri));
+
+    if (!urikey)
     {
-        treat_write_event(client);
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+    if (pico_process_uri(uri, urikey, NULL) < 0)
+    {
+        PICO_FREE(urikey);
+        return HTTP_RETURN_ERROR;
     }
 
-    if (ev & PICO_SOCK_EV_RD)
+    dbg("Redirect to %s\n", uri);
+    if (urikey->port == client->urikey->port && !strcmp(urikey->host, client->urikey->host))
     {
-        treat_read_event(client);
+        /* the credentials stay with the server they were given for */
+        urikey->user_pass = client->urikey->user_pass;
+        client->urikey->user_pass = NULL;
+        if (client->conn_state == HTTP_CONNECTION_CONNECTED && client->connection_type == HTTP_CONN_KEEP_ALIVE &&
+            !client->server_close)
+        {
+            free_uri(client);
+            client->urikey = urikey;
+            return send_get(client, client->connection_type);
+        }
+    }
+
+    if (client->sck && !pool_put(client))
+    {
+        client_socket_close(client);
     }
+    client->sck = NULL;
+    client->conn_state = HTTP_CONNECTION_NOT_CONNECTED;
+    client->server_close = 0;
+    client->rx_len = 0;
+    client->rx_pos = 0;
+    free_uri(client);
+    client->urikey = urikey;
+    client->redirect_send = 1;
+    return client_connect(client);
 }
 
-/* used for getting a response from DNS servers */
-static void dns_callback(char *ip, void *ptr)
+/* the body of the redirect response is of no use, then the GET moves on */
+static void redirect_skip(struct pico_http_client *client)
 {
-    struct pico_http_client *client = (struct pico_http_client *)ptr;
-    uint32_t val = 0;
-    if (!client)
+    uint16_t code = client->header->response_code;
+    uint8_t *data;
+    int32_t len;
+    char *uri;
+
+    client->redirecting = 1;
+    body_decoder_stop(client);
+    do
     {
-        dbg("Who made the request ?!\n");
+        len = body_slice(client, &data);
+    } while (len > 0);
+    if (len < 0)
+    {
+        /* the rest comes with a later read event */
         return;
     }
 
-    if (ip)
+    client->redirecting = 0;
+    response_done(client);
+    client->redirect_hops++;
+    uri = redirect_target(client);
+    if (uri && (code == HTTP_MOVED_PERMANENT || code == HTTP_PERM_REDIRECT))
     {
-        client->wakeup(EV_HTTP_DNS, client->connectionID);
+        redirect_cache_put(client->urikey, uri);
+    }
+    if (!uri || redirect_to(client, uri) < 0)
+    {
+        client->wakeup(EV_HTTP_ERROR, client->connectionID);
+    }
+    if (uri)
+    {
+        PICO_FREE(uri);
+    }
+}
 
-        /* add the ip address to the client, and start a tcp connection socket */
-        pico_string_to_ipv4(ip, &client->ip.addr);
-        client->sck = pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_TCP, &tcp_callback);
-        if (!client->sck)
+/* connected to the server, or to the next one when following a redirect */
+static void client_connected(struct pico_http_client *client)
+{
+    client->connect_by = 0;
+    if (client->long_poll_resend)
+    {
+        /* the user still hears of the new connection, the poll is out already */
+        client->long_poll_resend = 0;
+        if (send_get(client, client->long_polling_state == HTTP_LONG_POLL_CONN_KEEP_ALIVE ? HTTP_CONN_KEEP_ALIVE : HTTP_CONN_CLOSE) < 0)
         {
             client->wakeup(EV_HTTP_ERROR, client->connectionID);
             return;
         }
-        val = 60000;
-        pico_socket_setoption(client->sck, PICO_SOCKET_OPT_KEEPIDLE, &val);
-        pico_socket_setoption(client->sck, PICO_SOCKET_OPT_KEEPINTVL, &val);
-        val = 7;
-        pico_socket_setoption(client->sck, PICO_SOCKET_OPT_KEEPCNT, &val);
-        dbg("client->sck: %p\n", client->sck);
-        if (pico_socket_connect(client->sck, &client->ip, short_be(client->urikey->port)) < 0)
+    }
+    if (client->redirect_send)
+    {
+        client->redirect_send = 0;
+        if (send_get(client, client->connection_type) < 0)
         {
             client->wakeup(EV_HTTP_ERROR, client->connectionID);
-            return;
         }
+        return;
     }
-    else
-    {
-        /* wakeup client and let know error occured */
-        client->wakeup(EV_HTTP_ERROR, client->connectionID);
-
-        /* close the client (free used heap) */
-        pico_http_client_close(client->connectionID);
-    }
+    client->wakeup(EV_HTTP_CON, client->connectionID);
 }
 
-/*
- * API for reading received data.
- *
- * Builds a GET request based on the fields on the uri.
- */
-char *pico_http_client_build_get(const struct pico_http_uri *uri_data, uint8_t connection_type)
+static int32_t build_get(const struct pico_http_uri *uri_data, uint8_t connection_type, const char *headers, uint8_t decoding, char **buf, uint32_t size)
 {
-    char *header;
-    char port[6u]; /* 6 = max length of a uint16 + \0 */
-    uint64_t header_size = HTTP_GET_BASIC_SIZE;
+    struct request_writer w = { .count = 0, .size = 0 };
+    char port[11u];
 
     if (!uri_data->host || !uri_data->resource || !uri_data->port)
     {
         pico_err = PICO_ERR_EINVAL;
-        return NULL;
+        return -1;
     }
 
-    if (!uri_data->user_pass){
-    	dbg("USING NO USERPASS\n");
-    	header_size += (header_size + strlen(uri_data->host));
-		header_size += (header_size + strlen(uri_data->resource));
-		header_size += (header_size + pico_itoa(uri_data->port, port) + 4u); /* 3 = size(CRLF + \0) */
-		header = PICO_ZALLOC(header_size);
-
-		if (!header)
-		{
-			/* not enough memory */
-			pico_err = PICO_ERR_ENOMEM;
-			return NULL;
-		}
-
-		/* build the actual header */
-		sprintf(header, "GET %s HTTP/1.1\r\nHost: %s:%s\r\nUser-Agent: picoTCP\r\nConnection: %s\r\n\r\n",
-				uri_data->resource,
-				uri_data->host,
-				port,
-				connection_type == HTTP_CONN_CLOSE ? "Close":"Keep-Alive");
-    } else {
-    	dbg("USING USERPASS\n");
-		printf("user_pass: %s\n",uri_data->user_pass);
-    	 /* build the header with authorization*/
-
-    	dbg("creating header length\n");
-    	header_size += (header_size + strlen(uri_data->host));
-    	header_size += (header_size + strlen(uri_data->user_pass));
-		header_size += (header_size + strlen(uri_data->resource));
-		header_size += (header_size + pico_itoa(uri_data->port, port) + 4u); /* 3 = size(CRLF + \0) */
-		header = PICO_ZALLOC(header_size);
-
-		if (!header)
-		{
-			/* not enough memory */
-			dbg("error header not created\n");
-			pico_err = PICO_ERR_ENOMEM;
-			return NULL;
-		}
-
-		/* build the actual header */
-		dbg("building the header/n");
-		sprintf(header, "GET %s HTTP/1.1\r\nAuthorization: Basic %s\r\nHost: %s:%s\r\nUser-Agent: picoTCP\r\nConnection: %s\r\n\r\n",
-						uri_data->resource,
-						uri_data->user_pass,
-		                uri_data->host,
-		                port,
-		                connection_type == HTTP_CONN_CLOSE ? "Close":"Keep-Alive");
+    writer_lit(&w, "GET ");
+    writer_str(&w, uri_data->resource);
+    writer_lit(&w, " HTTP/1.1\r\n");
+    if (uri_data->user_pass)
+    {
+        writer_lit(&w, "Authorization: Basic ");
+        writer_str(&w, uri_data->user_pass);
+        writer_lit(&w, "\r\n");
     }
+    writer_host(&w, uri_data, port);
+    writer_lit(&w, "User-Agent: picoTCP\r\n");
+    writer_connection(&w, connection_type);
+    writer_end(&w, headers, decoding);
+    return writer_finish(&w, buf, size);
+}
 
+/*
+ * Builds a GET request based on the fields on the uri.
+ */
+char *pico_http_client_build_get(const struct pico_http_uri *uri_data, uint8_t connection_type)
+{
+    char *header = NULL;
 
-
+    if (build_get(uri_data, connection_type, NULL, 0, &header, 0) < 0)
+        return NULL;
 
     return header;
 }
 
+/*
+ * API for building a GET request in a buffer of the caller.
+ *
+ * headers are extra header lines, each ended by CRLF, or NULL. Returns the
+ * length of the request, or -1 if it does not fit in size bytes
+ * (including the terminating \0). The buffer can be handed to
+ * pico_http_client_send_raw.
+ */
+int32_t MOCKABLE pico_http_client_format_get(const struct pico_http_uri *uri_data, uint8_t connection_type, const char *headers, char *buf, uint32_t size)
+{
+    if (!uri_data || !buf)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return -1;
+    }
+    return build_get(uri_data, connection_type, headers, 0, &buf, size);
+}
 
 /*
  * Builds a DELETE header based on the fields of the uri
  */
-static char *pico_http_client_build_delete(const struct pico_http_uri *uri_data, uint8_t connection_type)
+static char *pico_http_client_build_delete(const struct pico_http_uri *uri_data, uint8_t connection_type, const char *headers, uint8_t decoding)
 {
-    char *header;
-    char port[6u]; /* 6 = max length of a uint16 + \0 */
-    uint64_t header_size = HTTP_DELETE_BASIC_SIZE;
+    struct request_writer w = { .count = 0, .size = 0 };
+    char port[11u];
+    char *header = NULL;
 
     if (!uri_data->host || !uri_data->resource || !uri_data->port)
     {
@@ -911,29 +2371,43 @@ static char *pico_http_client_build_delete(const struct pico_http_uri *uri_data,
         return NULL;
     }
 
-    /*  */
-    header_size += (header_size + strlen(uri_data->host));
-    header_size += (header_size + strlen(uri_data->resource));
-    header_size += (header_size + pico_itoa(uri_data->port, port) + 4u); /* 3 = size(CRLF + \0) */
-    header = PICO_ZALLOC(header_size);
-
-    if (!header)
-    {
-        /* not enough memory */
-        pico_err = PICO_ERR_ENOMEM;
+    writer_lit(&w, "DELETE ");
+    writer_str(&w, uri_data->resource);
+    writer_lit(&w, " HTTP/1.1\r\nUser-Agent: picoTCP\r\nAccept: */*\r\n");
+    writer_host(&w, uri_data, port);
+    writer_connection(&w, connection_type);
+    writer_end(&w, headers, decoding);
+    if (writer_finish(&w, &header, 0) < 0)
         return NULL;
-    }
 
-    /* build the actual header */
-    sprintf(header, "DELETE %s HTTP/1.1\r\nUser-Agent: picoTCP\r\nAccept: */*\r\nHost: %s:%s\r\nConnection: %s\r\n\r\n",
-            uri_data->resource,
-            uri_data->host,
-            port,
-            connection_type ==  HTTP_CONN_CLOSE ? "Close":"Keep-Alive");
     return header;
 }
 
 
+static void multipart_chunk_fields(struct multipart_chunk *chunk, char *name, char *filename, char *content_disposition, char *content_type)
+{
+    if (name)
+    {
+        chunk->name = strdup(name);
+        chunk->length_name = strlen(name);
+    }
+    if (content_disposition)
+    {
+        chunk->content_disposition = strdup(content_disposition);
+        chunk->length_content_disposition = strlen(content_disposition);
+    }
+    if (filename)
+    {
+        chunk->filename = strdup(filename);
+        chunk->length_filename = strlen(filename);
+    }
+    if (content_type)
+    {
+        chunk->content_type = strdup(content_type);
+        chunk->length_content_type = strlen(content_type);
+    }
+}
+
 struct multipart_chunk *multipart_chunk_create(unsigned char *data, uint64_t length_data, char *name, char *filename, char *content_disposition, char *content_type)
 {
     if (length_data <= 0 || data == NULL)
@@ -955,26 +2429,39 @@ struct multipart_chunk *multipart_chunk_create(unsigned char *data, uint64_t len
         memcpy(chunk->data, data, length_data);
         chunk->length_data = length_data;
     }
-    if (name)
-    {
-        chunk->name = strdup(name);
-        chunk->length_name = strlen(name);
-    }
-    if (content_disposition)
-    {
-        chunk->content_disposition = strdup(content_disposition);
-        chunk->length_content_disposition = strlen(content_disposition);
-    }
-    if (filename)
+    multipart_chunk_fields(chunk, name, filename, content_disposition, content_type);
+    return chunk;
+}
+
+/*
+ * A part whose body is not in memory. While the request goes out, read
+ * is asked for the next bytes of the part: it writes at most size bytes
+ * into buf and returns how many, or -1 on failure. The part must be
+ * exactly length_data bytes long, it is announced in the Content-Length.
+ * read is called from the write event of the socket and must not close
+ * the client.
+ */
+struct multipart_chunk *multipart_chunk_create_stream(uint32_t length_data, int32_t (*read)(uint8_t *buf, uint32_t size, void *arg), void *arg,
+                                                      char *name, char *filename, char *content_disposition, char *content_type)
+{
+    struct multipart_chunk *chunk;
+
+    if (!length_data || !read)
     {
-        chunk->filename = strdup(filename);
-        chunk->length_filename = strlen(filename);
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
     }
-    if (content_type)
+
+    chunk = PICO_ZALLOC(sizeof(struct multipart_chunk));
+    if (!chunk)
     {
-        chunk->content_type = strdup(content_type);
-        chunk->length_content_type = strlen(content_type);
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
     }
+    chunk->length_data = length_data;
+    chunk->read = read;
+    chunk->read_arg = arg;
+    multipart_chunk_fields(chunk, name, filename, content_disposition, content_type);
     return chunk;
 }
 
@@ -1008,128 +2495,144 @@ int8_t multipart_chunk_destroy(struct multipart_chunk *chunk)
     return 0;
 }
 
-static int32_t get_content_length(struct multipart_chunk **post_data, uint16_t post_data_elements, const char *boundary)
+static const char multipart_boundary[] = "--------------------------c6b5ca0828dmx010";
+
+#define multipart_chunk_present(chunk)  ((chunk)->data != NULL || (chunk)->read != NULL)
+
+/*
+ * The boundary line and the header lines in front of the data of a part,
+ * preceded by the CRLF behind the data of the previous part.
+ */
+static void writer_part_preamble(struct request_writer *w, struct multipart_chunk *chunk, uint8_t separate)
 {
-    uint32_t i;
-    uint64_t total_content_length = 0;
-    for (i=0; i<post_data_elements; i++)
+    if (separate)
+        writer_lit(w, "\r\n");
+    writer_lit(w, "--");
+    writer_str(w, multipart_boundary);
+    writer_lit(w, "\r\n");
+    if (chunk->content_disposition != NULL)
+    {
+        writer_lit(w, "Content-Disposition: ");
+        writer_str(w, chunk->content_disposition);
+        if (chunk->name != NULL)
+        {
+            writer_lit(w, "; name=\"");
+            writer_str(w, chunk->name);
+            writer_lit(w, "\"");
+        }
+        if (chunk->filename != NULL)
+        {
+            writer_lit(w, "; filename=\"");
+            writer_str(w, chunk->filename);
+            writer_lit(w, "\"");
+        }
+    }
+    if (chunk->content_type != NULL)
     {
-        if (post_data[i]->data != NULL)
+        writer_lit(w, "\r\nContent-type: ");
+        writer_str(w, chunk->content_type);
+    }
+    writer_lit(w, "\r\n\r\n");
+}
+
+static void writer_closing_boundary(struct request_writer *w, uint8_t separate)
+{
+    if (separate)
+        writer_lit(w, "\r\n");
+    writer_lit(w, "--");
+    writer_str(w, multipart_boundary);
+    writer_lit(w, "--\r\n");
+}
+
+/* copies up to size bytes of the pieces, starting offset bytes in */
+static uint32_t writer_copy(struct request_writer *w, uint32_t offset, uint8_t *buf, uint32_t size)
+{
+    uint32_t i, n, len = 0;
+
+    for (i = 0; i < w->count && len < size; i++)
+    {
+        if (offset >= w->len[i])
         {
-            total_content_length += 2; // "--"
-            total_content_length += strlen(boundary);
-            total_content_length += 2; // "\r\n"
-            if (post_data[i]->content_disposition != NULL)
-            {
-                total_content_length += 21 ; // "Content-Disposition: "
-                total_content_length += post_data[i]->length_content_disposition;
-                if (post_data[i]->name != NULL)
-                {
-                    total_content_length += 8; // "; name=\""
-                    total_content_length += post_data[i]->length_name;
-                    total_content_length += 1; // "\""
-                }
-                if (post_data[i]->filename != NULL)
-                {
-                    total_content_length += 12; // "; filename=\""
-                    total_content_length += post_data[i]->length_filename;
-                    total_content_length += 1; // "\""
-                }
-            }
-            if (post_data[i]->content_type != NULL)
+            offset -= w->len[i];
+            continue;
+        }
+        n = w->len[i] - offset;
+        if (n > size - len)
+            n = size - len;
+        memcpy(buf + len, w->str[i] + offset, n);
+        len += n;
+        offset = 0;
+    }
+    return len;
+}
+
+/*
+ * The exact length of the multipart body, from the same pieces that are
+ * sent. Returns -1 if the pieces do not fit a request header or the body
+ * is too long for a 32-bit Content-Length.
+ */
+static int8_t get_content_length(struct multipart_chunk **post_data, uint16_t post_data_elements, uint32_t *length)
+{
+    struct request_writer w;
+    uint64_t total_content_length = 0;
+    uint8_t separate = 0;
+    uint32_t i;
+
+    for (i = 0; i < post_data_elements; i++)
+    {
+        if (multipart_chunk_present(post_data[i]))
+        {
+            w.count = 0;
+            w.size = 0;
+            writer_part_preamble(&w, post_data[i], separate);
+            if (w.count > HTTP_REQUEST_FRAGMENTS)
             {
-                total_content_length += 2; // "\r\n"
-                total_content_length += 14; // "Content-type: "
-                total_content_length += post_data[i]->length_content_type;
+                pico_err = PICO_ERR_EINVAL;
+                return HTTP_RETURN_ERROR;
             }
-            total_content_length += 4; // "\r\n\r\n"
+            total_content_length += w.size;
             total_content_length += post_data[i]->length_data;
-            total_content_length += 2; // "\r\n"
+            separate = 1;
         }
     }
-    total_content_length += 2; // "--"
-    total_content_length += strlen(boundary);
-    total_content_length += 4; // "--\r\n"
-    return total_content_length;
-}
-
-static int32_t get_max_multipart_header_size(struct multipart_chunk **post_data, uint16_t length)
-{
-    uint32_t max = 0;
-    uint32_t len = 0;
-    uint32_t i = 0;
-    for (i=0; i<length; i++)
+    w.count = 0;
+    w.size = 0;
+    writer_closing_boundary(&w, separate);
+    total_content_length += w.size;
+    if (total_content_length > 0xFFFFFFFFu)
     {
-        len = 0;
-        len += post_data[i]->length_content_disposition;
-        len += post_data[i]->length_name;
-        len += post_data[i]->length_filename;
-        len += post_data[i]->length_content_type;
-        if (max < len)
-        {
-            max = len;
-        }
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
     }
-    return max;
+    *length = (uint32_t)total_content_length;
+    return HTTP_RETURN_OK;
 }
 
 /*
  * post_data: list with the multipart chunk that need to be added to the http client struct.
  * post_data_length: number of elements in post_data.
- * boundary: the const boundary used to separate the chunks.
  * http: the http client struct where we need to add the chunks to.
  */
-static int8_t add_multipart_chunks(struct multipart_chunk **post_data, uint16_t post_data_length, const char *boundary, struct pico_http_client *http)
+static int8_t add_multipart_chunks(struct multipart_chunk **post_data, uint16_t post_data_length, struct pico_http_client *http)
 {
+    struct request_writer w;
+    uint8_t separate = 0;
+    char *buf;
     uint32_t i = 0;
-    char *buf = NULL;
-    uint32_t buf_size = HTTP_POST_MULTIPART_BASIC_SIZE;
-
-    buf_size += get_max_multipart_header_size(post_data, post_data_length);
-    buf_size += strlen(boundary);
-    buf = PICO_ZALLOC(buf_size);
 
-    if(!buf)
-    {
-        pico_err = PICO_ERR_ENOMEM;
-        return HTTP_RETURN_ERROR;
-    }
     for (i=0; i<post_data_length; i++)
     {
         if (post_data[i]->data != NULL)
         {
-            if (i == 0)
-                strcpy(buf,"--");
-            else
-                strcat(buf,"--");
-            strcat(buf, boundary);
-            strcat(buf, "\r\n");
-            if (post_data[i]->content_disposition != NULL)
-            {
-                strcat(buf, "Content-Disposition: ");
-                strcat(buf, post_data[i]->content_disposition);
-                if (post_data[i]->name != NULL)
-                {
-                    strcat(buf, "; name=\"");
-                    strcat(buf, post_data[i]->name);
-                    strcat(buf, "\"");
-                }
-                if (post_data[i]->filename != NULL)
-                {
-                    strcat(buf, "; filename=\"");
-                    strcat(buf, post_data[i]->filename);
-                    strcat(buf, "\"");
-                }
-            }
-            if (post_data[i]->content_type != NULL)
-            {
-                strcat(buf, "\r\n");
-                strcat(buf, "Content-type: ");
-                strcat(buf, post_data[i]->content_type);
-            }
-            strcat(buf, "\r\n\r\n");
+            w.count = 0;
+            w.size = 0;
+            writer_part_preamble(&w, post_data[i], separate);
+
+            buf = NULL;
+            if (writer_finish(&w, &buf, 0) < 0)
+                return HTTP_RETURN_ERROR;
 
-            http->request_parts[http->request_parts_len] = request_part_create(buf, strlen(buf), HTTP_COPY_TO_HEAP, HTTP_NO_USER_MEM);
+            http->request_parts[http->request_parts_len] = request_part_create(buf, w.size, HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
             if (!http->request_parts[http->request_parts_len])
             {
                 PICO_FREE(buf);
@@ -1141,19 +2644,23 @@ static int8_t add_multipart_chunks(struct multipart_chunk **post_data, uint16_t
             http->request_parts[http->request_parts_len] = request_part_create((char *)post_data[i]->data, post_data[i]->length_data, HTTP_NO_COPY_TO_HEAP, HTTP_USER_MEM);
             if (!http->request_parts[http->request_parts_len])
             {
-                PICO_FREE(buf);
                 pico_err = PICO_ERR_ENOMEM;
                 return HTTP_RETURN_ERROR;
             }
             http->request_parts_len += 1;
-            strcpy(buf, "\r\n");
+            separate = 1;
         }
     }
-    strcat(buf,"--");
-    strcat(buf, boundary);
-    strcat(buf, "--\r\n");
 
-    http->request_parts[http->request_parts_len] = request_part_create(buf, strlen(buf), HTTP_COPY_TO_HEAP, HTTP_USER_MEM);
+    w.count = 0;
+    w.size = 0;
+    writer_closing_boundary(&w, separate);
+
+    buf = NULL;
+    if (writer_finish(&w, &buf, 0) < 0)
+        return HTTP_RETURN_ERROR;
+
+    http->request_parts[http->request_parts_len] = request_part_create(buf, w.size, HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
     if (!http->request_parts[http->request_parts_len])
     {
         PICO_FREE(buf);
@@ -1161,108 +2668,203 @@ static int8_t add_multipart_chunks(struct multipart_chunk **post_data, uint16_t
         return HTTP_RETURN_ERROR;
     }
     http->request_parts_len += 1;
-    PICO_FREE(buf);
     return HTTP_RETURN_OK;
 }
 
-static int8_t pico_http_client_build_post_multipart_request(const struct pico_http_uri *uri_data, struct multipart_chunk **post_data, uint16_t len, struct pico_http_client *http, uint8_t connection_type)
+/*
+ * Multipart body encoder for parts that are not in memory. The boundary
+ * and header lines of a part are rebuilt from the chunk and copied into
+ * the upload buffer, the data follows from the chunk or its read
+ * callback. Only the list of chunks is kept.
+ */
+#define MULTIPART_PREAMBLE  0u
+#define MULTIPART_DATA      1u
+#define MULTIPART_DONE      2u
+
+struct multipart_upload
 {
-    char *header = NULL;
-    uint32_t content_length = 0;
-    uint32_t data_length = 0;
-    char port[6u]; /* 6 = max length of a uint16 + \0 */
-    uint32_t header_size = HTTP_POST_HEADER_BASIC_SIZE;
-    const char *boundary = "--------------------------c6b5ca0828dmx010";
-    char str_content_length[6u];
-    uint16_t i = 0;
-    uint8_t rv = HTTP_RETURN_OK;
+    uint16_t count;
+    uint16_t part;          /* count once at the closing boundary */
+    uint8_t stage;
+    uint8_t separate;
+    uint32_t pos;           /* bytes of the current stage that are out */
+    struct multipart_chunk *parts[];
+};
 
-    if (!uri_data->host || !uri_data->resource || !uri_data->port)
-    {
-        pico_err = PICO_ERR_EINVAL;
-        return -1;
-    }
-    content_length = get_content_length(post_data, len, boundary);
-    sprintf(str_content_length, "%d", content_length);
-    for (i=0; i<len; i++)
+static int32_t multipart_produce(uint16_t conn, uint8_t *buf, uint32_t size, void *arg)
+{
+    struct multipart_upload *mp = arg;
+    struct multipart_chunk *chunk;
+    struct request_writer w;
+    uint32_t len = 0;
+    uint32_t n;
+    int32_t got;
+
+    (void)conn;
+    while (len < size && mp->stage != MULTIPART_DONE)
     {
-        if (post_data[i]->data)
+        while (mp->part < mp->count && !multipart_chunk_present(mp->parts[mp->part]))
+        {
+            mp->part++;
+        }
+
+        w.count = 0;
+        w.size = 0;
+        if (mp->part == mp->count)
+        {
+            writer_closing_boundary(&w, mp->separate);
+        }
+        else if (mp->stage == MULTIPART_PREAMBLE)
+        {
+            writer_part_preamble(&w, mp->parts[mp->part], mp->separate);
+        }
+        else
+        {
+            chunk = mp->parts[mp->part];
+            n = chunk->length_data - mp->pos;
+            if (n > size - len)
+                n = size - len;
+
+            if (chunk->data)
+            {
+                memcpy(buf + len, chunk->data + mp->pos, n);
+                got = (int32_t)n;
+            }
+            else
+            {
+                got = chunk->read(buf + len, n, chunk->read_arg);
+                /* the Content-Length is sent already, the part must be complete */
+                if (got <= 0 || (uint32_t)got > n)
+                    return -1;
+            }
+            len += (uint32_t)got;
+            mp->pos += (uint32_t)got;
+            if (mp->pos == chunk->length_data)
+            {
+                mp->part++;
+                mp->stage = MULTIPART_PREAMBLE;
+                mp->pos = 0;
+                mp->separate = 1;
+            }
+            continue;
+        }
+
+        n = writer_copy(&w, mp->pos, buf + len, size - len);
+        len += n;
+        mp->pos += n;
+        if (mp->pos == w.size)
         {
-            data_length += post_data[i]->length_data;
+            mp->stage = (mp->part == mp->count) ? MULTIPART_DONE : MULTIPART_DATA;
+            mp->pos = 0;
         }
     }
+    return (int32_t)len;
+}
 
-    header_size = (header_size + strlen(uri_data->host));
-    header_size = (header_size + strlen(uri_data->resource));
-    header_size = (header_size + pico_itoa(uri_data->port, port) + 4u); /* 3 = size(CRLF + \0) */
-    header_size = (header_size + strlen(boundary));
-    header = PICO_ZALLOC(header_size);
-    if (!header)
+static int8_t multipart_upload_start(struct multipart_chunk **post_data, uint16_t len, struct pico_http_client *http)
+{
+    struct multipart_upload *mp = PICO_ZALLOC(sizeof(struct multipart_upload) + len * sizeof(struct multipart_chunk *));
+
+    if (!mp)
     {
-        /* not enough memory */
         pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+    mp->count = len;
+    memcpy(mp->parts, post_data, len * sizeof(struct multipart_chunk *));
+    if (upload_start(http, multipart_produce, mp, 0u) < 0)
+    {
+        PICO_FREE(mp);
+        return HTTP_RETURN_ERROR;
+    }
+    http->multipart = mp;
+    return HTTP_RETURN_OK;
+}
+
+static int8_t pico_http_client_build_post_multipart_request(const struct pico_http_uri *uri_data, struct multipart_chunk **post_data, uint16_t len, struct pico_http_client *http, uint8_t connection_type, uint8_t stream)
+{
+    struct request_writer w = { .count = 0, .size = 0 };
+    char *header = NULL;
+    char port[11u];
+    char str_content_length[11u];
+    uint32_t content_length;
+
+    if (!uri_data->host || !uri_data->resource || !uri_data->port)
+    {
+        pico_err = PICO_ERR_EINVAL;
         return -1;
     }
 
-    /* build the actual header */
-    sprintf(header, "POST %s HTTP/1.1\r\nUser-Agent: picoTCP\r\nAccept: */*\r\nHost: %s:%s\r\nConnection: %s\r\nContent-Length: %s\r\nContent-Type: multipart/mixed; boundary=%s\r\n\r\n",
-            uri_data->resource,
-            uri_data->host,
-            port,
-            connection_type == HTTP_CONN_CLOSE ? "Close":"Keep-Alive",
-            str_content_length,
-            boundary);
+    if (get_content_length(post_data, len, &content_length) < 0)
+        return HTTP_RETURN_ERROR;
 
-    http->request_parts[http->request_parts_len] = request_part_create(header, strlen(header), HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
-    if (!http->request_parts[0])
+    writer_lit(&w, "POST ");
+    writer_str(&w, uri_data->resource);
+    writer_lit(&w, " HTTP/1.1\r\nUser-Agent: picoTCP\r\nAccept: */*\r\n");
+    writer_host(&w, uri_data, port);
+    writer_connection(&w, connection_type);
+    writer_lit(&w, "Content-Length: ");
+    writer_num(&w, content_length, str_content_length);
+    writer_lit(&w, "\r\nContent-Type: multipart/mixed; boundary=");
+    writer_str(&w, multipart_boundary);
+    writer_lit(&w, "\r\n");
+    writer_end(&w, http->headers, http->decoding);
+    if (writer_finish(&w, &header, 0) < 0)
+        return HTTP_RETURN_ERROR;
+
+    http->request_parts[http->request_parts_len] = request_part_create(header, w.size, HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
+    if (!http->request_parts[http->request_parts_len])
     {
+        PICO_FREE(header);
         pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
     http->request_parts_len += 1;
-    rv = add_multipart_chunks(post_data, len, boundary, http);
-    return rv;
+    if (stream)
+        return multipart_upload_start(post_data, len, http);
+
+    return add_multipart_chunks(post_data, len, http);
 }
 
 /*
  * Builds a POST header based on the fields of the uri provided.
  */
-static char *pico_http_client_build_post_header(const struct pico_http_uri *uri_data, uint32_t post_data_len, uint8_t connection_type, char *content_type, char *cache_control)
+static char *pico_http_client_build_post_header(const struct pico_http_uri *uri_data, uint8_t transfer_coding, uint32_t post_data_len, uint8_t connection_type, char *content_type, char *cache_control, const char *headers, uint8_t decoding)
 {
-    char *header;
-    char port[6u]; /* 6 = max length of a uint16 + \0 */
-    uint64_t header_size = HTTP_POST_BASIC_SIZE;
-    char str_post_data_len[6u];
+    struct request_writer w = { .count = 0, .size = 0 };
+    char *header = NULL;
+    char port[11u];
+    char str_post_data_len[11u];
 
     if (!uri_data->host || !uri_data->resource || !uri_data->port)
     {
         pico_err = PICO_ERR_EINVAL;
         return NULL;
     }
-    sprintf(str_post_data_len, "%d", post_data_len);
-    /*  */
-    header_size += (header_size + strlen(uri_data->host));
-    header_size += (header_size + strlen(uri_data->resource));
-    header_size += (header_size + pico_itoa(uri_data->port, port) + 4u); /* 3 = size(CRLF + \0) */
-    header_size += 6u; //str_post_data_len
-    header = PICO_ZALLOC(header_size);
 
-    if (!header)
+    writer_lit(&w, "POST ");
+    writer_str(&w, uri_data->resource);
+    writer_lit(&w, " HTTP/1.1\r\nUser-Agent: picoTCP\r\nAccept: */*\r\n");
+    writer_host(&w, uri_data, port);
+    writer_connection(&w, connection_type);
+    writer_lit(&w, "Content-Type: ");
+    writer_str(&w, content_type == NULL ? "application/x-www-form-urlencoded" : content_type);
+    writer_lit(&w, "\r\nCache-Control: ");
+    writer_str(&w, cache_control == NULL ? "private, max-age=0, no-cache" : cache_control);
+    if (transfer_coding == HTTP_TRANSFER_CHUNKED)
     {
-        /* not enough memory */
-        pico_err = PICO_ERR_ENOMEM;
-        return NULL;
+        writer_lit(&w, "\r\nTransfer-Encoding: chunked\r\n");
     }
+    else
+    {
+        writer_lit(&w, "\r\nContent-Length: ");
+        writer_num(&w, post_data_len, str_post_data_len);
+        writer_lit(&w, "\r\n");
+    }
+    writer_end(&w, headers, decoding);
+    if (writer_finish(&w, &header, 0) < 0)
+        return NULL;
 
-    /* build the actual header */
-    sprintf(header, "POST %s HTTP/1.1\r\nUser-Agent: picoTCP\r\nAccept: */*\r\nHost: %s:%s\r\nConnection: %s\r\nContent-Type: %s\r\nCache-Controle: %s\r\nContent-Length: %s\r\n\r\n",
-            uri_data->resource,
-            uri_data->host,
-            port,
-            connection_type == HTTP_CONN_CLOSE ? "Close":"Keep-Alive",
-            content_type == NULL ? "application/x-www-form-urlencoded":content_type,
-            cache_control == NULL ? "private, max-age=0, no-cache":cache_control,
-            str_post_data_len);
     return header;
 }
 /*  */
@@ -1320,7 +2922,6 @@ int8_t MOCKABLE pico_http_client_get_write_progress(uint16_t conn, uint32_t *tot
 static int32_t client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn), int32_t connID, int (*encoding)(char *out_buffer, char *in_buffer))
 {
     struct pico_http_client *client;
-    uint32_t ip = 0;
 
     if (!wakeup || !uri)
     {
@@ -1362,16 +2963,12 @@ static int32_t client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn)
         return HTTP_RETURN_ALREADYIN;
     }
 
-    /* dns query */
-    if (pico_string_to_ipv4(client->urikey->host, &ip) == -1)
-    {
-        dbg("Querying : %s \n", client->urikey->host);
-        pico_dns_client_getaddr(client->urikey->host, (void *)dns_callback, client);
-    }
-    else
+    if (client_connect(client) < 0)
     {
-        dbg("host already and ip address, no dns required\n");
-        dns_callback(client->urikey->host, client);
+        pico_tree_delete(&pico_client_list, client);
+        free_uri(client);
+        PICO_FREE(client);
+        return HTTP_RETURN_ERROR;
     }
 
     /* return the connection ID */
@@ -1407,6 +3004,10 @@ int32_t MOCKABLE pico_http_client_open(char *uri, void (*wakeup)(uint16_t ev, ui
  * POST request:
  *  post_data: pointer to multipart_chunk
  *  length_post_data: length of the multipart_chunk array
+ *
+ * Chunks made with multipart_chunk_create_stream are read while the
+ * request goes out; the chunks (not the array) must stay until
+ * EV_HTTP_WRITE_SUCCESS.
  */
 int8_t MOCKABLE pico_http_client_send_post_multipart(uint16_t conn, char *resource, struct multipart_chunk **post_data, uint16_t length_post_data, uint8_t connection_type)
 {
@@ -1416,6 +3017,8 @@ int8_t MOCKABLE pico_http_client_send_post_multipart(uint16_t conn, char *resour
     struct pico_http_client *http = NULL;
     int32_t bytes_written;
     int8_t rv = 0;
+    uint8_t stream = 0;
+    uint16_t i;
 
     dbg("POST MULTIPART request\n");
 
@@ -1442,7 +3045,6 @@ int8_t MOCKABLE pico_http_client_send_post_multipart(uint16_t conn, char *resour
     {
         if(pico_process_resource(resource, http->urikey) < 0)
         {
-            PICO_FREE(http);
             return HTTP_RETURN_ERROR;
         }
     }
@@ -1455,19 +3057,37 @@ int8_t MOCKABLE pico_http_client_send_post_multipart(uint16_t conn, char *resour
     http->request_parts_len = 0;
     http->request_parts_len_done = 0;
 
+    /* parts that are read while sending make the whole body go through the upload buffer */
+    for (i = 0; i < length_post_data; i++)
+    {
+        if (post_data[i]->read)
+        {
+            stream = 1;
+        }
+    }
+
     /* the api gives the possibility to the user to build the POST multipart header */
     /* based on the uri passed when opening the client, less headache for the user */
-    rv = pico_http_client_build_post_multipart_request(http->urikey, post_data, length_post_data, http, connection_type);
+    rv = pico_http_client_build_post_multipart_request(http->urikey, post_data, length_post_data, http, connection_type, stream);
     if (rv == HTTP_RETURN_ERROR)
     {
-        pico_err = PICO_ERR_ENOMEM;
+        request_parts_destroy(http);
         return HTTP_RETURN_ERROR;
     }
+    if (!stream)
+    {
+        http->request_parts[http->request_parts_len - 1]->last = 1;
+    }
+    http->connection_type = connection_type;
     bytes_written = socket_write_request_parts(http);
     if (bytes_written < 0)
     {
         return HTTP_RETURN_ERROR;
     }
+    if (http->upload && http->request_parts_len_done == http->request_parts_len)
+    {
+        upload_pump(http);
+    }
     return HTTP_RETURN_OK;
 }
 
@@ -1486,6 +3106,7 @@ int8_t MOCKABLE pico_http_client_send_delete(uint16_t conn, char *resource, uint
     };
     struct pico_http_client *http = pico_tree_findKey(&pico_client_list, &search);
     int32_t bytes_written = 0;
+    uint32_t first;
 
     dbg("DELETE request\n");
 
@@ -1494,7 +3115,7 @@ int8_t MOCKABLE pico_http_client_send_delete(uint16_t conn, char *resource, uint
         dbg("Client not found !\n");
         return HTTP_RETURN_ERROR;
     }
-    if (http->state != HTTP_CONN_IDLE)
+    if (!client_can_send(http))
     {
         return HTTP_RETURN_CONN_BUSY;
     }
@@ -1506,38 +3127,38 @@ int8_t MOCKABLE pico_http_client_send_delete(uint16_t conn, char *resource, uint
     {
         if (pico_process_resource(resource, http->urikey) < 0)
         {
-            PICO_FREE(http);
             return HTTP_RETURN_ERROR;
         }
     }
-    http->request_parts = PICO_ZALLOC(1 * sizeof(struct request_part *));
-    if (!http->request_parts)
+    if (request_parts_reserve(http, 1u) < 0)
     {
-        pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
-    http->request_parts_len = 0;
-    http->request_parts_len_done = 0;
+    first = http->request_parts_len;
 
-    request = pico_http_client_build_delete(http->urikey, connection_type);
+    request = pico_http_client_build_delete(http->urikey, connection_type, http->headers, http->decoding);
     dbg("DELETE: request: \n%s\n", request);
     if (!request)
     {
+        request_parts_abort(http, first);
         pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
     http->request_parts[http->request_parts_len] = request_part_create(request, strlen(request), HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
     if (!http->request_parts[http->request_parts_len])
     {
+        request_parts_abort(http, first);
         pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
     http->request_parts_len += 1;
+    http->request_parts[http->request_parts_len - 1]->last = 1;
     bytes_written = socket_write_request_parts(http);
     if (bytes_written < 0)
     {
         return HTTP_RETURN_ERROR;
     }
+    http->connection_type = connection_type;
     return HTTP_RETURN_OK;
 }
 
@@ -1564,6 +3185,7 @@ int8_t MOCKABLE pico_http_client_send_post(uint16_t conn, char *resource, uint8_
     };
     struct pico_http_client *http = NULL;
     int32_t bytes_written = 0;
+    uint32_t first;
 
     dbg("POST request\n");
 
@@ -1578,7 +3200,7 @@ int8_t MOCKABLE pico_http_client_send_post(uint16_t conn, char *resource, uint8_
         return HTTP_RETURN_ERROR;
     }
 
-    if (http->state != HTTP_CONN_IDLE)
+    if (!client_can_send(http))
     {
         return HTTP_RETURN_CONN_BUSY;
     }
@@ -1592,30 +3214,26 @@ int8_t MOCKABLE pico_http_client_send_post(uint16_t conn, char *resource, uint8_
     {
         if(pico_process_resource(resource, http->urikey) < 0)
         {
-            PICO_FREE(http);
             return HTTP_RETURN_ERROR;
         }
     }
 
-    http->request_parts = PICO_ZALLOC(2 * sizeof(struct request_part *));
-    if (!http->request_parts)
+    if (request_parts_reserve(http, 2u) < 0)
     {
-        pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
-    http->request_parts_len = 0;
-    http->request_parts_len_done = 0;
-    header = pico_http_client_build_post_header(http->urikey, post_data_len, connection_type, content_type, cache_control);
+    first = http->request_parts_len;
+    header = pico_http_client_build_post_header(http->urikey, HTTP_TRANSFER_FULL, post_data_len, connection_type, content_type, cache_control, http->headers, http->decoding);
     if (!header)
     {
-        request_parts_destroy(http);
+        request_parts_abort(http, first);
         pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
     http->request_parts[http->request_parts_len] = request_part_create(header, strlen(header), HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
     if (!http->request_parts[http->request_parts_len])
     {
-        request_parts_destroy(http);
+        request_parts_abort(http, first);
         pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
@@ -1624,17 +3242,111 @@ int8_t MOCKABLE pico_http_client_send_post(uint16_t conn, char *resource, uint8_
     http->request_parts[http->request_parts_len] = request_part_create((char *)post_data, post_data_len, HTTP_NO_COPY_TO_HEAP, HTTP_USER_MEM);
     if (!http->request_parts[http->request_parts_len])
     {
-        request_parts_destroy(http);
+        request_parts_abort(http, first);
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+    http->request_parts_len += 1;
+
+    http->request_parts[http->request_parts_len - 1]->last = 1;
+    bytes_written = socket_write_request_parts(http);
+    if (bytes_written < 0)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    http->connection_type = connection_type;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * API for sending a POST request whose body is not known up front.
+ *
+ * The body goes out with Transfer-Encoding: chunked. Whenever the socket
+ * has room, the producer is asked for the next piece: it writes at most
+ * size bytes (HTTP_CLIENT_UPLOAD_CHUNK) into buf and returns how many,
+ * 0 to end the body or -1 to give up (EV_HTTP_WRITE_FAILED). Only one
+ * chunk is held in memory. EV_HTTP_WRITE_SUCCESS follows the last chunk.
+ */
+int8_t MOCKABLE pico_http_client_send_post_stream(uint16_t conn, char *resource, uint8_t connection_type, char *content_type,
+                                                  int32_t (*producer)(uint16_t conn, uint8_t *buf, uint32_t size, void *arg), void *arg)
+{
+    char *header = NULL;
+    struct pico_http_client *http = NULL;
+    int32_t bytes_written = 0;
+    uint32_t first;
+
+    dbg("POST stream request\n");
+
+    if (!producer)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    http = find_client(conn);
+    if (!http)
+    {
+        dbg("Client not found !\n");
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (!client_can_send(http))
+    {
+        return HTTP_RETURN_CONN_BUSY;
+    }
+
+    if (connection_type != HTTP_CONN_CLOSE && connection_type != HTTP_CONN_KEEP_ALIVE)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (resource)
+    {
+        if (pico_process_resource(resource, http->urikey) < 0)
+        {
+            return HTTP_RETURN_ERROR;
+        }
+    }
+
+    if (upload_start(http, producer, arg, 1u) < 0)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (request_parts_reserve(http, 1u) < 0)
+    {
+        upload_stop(http);
+        return HTTP_RETURN_ERROR;
+    }
+    first = http->request_parts_len;
+    header = pico_http_client_build_post_header(http->urikey, HTTP_TRANSFER_CHUNKED, 0, connection_type, content_type, NULL, http->headers, http->decoding);
+    if (header)
+    {
+        http->request_parts[http->request_parts_len] = request_part_create(header, strlen(header), HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
+    }
+    if (!header || !http->request_parts[http->request_parts_len])
+    {
+        if (header)
+        {
+            PICO_FREE(header);
+        }
+        request_parts_abort(http, first);
+        upload_stop(http);
         pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
     http->request_parts_len += 1;
 
+    /* the request is complete with the last chunk, not with the header */
+    http->connection_type = connection_type;
     bytes_written = socket_write_request_parts(http);
     if (bytes_written < 0)
     {
         return HTTP_RETURN_ERROR;
     }
+    if (http->upload && http->request_parts_len_done == http->request_parts_len)
+    {
+        upload_pump(http);
+    }
     return HTTP_RETURN_OK;
 }
 
@@ -1686,6 +3398,7 @@ int8_t MOCKABLE pico_http_client_send_raw(uint16_t conn, char *request)
     }
 
     http->request_parts_len += 1;
+    http->request_parts[http->request_parts_len - 1]->last = 1;
     bytes_written = socket_write_request_parts(http);
     if (bytes_written < 0)
     {
@@ -1694,6 +3407,52 @@ int8_t MOCKABLE pico_http_client_send_raw(uint16_t conn, char *request)
     return HTTP_RETURN_OK;
 }
 
+/*
+ * API for streaming a request body after its header.
+ *
+ * Send the request header with pico_http_client_send_raw (including the
+ * Content-Length), then hand the body over piece by piece once
+ * EV_HTTP_WRITE_SUCCESS was received. Returns the number of bytes the
+ * socket took; when that is less than len, EV_HTTP_WRITE_PROGRESS_MADE
+ * tells when to continue.
+ */
+int32_t MOCKABLE pico_http_client_write_body(uint16_t conn, const uint8_t *data, uint32_t len)
+{
+    struct pico_http_client search = {
+        .connectionID = conn
+    };
+    struct pico_http_client *http = pico_tree_findKey(&pico_client_list, &search);
+    int32_t bytes_written;
+
+    if (!http || !data)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    /* no request going on */
+    if (http->state == HTTP_CONN_IDLE)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    /* the header is not out yet */
+    if (http->state == HTTP_WRITING_REQUEST)
+    {
+        return HTTP_RETURN_CONN_BUSY;
+    }
+
+    bytes_written = pico_socket_write(http->sck, (void *)data, (int)len);
+    if (bytes_written < 0)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    if ((uint32_t)bytes_written < len)
+    {
+        http->body_write_pending = 1;
+    }
+    return bytes_written;
+}
+
 /*
  * API for sending a long polling GET request to the client.
  * Can be used in combination with keep-alive.
@@ -1753,12 +3512,11 @@ int8_t MOCKABLE pico_http_client_long_poll_cancel(uint16_t conn)
  */
 int8_t MOCKABLE pico_http_client_send_get(uint16_t conn, char *resource, uint8_t connection_type)
 {
-    char *request = NULL;
     struct pico_http_client search = {
         .connectionID = conn
     };
     struct pico_http_client *http = pico_tree_findKey(&pico_client_list, &search);
-    int32_t bytes_written = 0;
+    struct http_redirect_entry *moved;
 
     if (!http)
     {
@@ -1766,6 +3524,17 @@ int8_t MOCKABLE pico_http_client_send_get(uint16_t conn, char *resource, uint8_t
         return HTTP_RETURN_ERROR;
     }
 
+    if (!client_can_send(http))
+    {
+        return HTTP_RETURN_CONN_BUSY;
+    }
+
+    if (connection_type != HTTP_CONN_CLOSE && connection_type != HTTP_CONN_KEEP_ALIVE)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+
+    /* a busy connection may still have to send the last resource again */
     if (resource)
     {
         if (pico_process_resource(resource, http->urikey) < 0)
@@ -1774,41 +3543,49 @@ int8_t MOCKABLE pico_http_client_send_get(uint16_t conn, char *resource, uint8_t
         }
     }
 
-    if (http->state != HTTP_CONN_IDLE)
+    http->redirect_hops = 0;
+    moved = http->redirect_max ? redirect_cache_find(http->urikey) : NULL;
+    if (moved && http->state == HTTP_CONN_IDLE && !http->long_polling_state)
     {
-        return HTTP_RETURN_CONN_BUSY;
+        /* moved for good, the request goes to the new place right away */
+        http->redirect_hops = 1;
+        http->connection_type = connection_type;
+        return redirect_to(http, moved->target);
     }
+    return send_get(http, connection_type);
+}
 
-    if (connection_type != HTTP_CONN_CLOSE && connection_type != HTTP_CONN_KEEP_ALIVE)
-    {
-        return HTTP_RETURN_ERROR;
-    }
+static int8_t send_get(struct pico_http_client *http, uint8_t connection_type)
+{
+    char *request = NULL;
+    int32_t bytes_written = 0;
+    int32_t request_len;
+    uint32_t first;
 
-    http->request_parts = PICO_ZALLOC(1 * sizeof(struct request_part *));
-    if (!http->request_parts)
+    if (request_parts_reserve(http, 1u) < 0)
     {
-        pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
-    http->request_parts_len = 0;
-    http->request_parts_len_done = 0;
+    first = http->request_parts_len;
 
-    request = pico_http_client_build_get(http->urikey, connection_type);
-    if (!request)
+    request_len = build_get(http->urikey, connection_type, http->headers, http->decoding, &request, 0);
+    if (request_len < 0)
     {
-        request_parts_destroy(http);
-        pico_err = PICO_ERR_ENOMEM;
+        request_parts_abort(http, first);
         return HTTP_RETURN_ERROR;
     }
     dbg("GET HEADER: %s\n", request);
-    http->request_parts[http->request_parts_len] = request_part_create(request, strlen(request), HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
+    http->request_parts[http->request_parts_len] = request_part_create(request, (uint32_t)request_len, HTTP_NO_COPY_TO_HEAP, HTTP_NO_USER_MEM);
     if (!http->request_parts[http->request_parts_len])
     {
-        request_parts_destroy(http);
+        PICO_FREE(request);
+        request_parts_abort(http, first);
         pico_err = PICO_ERR_ENOMEM;
         return HTTP_RETURN_ERROR;
     }
     http->request_parts_len += 1;
+    http->request_parts[http->request_parts_len - 1]->last = 1;
+    http->redirect_get = 1;
     bytes_written = socket_write_request_parts(http);
     if (bytes_written < 0)
     {
@@ -1851,14 +3628,14 @@ static inline int32_t read_body(struct pico_http_client *client, uint8_t *data,
     {
 
         /* if needed truncate the data */
-        *tmp_len_read = pico_socket_read(client->sck, data + (*len_read),
+        *tmp_len_read = client_recv(client, data + (*len_read),
                                        (client->header->content_length_or_chunk < ((uint32_t)(size - (*len_read)))) ? ((uint32_t)client->header->content_length_or_chunk) : (size - (*len_read)));
 
         update_content_length(client, *tmp_len_read);
         if (*tmp_len_read < 0)
         {
             /* error on reading */
-            dbg(">>> Error returned pico_socket_read\n");
+            dbg(">>> Error returned client_recv\n");
             pico_err = PICO_ERR_EBUSY;
             /* return how much data was read until now */
             return (*len_read);
@@ -1897,7 +3674,7 @@ static inline void read_small_chunk(struct pico_http_client *client, uint8_t *da
     if (size < client->header->content_length_or_chunk)
     {
         /* read the data from the chunk */
-        *len_read = pico_socket_read(client->sck, (void *)data, size);
+        *len_read = client_recv(client, data, size);
 
         if (*len_read)
         {
@@ -1917,20 +3694,486 @@ static inline int32_t read_chunked_data(struct pico_http_client *client, unsigne
         return HTTP_RETURN_ERROR;
     }
 
-    // nothing to read, no use to try
-    if (client->state != HTTP_READING_BODY)
-    {
-        pico_err = PICO_ERR_EAGAIN;
-        return HTTP_RETURN_OK;
-    }
+    // nothing to read, no use to try
+    if (client->state != HTTP_READING_BODY)
+    {
+        pico_err = PICO_ERR_EAGAIN;
+        return HTTP_RETURN_OK;
+    }
+
+    read_small_chunk(client, data, size, &len_read);
+    value = read_big_chunk(client, data, size, &len_read);
+    if (value)
+    {
+        return value;
+    }
+    return len_read;
+}
+
+/*
+ * Passes a slice of the coded body through the decoder to the sink, the
+ * decoded slices point into the window of the decoder. Stops when the
+ * sink closes the connection, the caller looks the client up again.
+ * Returns -1 if the coded stream is corrupt.
+ */
+static int8_t body_push_decoded(struct pico_http_client *client, const uint8_t *data, uint32_t len)
+{
+    struct pico_http_inflate *inf = client->inflate;
+    uint16_t conn = client->connectionID;
+    const uint8_t *out;
+    uint32_t taken;
+    int32_t out_len;
+    uint8_t progress;
+
+    do
+    {
+        taken = pico_http_inflate_input(inf, data, len);
+        data += taken;
+        len -= taken;
+        progress = (taken > 0);
+        while ((out_len = pico_http_inflate_output(inf, &out, 0xFFFFFFFFu)) > 0)
+        {
+            client->body_sink(conn, out, (uint32_t)out_len, client->body_sink_arg);
+            if (find_client(conn) != client || client->inflate != inf || !client->body_sink)
+            {
+                return HTTP_RETURN_OK;
+            }
+            progress = 1;
+        }
+        if (out_len < 0 || (len && !progress))
+        {
+            pico_err = PICO_ERR_EINVAL;
+            return HTTP_RETURN_ERROR;
+        }
+    } while (len);
+
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * The next slice of the body in the receive buffer, chunked bodies
+ * de-chunked. Returns its length, 0 once the body is complete, or -1
+ * when the rest has not come in yet.
+ */
+static int32_t body_slice(struct pico_http_client *client, uint8_t **data)
+{
+    struct pico_http_header *header = client->header;
+    uint32_t len, avail;
+
+    if (!header || client->state < HTTP_READING_BODY || client->state > HTTP_READING_CHUNK_TRAIL)
+    {
+        return -1;
+    }
+
+    while (!client->body_read_done)
+    {
+        if (header->transfer_coding == HTTP_TRANSFER_FULL)
+        {
+            len = header->content_length_or_chunk - client->body_read;
+            if (!len)
+            {
+                client->body_read_done = 1;
+                break;
+            }
+        }
+        else
+        {
+            len = (client->state == HTTP_READING_BODY) ? header->content_length_or_chunk : 0;
+        }
+
+        if (client->rx_pos == client->rx_len && client_fill(client) <= 0)
+        {
+            return -1;
+        }
+
+        if (!len)
+        {
+            /* between two chunks, takes at least one byte */
+            read_chunk_line(client);
+            continue;
+        }
+
+        avail = (uint32_t)(client->rx_len - client->rx_pos);
+        if (len > avail)
+        {
+            len = avail;
+        }
+        *data = &client->rx_buf[client->rx_pos];
+        client->rx_pos = (uint16_t)(client->rx_pos + len);
+        if (header->transfer_coding == HTTP_TRANSFER_FULL)
+        {
+            client->body_read += len;
+            client->body_read_done = (client->body_read == header->content_length_or_chunk);
+        }
+        else
+        {
+            header->content_length_or_chunk -= len;
+        }
+        return (int32_t)len;
+    }
+    return 0;
+}
+
+/*
+ * Hands the body to the sink of the client as it comes in: the data
+ * parts are passed straight from the receive buffer, the chunk lines are
+ * parsed in between. Stops when the socket has nothing more, the next
+ * read event continues. EV_HTTP_DONE follows the last slice.
+ */
+static void body_push(struct pico_http_client *client)
+{
+    void (*wakeup)(uint16_t ev, uint16_t conn) = client->wakeup;
+    uint16_t conn = client->connectionID;
+    struct pico_http_header *header = client->header;
+    uint8_t *data;
+    int32_t slice;
+    uint32_t len;
+
+    while ((slice = body_slice(client, &data)) > 0)
+    {
+        len = (uint32_t)slice;
+        if (client->inflate)
+        {
+            if (body_push_decoded(client, data, len) < 0)
+            {
+                wakeup(EV_HTTP_ERROR, conn);
+                return;
+            }
+        }
+        else
+        {
+            client->body_sink(conn, data, len, client->body_sink_arg);
+        }
+        /* the sink may have closed the connection */
+        client = find_client(conn);
+        if (!client || client->header != header || !client->body_sink)
+        {
+            return;
+        }
+    }
+    if (slice < 0)
+    {
+        return;
+    }
+
+    if (client->inflate)
+    {
+        /* what is left in the window, then the stream has to be complete */
+        if (body_push_decoded(client, NULL, 0) < 0)
+        {
+            wakeup(EV_HTTP_ERROR, conn);
+            return;
+        }
+        client = find_client(conn);
+        if (!client || client->header != header || !client->body_sink)
+        {
+            return;
+        }
+        if (!pico_http_inflate_done(client->inflate))
+        {
+            dbg("Coded body ended early\n");
+            wakeup(EV_HTTP_ERROR, conn);
+            return;
+        }
+    }
+
+    dbg("Body pushed\n");
+    response_done(client);
+    if (client->long_polling_state)
+    {
+        treat_long_polling(client, 0);
+    }
+    wakeup(EV_HTTP_DONE, conn);
+}
+
+/*
+ * API to take the response body without pico_http_client_read_body.
+ *
+ * The sink is called with the body as it comes in, chunked bodies
+ * already de-chunked, in slices that point into the receive buffer of
+ * the client and are only valid during the call. EV_HTTP_REQ announces
+ * the header, EV_HTTP_BODY is not passed; EV_HTTP_DONE follows once the
+ * whole body went to the sink. NULL goes back to pico_http_client_read_body.
+ */
+int8_t MOCKABLE pico_http_client_set_body_sink(uint16_t conn, void (*sink)(uint16_t conn, const uint8_t *data, uint32_t len, void *arg), void *arg)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client)
+    {
+        dbg("Wrong connection id !\n");
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    client->body_sink = sink;
+    client->body_sink_arg = arg;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * API to see the response header as it is, e.g. to relay it.
+ *
+ * The sink is called with every line of each response header, the
+ * status line first and then the fields, without the line end. Interim
+ * (1xx) responses pass their lines too. A line longer than the client
+ * keeps (HTTP_HEADER_LINE_SIZE) is passed as NULL. The line is only
+ * valid during the call and the sink must not close the client.
+ * NULL removes the sink.
+ */
+int8_t MOCKABLE pico_http_client_set_field_sink(uint16_t conn, void (*sink)(uint16_t conn, const char *line, void *arg), void *arg)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client)
+    {
+        dbg("Wrong connection id !\n");
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    client->field_sink = sink;
+    client->field_sink_arg = arg;
+    return HTTP_RETURN_OK;
+}
+
+/* clients that asked for coded responses, at most HTTP_CLIENT_INFLATE_MAX */
+static uint8_t decoding_clients = 0;
+
+/*
+ * API to ask for gzip and deflate coded responses.
+ *
+ * The requests built by the library carry "Accept-Encoding: gzip,
+ * deflate" and coded bodies are decoded on the fly, both for
+ * pico_http_client_read_body and for the body sink. A decoder of
+ * pico_http_inflate_size() bytes is allocated per coded body. At most
+ * HTTP_CLIENT_INFLATE_MAX clients decode at the same time, past that
+ * PICO_ERR_EBUSY is returned.
+ */
+int8_t MOCKABLE pico_http_client_set_decoding(uint16_t conn, uint8_t enable)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client)
+    {
+        dbg("Wrong connection id !\n");
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    enable = (uint8_t)(enable != 0);
+    if (enable == client->decoding)
+    {
+        return HTTP_RETURN_OK;
+    }
+    if (enable)
+    {
+        if (decoding_clients >= HTTP_CLIENT_INFLATE_MAX)
+        {
+            pico_err = PICO_ERR_EBUSY;
+            return HTTP_RETURN_ERROR;
+        }
+        decoding_clients++;
+    }
+    else
+    {
+        decoding_clients--;
+    }
+    client->decoding = enable;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * API to enable HTTP/1.1 pipelining on a connection.
+ *
+ * Up to depth GET, POST and DELETE requests can be sent before their
+ * responses came in, send them with HTTP_CONN_KEEP_ALIVE. The responses
+ * are handed out in the order of the requests: EV_HTTP_DONE is passed
+ * once one has been read completely, the header of the next one follows
+ * with EV_HTTP_REQ. Raw, multipart and long polling requests still wait
+ * for an idle connection. Depth 0 or 1 turns pipelining off.
+ */
+int8_t MOCKABLE pico_http_client_set_pipeline(uint16_t conn, uint8_t depth)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client)
+    {
+        dbg("Wrong connection id !\n");
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    client->pipeline_depth = depth;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * API to let the client follow redirects of GET requests.
+ *
+ * Up to max_hops 301, 302, 303, 307 and 308 responses in a row are
+ * followed to their Location (http only); EV_HTTP_REQ comes with the
+ * response at the end, pico_http_client_read_uri_data tells where that
+ * is. A redirect to the same server goes over the same connection when
+ * it stays open. The targets of 301 and 308 are kept in a cache of
+ * HTTP_CLIENT_REDIRECT_CACHE entries, later GETs of such a resource go
+ * there directly. 0 turns it off.
+ */
+int8_t MOCKABLE pico_http_client_set_redirects(uint16_t conn, uint8_t max_hops)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client)
+    {
+        dbg("Wrong connection id !\n");
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    client->redirect_max = max_hops;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * API to bound the time a request may take.
+ *
+ * The deadlines apply to the requests sent after the call, connect to
+ * the next connection, or to the one being set up (counted from now).
+ * When one passes, the connection is closed, the buffers of the request
+ * are freed and EV_HTTP_TIMEOUT is given; all that is left to do with
+ * the client is closing it. The timeouts are copied, NULL removes them.
+ */
+int8_t MOCKABLE pico_http_client_set_timeouts(uint16_t conn, const struct pico_http_timeouts *timeouts)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client)
+    {
+        dbg("Wrong connection id !\n");
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    if (timeouts)
+    {
+        client->timeouts = *timeouts;
+    }
+    else
+    {
+        memset(&client->timeouts, 0, sizeof(client->timeouts));
+    }
+    if (client->conn_state != HTTP_CONNECTION_CONNECTED && !client->timed_out)
+    {
+        deadline_set(client, &client->connect_by, client->timeouts.connect);
+    }
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * API to add header lines to the requests the library builds.
+ *
+ * headers holds complete lines, each ended by CRLF (e.g.
+ * "Accept-Encoding: identity\r\n"), and is not copied: it has to stay
+ * valid until it is replaced, NULL removes it. Raw requests are sent
+ * as they are.
+ */
+int8_t MOCKABLE pico_http_client_set_headers(uint16_t conn, const char *headers)
+{
+    struct pico_http_client *client = find_client(conn);
+
+    if (!client)
+    {
+        dbg("Wrong connection id !\n");
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+    client->headers = headers;
+    return HTTP_RETURN_OK;
+}
+
+/* body bytes as they came over the wire, de-chunked */
+static int32_t body_read_raw(struct pico_http_client *client, unsigned char *data, uint16_t size)
+{
+    int32_t bytes_read = 0;
+
+    if (client->header->transfer_coding == HTTP_TRANSFER_FULL)
+    {
+        //check to make sure we don't read more than the header told us, content-length
+        if ((client->header->content_length_or_chunk - client->body_read) < size)
+        {
+            size = (uint16_t)(client->header->content_length_or_chunk - client->body_read);
+            dbg("client->header->content_length_or_chunk: %d\n", client->header->content_length_or_chunk);
+        }
+        bytes_read = client_recv(client, data, size);
+        client->body_read += bytes_read;
+        if (client->header->content_length_or_chunk == client->body_read)
+        {
+            client->body_read_done = 1;
+        }
+    }
+    else
+    {
+        /*
+         * client->state will be set to HTTP_READ_BODY_DONE if we reach the
+         * ending '0' at the end of the body, read_chunked_data make sure
+         * we don't read to mutch.
+         */
+        client->body_read += bytes_read;
+        bytes_read = read_chunked_data(client, data, size);
+    }
+    return bytes_read;
+}
+
+/*
+ * Decoded body bytes: the output of the decoder first, then the coded
+ * bytes are read straight into its input buffer. A coded stream that is
+ * corrupt or ends with the body is an error.
+ */
+static int32_t body_read_decoded(struct pico_http_client *client, unsigned char *data, uint16_t size)
+{
+    struct pico_http_inflate *inf = client->inflate;
+    const uint8_t *out;
+    uint8_t *in;
+    uint32_t room;
+    int32_t len;
+    uint16_t bytes_read = 0;
 
-    read_small_chunk(client, data, size, &len_read);
-    value = read_big_chunk(client, data, size, &len_read);
-    if (value)
+    while (bytes_read < size)
     {
-        return value;
+        len = pico_http_inflate_output(inf, &out, (uint32_t)(size - bytes_read));
+        if (len > 0)
+        {
+            memcpy(data + bytes_read, out, (size_t)len);
+            bytes_read = (uint16_t)(bytes_read + len);
+            continue;
+        }
+        if (len < 0 || (client->body_read_done && !pico_http_inflate_done(inf)))
+        {
+            dbg("Coded body corrupt or cut short\n");
+            pico_err = PICO_ERR_EINVAL;
+            client->wakeup(EV_HTTP_ERROR, client->connectionID);
+            return HTTP_RETURN_ERROR;
+        }
+        if (client->body_read_done)
+        {
+            break;
+        }
+
+        in = pico_http_inflate_space(inf, &room);
+        if (!room)
+        {
+            /* a block header longer than the input buffer */
+            pico_err = PICO_ERR_EINVAL;
+            client->wakeup(EV_HTTP_ERROR, client->connectionID);
+            return HTTP_RETURN_ERROR;
+        }
+        len = body_read_raw(client, in, (uint16_t)room);
+        if (len < 0)
+        {
+            return len;
+        }
+        if (len == 0 && !client->body_read_done)
+        {
+            /* the rest is not in yet */
+            break;
+        }
+        pico_http_inflate_commit(inf, (uint32_t)len);
     }
-    return len_read;
+    return bytes_read;
 }
 
 /*
@@ -1939,12 +4182,14 @@ static inline int32_t read_chunked_data(struct pico_http_client *client, unsigne
  * This api hides from the user if the transfer-encoding
  * was chunked or a full length was provided, in case of
  * a chunked transfer encoding will "de-chunk" the data
- * and pass it to the user.
+ * and pass it to the user. Gzip and deflate coded bodies
+ * are decoded, see pico_http_client_set_decoding.
  * Body_read_done will be set to 1 if the body has been read completly.
  */
 int32_t MOCKABLE pico_http_client_read_body(uint16_t conn, unsigned char *data, uint16_t size, uint8_t *body_read_done)
 {
-    uint32_t bytes_read = 0;
+    int32_t bytes_read = 0;
+    uint8_t done_ev = 0;
     struct pico_http_client dummy = {
         .connectionID = conn
     };
@@ -1956,49 +4201,49 @@ int32_t MOCKABLE pico_http_client_read_body(uint16_t conn, unsigned char *data,
         pico_err = PICO_ERR_EINVAL;
         return HTTP_RETURN_ERROR;
     }
-    if (client->header->transfer_coding == HTTP_TRANSFER_FULL)
+    if (!client->header || client->state < HTTP_READING_BODY || client->state > HTTP_READING_CHUNK_TRAIL)
     {
-        //check to make sure we don't read more than the header told us, content-length
-        if ((client->header->content_length_or_chunk - client->body_read) < size)
-        {
-            size = client->header->content_length_or_chunk;
-            dbg("client->header->content_length_or_chunk: %d\n", client->header->content_length_or_chunk);
-        }
-        bytes_read = pico_socket_read(client->sck, (void *)data, size);
-        client->body_read += bytes_read;
-        if (client->header->content_length_or_chunk == client->body_read)
+        /* no response body is coming in (yet) */
+        pico_err = PICO_ERR_EAGAIN;
+        return 0;
+    }
+    if (client->inflate)
+    {
+        bytes_read = body_read_decoded(client, data, size);
+        if (bytes_read < 0)
         {
-            client->body_read_done = 1;
+            return bytes_read;
         }
     }
     else
     {
-        /*
-         * client->state will be set to HTTP_READ_BODY_DONE if we reach the
-         * ending '0' at the end of the body, read_chunked_data make sure
-         * we don't read to mutch.
-         */
-        client->body_read += bytes_read;
-        bytes_read = read_chunked_data(client, data, size);
+        bytes_read = body_read_raw(client, data, size);
     }
 
-    if (client->body_read_done)
+    if (client->body_read_done && (!client->inflate || pico_http_inflate_done(client->inflate)))
     {
         dbg("Body read finished! %d\n", client->body_read);
-        client->state = HTTP_CONN_IDLE;
-        client->body_read = 0;
+        response_done(client);
         //client->body_read_done = 0;
         *body_read_done = 1;
         if (client->long_polling_state)
         {
             treat_long_polling(client, 0);
         }
+        else if (client->pipeline_depth > 1)
+        {
+            done_ev = 1;
+        }
         if (client->connection_type == HTTP_CONN_CLOSE)
         {
         	//client->wakeup(EV_HTTP_CLOSE, client->connectionID);
         	//pico_http_client_close(client->connectionID);
         }
     }
+    if (done_ev)
+    {
+        client->wakeup(EV_HTTP_DONE, client->connectionID);
+    }
     return bytes_read;
 }
 
@@ -2061,6 +4306,14 @@ static void free_header(struct pico_http_client *to_be_removed)
         {
             PICO_FREE(to_be_removed->header->location);
         }
+        if (to_be_removed->header->etag)
+        {
+            PICO_FREE(to_be_removed->header->etag);
+        }
+        if (to_be_removed->header->last_modified)
+        {
+            PICO_FREE(to_be_removed->header->last_modified);
+        }
         PICO_FREE(to_be_removed->header);
     }
 }
@@ -2113,31 +4366,120 @@ int8_t MOCKABLE pico_http_client_close(uint16_t conn)
         return HTTP_RETURN_ERROR;
     }
 
-    /* close socket */
-    if (to_be_removed->sck)
+    /* a dns answer may still be on its way */
+    pico_http_dns_cancel(to_be_removed);
+    wheel_unlink(to_be_removed);
+
+    /* close socket, unless the pool keeps it for a next request */
+    if (to_be_removed->sck && !pool_put(to_be_removed))
     {
-        pico_socket_close(to_be_removed->sck);
+        client_socket_close(to_be_removed);
     }
     free_header(to_be_removed);
     free_uri(to_be_removed);
+    body_decoder_stop(to_be_removed);
+    upload_stop(to_be_removed);
+    if (to_be_removed->decoding)
+    {
+        decoding_clients--;
+    }
 
     PICO_FREE(to_be_removed);
 
     return 0;
 }
 
-static inline void read_first_line(struct pico_http_client *client, uint8_t *line, uint32_t *index)
+/* refills the empty receive buffer with one socket read */
+static int32_t client_fill(struct pico_http_client *client)
 {
-    uint8_t c;
-    /* read the first line of the header */
-    while (consume_char(c) > 0 && c != '\r')
+    int32_t len;
+
+    client->rx_pos = 0;
+    client->rx_len = 0;
+    if (!client->sck)
+    {
+        return 0;
+    }
+    len = pico_socket_read(client->sck, client->rx_buf, HTTP_CLIENT_RX_SIZE);
+    if (len <= 0)
+    {
+        return len;
+    }
+    client->rx_len = (uint16_t)len;
+    deadline_received(client);
+    return len;
+}
+
+/* next byte of the response */
+static int32_t client_getc(struct pico_http_client *client, uint8_t *c)
+{
+    int32_t len;
+
+    if (client->rx_pos == client->rx_len)
     {
-        if (*index < HTTP_HEADER_LINE_SIZE) /* truncate if too long */
+        len = client_fill(client);
+        if (len <= 0)
         {
-            line[(*index)++] = c;
+            return len;
         }
     }
-    consume_char(c); /* consume \n */
+    *c = client->rx_buf[client->rx_pos++];
+    return 1;
+}
+
+/* body bytes, whatever is left in the receive buffer goes first */
+static int32_t client_recv(struct pico_http_client *client, uint8_t *data, uint32_t size)
+{
+    uint32_t len = (uint32_t)(client->rx_len - client->rx_pos);
+    int32_t ret;
+
+    if (len > size)
+    {
+        len = size;
+    }
+    memcpy(data, client->rx_buf + client->rx_pos, len);
+    client->rx_pos = (uint16_t)(client->rx_pos + len);
+    if (len == size || !client->sck)
+    {
+        return (int32_t)len;
+    }
+    ret = pico_socket_read(client->sck, data + len, (int)(size - len));
+    if (ret < 0)
+    {
+        return len ? (int32_t)len : ret;
+    }
+    if (ret > 0)
+    {
+        deadline_received(client);
+    }
+    return (int32_t)len + ret;
+}
+
+static void body_decoder_stop(struct pico_http_client *client)
+{
+    if (client->inflate)
+    {
+        pico_http_inflate_destroy(client->inflate);
+        client->inflate = NULL;
+    }
+}
+
+/* a coded body the client asked for gets a decoder, other codings are passed as they are */
+static int8_t body_decoder_start(struct pico_http_client *client, struct pico_http_header *header)
+{
+    body_decoder_stop(client);
+    if (!client->decoding || !client->coding ||
+        (header->transfer_coding == HTTP_TRANSFER_FULL && !header->content_length_or_chunk))
+    {
+        return HTTP_RETURN_OK;
+    }
+
+    client->inflate = pico_http_inflate_create(client->coding);
+    if (!client->inflate)
+    {
+        return HTTP_RETURN_ERROR;
+    }
+    return HTTP_RETURN_OK;
 }
 
 static inline void start_reading_body(struct pico_http_client *client, struct pico_http_header *header)
@@ -2155,173 +4497,317 @@ static inline void start_reading_body(struct pico_http_client *client, struct pi
         client->state = HTTP_READING_BODY;
 }
 
-static inline int32_t parse_loc_and_cont(struct pico_http_client *client, struct pico_http_header *header, uint8_t *line, uint32_t *index)
+/* case insensitive match of a header field name, line holds "name:value" */
+static int is_field(const char *line, uint16_t name_len, const char *name)
 {
-    uint8_t c;
-    /* Location: */
-    if (is_location(line))
-    {
-        *index = 0;
-        while (consume_char(c) > 0 && c != '\r')
-        {
-            dbg("parse_location: %c\n", c);
-            line[(*index)++] = c;
-        }
-        /* allocate space for the field */
-        header->location = PICO_ZALLOC((*index) + 1u);
-        if (header->location)
-        {
-            memcpy(header->location, line, (*index));
-            return 1;
-        }
-        else
-        {
-            return -1;
-        }
-    }    /* Content-Length: */
-    else if (is_content_length(line))
+    uint16_t i;
+
+    for (i = 0; i < name_len; i++)
     {
-        header->content_length_or_chunk = 0u;
-        header->transfer_coding = HTTP_TRANSFER_FULL;
-        /* consume the first space */
-        consume_char(c);
-        while (consume_char(c) > 0 && c != '\r')
+        if (!name[i] || tolower((unsigned char)line[i]) != name[i])
         {
-            dbg("parse_content_length: %c\n", c);
-            header->content_length_or_chunk = header->content_length_or_chunk * 10u + (uint32_t)(c - '0');
+            return 0;
         }
-        return 1;
-    }    /* Transfer-Encoding: chunked */
-
-    return 0;
+    }
+    return name[name_len] == '\0';
 }
 
-static inline int32_t parse_transfer_encoding(struct pico_http_client *client, struct pico_http_header *header, uint8_t *line, uint32_t *index)
+static void lowercase(char *str)
 {
-    uint8_t c;
-
-    if (is_transfer_encoding(line))
+    for (; *str; str++)
     {
-        (*index) = 0;
-        while (consume_char(c) > 0 && c != '\r')
-        {
-            line[(*index)++] = c;
-        }
-        if (is_chunked(line))
-        {
-            header->content_length_or_chunk = 0u;
-            header->transfer_coding = HTTP_TRANSFER_CHUNKED;
-        }
+        *str = (char)tolower((unsigned char)*str);
+    }
+}
 
-        return 1;
-    } /* just ignore the line */
+static int8_t parse_status_line(struct pico_http_header *header, const char *line, uint16_t len)
+{
+    /* make sure the server response starts with HTTP/1. and holds a response code */
+    if ((len < RESPONSE_INDEX + 3u) || is_not_HTTPv1(line) ||
+        !isdigit((unsigned char)line[RESPONSE_INDEX]) ||
+        !isdigit((unsigned char)line[RESPONSE_INDEX + 1]) ||
+        !isdigit((unsigned char)line[RESPONSE_INDEX + 2]))
+    {
+        /* wrong format of the the response */
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
 
-    return 0;
+    /* extract response code */
+    header->response_code = (uint16_t)((line[RESPONSE_INDEX] - '0') * 100 +
+                                       (line[RESPONSE_INDEX + 1] - '0') * 10 +
+                                       (line[RESPONSE_INDEX + 2] - '0'));
+    return HTTP_RETURN_OK;
 }
 
+static uint32_t parse_number(const char **str)
+{
+    uint32_t value = 0u;
+
+    while (isdigit((unsigned char)**str))
+    {
+        value = value * 10u + (uint32_t)(**str - '0');
+        (*str)++;
+    }
+    return value;
+}
 
-static inline int32_t parse_fields(struct pico_http_client *client, struct pico_http_header *header, uint8_t *line, uint32_t *index)
+/* "bytes first-last/total", the total can be '*' */
+static void parse_content_range(struct pico_http_header *header, const char *value)
 {
-    int8_t c;
-    int32_t ret_val;
+    if (strncmp(value, "bytes", 5u))
+    {
+        return;
+    }
+    value += 5;
+    while (*value == ' ')
+    {
+        value++;
+    }
+    header->range_first = parse_number(&value);
+    value = strchr(value, '/');
+    if (value)
+    {
+        value++;
+        header->range_total = parse_number(&value);
+    }
+}
 
-    ret_val = parse_loc_and_cont(client, header, line, index);
-    if (ret_val == 0)
+/* the field keeps its own copy of value */
+static int8_t header_copy(char **field, const char *value)
+{
+    if (*field)
     {
-        if (!parse_transfer_encoding(client, header, line, index))
-        {
-            while (consume_char(c) > 0 && c != '\r') nop();
-        }
+        PICO_FREE(*field);
     }
-    else if (ret_val == -1)
+    *field = PICO_ZALLOC(strlen(value) + 1u);
+    if (!*field)
     {
-        return -1;
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
     }
+    strcpy(*field, value);
+    return HTTP_RETURN_OK;
+}
 
-    /* consume the next one */
-    consume_char(c);
-    /* reset the index */
-    (*index) = 0u;
+/* the directives a client cache cares about, of Cache-Control or Pragma */
+static void parse_cache_control(struct pico_http_header *header, char *value)
+{
+    const char *age;
 
-    return 0;
+    lowercase(value);
+    if (strstr(value, "no-store"))
+    {
+        header->cache_control |= HTTP_CACHE_CONTROL_NO_STORE;
+    }
+    if (strstr(value, "no-cache"))
+    {
+        header->cache_control |= HTTP_CACHE_CONTROL_NO_CACHE;
+    }
+    age = strstr(value, "max-age=");
+    if (age && (age == value || age[-1] == ' ' || age[-1] == ','))
+    {
+        age += 8;
+        header->max_age = parse_number(&age);
+        header->cache_control |= HTTP_CACHE_CONTROL_MAX_AGE;
+    }
 }
 
-static inline int32_t parse_rest_of_header(struct pico_http_client *client, struct pico_http_header *header, uint8_t *line, uint32_t *index)
+static int8_t parse_header_field(struct pico_http_client *client, struct pico_http_header *header, char *line)
 {
-    uint8_t c;
-    uint32_t read_len = 0;
-    (*index) = 0u;
+    char *value = strchr(line, ':');
+    uint16_t name_len;
 
-    /* parse the rest of the header */
-    read_len = consume_char(c);
-    if (read_len == 0)
-        return HTTP_RETURN_BUSY;
-    dbg("parse_rest_of_header: client %p, header %p, line %p, index: %d\n", client, header, line, *index);
-    while (read_len > 0)
+    if (!value)
+    {
+        /* not a field, just ignore the line */
+        return HTTP_RETURN_OK;
+    }
+    name_len = (uint16_t)(value - line);
+    value++;
+    while (*value == ' ' || *value == '\t')
+    {
+        value++;
+    }
+
+    if (is_field(line, name_len, "location"))
+    {
+        return header_copy(&header->location, value);
+    }
+    else if (is_field(line, name_len, "etag"))
+    {
+        return header_copy(&header->etag, value);
+    }
+    else if (is_field(line, name_len, "last-modified"))
+    {
+        return header_copy(&header->last_modified, value);
+    }
+    else if (is_field(line, name_len, "cache-control") || is_field(line, name_len, "pragma"))
+    {
+        parse_cache_control(header, value);
+    }
+    else if (is_field(line, name_len, "content-range"))
+    {
+        parse_content_range(header, value);
+    }
+    else if (is_field(line, name_len, "content-length"))
     {
-        if (c == ':')
+        header->content_length_or_chunk = 0u;
+        header->transfer_coding = HTTP_TRANSFER_FULL;
+        while (isdigit((unsigned char)*value))
         {
-            if (parse_fields(client, header, line, index) == -1)
-                return HTTP_RETURN_ERROR;
+            header->content_length_or_chunk = header->content_length_or_chunk * 10u + (uint32_t)(*value - '0');
+            value++;
         }
-        else if (c == '\r' && !(*index))
+    }
+    else if (is_field(line, name_len, "transfer-encoding"))
+    {
+        lowercase(value);
+        if (strstr(value, "chunked"))
         {
-            /* consume the \n */
-            consume_char(c);
-            break;
+            header->content_length_or_chunk = 0u;
+            header->transfer_coding = HTTP_TRANSFER_CHUNKED;
+        }
+    }
+    else if (is_field(line, name_len, "content-encoding"))
+    {
+        lowercase(value);
+        if (!strcmp(value, "gzip") || !strcmp(value, "x-gzip"))
+        {
+            client->coding = HTTP_INFLATE_GZIP;
+        }
+        else if (!strcmp(value, "deflate"))
+        {
+            client->coding = HTTP_INFLATE_DEFLATE;
         }
         else
         {
-            line[(*index)++] = c;
+            client->coding = 0;
+        }
+    }
+    else if (is_field(line, name_len, "connection"))
+    {
+        lowercase(value);
+        if (strstr(value, "close"))
+        {
+            client->server_close = 1;
+        }
+        else if (strstr(value, "keep-alive"))
+        {
+            client->server_close = 0;
         }
-        read_len = consume_char(c);
     }
+
     return HTTP_RETURN_OK;
 }
 
+/* the fields an earlier response on the connection may have left */
+static void header_validators_clear(struct pico_http_header *header)
+{
+    if (header->etag)
+    {
+        PICO_FREE(header->etag);
+        header->etag = NULL;
+    }
+    if (header->last_modified)
+    {
+        PICO_FREE(header->last_modified);
+        header->last_modified = NULL;
+    }
+    header->max_age = 0u;
+    header->cache_control = 0u;
+}
+
+/*
+ * Resumable header parser. Bytes are taken from the receive buffer and
+ * collected in client->line until the end of the line; a line that is cut
+ * by a segment boundary is completed on the next read event. The status
+ * line is parsed in HTTP_START_READING_HEADER, the fields in
+ * HTTP_READING_HEADER. Interim 1xx responses are skipped.
+ */
 static int8_t parse_header_from_server(struct pico_http_client *client, struct pico_http_header *header)
 {
-    uint8_t line[HTTP_HEADER_LINE_SIZE];
-    uint32_t index = 0;
+    uint8_t c;
+    uint16_t len;
+
     dbg("Parse header from server\n");
-    if (client->state == HTTP_START_READING_HEADER)
+    while (consume_char(c) > 0)
     {
-        read_first_line(client, line, &index);
-        /* check the integrity of the response */
-        /* make sure we have enough characters to include the response code */
-        /* make sure the server response starts with HTTP/1. */
-        if ((index < RESPONSE_INDEX + 2u) || is_not_HTTPv1(line))
+        if (c != '\n')
         {
-            /* wrong format of the the response */
-            pico_err = PICO_ERR_EINVAL;
-            return HTTP_RETURN_ERROR;
+            if (client->line_len < HTTP_HEADER_LINE_SIZE - 1u) /* truncate if too long */
+            {
+                client->line[client->line_len++] = (char)c;
+            }
+            else
+            {
+                client->line_cut = 1;
+            }
+            continue;
         }
 
-        /* extract response code */
-        header->response_code = (uint16_t)((line[RESPONSE_INDEX] - '0') * 100 +
-                                          (line[RESPONSE_INDEX + 1] - '0') * 10 +
-                                          (line[RESPONSE_INDEX + 2] - '0'));
+        len = client->line_len;
+        if (len && client->line[len - 1] == '\r')
+        {
+            len--;
+        }
+        client->line[len] = '\0';
+        client->line_len = 0;
 
-        /*if (header->response_code == HTTP_NOT_FOUND)
+        /* before the parsers below, they may change the line */
+        if (len && client->field_sink)
         {
-            return HTTP_RETURN_NOT_FOUND;
+            client->field_sink(client->connectionID, client->line_cut ? NULL : client->line, client->field_sink_arg);
+        }
+        client->line_cut = 0;
+
+        if (client->state == HTTP_START_READING_HEADER)
+        {
+            if (len == 0)
+            {
+                /* end of the trailer of an earlier chunked body */
+                continue;
+            }
+            if (parse_status_line(header, client->line, len) < 0)
+            {
+                return HTTP_RETURN_ERROR;
+            }
+            header_validators_clear(header);
+            dbg("Server response : %d \n", header->response_code);
+            /* HTTP/1.0 servers close unless they say otherwise */
+            client->server_close = (client->line[7] == '0');
+            client->coding = 0;
+            client->state = HTTP_READING_HEADER;
+        }
+        else if (len == 0)
+        {
+            if (header->response_code / 100u == 1u)
+            {
+                /* interim response, the real one follows */
+                client->state = HTTP_START_READING_HEADER;
+                continue;
+            }
+            if (header->response_code == HTTP_NOT_MODIFIED || header->response_code == HTTP_NO_CONTENT)
+            {
+                /* never a body, whatever Content-Length says */
+                header->transfer_coding = HTTP_TRANSFER_FULL;
+                header->content_length_or_chunk = 0u;
+            }
+            if (body_decoder_start(client, header) < 0)
+            {
+                return HTTP_RETURN_ERROR;
+            }
+            start_reading_body(client, header);
+            dbg("End of header\n");
+            return HTTP_RETURN_OK;
         }
-        else if (header->response_code >= HTTP_INTERNAL_SERVER_ERR)
+        else if (parse_header_field(client, header, client->line) < 0)
         {
-            // invalid response type
-            header->response_code = 0;
             return HTTP_RETURN_ERROR;
-        }*/
+        }
     }
 
-    dbg("Server response : %d \n", header->response_code);
-
-    if (parse_rest_of_header(client, header, line, &index) == HTTP_RETURN_BUSY)
-        return HTTP_RETURN_BUSY;
-    start_reading_body(client, header);
-    dbg("End of header\n");
-    return HTTP_RETURN_OK;
-
+    return HTTP_RETURN_BUSY;
 }
 
 /* an async read of the chunk part, since in theory a chunk can be split in 2 packets */
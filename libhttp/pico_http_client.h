@@ -27,6 +27,80 @@
 #define HTTP_CONN_CLOSE         0u
 #define HTTP_CONN_KEEP_ALIVE    1u
 
+/*
+ * Cache-Control (and Pragma) directives of a response
+ */
+#define HTTP_CACHE_CONTROL_MAX_AGE  1u      /* max_age is set */
+#define HTTP_CACHE_CONTROL_NO_STORE 2u
+#define HTTP_CACHE_CONTROL_NO_CACHE 4u      /* stored, but checked with the server each time */
+
+/*
+ * Keep-alive connection pool: a closed client whose connection is still
+ * usable is parked here, and a client opened later for the same host and
+ * port takes it over instead of connecting again.
+ */
+#ifndef HTTP_CLIENT_POOL_SIZE
+#define HTTP_CLIENT_POOL_SIZE       4u      /* idle connections, all hosts together */
+#endif
+#ifndef HTTP_CLIENT_POOL_PER_HOST
+#define HTTP_CLIENT_POOL_PER_HOST   2u
+#endif
+#ifndef HTTP_CLIENT_POOL_IDLE_MS
+#define HTTP_CLIENT_POOL_IDLE_MS    30000u  /* idle connections are closed after this */
+#endif
+
+/*
+ * Content decoding: clients that ask for gzip or deflate responses, see
+ * pico_http_client_set_decoding. Each one decoding a body holds a
+ * decoder of pico_http_inflate_size() bytes, mostly its window, see
+ * HTTP_INFLATE_WINDOW_BITS in pico_http_inflate.h.
+ */
+#ifndef HTTP_CLIENT_INFLATE_MAX
+#define HTTP_CLIENT_INFLATE_MAX     1u
+#endif
+
+/*
+ * Permanent redirects (301, 308) remembered for the clients that follow
+ * redirects, see pico_http_client_set_redirects.
+ */
+#ifndef HTTP_CLIENT_REDIRECT_CACHE
+#define HTTP_CLIENT_REDIRECT_CACHE  4u
+#endif
+
+/*
+ * Long polling: a lost connection is set up again after a backoff that
+ * starts at HTTP_CLIENT_LONG_POLL_RETRY_MS and doubles up to
+ * HTTP_CLIENT_LONG_POLL_RETRY_MAX_MS, plus up to half of it at random.
+ * The first reconnect after a response goes at once.
+ */
+#ifndef HTTP_CLIENT_LONG_POLL_RETRY_MS
+#define HTTP_CLIENT_LONG_POLL_RETRY_MS      500u
+#endif
+#ifndef HTTP_CLIENT_LONG_POLL_RETRY_MAX_MS
+#define HTTP_CLIENT_LONG_POLL_RETRY_MAX_MS  30000u
+#endif
+
+/*
+ * Deadlines, see pico_http_client_set_timeouts: one timer turns a wheel
+ * of HTTP_CLIENT_WHEEL_SLOTS lists every HTTP_CLIENT_WHEEL_TICK_MS, it
+ * only runs while some client has a deadline. Deadlines are checked with
+ * the precision of a tick.
+ */
+#ifndef HTTP_CLIENT_WHEEL_TICK_MS
+#define HTTP_CLIENT_WHEEL_TICK_MS   100u
+#endif
+#ifndef HTTP_CLIENT_WHEEL_SLOTS
+#define HTTP_CLIENT_WHEEL_SLOTS     32u
+#endif
+
+/*
+ * Streamed uploads: the body of pico_http_client_send_post_stream is
+ * held one chunk at a time, in a buffer of about this size per client.
+ */
+#ifndef HTTP_CLIENT_UPLOAD_CHUNK
+#define HTTP_CLIENT_UPLOAD_CHUNK    1024u
+#endif
+
 /*
  * Data types
  */
@@ -37,10 +111,25 @@ struct pico_http_header
     char *location;                          /* if redirect is reported */
     uint32_t content_length_or_chunk;        /* size of the message */
     uint8_t transfer_coding;                 /* chunked or full */
+    char *etag;                              /* validator of the resource, NULL if none */
+    uint32_t range_first;                    /* offset of a partial (206) body */
+    uint32_t range_total;                    /* size of the resource of a partial body, 0 if unknown */
+    char *last_modified;                     /* other validator, NULL if none */
+    uint32_t max_age;                        /* seconds the response stays fresh, see cache_control */
+    uint8_t cache_control;                   /* HTTP_CACHE_CONTROL_* */
 };
 
 struct pico_http_client;
 
+/* milliseconds, 0 for no deadline */
+struct pico_http_timeouts
+{
+    uint32_t connect;       /* until connected (dns, handshake) */
+    uint32_t first_byte;    /* from the request being written to the first byte of the response */
+    uint32_t idle;          /* without any byte received while a response is expected */
+    uint32_t total;         /* from the request being sent until its response has been read */
+};
+
 struct multipart_chunk
 {
     unsigned char *data;
@@ -53,19 +142,36 @@ struct multipart_chunk
     uint16_t length_content_disposition;
     char *content_type;
     uint16_t length_content_type;
+    /* instead of data: gives the next bytes of the part, see multipart_chunk_create_stream */
+    int32_t (*read)(uint8_t *buf, uint32_t size, void *arg);
+    void *read_arg;
 };
 
 struct multipart_chunk *multipart_chunk_create(unsigned char *data, uint64_t length_data, char *name, char *filename, char *content_disposition, char *content_type);
+struct multipart_chunk *multipart_chunk_create_stream(uint32_t length_data, int32_t (*read)(uint8_t *buf, uint32_t size, void *arg), void *arg,
+                                                      char *name, char *filename, char *content_disposition, char *content_type);
 int8_t multipart_chunk_destroy(struct multipart_chunk *chunk);
 int8_t pico_http_client_get_write_progress(uint16_t conn, uint32_t *total_bytes_written, uint32_t *total_bytes_to_write);
 int32_t pico_http_client_open_with_usr_pwd_encoding(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn), int (*encoding)(char *out_buffer, char *in_buffer));
 int32_t pico_http_client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn));
 int8_t pico_http_client_send_raw(uint16_t conn, char *resource);
+int32_t pico_http_client_write_body(uint16_t conn, const uint8_t *data, uint32_t len);
 int8_t pico_http_client_send_get(uint16_t conn, char *resource, uint8_t connection_type);
 int8_t pico_http_client_long_poll_send_get(uint16_t conn, char *resource, uint8_t connection_type);
 int8_t pico_http_client_long_poll_cancel(uint16_t conn);
 int8_t pico_http_client_send_post(uint16_t conn, char *resource, uint8_t *post_data, uint32_t post_data_len, uint8_t connection_type, char *content_type, char *cache_control);
+int8_t pico_http_client_send_post_stream(uint16_t conn, char *resource, uint8_t connection_type, char *content_type,
+                                         int32_t (*producer)(uint16_t conn, uint8_t *buf, uint32_t size, void *arg), void *arg);
 int8_t pico_http_client_send_delete(uint16_t conn, char *resource, uint8_t connection_type);
+int8_t pico_http_client_set_pipeline(uint16_t conn, uint8_t depth);
+int8_t pico_http_client_set_headers(uint16_t conn, const char *headers);
+int8_t pico_http_client_set_redirects(uint16_t conn, uint8_t max_hops);
+int8_t pico_http_client_set_timeouts(uint16_t conn, const struct pico_http_timeouts *timeouts);
+void pico_http_client_redirect_cache_flush(void);
+int8_t pico_http_client_set_decoding(uint16_t conn, uint8_t enable);
+int8_t pico_http_client_set_body_sink(uint16_t conn, void (*sink)(uint16_t conn, const uint8_t *data, uint32_t len, void *arg), void *arg);
+int8_t pico_http_client_set_field_sink(uint16_t conn, void (*sink)(uint16_t conn, const char *line, void *arg), void *arg);
+int32_t pico_http_client_format_get(const struct pico_http_uri *uri_data, uint8_t connection_type, const char *headers, char *buf, uint32_t size);
 int8_t pico_http_client_send_post_multipart(uint16_t conn, char *resource, struct multipart_chunk **post_data, uint16_t post_data_len, uint8_t connection_type);
 
 struct pico_http_header *pico_http_client_read_header(uint16_t conn);
@@ -75,5 +181,6 @@ int32_t pico_http_client_read_body(uint16_t conn, unsigned char *data, uint16_t
 int8_t pico_http_client_close(uint16_t conn);
 
 int8_t pico_http_set_close_ev(uint16_t conn);
+void pico_http_client_pool_flush(void);
 
 #endif /* PICO_HTTP_CLIENT_H_ */
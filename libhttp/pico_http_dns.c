@@ -0,0 +1,227 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+#include <string.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_dns_client.h"
+#include "pico_http_dns.h"
+
+/* Cache entry states */
+#define HTTP_DNS_FREE       0
+#define HTTP_DNS_PENDING    1   /* query sent, the waiters get the answer */
+#define HTTP_DNS_VALID      2   /* answer (or failure) known until expires */
+
+#define HTTP_DNS_IP_MAX     16u
+
+struct http_dns_entry
+{
+    char name[HTTP_DNS_NAME_MAX];
+    char ip[HTTP_DNS_IP_MAX];   /* empty if the name did not resolve */
+    pico_time expires;
+    uint8_t state;
+};
+
+struct http_dns_waiter
+{
+    struct http_dns_entry *entry;
+    void (*callback)(char *ip, void *arg);
+    void *arg;
+};
+
+static struct http_dns_entry dns_cache[HTTP_DNS_CACHE_SIZE];
+static struct http_dns_waiter dns_waiters[HTTP_DNS_WAITERS];
+static uint8_t dns_deliver_pending = 0;
+
+/*
+ * Hands the known answers to their waiters. A callback may start or
+ * cancel lookups, so every waiter is taken off the list before it is
+ * called and the search starts over afterwards.
+ */
+static void dns_deliver(void)
+{
+    char ip[HTTP_DNS_IP_MAX];
+    struct http_dns_waiter w;
+    uint32_t i;
+
+    do
+    {
+        for (i = 0; i < HTTP_DNS_WAITERS; i++)
+        {
+            if (dns_waiters[i].callback && dns_waiters[i].entry->state == HTTP_DNS_VALID)
+                break;
+        }
+        if (i == HTTP_DNS_WAITERS)
+            return;
+
+        w = dns_waiters[i];
+        memset(&dns_waiters[i], 0, sizeof(dns_waiters[i]));
+        /* the entry can be reused for another name by the callback */
+        strcpy(ip, w.entry->ip);
+        w.callback(ip[0] ? ip : NULL, w.arg);
+    } while (1);
+}
+
+static void dns_deliver_timer(pico_time now, void *arg)
+{
+    (void)now;
+    (void)arg;
+    dns_deliver_pending = 0;
+    dns_deliver();
+}
+
+static void dns_answer(char *ip, void *arg)
+{
+    struct http_dns_entry *entry = (struct http_dns_entry *)arg;
+
+    if (entry->state != HTTP_DNS_PENDING)
+        return;
+
+    if (ip && strlen(ip) < HTTP_DNS_IP_MAX)
+    {
+        strcpy(entry->ip, ip);
+        entry->expires = PICO_TIME_MS() + HTTP_DNS_TTL_MS;
+    }
+    else
+    {
+        entry->ip[0] = '\0';
+        entry->expires = PICO_TIME_MS() + HTTP_DNS_NEGATIVE_TTL_MS;
+    }
+    entry->state = HTTP_DNS_VALID;
+    dns_deliver();
+}
+
+static int dns_has_waiters(struct http_dns_entry *entry)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_DNS_WAITERS; i++)
+    {
+        if (dns_waiters[i].callback && dns_waiters[i].entry == entry)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * The entry of the name, or else a slot for it: a free one or the one
+ * closest to expiring. Queries on their way and answers that still have
+ * to be delivered are not replaced.
+ */
+static struct http_dns_entry *dns_lookup(const char *host)
+{
+    struct http_dns_entry *slot = NULL;
+    uint32_t i;
+
+    for (i = 0; i < HTTP_DNS_CACHE_SIZE; i++)
+    {
+        struct http_dns_entry *entry = &dns_cache[i];
+
+        if (entry->state != HTTP_DNS_FREE && !strcmp(entry->name, host))
+            return entry;
+
+        if (entry->state == HTTP_DNS_PENDING || dns_has_waiters(entry))
+            continue;
+
+        if (!slot || (slot->state != HTTP_DNS_FREE && (entry->state == HTTP_DNS_FREE || entry->expires < slot->expires)))
+            slot = entry;
+    }
+    if (slot)
+        slot->state = HTTP_DNS_FREE;
+
+    return slot;
+}
+
+int8_t pico_http_dns_getaddr(const char *host, void (*callback)(char *ip, void *arg), void *arg)
+{
+    struct http_dns_entry *entry = NULL;
+    struct http_dns_waiter *waiter = NULL;
+    uint32_t i;
+
+    if (!host || !callback)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return -1;
+    }
+
+    if (strlen(host) >= HTTP_DNS_NAME_MAX)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < HTTP_DNS_WAITERS; i++)
+    {
+        if (!dns_waiters[i].callback)
+        {
+            waiter = &dns_waiters[i];
+            break;
+        }
+    }
+
+    if (waiter)
+        entry = dns_lookup(host);
+
+    /* nothing to keep the lookup in, a query of its own could not be cancelled */
+    if (!entry)
+    {
+        pico_err = PICO_ERR_EAGAIN;
+        return -1;
+    }
+
+    if (entry->state == HTTP_DNS_VALID && (int64_t)(entry->expires - PICO_TIME_MS()) <= 0)
+        entry->state = HTTP_DNS_FREE;
+
+    if (entry->state == HTTP_DNS_FREE)
+    {
+        strcpy(entry->name, host);
+        entry->ip[0] = '\0';
+        entry->state = HTTP_DNS_PENDING;
+        if (pico_dns_client_getaddr(host, dns_answer, entry) < 0)
+        {
+            entry->state = HTTP_DNS_FREE;
+            return -1;
+        }
+    }
+
+    /* a known answer (some resolvers answer from within getaddr) is delivered from a timer */
+    if (entry->state == HTTP_DNS_VALID && !dns_deliver_pending)
+    {
+        if (!pico_timer_add(0, dns_deliver_timer, NULL))
+            return -1;
+
+        dns_deliver_pending = 1;
+    }
+
+    waiter->entry = entry;
+    waiter->callback = callback;
+    waiter->arg = arg;
+    return 0;
+}
+
+void pico_http_dns_cancel(void *arg)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_DNS_WAITERS; i++)
+    {
+        if (dns_waiters[i].callback && dns_waiters[i].arg == arg)
+            memset(&dns_waiters[i], 0, sizeof(dns_waiters[i]));
+    }
+}
+
+/*
+ * Forgets all answers, queries on their way and answers that are about
+ * to be delivered are kept.
+ */
+void pico_http_dns_flush(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < HTTP_DNS_CACHE_SIZE; i++)
+    {
+        if (dns_cache[i].state == HTTP_DNS_VALID && !dns_has_waiters(&dns_cache[i]))
+            dns_cache[i].state = HTTP_DNS_FREE;
+    }
+}
@@ -0,0 +1,48 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP_DNS_H_
+#define PICO_HTTP_DNS_H_
+
+#include <stdint.h>
+
+#ifndef HTTP_DNS_CACHE_SIZE
+#define HTTP_DNS_CACHE_SIZE         8u      /* names kept */
+#endif
+#ifndef HTTP_DNS_WAITERS
+#define HTTP_DNS_WAITERS            8u      /* lookups waiting for an answer, all names together */
+#endif
+#ifndef HTTP_DNS_TTL_MS
+#define HTTP_DNS_TTL_MS             300000u /* addresses are reused this long */
+#endif
+#ifndef HTTP_DNS_NEGATIVE_TTL_MS
+#define HTTP_DNS_NEGATIVE_TTL_MS    30000u  /* names that did not resolve are not asked again this long */
+#endif
+#ifndef HTTP_DNS_NAME_MAX
+#define HTTP_DNS_NAME_MAX           254u    /* longest name kept, with the terminating zero */
+#endif
+
+/*
+ * Caching front end for pico_dns_client_getaddr, shared by the HTTP and
+ * websocket clients.
+ *
+ * The callback gets the dotted address, or NULL if the name does not
+ * resolve, always from the stack and never from within
+ * pico_http_dns_getaddr. Lookups of a name that is being queried already
+ * wait for that query instead of sending their own.
+ * The resolver does not report the TTL of the records, so answers are
+ * kept for HTTP_DNS_TTL_MS and failures for HTTP_DNS_NEGATIVE_TTL_MS.
+ * pico_http_dns_getaddr fails with PICO_ERR_EINVAL for a name that does
+ * not fit and with PICO_ERR_EAGAIN while all waiters or cache entries are
+ * in use, retry it later.
+ *
+ * pico_http_dns_cancel drops the pending lookups made with arg, call it
+ * before freeing arg.
+ */
+int8_t pico_http_dns_getaddr(const char *host, void (*callback)(char *ip, void *arg), void *arg);
+void pico_http_dns_cancel(void *arg);
+void pico_http_dns_flush(void);
+
+#endif /* PICO_HTTP_DNS_H_ */
@@ -0,0 +1,604 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+#include <string.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_client.h"
+#include "pico_http_util.h"
+#include "pico_http_download.h"
+
+/* Segment states */
+#define SEG_IDLE        0   /* not in use, or given up for a full fetch */
+#define SEG_CONNECTING  1   /* client opened, the request goes out with EV_HTTP_CON */
+#define SEG_HEADER      2   /* waiting for the response header */
+#define SEG_BODY        3   /* body of a 200 or 206 coming in */
+#define SEG_CLOSING     4   /* client is closed from the timer, then next_state */
+#define SEG_RETRY       5   /* waiting to reconnect */
+#define SEG_DONE        6
+
+struct http_download_segment
+{
+    int32_t conn;           /* client, -1 if none */
+    uint32_t start;         /* first byte of the part */
+    uint32_t offset;        /* next byte to fetch */
+    uint32_t end;           /* one past the last byte, 0 for up to the end */
+    uint8_t state;
+    uint8_t next_state;
+    uint8_t tries;          /* reconnects since the last progress */
+    char headers[HTTP_DOWNLOAD_ETAG_MAX + 48u];    /* Range and If-Range lines */
+};
+
+struct pico_http_download
+{
+    struct pico_http_download *next;
+    char *uri;
+    char etag[HTTP_DOWNLOAD_ETAG_MAX];  /* strong validator, empty if none */
+    uint32_t total;         /* size of the resource, 0 while unknown */
+    uint8_t segments;       /* parallel connections asked for */
+    uint8_t used;           /* segments in use */
+    uint8_t split;          /* no (more) splitting */
+    uint8_t finished;
+    int8_t result;
+    void (*data)(struct pico_http_download *dl, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg);
+    void (*done)(struct pico_http_download *dl, int8_t result, void *arg);
+    void *arg;
+    struct http_download_segment seg[HTTP_DOWNLOAD_SEGMENTS];
+};
+
+static struct pico_http_download *downloads = NULL;
+static uint8_t download_kick_pending = 0;
+static uint8_t download_retry_pending = 0;
+
+static void download_wakeup(uint16_t ev, uint16_t conn);
+static void download_sink(uint16_t conn, const uint8_t *data, uint32_t len, void *arg);
+
+static struct http_download_segment *segment_find(uint16_t conn, struct pico_http_download **dl)
+{
+    struct pico_http_download *d;
+    uint32_t i;
+
+    for (d = downloads; d; d = d->next)
+    {
+        for (i = 0; i < d->used; i++)
+        {
+            if (d->seg[i].conn == (int32_t)conn && d->seg[i].state >= SEG_CONNECTING && d->seg[i].state <= SEG_BODY)
+            {
+                *dl = d;
+                return &d->seg[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+static void download_kick(pico_time now, void *arg);
+static void download_retry(pico_time now, void *arg);
+
+static void download_schedule_kick(void)
+{
+    if (!download_kick_pending && pico_timer_add(0, download_kick, NULL))
+    {
+        download_kick_pending = 1;
+    }
+}
+
+static void download_finish(struct pico_http_download *dl, int8_t result)
+{
+    if (!dl->finished)
+    {
+        dl->finished = 1;
+        dl->result = result;
+    }
+    download_schedule_kick();
+}
+
+/* the client of the segment is closed from the timer, not from within its wakeup */
+static void segment_close(struct http_download_segment *seg, uint8_t next_state)
+{
+    seg->state = SEG_CLOSING;
+    seg->next_state = next_state;
+    download_schedule_kick();
+}
+
+static void segment_fail(struct pico_http_download *dl, struct http_download_segment *seg)
+{
+    if (++seg->tries > HTTP_DOWNLOAD_RETRIES)
+    {
+        download_finish(dl, -1);
+        return;
+    }
+    segment_close(seg, SEG_RETRY);
+}
+
+static char *put_number(char *p, uint32_t value)
+{
+    if (!value)
+    {
+        *p++ = '0';
+        return p;
+    }
+    return p + pico_itoa(value, p);
+}
+
+static void segment_headers(struct pico_http_download *dl, struct http_download_segment *seg)
+{
+    char *p = seg->headers;
+
+    /* a first request that may be split asks for a range to learn the size */
+    if (seg->offset || seg->end || (dl->segments > 1 && !dl->split))
+    {
+        memcpy(p, "Range: bytes=", 13u);
+        p = put_number(p + 13, seg->offset);
+        *p++ = '-';
+        if (seg->end)
+        {
+            p = put_number(p, seg->end - 1u);
+        }
+        memcpy(p, "\r\n", 2u);
+        p += 2;
+        if (dl->etag[0])
+        {
+            memcpy(p, "If-Range: ", 10u);
+            strcpy(p + 10, dl->etag);
+            p += 10 + strlen(dl->etag);
+            memcpy(p, "\r\n", 2u);
+            p += 2;
+        }
+    }
+    *p = '\0';
+}
+
+static int8_t segment_open(struct pico_http_download *dl, struct http_download_segment *seg)
+{
+    int32_t conn;
+
+    if (seg->offset > seg->start && !dl->etag[0])
+    {
+        /* nothing to check the rest against, start over */
+        seg->offset = seg->start;
+    }
+    segment_headers(dl, seg);
+    conn = pico_http_client_open(dl->uri, download_wakeup);
+    if (conn < 0)
+    {
+        segment_fail(dl, seg);
+        return HTTP_RETURN_ERROR;
+    }
+    seg->conn = conn;
+    seg->state = SEG_CONNECTING;
+    pico_http_client_set_headers((uint16_t)conn, seg->headers);
+    pico_http_client_set_body_sink((uint16_t)conn, download_sink, NULL);
+    return HTTP_RETURN_OK;
+}
+
+static void etag_store(struct pico_http_download *dl, const char *etag)
+{
+    /* If-Range takes strong validators only */
+    if (etag && strncmp(etag, "W/", 2u) && strlen(etag) < HTTP_DOWNLOAD_ETAG_MAX)
+    {
+        strcpy(dl->etag, etag);
+    }
+    else
+    {
+        dl->etag[0] = '\0';
+    }
+}
+
+/* spreads what is left after the first segment over the other ones */
+static void download_split(struct pico_http_download *dl, struct http_download_segment *first)
+{
+    uint32_t left, part, next;
+    uint32_t n = dl->segments;
+    uint32_t i;
+
+    dl->split = 1;
+    if (!dl->total || !dl->etag[0] || first->end || first->offset >= dl->total)
+    {
+        return;
+    }
+
+    left = dl->total - first->offset;
+    if (left / n < HTTP_DOWNLOAD_MIN_SEGMENT)
+    {
+        n = left / HTTP_DOWNLOAD_MIN_SEGMENT;
+    }
+    if (n < 2u)
+    {
+        return;
+    }
+
+    part = left / n;
+    first->end = first->offset + part;
+    next = first->end;
+    dl->used = (uint8_t)n;
+    for (i = 1; i < n; i++)
+    {
+        struct http_download_segment *seg = &dl->seg[i];
+
+        seg->start = next;
+        seg->offset = next;
+        seg->end = (i == n - 1u) ? dl->total : next + part;
+        next = seg->end;
+        segment_open(dl, seg);
+    }
+}
+
+/* a 200: the whole resource comes in on this segment, the other ones are dropped */
+static void download_restart(struct pico_http_download *dl, struct http_download_segment *full, struct pico_http_header *header)
+{
+    uint32_t i;
+
+    for (i = 0; i < dl->used; i++)
+    {
+        struct http_download_segment *seg = &dl->seg[i];
+
+        if (seg == full)
+        {
+            continue;
+        }
+        if (seg->conn >= 0)
+        {
+            segment_close(seg, SEG_IDLE);
+        }
+        else
+        {
+            seg->state = SEG_IDLE;
+        }
+        seg->start = 0;
+        seg->offset = 0;
+        seg->end = 0;
+    }
+    full->start = 0;
+    full->offset = 0;
+    full->end = 0;
+    dl->split = 1;
+    etag_store(dl, header->etag);
+    dl->total = (header->transfer_coding == HTTP_TRANSFER_FULL) ? header->content_length_or_chunk : 0;
+}
+
+static void segment_response(struct pico_http_download *dl, struct http_download_segment *seg, uint16_t conn)
+{
+    struct pico_http_header *header = pico_http_client_read_header(conn);
+
+    if (!header)
+    {
+        segment_fail(dl, seg);
+        return;
+    }
+
+    if (header->response_code == HTTP_PARTIAL_CONTENT)
+    {
+        if (header->range_first != seg->offset)
+        {
+            segment_fail(dl, seg);
+            return;
+        }
+        if (header->range_total)
+        {
+            dl->total = header->range_total;
+        }
+        if (!dl->etag[0])
+        {
+            etag_store(dl, header->etag);
+        }
+        seg->state = SEG_BODY;
+        if (!dl->split && dl->segments > 1)
+        {
+            download_split(dl, seg);
+        }
+    }
+    else if (header->response_code == HTTP_OK)
+    {
+        download_restart(dl, seg, header);
+        seg->state = SEG_BODY;
+    }
+    else if (header->response_code == HTTP_REQ_RANGE_NOK && !seg->end &&
+             header->range_total && seg->offset >= header->range_total)
+    {
+        /* there was nothing left to fetch */
+        dl->total = header->range_total;
+        segment_close(seg, SEG_DONE);
+    }
+    else if (header->response_code >= HTTP_INTERNAL_SERVER_ERR)
+    {
+        segment_fail(dl, seg);
+    }
+    else
+    {
+        download_finish(dl, -1);
+    }
+}
+
+static void segment_body_done(struct pico_http_download *dl, struct http_download_segment *seg)
+{
+    uint32_t end = seg->end ? seg->end : dl->total;
+
+    if (end && seg->offset < end)
+    {
+        /* the server sent less than it announced */
+        segment_fail(dl, seg);
+        return;
+    }
+    if (!dl->total)
+    {
+        dl->total = seg->offset;
+    }
+    segment_close(seg, SEG_DONE);
+}
+
+static void download_wakeup(uint16_t ev, uint16_t conn)
+{
+    struct pico_http_download *dl = NULL;
+    struct http_download_segment *seg = segment_find(conn, &dl);
+
+    if (!seg)
+    {
+        return;
+    }
+
+    if ((ev & EV_HTTP_CON) && seg->state == SEG_CONNECTING)
+    {
+        if (pico_http_client_send_get(conn, NULL, HTTP_CONN_CLOSE) < 0)
+        {
+            segment_fail(dl, seg);
+            return;
+        }
+        seg->state = SEG_HEADER;
+    }
+    if ((ev & EV_HTTP_REQ) && seg->state == SEG_HEADER)
+    {
+        segment_response(dl, seg, conn);
+    }
+    if ((ev & EV_HTTP_DONE) && seg->state == SEG_BODY)
+    {
+        segment_body_done(dl, seg);
+    }
+    if ((ev & (EV_HTTP_ERROR | EV_HTTP_CLOSE)) && seg->state >= SEG_CONNECTING && seg->state <= SEG_BODY)
+    {
+        segment_fail(dl, seg);
+    }
+}
+
+static void download_sink(uint16_t conn, const uint8_t *data, uint32_t len, void *arg)
+{
+    struct pico_http_download *dl = NULL;
+    struct http_download_segment *seg = segment_find(conn, &dl);
+    uint32_t offset;
+
+    (void)arg;
+    if (!seg || seg->state != SEG_BODY)
+    {
+        return;
+    }
+
+    if (seg->end && len > seg->end - seg->offset)
+    {
+        /* the first segment asked for everything before it was split */
+        len = seg->end - seg->offset;
+    }
+    offset = seg->offset;
+    seg->offset += len;
+    seg->tries = 0;
+    if (seg->end && seg->offset == seg->end)
+    {
+        segment_close(seg, SEG_DONE);
+    }
+    /* the download may be aborted from the callback, nothing is touched after it */
+    if (len)
+    {
+        dl->data(dl, offset, data, len, dl->arg);
+    }
+}
+
+static void download_free(struct pico_http_download *dl)
+{
+    uint32_t i;
+
+    for (i = 0; i < dl->used; i++)
+    {
+        if (dl->seg[i].conn >= 0)
+        {
+            pico_http_client_close((uint16_t)dl->seg[i].conn);
+        }
+    }
+    PICO_FREE(dl->uri);
+    PICO_FREE(dl);
+}
+
+/*
+ * Closes the clients of the segments that are done or failed, and
+ * finishes the downloads that have nothing left to do. The done
+ * callbacks may start or abort downloads, so the list is searched
+ * again after each one.
+ */
+static void download_kick(pico_time now, void *arg)
+{
+    struct pico_http_download *dl, **prev;
+    struct http_download_segment *seg;
+    uint8_t active, retry = 0;
+    uint32_t i;
+
+    (void)now;
+    (void)arg;
+    download_kick_pending = 0;
+    do
+    {
+        for (prev = &downloads; (dl = *prev) != NULL; prev = &dl->next)
+        {
+            active = 0;
+            for (i = 0; i < dl->used; i++)
+            {
+                seg = &dl->seg[i];
+                if (seg->state == SEG_CLOSING)
+                {
+                    if (seg->conn >= 0)
+                    {
+                        pico_http_client_close((uint16_t)seg->conn);
+                    }
+                    seg->conn = -1;
+                    seg->state = seg->next_state;
+                }
+                if (seg->state == SEG_RETRY)
+                {
+                    retry = 1;
+                }
+                if (seg->state != SEG_IDLE && seg->state != SEG_DONE)
+                {
+                    active = 1;
+                }
+            }
+            if (!active && !dl->finished)
+            {
+                dl->finished = 1;
+                dl->result = 0;
+            }
+            if (dl->finished)
+            {
+                break;
+            }
+        }
+        if (dl)
+        {
+            *prev = dl->next;
+            dl->done(dl, dl->result, dl->arg);
+            download_free(dl);
+        }
+    } while (dl);
+
+    if (retry && !download_retry_pending && pico_timer_add(HTTP_DOWNLOAD_RETRY_MS, download_retry, NULL))
+    {
+        download_retry_pending = 1;
+    }
+}
+
+static void download_retry(pico_time now, void *arg)
+{
+    struct pico_http_download *dl;
+    uint32_t i;
+
+    (void)now;
+    (void)arg;
+    download_retry_pending = 0;
+    for (dl = downloads; dl; dl = dl->next)
+    {
+        for (i = 0; i < dl->used; i++)
+        {
+            if (dl->seg[i].state == SEG_RETRY)
+            {
+                segment_open(dl, &dl->seg[i]);
+            }
+        }
+    }
+}
+
+/*
+ * API to download a resource, see pico_http_download.h.
+ *
+ * offset and etag continue an earlier download, pass 0 and NULL for a
+ * new one. Returns NULL if the uri can not be opened.
+ */
+struct pico_http_download *pico_http_download_start(const char *uri, uint32_t offset, const char *etag, uint8_t segments,
+                                                    void (*data)(struct pico_http_download *dl, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg),
+                                                    void (*done)(struct pico_http_download *dl, int8_t result, void *arg),
+                                                    void *arg)
+{
+    struct pico_http_download *dl;
+    uint32_t i;
+
+    if (!uri || !data || !done || !segments)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    dl = PICO_ZALLOC(sizeof(struct pico_http_download));
+    if (!dl)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+    dl->uri = PICO_ZALLOC(strlen(uri) + 1u);
+    if (!dl->uri)
+    {
+        PICO_FREE(dl);
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+    strcpy(dl->uri, uri);
+    dl->segments = (segments > HTTP_DOWNLOAD_SEGMENTS) ? (uint8_t)HTTP_DOWNLOAD_SEGMENTS : segments;
+    dl->data = data;
+    dl->done = done;
+    dl->arg = arg;
+    for (i = 0; i < HTTP_DOWNLOAD_SEGMENTS; i++)
+    {
+        dl->seg[i].conn = -1;
+    }
+    etag_store(dl, etag);
+    dl->used = 1;
+    dl->seg[0].offset = offset;
+
+    if (segment_open(dl, &dl->seg[0]) < 0)
+    {
+        PICO_FREE(dl->uri);
+        PICO_FREE(dl);
+        return NULL;
+    }
+    dl->next = downloads;
+    downloads = dl;
+    return dl;
+}
+
+/*
+ * Bytes received in one piece from the start of the resource, what an
+ * interrupted download can continue from. total gets the size of the
+ * resource, 0 while it is unknown.
+ */
+uint32_t pico_http_download_progress(struct pico_http_download *dl, uint32_t *total)
+{
+    uint32_t progress = 0;
+    uint32_t i;
+    uint8_t found;
+
+    do
+    {
+        found = 0;
+        for (i = 0; i < dl->used; i++)
+        {
+            if (dl->seg[i].start == progress && dl->seg[i].offset > progress)
+            {
+                progress = dl->seg[i].offset;
+                found = 1;
+            }
+        }
+    } while (found);
+
+    if (total)
+    {
+        *total = dl->total;
+    }
+    return progress;
+}
+
+/* validator the progress belongs to, NULL if the download can not be resumed */
+const char *pico_http_download_etag(struct pico_http_download *dl)
+{
+    return dl->etag[0] ? dl->etag : NULL;
+}
+
+/* stops the download, the done callback is not called */
+void pico_http_download_abort(struct pico_http_download *dl)
+{
+    struct pico_http_download **prev;
+
+    for (prev = &downloads; *prev; prev = &(*prev)->next)
+    {
+        if (*prev == dl)
+        {
+            *prev = dl->next;
+            download_free(dl);
+            return;
+        }
+    }
+}
@@ -0,0 +1,56 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP_DOWNLOAD_H_
+#define PICO_HTTP_DOWNLOAD_H_
+
+#include <stdint.h>
+
+#ifndef HTTP_DOWNLOAD_SEGMENTS
+#define HTTP_DOWNLOAD_SEGMENTS      4u      /* connections one download may use in parallel */
+#endif
+#ifndef HTTP_DOWNLOAD_RETRIES
+#define HTTP_DOWNLOAD_RETRIES       5u      /* reconnects in a row without progress before giving up */
+#endif
+#ifndef HTTP_DOWNLOAD_RETRY_MS
+#define HTTP_DOWNLOAD_RETRY_MS      2000u   /* wait before a reconnect */
+#endif
+#ifndef HTTP_DOWNLOAD_MIN_SEGMENT
+#define HTTP_DOWNLOAD_MIN_SEGMENT   16384u  /* no parallel fetch of smaller parts */
+#endif
+#define HTTP_DOWNLOAD_ETAG_MAX      64u
+
+/*
+ * Resumable download of one resource over the HTTP client.
+ *
+ * The body goes to the data callback with its offset in the resource.
+ * When the connection drops the download reconnects and asks for the
+ * rest with "Range: bytes=N-" and "If-Range: <ETag>". A server that
+ * answers with 200 instead (the resource changed, or ranges are not
+ * supported) sends the whole body again, it comes in from offset 0.
+ * Without a strong ETag nothing can be resumed, the download starts over.
+ *
+ * A download that was interrupted earlier (e.g. by a reset) continues
+ * from offset with the etag that pico_http_download_progress and
+ * pico_http_download_etag reported then. With segments > 1 the rest of
+ * the resource is split over that many connections once its size is
+ * known; the progress then only covers the bytes received in one piece
+ * from the start.
+ *
+ * The done callback gets 0 on success, -1 if the download failed; the
+ * download is freed after it returns. pico_http_download_abort stops a
+ * download without calling it.
+ */
+struct pico_http_download;
+
+struct pico_http_download *pico_http_download_start(const char *uri, uint32_t offset, const char *etag, uint8_t segments,
+                                                    void (*data)(struct pico_http_download *dl, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg),
+                                                    void (*done)(struct pico_http_download *dl, int8_t result, void *arg),
+                                                    void *arg);
+uint32_t pico_http_download_progress(struct pico_http_download *dl, uint32_t *total);
+const char *pico_http_download_etag(struct pico_http_download *dl);
+void pico_http_download_abort(struct pico_http_download *dl);
+
+#endif /* PICO_HTTP_DOWNLOAD_H_ */
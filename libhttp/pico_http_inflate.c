@@ -0,0 +1,687 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+#include <string.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_inflate.h"
+
+/* Decoder states */
+#define INFLATE_GZIP_HEADER     0
+#define INFLATE_GZIP_EXTRA_LEN  1
+#define INFLATE_GZIP_EXTRA      2
+#define INFLATE_GZIP_NAME       3
+#define INFLATE_GZIP_COMMENT    4
+#define INFLATE_GZIP_HCRC       5
+#define INFLATE_ZLIB_HEADER     6
+#define INFLATE_BLOCK           7   /* header of the next block */
+#define INFLATE_STORED          8
+#define INFLATE_CODES           9
+#define INFLATE_TRAILER         10
+#define INFLATE_DONE            11
+#define INFLATE_ERROR           12
+
+/* gzip header flags */
+#define GZIP_FHCRC      0x02u
+#define GZIP_FEXTRA     0x04u
+#define GZIP_FNAME      0x08u
+#define GZIP_FCOMMENT   0x10u
+#define GZIP_RESERVED   0xE0u
+
+#define INFLATE_RAW             3u  /* deflate without zlib wrapper */
+#define INFLATE_WINDOW          (1u << HTTP_INFLATE_WINDOW_BITS)
+#define INFLATE_MAX_MATCH       258u
+#define INFLATE_MAX_BITS        15u
+
+/* Results of a decoding step */
+#define STEP_OK         0
+#define STEP_WAIT       1   /* needs input or room in the window */
+#define STEP_ERROR      (-1)
+
+struct inflate_huffman
+{
+    uint16_t count[INFLATE_MAX_BITS + 1u];  /* codes per length */
+    uint16_t symbol[288];                   /* symbols ordered by code */
+};
+
+struct pico_http_inflate
+{
+    uint8_t format;
+    uint8_t state;
+    uint8_t final;          /* the current block is the last one */
+    uint8_t gzip_flags;     /* optional gzip header fields still to skip */
+    uint8_t short_input;    /* the step ran out of input, it is undone */
+    uint8_t bitcnt;
+    uint32_t bitbuf;
+    uint16_t in_pos;
+    uint16_t in_len;
+    uint32_t left;          /* bytes of a stored block or gzip extra field */
+    uint32_t check;         /* crc32 (gzip) or adler32 (zlib) of the output */
+    uint32_t total_out;
+    uint32_t history;       /* output bytes a distance may refer to */
+    uint32_t wpos;          /* next byte of the window */
+    uint32_t pending;       /* decoded bytes not handed out, they end at wpos */
+    struct inflate_huffman lencode;
+    struct inflate_huffman distcode;
+    uint8_t lengths[286 + 30];
+    uint8_t in[HTTP_INFLATE_IN_SIZE];
+    uint8_t window[INFLATE_WINDOW];
+};
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/* order of the code length code lengths */
+static const uint8_t clen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+/* crc32 four bits at a time */
+static const uint32_t crc_nibble[16] = {
+    0x00000000u, 0x1db71064u, 0x3b6e20c8u, 0x26d930acu, 0x76dc4190u, 0x6b6b51f4u, 0x4db26158u, 0x5005713cu,
+    0xedb88320u, 0xf00f9344u, 0xd6d6a3e8u, 0xcb61b38cu, 0x9b64c2b0u, 0x86d3d2d4u, 0xa00ae278u, 0xbdbdf21cu
+};
+
+/*
+ * Takes need bits (at most 16) from the input. When the input runs out,
+ * short_input is set and the step is undone by inflate_run, nothing
+ * taken by that step counts.
+ */
+static uint32_t bits(struct pico_http_inflate *inf, uint8_t need)
+{
+    uint32_t val;
+
+    while (inf->bitcnt < need)
+    {
+        if (inf->in_pos == inf->in_len)
+        {
+            inf->short_input = 1;
+            return 0;
+        }
+        inf->bitbuf |= (uint32_t)inf->in[inf->in_pos++] << inf->bitcnt;
+        inf->bitcnt = (uint8_t)(inf->bitcnt + 8u);
+    }
+    val = inf->bitbuf & ((1u << need) - 1u);
+    inf->bitbuf >>= need;
+    inf->bitcnt = (uint8_t)(inf->bitcnt - need);
+    return val;
+}
+
+static void put(struct pico_http_inflate *inf, uint8_t c)
+{
+    inf->window[inf->wpos] = c;
+    inf->wpos = (inf->wpos + 1u) & (INFLATE_WINDOW - 1u);
+    inf->pending++;
+    inf->total_out++;
+    if (inf->history < INFLATE_WINDOW)
+        inf->history++;
+
+    if (inf->format == HTTP_INFLATE_GZIP)
+    {
+        inf->check ^= c;
+        inf->check = (inf->check >> 4) ^ crc_nibble[inf->check & 0x0Fu];
+        inf->check = (inf->check >> 4) ^ crc_nibble[inf->check & 0x0Fu];
+    }
+    else if (inf->format == HTTP_INFLATE_DEFLATE)
+    {
+        uint32_t a = ((inf->check & 0xFFFFu) + c) % 65521u;
+        uint32_t b = ((inf->check >> 16) + a) % 65521u;
+        inf->check = (b << 16) | a;
+    }
+}
+
+/* canonical Huffman code from the code lengths, < 0 if over-subscribed, > 0 if incomplete */
+static int32_t construct(struct inflate_huffman *h, const uint8_t *length, uint16_t n)
+{
+    uint16_t offs[INFLATE_MAX_BITS + 1u];
+    int32_t left = 1;
+    uint16_t sym;
+    uint8_t len;
+
+    memset(h->count, 0, sizeof(h->count));
+    for (sym = 0; sym < n; sym++)
+        h->count[length[sym]]++;
+
+    if (h->count[0] == n)
+        return 0;
+
+    for (len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0)
+            return left;
+    }
+
+    offs[1] = 0;
+    for (len = 1; len < INFLATE_MAX_BITS; len++)
+        offs[len + 1] = (uint16_t)(offs[len] + h->count[len]);
+
+    for (sym = 0; sym < n; sym++)
+    {
+        if (length[sym])
+            h->symbol[offs[length[sym]]++] = sym;
+    }
+    return left;
+}
+
+/* next symbol, -1 if the input ran out, -2 for a code that is not in the table */
+static int32_t decode(struct pico_http_inflate *inf, const struct inflate_huffman *h)
+{
+    int32_t code = 0, first = 0, index = 0, count;
+    uint8_t len;
+
+    for (len = 1; len <= INFLATE_MAX_BITS; len++)
+    {
+        code |= (int32_t)bits(inf, 1);
+        if (inf->short_input)
+            return -1;
+
+        count = h->count[len];
+        if (code - count < first)
+            return h->symbol[index + (code - first)];
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -2;
+}
+
+static void fixed_codes(struct pico_http_inflate *inf)
+{
+    uint16_t sym;
+
+    for (sym = 0; sym < 288; sym++)
+        inf->lengths[sym] = (uint8_t)((sym < 144) ? 8 : (sym < 256) ? 9 : (sym < 280) ? 7 : 8);
+    construct(&inf->lencode, inf->lengths, 288);
+
+    for (sym = 0; sym < 30; sym++)
+        inf->lengths[sym] = 5;
+    construct(&inf->distcode, inf->lengths, 30);
+}
+
+/* only a code with a single symbol may be incomplete */
+static int code_ok(int32_t err, const struct inflate_huffman *h, uint16_t n)
+{
+    return err == 0 || (err > 0 && n - h->count[0] == 1);
+}
+
+static int8_t dynamic_codes(struct pico_http_inflate *inf)
+{
+    uint16_t nlen, ndist, ncode, idx;
+    int32_t sym;
+    uint8_t len;
+
+    nlen = (uint16_t)(bits(inf, 5) + 257u);
+    ndist = (uint16_t)(bits(inf, 5) + 1u);
+    ncode = (uint16_t)(bits(inf, 4) + 4u);
+    if (inf->short_input)
+        return STEP_OK;
+
+    if (nlen > 286 || ndist > 30)
+        return STEP_ERROR;
+
+    memset(inf->lengths, 0, 19);
+    for (idx = 0; idx < ncode; idx++)
+        inf->lengths[clen_order[idx]] = (uint8_t)bits(inf, 3);
+    if (inf->short_input)
+        return STEP_OK;
+
+    if (construct(&inf->lencode, inf->lengths, 19) != 0)
+        return STEP_ERROR;
+
+    idx = 0;
+    while (idx < nlen + ndist)
+    {
+        sym = decode(inf, &inf->lencode);
+        if (inf->short_input)
+            return STEP_OK;
+        if (sym < 0)
+            return STEP_ERROR;
+
+        if (sym < 16)
+        {
+            inf->lengths[idx++] = (uint8_t)sym;
+            continue;
+        }
+
+        len = 0;
+        if (sym == 16)
+        {
+            if (!idx)
+                return STEP_ERROR;
+            len = inf->lengths[idx - 1];
+            sym = 3 + (int32_t)bits(inf, 2);
+        }
+        else if (sym == 17)
+        {
+            sym = 3 + (int32_t)bits(inf, 3);
+        }
+        else
+        {
+            sym = 11 + (int32_t)bits(inf, 7);
+        }
+        if (inf->short_input)
+            return STEP_OK;
+        if (idx + sym > nlen + ndist)
+            return STEP_ERROR;
+
+        while (sym--)
+            inf->lengths[idx++] = len;
+    }
+
+    /* a block without end-of-block code cannot end */
+    if (!inf->lengths[256])
+        return STEP_ERROR;
+
+    if (!code_ok(construct(&inf->lencode, inf->lengths, nlen), &inf->lencode, nlen))
+        return STEP_ERROR;
+
+    if (!code_ok(construct(&inf->distcode, inf->lengths + nlen, ndist), &inf->distcode, ndist))
+        return STEP_ERROR;
+
+    return STEP_OK;
+}
+
+static void gzip_next_field(struct pico_http_inflate *inf)
+{
+    if (inf->gzip_flags & GZIP_FEXTRA)
+    {
+        inf->gzip_flags &= (uint8_t)~GZIP_FEXTRA;
+        inf->state = INFLATE_GZIP_EXTRA_LEN;
+    }
+    else if (inf->gzip_flags & GZIP_FNAME)
+    {
+        inf->gzip_flags &= (uint8_t)~GZIP_FNAME;
+        inf->state = INFLATE_GZIP_NAME;
+    }
+    else if (inf->gzip_flags & GZIP_FCOMMENT)
+    {
+        inf->gzip_flags &= (uint8_t)~GZIP_FCOMMENT;
+        inf->state = INFLATE_GZIP_COMMENT;
+    }
+    else if (inf->gzip_flags & GZIP_FHCRC)
+    {
+        inf->gzip_flags &= (uint8_t)~GZIP_FHCRC;
+        inf->state = INFLATE_GZIP_HCRC;
+    }
+    else
+    {
+        inf->state = INFLATE_BLOCK;
+    }
+}
+
+static void block_end(struct pico_http_inflate *inf)
+{
+    if (!inf->final)
+    {
+        inf->state = INFLATE_BLOCK;
+        return;
+    }
+    /* the trailer starts on a byte boundary */
+    bits(inf, (uint8_t)(inf->bitcnt & 7u));
+    inf->state = INFLATE_TRAILER;
+}
+
+static int8_t step_header(struct pico_http_inflate *inf)
+{
+    uint32_t b0, b1, method, flags;
+
+    switch (inf->state)
+    {
+    case INFLATE_GZIP_HEADER:
+        b0 = bits(inf, 8);
+        b1 = bits(inf, 8);
+        method = bits(inf, 8);
+        flags = bits(inf, 8);
+        bits(inf, 16);              /* mtime */
+        bits(inf, 16);
+        bits(inf, 16);              /* extra flags, os */
+        if (inf->short_input)
+            return STEP_OK;
+        if (b0 != 0x1Fu || b1 != 0x8Bu || method != 8u || (flags & GZIP_RESERVED))
+            return STEP_ERROR;
+
+        inf->gzip_flags = (uint8_t)flags;
+        gzip_next_field(inf);
+        break;
+
+    case INFLATE_GZIP_EXTRA_LEN:
+        inf->left = bits(inf, 16);
+        if (inf->short_input)
+            return STEP_OK;
+        inf->state = INFLATE_GZIP_EXTRA;
+        break;
+
+    case INFLATE_GZIP_EXTRA:
+        if (!inf->left)
+        {
+            gzip_next_field(inf);
+            break;
+        }
+        bits(inf, 8);
+        if (inf->short_input)
+            return STEP_OK;
+        inf->left--;
+        break;
+
+    case INFLATE_GZIP_NAME:
+    case INFLATE_GZIP_COMMENT:
+        b0 = bits(inf, 8);
+        if (inf->short_input)
+            return STEP_OK;
+        if (!b0)
+            gzip_next_field(inf);
+        break;
+
+    case INFLATE_GZIP_HCRC:
+        bits(inf, 16);
+        if (inf->short_input)
+            return STEP_OK;
+        gzip_next_field(inf);
+        break;
+
+    case INFLATE_ZLIB_HEADER:
+        b0 = bits(inf, 8);
+        b1 = bits(inf, 8);
+        if (inf->short_input)
+            return STEP_OK;
+        if ((b0 & 0x0Fu) == 8u && ((b0 << 8) | b1) % 31u == 0)
+        {
+            /* no preset dictionaries, no windows bigger than ours */
+            if ((b1 & 0x20u) || (b0 >> 4) + 8u > HTTP_INFLATE_WINDOW_BITS)
+                return STEP_ERROR;
+        }
+        else
+        {
+            /* raw deflate, the bytes were the start of the first block */
+            inf->in_pos = (uint16_t)(inf->in_pos - 2u);
+            inf->format = INFLATE_RAW;
+        }
+        inf->state = INFLATE_BLOCK;
+        break;
+    }
+    return STEP_OK;
+}
+
+static int8_t step(struct pico_http_inflate *inf)
+{
+    uint32_t len, dist, type;
+    int32_t sym;
+
+    switch (inf->state)
+    {
+    case INFLATE_BLOCK:
+        inf->final = (uint8_t)bits(inf, 1);
+        type = bits(inf, 2);
+        if (inf->short_input)
+            return STEP_OK;
+
+        if (type == 0)
+        {
+            bits(inf, (uint8_t)(inf->bitcnt & 7u));
+            len = bits(inf, 16);
+            dist = bits(inf, 16);
+            if (inf->short_input)
+                return STEP_OK;
+            if (len != (~dist & 0xFFFFu))
+                return STEP_ERROR;
+            inf->left = len;
+            inf->state = INFLATE_STORED;
+        }
+        else if (type == 1)
+        {
+            fixed_codes(inf);
+            inf->state = INFLATE_CODES;
+        }
+        else if (type == 2)
+        {
+            if (dynamic_codes(inf) < 0)
+                return STEP_ERROR;
+            if (inf->short_input)
+                return STEP_OK;
+            inf->state = INFLATE_CODES;
+        }
+        else
+        {
+            return STEP_ERROR;
+        }
+        break;
+
+    case INFLATE_STORED:
+        /* every byte counts by itself, nothing is undone here */
+        while (inf->left && inf->pending < INFLATE_WINDOW && (inf->bitcnt || inf->in_pos < inf->in_len))
+        {
+            put(inf, (uint8_t)bits(inf, 8));
+            inf->left--;
+        }
+        if (inf->left)
+            return STEP_WAIT;
+        block_end(inf);
+        break;
+
+    case INFLATE_CODES:
+        if (INFLATE_WINDOW - inf->pending < INFLATE_MAX_MATCH)
+            return STEP_WAIT;
+
+        sym = decode(inf, &inf->lencode);
+        if (inf->short_input)
+            return STEP_OK;
+        if (sym < 0)
+            return STEP_ERROR;
+
+        if (sym < 256)
+        {
+            put(inf, (uint8_t)sym);
+        }
+        else if (sym == 256)
+        {
+            block_end(inf);
+        }
+        else
+        {
+            sym -= 257;
+            if (sym >= 29)
+                return STEP_ERROR;
+            len = len_base[sym] + bits(inf, len_extra[sym]);
+            sym = decode(inf, &inf->distcode);
+            if (inf->short_input)
+                return STEP_OK;
+            if (sym < 0 || sym >= 30)
+                return STEP_ERROR;
+            dist = dist_base[sym] + bits(inf, dist_extra[sym]);
+            if (inf->short_input)
+                return STEP_OK;
+            if (dist > inf->history)
+                return STEP_ERROR;
+
+            while (len--)
+                put(inf, inf->window[(inf->wpos - dist) & (INFLATE_WINDOW - 1u)]);
+        }
+        break;
+
+    case INFLATE_TRAILER:
+        if (inf->format == HTTP_INFLATE_GZIP)
+        {
+            len = bits(inf, 16);
+            len |= bits(inf, 16) << 16;
+            dist = bits(inf, 16);
+            dist |= bits(inf, 16) << 16;
+            if (inf->short_input)
+                return STEP_OK;
+            if (len != (inf->check ^ 0xFFFFFFFFu) || dist != inf->total_out)
+                return STEP_ERROR;
+        }
+        else if (inf->format == HTTP_INFLATE_DEFLATE)
+        {
+            /* adler32, big endian */
+            len = bits(inf, 8) << 24;
+            len |= bits(inf, 8) << 16;
+            len |= bits(inf, 8) << 8;
+            len |= bits(inf, 8);
+            if (inf->short_input)
+                return STEP_OK;
+            if (len != inf->check)
+                return STEP_ERROR;
+        }
+        inf->state = INFLATE_DONE;
+        break;
+
+    default:
+        return step_header(inf);
+    }
+    return STEP_OK;
+}
+
+/* decodes until the input runs out or the window is full of undelivered output */
+static void inflate_run(struct pico_http_inflate *inf)
+{
+    uint16_t in_pos;
+    uint32_t bitbuf;
+    uint8_t bitcnt;
+    int8_t ret;
+
+    while (inf->state != INFLATE_DONE && inf->state != INFLATE_ERROR)
+    {
+        in_pos = inf->in_pos;
+        bitbuf = inf->bitbuf;
+        bitcnt = inf->bitcnt;
+        inf->short_input = 0;
+
+        ret = step(inf);
+        if (ret == STEP_ERROR)
+        {
+            inf->state = INFLATE_ERROR;
+            return;
+        }
+        if (inf->short_input)
+        {
+            inf->in_pos = in_pos;
+            inf->bitbuf = bitbuf;
+            inf->bitcnt = bitcnt;
+            return;
+        }
+        if (ret == STEP_WAIT)
+            return;
+    }
+}
+
+struct pico_http_inflate *pico_http_inflate_create(uint8_t format)
+{
+    struct pico_http_inflate *inf;
+
+    if (format != HTTP_INFLATE_GZIP && format != HTTP_INFLATE_DEFLATE)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    inf = PICO_ZALLOC(sizeof(struct pico_http_inflate));
+    if (!inf)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+    inf->format = format;
+    if (format == HTTP_INFLATE_GZIP)
+    {
+        inf->state = INFLATE_GZIP_HEADER;
+        inf->check = 0xFFFFFFFFu;
+    }
+    else
+    {
+        inf->state = INFLATE_ZLIB_HEADER;
+        inf->check = 1u;
+    }
+    return inf;
+}
+
+void pico_http_inflate_destroy(struct pico_http_inflate *inf)
+{
+    PICO_FREE(inf);
+}
+
+uint32_t pico_http_inflate_size(void)
+{
+    return (uint32_t)sizeof(struct pico_http_inflate);
+}
+
+/* room for compressed bytes, what is after the end of the stream is dropped */
+uint8_t *pico_http_inflate_space(struct pico_http_inflate *inf, uint32_t *len)
+{
+    if (inf->state == INFLATE_DONE)
+    {
+        inf->in_pos = 0;
+        inf->in_len = 0;
+    }
+    else if (inf->in_pos)
+    {
+        memmove(inf->in, &inf->in[inf->in_pos], (size_t)(inf->in_len - inf->in_pos));
+        inf->in_len = (uint16_t)(inf->in_len - inf->in_pos);
+        inf->in_pos = 0;
+    }
+    *len = HTTP_INFLATE_IN_SIZE - inf->in_len;
+    return &inf->in[inf->in_len];
+}
+
+void pico_http_inflate_commit(struct pico_http_inflate *inf, uint32_t len)
+{
+    inf->in_len = (uint16_t)(inf->in_len + len);
+}
+
+uint32_t pico_http_inflate_input(struct pico_http_inflate *inf, const uint8_t *data, uint32_t len)
+{
+    uint32_t space;
+    uint8_t *buf = pico_http_inflate_space(inf, &space);
+
+    if (len > space)
+        len = space;
+    if (!len)
+        return 0;
+
+    memcpy(buf, data, len);
+    pico_http_inflate_commit(inf, len);
+    return len;
+}
+
+int32_t pico_http_inflate_output(struct pico_http_inflate *inf, const uint8_t **data, uint32_t max)
+{
+    uint32_t start, len;
+
+    if (!inf->pending)
+        inflate_run(inf);
+
+    if (!inf->pending)
+        return (inf->state == INFLATE_ERROR) ? -1 : 0;
+
+    start = (inf->wpos - inf->pending) & (INFLATE_WINDOW - 1u);
+    len = inf->pending;
+    if (start + len > INFLATE_WINDOW)
+        len = INFLATE_WINDOW - start;
+    if (len > max)
+        len = max;
+
+    *data = &inf->window[start];
+    inf->pending -= len;
+    return (int32_t)len;
+}
+
+int pico_http_inflate_done(struct pico_http_inflate *inf)
+{
+    return inf->state == INFLATE_DONE && !inf->pending;
+}
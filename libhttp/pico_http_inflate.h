@@ -0,0 +1,46 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP_INFLATE_H_
+#define PICO_HTTP_INFLATE_H_
+
+#include <stdint.h>
+
+#ifndef HTTP_INFLATE_WINDOW_BITS
+#define HTTP_INFLATE_WINDOW_BITS    15u     /* 32K, streams referring further back are rejected */
+#endif
+#ifndef HTTP_INFLATE_IN_SIZE
+#define HTTP_INFLATE_IN_SIZE        512u    /* compressed bytes buffered, holds the largest block header */
+#endif
+
+/* Formats */
+#define HTTP_INFLATE_GZIP           1u
+#define HTTP_INFLATE_DEFLATE        2u      /* zlib stream, or raw deflate as some servers send it */
+
+/*
+ * Streaming decoder for gzip and deflate content codings.
+ *
+ * Compressed bytes go in with pico_http_inflate_input (or straight into
+ * the buffer of pico_http_inflate_space, followed by
+ * pico_http_inflate_commit), decoded bytes come out of
+ * pico_http_inflate_output. The output points into the window of the
+ * decoder and stays valid until the next call. Output returns 0 when it
+ * needs more input, -1 if the stream is corrupt or its checksum is wrong.
+ *
+ * A decoder takes pico_http_inflate_size() bytes, most of it the window
+ * of 2^HTTP_INFLATE_WINDOW_BITS bytes.
+ */
+struct pico_http_inflate;
+
+struct pico_http_inflate *pico_http_inflate_create(uint8_t format);
+void pico_http_inflate_destroy(struct pico_http_inflate *inf);
+uint32_t pico_http_inflate_size(void);
+uint32_t pico_http_inflate_input(struct pico_http_inflate *inf, const uint8_t *data, uint32_t len);
+uint8_t *pico_http_inflate_space(struct pico_http_inflate *inf, uint32_t *len);
+void pico_http_inflate_commit(struct pico_http_inflate *inf, uint32_t len);
+int32_t pico_http_inflate_output(struct pico_http_inflate *inf, const uint8_t **data, uint32_t max);
+int pico_http_inflate_done(struct pico_http_inflate *inf);
+
+#endif /* PICO_HTTP_INFLATE_H_ */
@@ -0,0 +1,468 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_multipart.h"
+
+/*
+ * Incremental multipart/form-data parser.
+ *
+ * The body is fed in arbitrary slices. Part bodies are searched for the
+ * delimiter "\r\n--<boundary>" with a Boyer-Moore-Horspool skip table and
+ * delivered straight from the fed buffer. Only the bytes that could still
+ * be the start of a delimiter are kept back, so the memory used depends on
+ * the boundary length and not on the size of the upload.
+ */
+
+#define HTTP_MULTIPART_DELIM_PREFIX     4u      /* "\r\n--" */
+#define HTTP_MULTIPART_DELIM_MAX        (HTTP_MULTIPART_DELIM_PREFIX + HTTP_MULTIPART_BOUNDARY_MAX)
+#define HTTP_MULTIPART_LINE_SIZE        128u    /* part header lines are truncated to this */
+
+/* parser states */
+#define HTTP_MP_LEARN_BOUNDARY      0u
+#define HTTP_MP_PREAMBLE            1u
+#define HTTP_MP_AFTER_DELIM         2u
+#define HTTP_MP_AFTER_DELIM_DASH    3u
+#define HTTP_MP_AFTER_DELIM_CR      4u
+#define HTTP_MP_HEADERS             5u
+#define HTTP_MP_DATA                6u
+#define HTTP_MP_DONE                7u
+#define HTTP_MP_ERROR               8u
+
+struct pico_http_multipart
+{
+    uint8_t state;
+    struct pico_http_multipart_cb cb;
+    void *arg;
+    uint8_t delim[HTTP_MULTIPART_DELIM_MAX];    /* "\r\n--<boundary>" */
+    uint8_t delim_len;
+    uint8_t skip[256];                          /* Horspool shift per byte value */
+    uint8_t lookbehind[HTTP_MULTIPART_DELIM_MAX];
+    uint8_t lookbehind_len;
+    char line[HTTP_MULTIPART_LINE_SIZE];
+    uint8_t line_len;
+};
+
+static void build_skip_table(struct pico_http_multipart *mp)
+{
+    uint32_t i;
+
+    memset(mp->skip, mp->delim_len, sizeof(mp->skip));
+    for (i = 0; i + 1u < mp->delim_len; i++)
+        mp->skip[mp->delim[i]] = (uint8_t)(mp->delim_len - 1u - i);
+}
+
+static int8_t set_boundary(struct pico_http_multipart *mp, const char *boundary, uint32_t len)
+{
+    if (!len || len > HTTP_MULTIPART_BOUNDARY_MAX)
+        return HTTP_RETURN_ERROR;
+
+    memcpy(mp->delim, "\r\n--", HTTP_MULTIPART_DELIM_PREFIX);
+    memcpy(mp->delim + HTTP_MULTIPART_DELIM_PREFIX, boundary, len);
+    mp->delim_len = (uint8_t)(HTTP_MULTIPART_DELIM_PREFIX + len);
+    build_skip_table(mp);
+    return HTTP_RETURN_OK;
+}
+
+/* case-insensitive compare of a parameter name, no locale needed */
+static int name_matches(const char *name, const char *param, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        char a = name[i], b = param[i];
+
+        if (a >= 'A' && a <= 'Z')
+            a = (char)(a - 'A' + 'a');
+
+        if (b >= 'A' && b <= 'Z')
+            b = (char)(b - 'A' + 'a');
+
+        if (a != b)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Extracts a parameter from a header value, e.g. the boundary out of
+ * "multipart/form-data; boundary=xyz" or the name out of a
+ * Content-Disposition. Quotes are stripped.
+ *
+ * Returns the length of the parameter value or -1 if it is not found
+ * or does not fit in out (out is always NUL terminated).
+ */
+int32_t pico_http_multipart_param(const char *value, const char *param, char *out, uint32_t out_len)
+{
+    uint32_t param_len;
+    uint32_t len = 0;
+    const char *p;
+
+    if (!value || !param || !out || !out_len)
+        return HTTP_RETURN_ERROR;
+
+    param_len = (uint32_t)strlen(param);
+    for (p = strchr(value, ';'); p; p = strchr(p + 1, ';'))
+    {
+        const char *name = p + 1;
+        char end = ';';
+
+        while (*name == ' ' || *name == '\t')
+            name++;
+
+        if (!name_matches(name, param, param_len) || name[param_len] != '=')
+            continue;
+
+        name += param_len + 1u;
+        if (*name == '"')
+        {
+            end = '"';
+            name++;
+        }
+
+        while (name[len] && name[len] != end && (end == '"' || (name[len] != ' ' && name[len] != '\t')))
+        {
+            if (len + 1u >= out_len)
+                return HTTP_RETURN_ERROR;
+
+            out[len] = name[len];
+            len++;
+        }
+        out[len] = '\0';
+        return (int32_t)len;
+    }
+    return HTTP_RETURN_ERROR;
+}
+
+/*
+ * Creates a parser for one request body.
+ *
+ * content_type is the Content-Type value of the request; the boundary is
+ * taken from it. If NULL is passed the boundary is learned from the
+ * first delimiter line of the body.
+ */
+struct pico_http_multipart *pico_http_multipart_create(const char *content_type, const struct pico_http_multipart_cb *cb, void *arg)
+{
+    struct pico_http_multipart *mp;
+    char boundary[HTTP_MULTIPART_BOUNDARY_MAX + 1u];
+    int32_t len;
+
+    if (!cb)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    mp = PICO_ZALLOC(sizeof(struct pico_http_multipart));
+    if (!mp)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+
+    mp->cb = *cb;
+    mp->arg = arg;
+
+    if (!content_type)
+    {
+        mp->state = HTTP_MP_LEARN_BOUNDARY;
+        return mp;
+    }
+
+    len = pico_http_multipart_param(content_type, "boundary", boundary, sizeof(boundary));
+    if (len <= 0 || set_boundary(mp, boundary, (uint32_t)len) < 0)
+    {
+        PICO_FREE(mp);
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    /* the first delimiter has no leading CRLF, pretend it was there */
+    memcpy(mp->lookbehind, "\r\n", 2u);
+    mp->lookbehind_len = 2u;
+    mp->state = HTTP_MP_PREAMBLE;
+    return mp;
+}
+
+void pico_http_multipart_destroy(struct pico_http_multipart *mp)
+{
+    if (mp)
+        PICO_FREE(mp);
+}
+
+/*
+ * Returns 1 once the closing delimiter has been seen, 0 if more data
+ * is expected, -1 if the parse failed.
+ */
+int8_t pico_http_multipart_done(struct pico_http_multipart *mp)
+{
+    if (!mp || mp->state == HTTP_MP_ERROR)
+        return HTTP_RETURN_ERROR;
+
+    return (int8_t)(mp->state == HTTP_MP_DONE);
+}
+
+static inline uint8_t stream_at(struct pico_http_multipart *mp, const uint8_t *data, uint32_t idx)
+{
+    return (idx < mp->lookbehind_len) ? mp->lookbehind[idx] : data[idx - mp->lookbehind_len];
+}
+
+static int8_t deliver(struct pico_http_multipart *mp, const uint8_t *data, uint32_t end, uint8_t deliver_data)
+{
+    uint32_t from_lookbehind = (end < mp->lookbehind_len) ? end : mp->lookbehind_len;
+
+    if (!deliver_data || !mp->cb.part_data)
+        return HTTP_RETURN_OK;
+
+    if (from_lookbehind && mp->cb.part_data(mp->arg, mp->lookbehind, from_lookbehind) < 0)
+        return HTTP_RETURN_ERROR;
+
+    if (end > from_lookbehind && mp->cb.part_data(mp->arg, data, end - from_lookbehind) < 0)
+        return HTTP_RETURN_ERROR;
+
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Searches the stream (lookbehind followed by data) for the delimiter.
+ * Everything before the delimiter is passed to part_data when
+ * deliver_data is set, or dropped otherwise (preamble).
+ *
+ * Returns the number of bytes of data consumed, *found is set when the
+ * delimiter was matched.
+ */
+static int32_t search_delimiter(struct pico_http_multipart *mp, const uint8_t *data, uint32_t len, uint8_t deliver_data, uint8_t *found)
+{
+    uint32_t total = mp->lookbehind_len + len;
+    uint32_t n = mp->delim_len;
+    uint32_t pos = 0;
+    uint32_t keep;
+
+    *found = 0;
+    while (pos + n <= total)
+    {
+        int32_t i = (int32_t)n - 1;
+
+        while (i >= 0 && stream_at(mp, data, pos + (uint32_t)i) == mp->delim[i])
+            i--;
+
+        if (i < 0)
+        {
+            uint32_t consumed = pos + n - mp->lookbehind_len;
+
+            if (deliver(mp, data, pos, deliver_data) < 0)
+                return HTTP_RETURN_ERROR;
+
+            mp->lookbehind_len = 0;
+            *found = 1;
+            return (int32_t)consumed;
+        }
+
+        pos += mp->skip[stream_at(mp, data, pos + n - 1u)];
+    }
+
+    /* no full match: keep the shortest tail that could still start one */
+    if (pos > total)
+        pos = total;
+
+    for (; pos < total; pos++)
+    {
+        uint32_t j = 0;
+
+        while (pos + j < total && stream_at(mp, data, pos + j) == mp->delim[j])
+            j++;
+
+        if (pos + j == total)
+            break;
+    }
+
+    if (deliver(mp, data, pos, deliver_data) < 0)
+        return HTTP_RETURN_ERROR;
+
+    keep = total - pos;
+    if (pos < mp->lookbehind_len)
+    {
+        memmove(mp->lookbehind, mp->lookbehind + pos, mp->lookbehind_len - pos);
+        memcpy(mp->lookbehind + mp->lookbehind_len - pos, data, len);
+    }
+    else
+    {
+        memcpy(mp->lookbehind, data + (pos - mp->lookbehind_len), keep);
+    }
+
+    mp->lookbehind_len = (uint8_t)keep;
+    return (int32_t)len;
+}
+
+/* splits "Name: value" and reports it, the line is NUL terminated in place */
+static int8_t header_line(struct pico_http_multipart *mp)
+{
+    char *value;
+
+    mp->line[mp->line_len] = '\0';
+    value = strchr(mp->line, ':');
+    if (!value)
+        return HTTP_RETURN_ERROR;
+
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t')
+        value++;
+
+    if (mp->cb.part_header)
+        return (mp->cb.part_header(mp->arg, mp->line, value) < 0) ? HTTP_RETURN_ERROR : HTTP_RETURN_OK;
+
+    return HTTP_RETURN_OK;
+}
+
+/* first line of the body is "--<boundary>\r\n" */
+static int8_t learn_boundary(struct pico_http_multipart *mp, uint8_t c)
+{
+    if (c != '\n')
+    {
+        if (mp->line_len >= HTTP_MULTIPART_BOUNDARY_MAX + 3u)
+            return HTTP_RETURN_ERROR;
+
+        mp->line[mp->line_len++] = (char)c;
+        return HTTP_RETURN_OK;
+    }
+
+    if (mp->line_len && mp->line[mp->line_len - 1u] == '\r')
+        mp->line_len--;
+
+    if (mp->line_len < 3u || mp->line[0] != '-' || mp->line[1] != '-')
+        return HTTP_RETURN_ERROR;
+
+    if (set_boundary(mp, mp->line + 2, (uint32_t)mp->line_len - 2u) < 0)
+        return HTTP_RETURN_ERROR;
+
+    mp->line_len = 0;
+    mp->state = HTTP_MP_HEADERS;
+    return HTTP_RETURN_OK;
+}
+
+static int8_t parse_byte(struct pico_http_multipart *mp, uint8_t c)
+{
+    switch (mp->state)
+    {
+    case HTTP_MP_LEARN_BOUNDARY:
+        return learn_boundary(mp, c);
+
+    case HTTP_MP_AFTER_DELIM:
+        if (c == '-')
+            mp->state = HTTP_MP_AFTER_DELIM_DASH;
+        else if (c == '\r')
+            mp->state = HTTP_MP_AFTER_DELIM_CR;
+        else if (c == '\n')
+            mp->state = HTTP_MP_HEADERS;
+        else if (c != ' ' && c != '\t') /* transport padding */
+            return HTTP_RETURN_ERROR;
+        return HTTP_RETURN_OK;
+
+    case HTTP_MP_AFTER_DELIM_DASH:
+        if (c != '-')
+            return HTTP_RETURN_ERROR;
+        mp->state = HTTP_MP_DONE;
+        return HTTP_RETURN_OK;
+
+    case HTTP_MP_AFTER_DELIM_CR:
+        if (c != '\n')
+            return HTTP_RETURN_ERROR;
+        mp->line_len = 0;
+        mp->state = HTTP_MP_HEADERS;
+        return HTTP_RETURN_OK;
+
+    case HTTP_MP_HEADERS:
+        if (c == '\r')
+            return HTTP_RETURN_OK;
+
+        if (c != '\n')
+        {
+            /* overlong lines are truncated, the value is usually all we need */
+            if (mp->line_len < HTTP_MULTIPART_LINE_SIZE - 1u)
+                mp->line[mp->line_len++] = (char)c;
+            return HTTP_RETURN_OK;
+        }
+
+        if (!mp->line_len)
+        {
+            /* empty line, the part body starts */
+            mp->state = HTTP_MP_DATA;
+            mp->lookbehind_len = 0;
+            return HTTP_RETURN_OK;
+        }
+
+        if (header_line(mp) < 0)
+            return HTTP_RETURN_ERROR;
+
+        mp->line_len = 0;
+        return HTTP_RETURN_OK;
+
+    case HTTP_MP_DONE:
+        return HTTP_RETURN_OK; /* epilogue is ignored */
+
+    default:
+        return HTTP_RETURN_ERROR;
+    }
+}
+
+/*
+ * Feeds the next slice of the request body to the parser.
+ *
+ * Returns the number of bytes consumed (always len) or -1 on a malformed
+ * body or when a callback aborted the parse.
+ */
+int32_t pico_http_multipart_feed(struct pico_http_multipart *mp, const uint8_t *data, uint32_t len)
+{
+    uint32_t idx = 0;
+
+    if (!mp || (!data && len))
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (mp->state == HTTP_MP_ERROR)
+        return HTTP_RETURN_ERROR;
+
+    while (idx < len)
+    {
+        if (mp->state == HTTP_MP_PREAMBLE || mp->state == HTTP_MP_DATA)
+        {
+            uint8_t found;
+            uint8_t in_data = (uint8_t)(mp->state == HTTP_MP_DATA);
+            int32_t consumed = search_delimiter(mp, data + idx, len - idx, in_data, &found);
+
+            if (consumed < 0)
+                break;
+
+            idx += (uint32_t)consumed;
+            if (found)
+            {
+                if (in_data && mp->cb.part_end && mp->cb.part_end(mp->arg) < 0)
+                    break;
+
+                mp->state = HTTP_MP_AFTER_DELIM;
+            }
+            continue;
+        }
+
+        if (parse_byte(mp, data[idx]) < 0)
+            break;
+
+        idx++;
+    }
+
+    if (idx < len)
+    {
+        mp->state = HTTP_MP_ERROR;
+        return HTTP_RETURN_ERROR;
+    }
+
+    return (int32_t)len;
+}
@@ -0,0 +1,38 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP_MULTIPART_H_
+#define PICO_HTTP_MULTIPART_H_
+
+#include <stdint.h>
+#include "pico_http_util.h"
+
+/* RFC 2046: a boundary has at most 70 characters */
+#define HTTP_MULTIPART_BOUNDARY_MAX     70u
+
+/*
+ * Callbacks of the incremental multipart/form-data parser.
+ * Any of them may be NULL. Returning a negative value aborts the parse.
+ *
+ * part_header: one call per header line of a part (e.g. Content-Disposition)
+ * part_data:   a slice of the part body, straight from the fed buffer
+ * part_end:    the part body is complete
+ */
+struct pico_http_multipart_cb
+{
+    int8_t (*part_header)(void *arg, const char *name, const char *value);
+    int8_t (*part_data)(void *arg, const uint8_t *data, uint32_t len);
+    int8_t (*part_end)(void *arg);
+};
+
+struct pico_http_multipart;
+
+struct pico_http_multipart *pico_http_multipart_create(const char *content_type, const struct pico_http_multipart_cb *cb, void *arg);
+int32_t pico_http_multipart_feed(struct pico_http_multipart *mp, const uint8_t *data, uint32_t len);
+int8_t pico_http_multipart_done(struct pico_http_multipart *mp);
+void pico_http_multipart_destroy(struct pico_http_multipart *mp);
+int32_t pico_http_multipart_param(const char *value, const char *param, char *out, uint32_t out_len);
+
+#endif /* PICO_HTTP_MULTIPART_H_ */
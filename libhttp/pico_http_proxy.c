@@ -0,0 +1,896 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+#include <stdarg.h>
+#include <stdio.h>
+#include "pico_stack.h"
+#include "pico_tree.h"
+#include "pico_http_server.h"
+#include "pico_http_client.h"
+#include "pico_http_proxy.h"
+
+/*
+ * Every proxied request is a session between a server connection
+ * (downstream) and a keep-alive client connection (upstream) taken from
+ * the pool of its route. Bodies go through the session buffer one piece
+ * at a time: the next piece is only read once the previous one was
+ * taken by the other side, so a slow peer stalls its sender instead of
+ * filling the memory.
+ */
+
+/* Upstream connection states */
+#define HTTP_PROXY_UP_FREE          0
+#define HTTP_PROXY_UP_CONNECTING    1
+#define HTTP_PROXY_UP_IDLE          2
+#define HTTP_PROXY_UP_BUSY          3
+#define HTTP_PROXY_UP_DEAD          4   /* closed by the reaper, outside the client callbacks */
+
+/* Session states */
+#define HTTP_PROXY_WAIT_UPSTREAM    0
+#define HTTP_PROXY_SEND_REQUEST     1
+#define HTTP_PROXY_UPLOAD           2
+#define HTTP_PROXY_WAIT_RESPONSE    3
+#define HTTP_PROXY_DOWNLOAD         4
+#define HTTP_PROXY_CLOSING          5   /* response cut short, the reaper closes the connection */
+
+#define HTTP_PROXY_REQUEST_FIXED    96u
+#define HTTP_PROXY_REASON_MAX       32u
+#define HTTP_PROXY_CONNECTION_MAX   128u    /* of the Connection field, for the names it lists */
+
+struct http_proxy_session;
+
+struct http_proxy_upstream
+{
+    uint16_t conn;
+    uint8_t state;
+    char *request;      /* request header, owned here until the client wrote it */
+    struct http_proxy_session *session;
+};
+
+struct http_proxy_route
+{
+    char prefix[HTTP_PROXY_PREFIX_MAX];
+    uint16_t prefix_len;
+    char *uri;
+    const char *path;   /* resource part of uri */
+    struct http_proxy_upstream pool[HTTP_PROXY_POOL_SIZE];
+};
+
+struct http_proxy_session
+{
+    uint16_t conn;
+    uint8_t state;
+    uint8_t reuse;          /* upstream may go back to the pool at the end */
+    uint8_t down_busy;      /* a chunk is on its way downstream */
+    uint8_t up_done;        /* upstream body complete */
+    struct http_proxy_route *route;
+    struct http_proxy_upstream *up;
+    uint32_t upload_left;
+    uint16_t buf_len;
+    uint16_t buf_off;
+    uint8_t buf[HTTP_PROXY_BUF_SIZE];
+    char reason[HTTP_PROXY_REASON_MAX];         /* of the upstream status line */
+    char fields[HTTP_PROXY_HEADER_SIZE + 1];    /* of the upstream answer, CRLF ended lines */
+    uint16_t fields_len;
+    uint8_t fields_cut;                         /* they did not fit */
+};
+
+static struct http_proxy_route proxy_routes[HTTP_PROXY_ROUTES];
+static uint8_t proxy_reap_pending = 0;
+
+static const char *http_proxy_methods[] = {
+    NULL, "GET", "POST", "HEAD", "OPTIONS"
+};
+
+/* fields that end at the proxy, the last two it sets itself */
+static const char *http_proxy_hop_fields[] = {
+    "connection", "keep-alive", "proxy-connection", "proxy-authenticate", "proxy-authorization",
+    "te", "trailer", "transfer-encoding", "upgrade", "host", "content-length"
+};
+
+static int32_t compare_sessions(void *ka, void *kb)
+{
+    return ((struct http_proxy_session *)ka)->conn - ((struct http_proxy_session *)kb)->conn;
+}
+
+PICO_TREE_DECLARE(pico_http_proxy_sessions, compare_sessions);
+
+static void proxy_server_wakeup(uint16_t ev, uint16_t conn);
+static void proxy_client_wakeup(uint16_t ev, uint16_t conn);
+static void session_start(struct http_proxy_session *s);
+
+static struct http_proxy_session *find_session(uint16_t conn)
+{
+    struct http_proxy_session dummy = {
+        .conn = conn
+    };
+
+    return pico_tree_findKey(&pico_http_proxy_sessions, &dummy);
+}
+
+static struct http_proxy_upstream *find_upstream(uint16_t conn)
+{
+    uint32_t i, j;
+
+    for (i = 0; i < HTTP_PROXY_ROUTES; i++)
+    {
+        for (j = 0; j < HTTP_PROXY_POOL_SIZE; j++)
+        {
+            struct http_proxy_upstream *up = &proxy_routes[i].pool[j];
+
+            if (up->state != HTTP_PROXY_UP_FREE && up->conn == conn)
+                return up;
+        }
+    }
+    return NULL;
+}
+
+/* matches on whole path segments, "/svc" takes "/svc/a" and "/svc?x" but not "/svcx" */
+static struct http_proxy_route *find_route(const char *resource)
+{
+    uint32_t i;
+
+    if (!resource)
+        return NULL;
+
+    for (i = 0; i < HTTP_PROXY_ROUTES; i++)
+    {
+        struct http_proxy_route *r = &proxy_routes[i];
+        char next;
+
+        if (!r->uri || strncmp(resource, r->prefix, r->prefix_len))
+            continue;
+
+        next = resource[r->prefix_len];
+        if (r->prefix[r->prefix_len - 1] == '/' || next == '\0' || next == '/' || next == '?')
+            return r;
+    }
+    return NULL;
+}
+
+static void proxy_reap(pico_time now, void *arg)
+{
+    uint32_t i, j;
+    struct pico_tree_node *index, *tmp;
+
+    (void)now;
+    (void)arg;
+    proxy_reap_pending = 0;
+    pico_tree_foreach_safe(index, &pico_http_proxy_sessions, tmp)
+    {
+        struct http_proxy_session *s = index->keyValue;
+
+        if (s->state != HTTP_PROXY_CLOSING)
+            continue;
+
+        pico_tree_delete(&pico_http_proxy_sessions, s);
+        pico_http_close(s->conn);
+        PICO_FREE(s);
+    }
+
+    for (i = 0; i < HTTP_PROXY_ROUTES; i++)
+    {
+        for (j = 0; j < HTTP_PROXY_POOL_SIZE; j++)
+        {
+            struct http_proxy_upstream *up = &proxy_routes[i].pool[j];
+
+            if (up->state != HTTP_PROXY_UP_DEAD)
+                continue;
+
+            pico_http_client_close(up->conn);
+            if (up->request)
+                PICO_FREE(up->request);
+
+            memset(up, 0, sizeof(*up));
+        }
+    }
+
+    /* the freed slots may serve sessions that were waiting */
+    pico_tree_foreach_safe(index, &pico_http_proxy_sessions, tmp)
+    {
+        struct http_proxy_session *s = index->keyValue;
+
+        if (s->state == HTTP_PROXY_WAIT_UPSTREAM)
+            session_start(s);
+    }
+}
+
+/*
+ * Connections are closed from a timer: the proxy is mostly running
+ * inside the callbacks of the server and the client, which still use
+ * the connection after calling us.
+ */
+static void schedule_reap(void)
+{
+    if (!proxy_reap_pending && pico_timer_add(0, proxy_reap, NULL))
+        proxy_reap_pending = 1;
+}
+
+/*
+ * Gives the upstream back to the pool, or drops it when it is not at a
+ * clean request boundary.
+ */
+static void release_upstream(struct http_proxy_upstream *up, uint8_t reuse)
+{
+    struct pico_tree_node *index;
+
+    up->session = NULL;
+    if (!reuse)
+    {
+        up->state = HTTP_PROXY_UP_DEAD;
+        schedule_reap();
+        return;
+    }
+
+    up->state = HTTP_PROXY_UP_IDLE;
+    pico_tree_foreach(index, &pico_http_proxy_sessions)
+    {
+        struct http_proxy_session *s = index->keyValue;
+
+        if (s->state == HTTP_PROXY_WAIT_UPSTREAM && s->route->pool <= up && up < s->route->pool + HTTP_PROXY_POOL_SIZE)
+        {
+            session_start(s);
+            break;
+        }
+    }
+}
+
+static void session_free(struct http_proxy_session *s, uint8_t reuse)
+{
+    if (s->up)
+        release_upstream(s->up, reuse);
+
+    pico_tree_delete(&pico_http_proxy_sessions, s);
+    PICO_FREE(s);
+}
+
+/*
+ * The upstream failed. Before the response started the client gets a
+ * 502, after that the only way to tell is closing the connection.
+ */
+static void session_fail(struct http_proxy_session *s)
+{
+    if (s->state == HTTP_PROXY_DOWNLOAD)
+    {
+        release_upstream(s->up, 0);
+        s->up = NULL;
+        s->state = HTTP_PROXY_CLOSING;
+        schedule_reap();
+        return;
+    }
+
+    pico_http_respond(s->conn, HTTP_RESOURCE_BAD_GATEWAY);
+    session_free(s, 0);
+}
+
+static uint8_t same_name(const char *a, const char *b, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((a[i] | 0x20) != (b[i] | 0x20))
+            return 0;
+    }
+    return 1;
+}
+
+/* copies the value of the Connection field of fields to conn, "" if there is none */
+static void connection_names(const char *fields, uint32_t len, char *conn)
+{
+    const char *line = fields;
+    const char *end = fields + len;
+
+    conn[0] = '\0';
+    while (line < end)
+    {
+        const char *eol = memchr(line, '\n', (size_t)(end - line));
+        uint32_t n;
+
+        if (!eol)
+            return;
+
+        if (eol - line > 11 && same_name(line, "connection:", 11u))
+        {
+            line += 11;
+            n = (uint32_t)(eol - line);
+            if (n >= HTTP_PROXY_CONNECTION_MAX)
+                n = HTTP_PROXY_CONNECTION_MAX - 1u;
+
+            memcpy(conn, line, n);
+            conn[n] = '\0';
+            return;
+        }
+        line = eol + 1;
+    }
+}
+
+static uint8_t hop_field(const char *name, uint32_t len, const char *conn)
+{
+    uint32_t i, n;
+
+    for (i = 0; i < sizeof(http_proxy_hop_fields) / sizeof(http_proxy_hop_fields[0]); i++)
+    {
+        if (strlen(http_proxy_hop_fields[i]) == len && same_name(name, http_proxy_hop_fields[i], len))
+            return 1;
+    }
+
+    /* the comma separated names in the Connection field */
+    while (*conn)
+    {
+        while (*conn == ' ' || *conn == '\t' || *conn == ',')
+            conn++;
+        for (n = 0; conn[n] && conn[n] != ',' && conn[n] != ' ' && conn[n] != '\t' && conn[n] != '\r'; n++)
+            ;
+        if (n == len && same_name(name, conn, len))
+            return 1;
+
+        conn += n;
+        if (*conn == '\r')
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Copies the end-to-end fields of the CRLF ended lines in to out, which
+ * may be in itself. Returns the length copied, out is terminated.
+ */
+static uint32_t copy_fields(char *out, const char *in, uint32_t len)
+{
+    char conn[HTTP_PROXY_CONNECTION_MAX];
+    uint32_t pos = 0, o = 0;
+
+    connection_names(in, len, conn);
+    while (pos < len)
+    {
+        const char *line = in + pos;
+        const char *eol = memchr(line, '\n', len - pos);
+        uint32_t n = eol ? (uint32_t)(eol + 1 - line) : len - pos;
+        const char *colon = memchr(line, ':', n);
+
+        if (colon && !hop_field(line, (uint32_t)(colon - line), conn))
+        {
+            memmove(out + o, line, n);
+            o += n;
+        }
+        pos += n;
+    }
+    out[o] = '\0';
+    return o;
+}
+
+/* formats at offset o of a request of size len, returns the new offset or len when it did not fit */
+static uint32_t request_append(char *request, uint32_t len, uint32_t o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (o >= len)
+        return len;
+
+    va_start(ap, fmt);
+    n = vsnprintf(request + o, len - o, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (uint32_t)n >= len - o)
+        return len;
+
+    return o + (uint32_t)n;
+}
+
+static char *build_request(struct http_proxy_session *s)
+{
+    const char *resource = pico_http_get_resource(s->conn) + s->route->prefix_len;
+    struct pico_http_uri *uri = pico_http_client_read_uri_data(s->up->conn);
+    uint16_t method = (uint16_t)pico_http_get_method(s->conn);
+    const char *fields = pico_http_get_fields(s->conn);
+    uint32_t path_len = (uint32_t)strlen(s->route->path);
+    const char *sep = "";
+    uint32_t len, o;
+    char *request;
+
+    if (!uri || !uri->host || !fields || method < HTTP_METHOD_GET || method > HTTP_METHOD_HEAD)
+        return NULL;
+
+    /* join the upstream path and the rest of the resource with a single '/' */
+    if (path_len && s->route->path[path_len - 1] == '/')
+    {
+        if (*resource == '/')
+            resource++;
+    }
+    else if (*resource != '/' && (!path_len || (*resource && *resource != '?')))
+    {
+        sep = "/";
+    }
+
+    len = HTTP_PROXY_REQUEST_FIXED + path_len + (uint32_t)strlen(resource) + (uint32_t)strlen(uri->host)
+          + (uint32_t)strlen(fields);
+    request = PICO_ZALLOC(len);
+    if (!request)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+
+    /* every piece goes in the room that is left, a request that does not fit is not sent */
+    o = request_append(request, len, 0, "%s %s%s%s HTTP/1.1\r\nHost: %s", http_proxy_methods[method], s->route->path, sep,
+                       resource, uri->host);
+    if (uri->port && uri->port != 80u)
+        o = request_append(request, len, o, ":%u", uri->port);
+
+    if (s->upload_left)
+        o = request_append(request, len, o, "\r\nContent-Length: %u", (unsigned int)s->upload_left);
+
+    o = request_append(request, len, o, "\r\n");
+    if (o < len && len - o > (uint32_t)strlen(fields))
+        o += copy_fields(request + o, fields, (uint32_t)strlen(fields));
+    else
+        o = len;
+
+    o = request_append(request, len, o, "Connection: Keep-Alive\r\n\r\n");
+    if (o >= len)
+    {
+        dbg("Proxy: request for %s too long\n", uri->host);
+        PICO_FREE(request);
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    return request;
+}
+
+static void send_request(struct http_proxy_session *s)
+{
+    struct http_proxy_upstream *up = s->up;
+
+    up->request = build_request(s);
+    if (!up->request)
+    {
+        session_fail(s);
+        return;
+    }
+
+    s->state = HTTP_PROXY_SEND_REQUEST;
+    if (pico_http_client_send_raw(up->conn, up->request) != HTTP_RETURN_OK)
+        session_fail(s);
+}
+
+/* client field sink, keeps the reason phrase and the fields of the upstream answer */
+static void upstream_field(uint16_t conn, const char *line, void *arg)
+{
+    struct http_proxy_session *s = ((struct http_proxy_upstream *)arg)->session;
+    const char *reason;
+    uint32_t len;
+
+    (void)conn;
+    if (!s)
+        return;
+
+    if (!line)
+    {
+        s->fields_cut = 1;
+        return;
+    }
+
+    /* a new status line, e.g. after 100 Continue, starts over */
+    if (!strncmp(line, "HTTP/", 5u))
+    {
+        reason = strchr(line, ' ');
+        reason = reason ? strchr(reason + 1, ' ') : NULL;
+        s->reason[0] = '\0';
+        if (reason)
+        {
+            strncpy(s->reason, reason + 1, HTTP_PROXY_REASON_MAX - 1u);
+            s->reason[HTTP_PROXY_REASON_MAX - 1u] = '\0';
+        }
+        s->fields_len = 0;
+        s->fields_cut = 0;
+        return;
+    }
+
+    len = (uint32_t)strlen(line);
+    if (s->fields_len + len + 2u > HTTP_PROXY_HEADER_SIZE)
+    {
+        s->fields_cut = 1;
+        return;
+    }
+    memcpy(s->fields + s->fields_len, line, len);
+    memcpy(s->fields + s->fields_len + len, "\r\n", 2u);
+    s->fields_len = (uint16_t)(s->fields_len + len + 2u);
+    s->fields[s->fields_len] = '\0';
+}
+
+/* attaches an upstream to the session, or leaves it waiting for one */
+static void session_start(struct http_proxy_session *s)
+{
+    struct http_proxy_upstream *spare = NULL;
+    int32_t conn;
+    uint32_t i;
+
+    for (i = 0; i < HTTP_PROXY_POOL_SIZE; i++)
+    {
+        struct http_proxy_upstream *up = &s->route->pool[i];
+
+        if (up->state == HTTP_PROXY_UP_IDLE)
+        {
+            up->state = HTTP_PROXY_UP_BUSY;
+            up->session = s;
+            s->up = up;
+            send_request(s);
+            return;
+        }
+
+        if (up->state == HTTP_PROXY_UP_FREE && !spare)
+            spare = up;
+    }
+
+    if (!spare)
+    {
+        s->state = HTTP_PROXY_WAIT_UPSTREAM;
+        return;
+    }
+
+    conn = pico_http_client_open(s->route->uri, proxy_client_wakeup);
+    if (conn < 0)
+    {
+        session_fail(s);
+        return;
+    }
+
+    pico_http_client_set_field_sink((uint16_t)conn, upstream_field, spare);
+    spare->conn = (uint16_t)conn;
+    spare->state = HTTP_PROXY_UP_CONNECTING;
+    spare->session = s;
+    s->up = spare;
+    s->state = HTTP_PROXY_SEND_REQUEST;
+}
+
+/* request body: downstream -> buffer -> upstream */
+static void pump_upload(struct http_proxy_session *s)
+{
+    while (s->state == HTTP_PROXY_UPLOAD)
+    {
+        int32_t len;
+
+        if (s->buf_off < s->buf_len)
+        {
+            len = pico_http_client_write_body(s->up->conn, s->buf + s->buf_off, (uint32_t)(s->buf_len - s->buf_off));
+            if (len < 0)
+            {
+                session_fail(s);
+                return;
+            }
+
+            s->buf_off = (uint16_t)(s->buf_off + len);
+            if (s->buf_off < s->buf_len)
+                return; /* EV_HTTP_WRITE_PROGRESS_MADE */
+        }
+
+        if (!s->upload_left)
+        {
+            s->state = HTTP_PROXY_WAIT_RESPONSE;
+            return;
+        }
+
+        len = pico_http_read_body(s->conn, s->buf, (s->upload_left < HTTP_PROXY_BUF_SIZE) ? s->upload_left : HTTP_PROXY_BUF_SIZE);
+        if (len < 0)
+        {
+            session_fail(s);
+            return;
+        }
+
+        if (len == 0)
+            return; /* EV_HTTP_BODY */
+
+        s->buf_len = (uint16_t)len;
+        s->buf_off = 0;
+        s->upload_left -= (uint32_t)len;
+    }
+}
+
+/* response body: upstream -> buffer -> downstream, one chunk in flight */
+static void pump_download(struct http_proxy_session *s)
+{
+    int32_t len;
+    uint8_t done = 0;
+
+    if (s->state != HTTP_PROXY_DOWNLOAD || s->down_busy)
+        return;
+
+    if (!s->up_done)
+    {
+        len = pico_http_client_read_body(s->up->conn, s->buf, HTTP_PROXY_BUF_SIZE, &done);
+        if (len < 0)
+        {
+            session_fail(s);
+            return;
+        }
+
+        s->up_done = done;
+        if (len > 0)
+        {
+            if (pico_http_submit_data(s->conn, s->buf, (uint16_t)len) != HTTP_RETURN_OK)
+            {
+                session_fail(s);
+                return;
+            }
+
+            s->down_busy = 1; /* EV_HTTP_SENT */
+            return;
+        }
+    }
+
+    if (s->up_done)
+    {
+        pico_http_submit_data(s->conn, NULL, 0);
+        session_free(s, s->reuse);
+    }
+}
+
+static void upstream_response(struct http_proxy_session *s)
+{
+    struct pico_http_header *header = pico_http_client_read_header(s->up->conn);
+    uint16_t code;
+
+    if (!header)
+    {
+        session_fail(s);
+        return;
+    }
+
+    /* an upstream that answers before taking the whole body is not reused */
+    if (s->state != HTTP_PROXY_WAIT_RESPONSE)
+        s->reuse = 0;
+
+    if (s->fields_cut)
+    {
+        dbg("Proxy: upstream header too large\n");
+        session_fail(s);
+        return;
+    }
+
+    code = header->response_code;
+    copy_fields(s->fields, s->fields, s->fields_len);
+    s->state = HTTP_PROXY_DOWNLOAD;
+    if (pico_http_respond_status(s->conn, code, s->reason, s->fields) < 0)
+    {
+        session_fail(s);
+        return;
+    }
+
+    /* these answers are complete, the upstream may still send a body for HEAD */
+    if (pico_http_get_method(s->conn) == HTTP_METHOD_HEAD || code == HTTP_NO_CONTENT || code == HTTP_NOT_MODIFIED)
+    {
+        session_free(s, 0);
+        return;
+    }
+
+    pump_download(s);
+}
+
+static void proxy_client_wakeup(uint16_t ev, uint16_t conn)
+{
+    struct http_proxy_upstream *up = find_upstream(conn);
+    struct http_proxy_session *s;
+
+    if (!up || up->state == HTTP_PROXY_UP_DEAD)
+        return;
+
+    s = up->session;
+    if (ev & (EV_HTTP_CLOSE | EV_HTTP_ERROR | EV_HTTP_WRITE_FAILED))
+    {
+        if (s)
+            session_fail(s);
+        else
+            release_upstream(up, 0);
+
+        return;
+    }
+
+    if (ev & EV_HTTP_CON)
+    {
+        up->state = HTTP_PROXY_UP_BUSY;
+        if (s)
+            send_request(s);
+        else
+            release_upstream(up, 1);
+
+        return;
+    }
+
+    if (!s)
+        return;
+
+    if (ev & EV_HTTP_WRITE_SUCCESS)
+    {
+        PICO_FREE(up->request);
+        up->request = NULL;
+        if (s->state == HTTP_PROXY_SEND_REQUEST)
+        {
+            s->state = HTTP_PROXY_UPLOAD;
+            pump_upload(s);
+            return;
+        }
+    }
+
+    if ((ev & EV_HTTP_WRITE_PROGRESS_MADE) && s->state == HTTP_PROXY_UPLOAD)
+    {
+        pump_upload(s);
+        return;
+    }
+
+    if (ev & EV_HTTP_REQ)
+    {
+        upstream_response(s);
+        return;
+    }
+
+    if (ev & EV_HTTP_BODY)
+        pump_download(s);
+}
+
+static void proxy_server_wakeup(uint16_t ev, uint16_t conn)
+{
+    struct http_proxy_session *s = find_session(conn);
+
+    if (ev & (EV_HTTP_CLOSE | EV_HTTP_ERROR))
+    {
+        /* the upstream is only reused when its answer was read completely */
+        if (s)
+            session_free(s, 0);
+
+        pico_http_close(conn);
+        return;
+    }
+
+    if (!s || s->state == HTTP_PROXY_CLOSING)
+        return;
+
+    if (ev & EV_HTTP_REQ)
+    {
+        if (!pico_http_get_fields(conn))
+        {
+            pico_http_respond_status(conn, HTTP_HEDER_FIELD_LARGE, "Request Header Fields Too Large", NULL);
+            pico_http_submit_data(conn, NULL, 0);
+            session_free(s, 0);
+            return;
+        }
+
+        s->upload_left = pico_http_get_content_length(conn);
+        session_start(s);
+        return;
+    }
+
+    if (ev & EV_HTTP_BODY)
+    {
+        pump_upload(s);
+        return;
+    }
+
+    if (ev & EV_HTTP_SENT)
+    {
+        s->down_busy = 0;
+        pump_download(s);
+    }
+}
+
+/* server request hook, takes over the requests of the routes */
+static void proxy_request_hook(uint16_t conn)
+{
+    struct http_proxy_route *route = find_route(pico_http_get_resource(conn));
+    struct http_proxy_session *s;
+
+    if (!route)
+        return;
+
+    s = PICO_ZALLOC(sizeof(struct http_proxy_session));
+    if (!s)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return; /* left to the application */
+    }
+
+    s->conn = conn;
+    s->route = route;
+    s->reuse = 1;
+    if (pico_tree_insert(&pico_http_proxy_sessions, s) || pico_http_set_wakeup(conn, proxy_server_wakeup) < 0)
+    {
+        pico_tree_delete(&pico_http_proxy_sessions, s);
+        PICO_FREE(s);
+    }
+}
+
+/*
+ * API to forward the requests for prefix to an upstream server,
+ * e.g. pico_http_proxy_add_route("/svc", "http://10.0.0.2:8080/api").
+ * Only http:// upstreams are supported. The server must be running on
+ * the same stack; the route takes effect for the next request.
+ */
+int16_t pico_http_proxy_add_route(const char *prefix, const char *upstream_uri)
+{
+    struct http_proxy_route *route = NULL;
+    const char *path;
+    uint32_t i;
+
+    if (!prefix || !upstream_uri || prefix[0] != '/' || strlen(prefix) >= HTTP_PROXY_PREFIX_MAX
+        || strncmp(upstream_uri, "http://", 7))
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    for (i = 0; i < HTTP_PROXY_ROUTES; i++)
+    {
+        if (!proxy_routes[i].uri)
+        {
+            route = &proxy_routes[i];
+            break;
+        }
+    }
+
+    if (!route)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    route->uri = PICO_ZALLOC(strlen(upstream_uri) + 1);
+    if (!route->uri)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    strcpy(route->uri, upstream_uri);
+    strcpy(route->prefix, prefix);
+    route->prefix_len = (uint16_t)strlen(prefix);
+
+    /* the path is whatever follows the host and port */
+    path = strchr(route->uri + 7, '/');
+    route->path = path ? path : "";
+
+    pico_http_server_set_request_hook(proxy_request_hook);
+    pico_http_server_keep_fields(HTTP_PROXY_HEADER_SIZE);
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Removes all routes, closes the pooled upstream connections and drops
+ * the requests in progress.
+ */
+void pico_http_proxy_close(void)
+{
+    struct pico_tree_node *index, *tmp;
+    uint32_t i, j;
+
+    pico_http_server_set_request_hook(NULL);
+    pico_http_server_keep_fields(0);
+    pico_tree_foreach_safe(index, &pico_http_proxy_sessions, tmp)
+    {
+        struct http_proxy_session *s = index->keyValue;
+
+        pico_tree_delete(&pico_http_proxy_sessions, s);
+        pico_http_close(s->conn);
+        PICO_FREE(s);
+    }
+
+    for (i = 0; i < HTTP_PROXY_ROUTES; i++)
+    {
+        for (j = 0; j < HTTP_PROXY_POOL_SIZE; j++)
+        {
+            struct http_proxy_upstream *up = &proxy_routes[i].pool[j];
+
+            if (up->state != HTTP_PROXY_UP_FREE)
+                pico_http_client_close(up->conn);
+
+            if (up->request)
+                PICO_FREE(up->request);
+        }
+
+        if (proxy_routes[i].uri)
+            PICO_FREE(proxy_routes[i].uri);
+    }
+
+    memset(proxy_routes, 0, sizeof(proxy_routes));
+}
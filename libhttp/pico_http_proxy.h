@@ -0,0 +1,44 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP_PROXY_H_
+#define PICO_HTTP_PROXY_H_
+
+#include <stdint.h>
+#include "pico_http_util.h"
+
+#ifndef HTTP_PROXY_ROUTES
+#define HTTP_PROXY_ROUTES           4u
+#endif
+#ifndef HTTP_PROXY_POOL_SIZE
+#define HTTP_PROXY_POOL_SIZE        4u      /* upstream connections per route */
+#endif
+#ifndef HTTP_PROXY_BUF_SIZE
+#define HTTP_PROXY_BUF_SIZE         512u    /* per proxied request, used in both directions */
+#endif
+#ifndef HTTP_PROXY_HEADER_SIZE
+#define HTTP_PROXY_HEADER_SIZE      512u    /* header fields forwarded, in each direction */
+#endif
+#define HTTP_PROXY_PREFIX_MAX       32u
+
+/*
+ * Reverse proxy on top of the HTTP server.
+ *
+ * Requests whose resource starts with a route prefix are forwarded to
+ * the upstream of that route, with the prefix replaced by the path of
+ * the upstream uri: prefix "/svc" and upstream "http://10.0.0.2:8080/api"
+ * send "/svc/a?b=1" upstream as "/api/a?b=1".
+ * All other requests reach the application as before.
+ *
+ * The header fields go along both ways and the status of the upstream
+ * comes back as it is, apart from the hop-by-hop fields (Connection,
+ * Keep-Alive, Transfer-Encoding, ... and those Connection names). A
+ * request whose fields exceed HTTP_PROXY_HEADER_SIZE gets 431, an answer
+ * whose fields do gets 502.
+ */
+int16_t pico_http_proxy_add_route(const char *prefix, const char *upstream_uri);
+void pico_http_proxy_close(void);
+
+#endif /* PICO_HTTP_PROXY_H_ */
@@ -0,0 +1,303 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+#include <string.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_client.h"
+#include "pico_http_util.h"
+#include "pico_http_sched.h"
+
+/* Request states */
+#define SCHED_REQ_QUEUED        0   /* waiting in the queue of its class */
+#define SCHED_REQ_RUNNING       1   /* has a client, its events go to the user */
+#define SCHED_REQ_DONE          2   /* the client is closed and done is called from the timer */
+
+struct pico_http_sched_request
+{
+    struct pico_http_sched_request *next;
+    char *uri;
+    const char *host;       /* host[:port] part of uri */
+    uint32_t host_len;
+    int32_t conn;           /* client, -1 if none */
+    uint8_t priority;
+    uint8_t state;
+    uint8_t cancelled;      /* done is not called */
+    int8_t result;
+    void (*wakeup)(struct pico_http_sched_request *req, uint16_t ev, uint16_t conn, void *arg);
+    void (*done)(struct pico_http_sched_request *req, int8_t result, void *arg);
+    void *arg;
+};
+
+static struct pico_http_sched_request *sched_queue[HTTP_SCHED_CLASSES];
+static struct pico_http_sched_request *sched_running = NULL;
+static uint32_t sched_active = 0;
+static uint8_t sched_kick_pending = 0;
+
+static void sched_wakeup(uint16_t ev, uint16_t conn);
+static void sched_kick(pico_time now, void *arg);
+
+/* the server part of the uri, without scheme, user and resource */
+static void uri_host(struct pico_http_sched_request *req)
+{
+    const char *p = req->uri;
+    const char *at;
+    uint32_t len;
+
+    if (!strncmp(p, "http://", 7u))
+    {
+        p += 7;
+    }
+    for (len = 0; p[len] && p[len] != '/' && p[len] != '?'; len++)
+        ;
+    at = memchr(p, '@', len);
+    if (at)
+    {
+        len -= (uint32_t)(at + 1 - p);
+        p = at + 1;
+    }
+    req->host = p;
+    req->host_len = len;
+}
+
+static uint32_t host_running(struct pico_http_sched_request *req)
+{
+    struct pico_http_sched_request *r;
+    uint32_t n = 0;
+
+    for (r = sched_running; r; r = r->next)
+    {
+        if (r->host_len == req->host_len && !memcmp(r->host, req->host, req->host_len))
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
+static void schedule_kick(void)
+{
+    if (!sched_kick_pending && pico_timer_add(0, sched_kick, NULL))
+    {
+        sched_kick_pending = 1;
+    }
+}
+
+static void request_finish(struct pico_http_sched_request *req, int8_t result)
+{
+    req->state = SCHED_REQ_DONE;
+    req->result = result;
+    schedule_kick();
+}
+
+/* the first request of the lowest class that may start now, NULL if none */
+static struct pico_http_sched_request **queue_next(void)
+{
+    struct pico_http_sched_request **prev;
+    uint32_t c;
+
+    for (c = 0; c < HTTP_SCHED_CLASSES; c++)
+    {
+        if (sched_active >= HTTP_SCHED_MAX_ACTIVE ||
+            (c != HTTP_SCHED_URGENT && sched_active + HTTP_SCHED_RESERVED >= HTTP_SCHED_MAX_ACTIVE))
+        {
+            return NULL;
+        }
+        for (prev = &sched_queue[c]; *prev; prev = &(*prev)->next)
+        {
+            if (host_running(*prev) < HTTP_SCHED_MAX_PER_HOST)
+            {
+                return prev;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void request_start(struct pico_http_sched_request *req)
+{
+    int32_t conn;
+
+    req->next = sched_running;
+    sched_running = req;
+    sched_active++;
+    req->state = SCHED_REQ_RUNNING;
+    conn = pico_http_client_open(req->uri, sched_wakeup);
+    if (conn < 0)
+    {
+        dbg("Sched: can not open %s\n", req->uri);
+        request_finish(req, HTTP_SCHED_FAILED);
+        return;
+    }
+    req->conn = conn;
+}
+
+static void request_free(struct pico_http_sched_request *req)
+{
+    if (req->conn >= 0)
+    {
+        pico_http_client_close((uint16_t)req->conn);
+    }
+    PICO_FREE(req->uri);
+    PICO_FREE(req);
+}
+
+static struct pico_http_sched_request *request_find(uint16_t conn)
+{
+    struct pico_http_sched_request *req;
+
+    for (req = sched_running; req; req = req->next)
+    {
+        if (req->conn == (int32_t)conn && req->state == SCHED_REQ_RUNNING)
+        {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+/* passes the events on, the request ends with the response or the connection */
+static void sched_wakeup(uint16_t ev, uint16_t conn)
+{
+    struct pico_http_sched_request *req = request_find(conn);
+
+    if (!req)
+    {
+        return;
+    }
+
+    /* freeing is left to the timer, req outlives a cancel from the callback */
+    req->wakeup(req, ev, conn, req->arg);
+    if (req->state != SCHED_REQ_RUNNING)
+    {
+        return;
+    }
+    if (ev & EV_HTTP_DONE)
+    {
+        request_finish(req, HTTP_SCHED_DONE);
+    }
+    else if (ev & (EV_HTTP_ERROR | EV_HTTP_CLOSE | EV_HTTP_TIMEOUT))
+    {
+        request_finish(req, HTTP_SCHED_FAILED);
+    }
+}
+
+/*
+ * Ends the requests that are done, then starts as many queued ones as
+ * the limits allow. Their connections are closed first, so the next
+ * request to the same server finds them in the pool. The callbacks may
+ * submit or cancel requests, the lists are searched again after each one.
+ */
+static void sched_kick(pico_time now, void *arg)
+{
+    struct pico_http_sched_request *req, **prev;
+
+    (void)now;
+    (void)arg;
+    sched_kick_pending = 0;
+    do
+    {
+        for (prev = &sched_running; (req = *prev) != NULL; prev = &req->next)
+        {
+            if (req->state == SCHED_REQ_DONE)
+            {
+                break;
+            }
+        }
+        if (!req)
+        {
+            break;
+        }
+        *prev = req->next;
+        sched_active--;
+        if (req->conn >= 0)
+        {
+            pico_http_client_close((uint16_t)req->conn);
+            req->conn = -1;
+        }
+        if (!req->cancelled)
+        {
+            req->done(req, req->result, req->arg);
+        }
+        request_free(req);
+    } while (1);
+
+    while ((prev = queue_next()) != NULL)
+    {
+        req = *prev;
+        *prev = req->next;
+        request_start(req);
+    }
+}
+
+/*
+ * API to queue a request, see pico_http_sched.h. It is started from the
+ * stack, never from within the call. Returns NULL on a bad argument or
+ * when out of memory.
+ */
+struct pico_http_sched_request *pico_http_sched_submit(const char *uri, uint8_t priority,
+                                                       void (*wakeup)(struct pico_http_sched_request *req, uint16_t ev, uint16_t conn, void *arg),
+                                                       void (*done)(struct pico_http_sched_request *req, int8_t result, void *arg),
+                                                       void *arg)
+{
+    struct pico_http_sched_request *req, **last;
+
+    if (!uri || !wakeup || !done || priority >= HTTP_SCHED_CLASSES)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return NULL;
+    }
+
+    req = PICO_ZALLOC(sizeof(struct pico_http_sched_request));
+    if (!req)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+    req->uri = PICO_ZALLOC(strlen(uri) + 1u);
+    if (!req->uri)
+    {
+        PICO_FREE(req);
+        pico_err = PICO_ERR_ENOMEM;
+        return NULL;
+    }
+    strcpy(req->uri, uri);
+    uri_host(req);
+    req->conn = -1;
+    req->priority = priority;
+    req->wakeup = wakeup;
+    req->done = done;
+    req->arg = arg;
+
+    for (last = &sched_queue[priority]; *last; last = &(*last)->next)
+        ;
+    *last = req;
+    schedule_kick();
+    return req;
+}
+
+/* drops the request, its client is closed from the stack and done is not called */
+void pico_http_sched_cancel(struct pico_http_sched_request *req)
+{
+    struct pico_http_sched_request **prev;
+
+    if (req->state != SCHED_REQ_QUEUED)
+    {
+        req->cancelled = 1;
+        if (req->state == SCHED_REQ_RUNNING)
+        {
+            request_finish(req, HTTP_SCHED_FAILED);
+        }
+        return;
+    }
+    for (prev = &sched_queue[req->priority]; *prev; prev = &(*prev)->next)
+    {
+        if (*prev == req)
+        {
+            *prev = req->next;
+            request_free(req);
+            return;
+        }
+    }
+}
@@ -0,0 +1,62 @@
+/*********************************************************************
+   PicoTCP. Copyright (c) 2012 TASS Belgium NV. Some rights reserved.
+   See LICENSE and COPYING for usage.
+ *********************************************************************/
+
+#ifndef PICO_HTTP_SCHED_H_
+#define PICO_HTTP_SCHED_H_
+
+#include <stdint.h>
+
+#ifndef HTTP_SCHED_MAX_ACTIVE
+#define HTTP_SCHED_MAX_ACTIVE       4u      /* requests running at a time, all servers together */
+#endif
+#ifndef HTTP_SCHED_MAX_PER_HOST
+#define HTTP_SCHED_MAX_PER_HOST     2u      /* requests running at a time to one server */
+#endif
+#ifndef HTTP_SCHED_RESERVED
+#define HTTP_SCHED_RESERVED         1u      /* of HTTP_SCHED_MAX_ACTIVE, only urgent requests take these */
+#endif
+
+/* Priority classes, lower goes first */
+#define HTTP_SCHED_URGENT           0u
+#define HTTP_SCHED_NORMAL           1u
+#define HTTP_SCHED_BULK             2u
+#define HTTP_SCHED_CLASSES          3u
+
+/* Result passed to the done callback */
+#define HTTP_SCHED_FAILED           (-1)    /* not opened, error, close or timeout */
+#define HTTP_SCHED_DONE             0       /* the response has been read completely */
+
+/*
+ * Queue of requests above pico_http_client_open.
+ *
+ * pico_http_sched_submit queues a request for uri in one of the classes
+ * above. It is started when no request of a lower class is waiting and
+ * the limits allow it: HTTP_SCHED_MAX_ACTIVE running in all,
+ * HTTP_SCHED_MAX_PER_HOST to the server of uri, and the last
+ * HTTP_SCHED_RESERVED slots are kept for urgent requests so bulk
+ * transfers can not take them all. Within a class the requests start in
+ * the order they were queued; one waiting for a busy server does not
+ * hold up the ones to other servers.
+ *
+ * A started request gets its own client. The events of the client go to
+ * wakeup; on EV_HTTP_CON the request is sent with any of the send
+ * functions of the client, the response is read as usual. The client is
+ * closed by the scheduler once the response has been read (EV_HTTP_DONE)
+ * or the connection failed, a keep-alive connection then goes to the pool
+ * for the next request to that server. done is called after that, from
+ * the stack, and the request is freed when it returns.
+ *
+ * pico_http_sched_cancel drops the request without calling done, it may
+ * be called from the callbacks.
+ */
+struct pico_http_sched_request;
+
+struct pico_http_sched_request *pico_http_sched_submit(const char *uri, uint8_t priority,
+                                                       void (*wakeup)(struct pico_http_sched_request *req, uint16_t ev, uint16_t conn, void *arg),
+                                                       void (*done)(struct pico_http_sched_request *req, int8_t result, void *arg),
+                                                       void *arg);
+void pico_http_sched_cancel(struct pico_http_sched_request *req);
+
+#endif /* PICO_HTTP_SCHED_H_ */
@@ -6,6 +6,7 @@
  *********************************************************************/
 #include "pico_stack.h"
 #include "pico_http_server.h"
+#include "pico_http2.h"
 #include "pico_tcp.h"
 #include "pico_tree.h"
 #include "pico_socket.h"
@@ -18,16 +19,90 @@
 #define HTTP_HEADER_MAX_LINE    256u
 #define HTTP_OK_HEADER_FIXED    160u
 
-#define consume_char(c) (pico_socket_read(client->sck, &c, 1u))
+/*
+ * Chunk framing. The size line (max 4 hex digits + CRLF) and the CRLF trail
+ * are sent together with payload bytes instead of in writes of their own,
+ * so every chunk leaves as few and as full segments as possible.
+ */
+#define HTTP_CHUNK_HDR_MAX      6u
+#define HTTP_CHUNK_TRAIL_LEN    2u
+#define HTTP_CHUNK_PIECES       3u      /* size line, payload, trail */
+#ifndef HTTP_CHUNK_STAGE_SIZE
+#define HTTP_CHUNK_STAGE_SIZE   536u    /* static chunks go out through it, one write each (the default MSS) */
+#endif
+
+/*
+ * Per source address rate limiting: a token bucket per client address,
+ * kept in a small open addressing table. Every request costs one token,
+ * tokens come back at one per HTTP_RATE_REFILL_MS up to HTTP_RATE_BURST.
+ * Buckets that were idle long enough to be full again may be reused for
+ * another address. A burst of 0 leaves it off, it is turned on with
+ * pico_http_server_set_rate_limit.
+ */
+#ifndef HTTP_RATE_TABLE_SIZE
+#define HTTP_RATE_TABLE_SIZE    16u
+#endif
+#ifndef HTTP_RATE_BURST
+#define HTTP_RATE_BURST         0u
+#endif
+#ifndef HTTP_RATE_REFILL_MS
+#define HTTP_RATE_REFILL_MS     100u
+#endif
+
+/* OPTIONS is answered by the server, see pico_http_server_set_options */
+#define HTTP_OPTIONS_HEADER_SIZE    256u
+#define HTTP_OPTIONS_DEFAULT_ALLOW  "GET, POST, HEAD, OPTIONS"
+
+/* only the start of a header line is kept, enough for the fields the server uses */
+#define HTTP_HDR_FIELD_KEEP     32u
+#define HTTP_CONTENT_LENGTH     "content-length:"
+#define HTTP_TRANSFER_ENCODING  "transfer-encoding:"
+
+/* status line and the fields the server adds, see pico_http_respond_status */
+#define HTTP_STATUS_HEADER_FIXED    80u
+
+/*
+ * HTTP/2 is recognized by its connection preface, whose first line looks
+ * like a request line. This covers both prior knowledge on plain TCP and
+ * TLS connections that negotiated "h2" with ALPN. Every stream of the
+ * connection becomes a connection ID of its own for the application.
+ */
+#define HTTP2_PREFACE_LINE_LEN  16u     /* "PRI * HTTP/2.0\r\n" */
+#define HTTP2_READ_CHUNK        256u
+
+#define consume_char(c) (transport_read(client, &c, 1u))
 
 //TODO: check in rfc what to add
 
+#define HTTP_FAIL_BODY  "<html><body>The resource you requested cannot be found !</body></html>"
+
 static const char return_fail_header[] =
     "HTTP/1.1 404 Not Found\r\n\
 Host: localhost\r\n\
 Connection: close\r\n\
-\r\n\
-<html><body>The resource you requested cannot be found !</body></html>";
+\r\n" HTTP_FAIL_BODY;
+
+static const char too_many_header[] =
+    "HTTP/1.1 429 Too Many Requests\r\n\
+Host: localhost\r\n\
+Retry-After: 1\r\n\
+Content-Length: 0\r\n\
+Connection: close\r\n\
+\r\n";
+
+static const char length_required_header[] =
+    "HTTP/1.1 411 Length Required\r\n\
+Host: localhost\r\n\
+Content-Length: 0\r\n\
+Connection: close\r\n\
+\r\n";
+
+static const char bad_gateway_header[] =
+    "HTTP/1.1 502 Bad Gateway\r\n\
+Host: localhost\r\n\
+Content-Length: 0\r\n\
+Connection: close\r\n\
+\r\n";
 
 static const char error_header[] =
     "HTTP/1.1 400 Bad Request\r\n\
@@ -56,6 +131,13 @@ int32_t construct_return_ok_header(char* headerstring, uint8_t cacheable, const
 }
 
 
+struct http_rate_bucket
+{
+    uint32_t addr;      /* 0 for a free slot */
+    uint16_t tokens;
+    pico_time last;     /* time the tokens were last brought up to date */
+};
+
 struct http_server
 {
     uint16_t state;
@@ -63,19 +145,55 @@ struct http_server
     uint16_t port;
     void (*wakeup)(uint16_t ev, uint16_t param);
     uint8_t accepted;
+    void (*request_hook)(uint16_t conn);
+    const struct pico_http_transport *transport;
+    char options_header[HTTP_OPTIONS_HEADER_SIZE];
+    uint16_t options_len;
+    uint16_t rate_burst;        /* 0 disables rate limiting */
+    uint32_t rate_refill_ms;
+    struct http_rate_bucket rate[HTTP_RATE_TABLE_SIZE];
+    uint16_t keep_fields;       /* header bytes kept per request, see pico_http_server_keep_fields */
+};
+
+struct http_chunk_piece
+{
+    const uint8_t *ptr;
+    uint32_t len;
 };
 
 struct http_client
 {
     uint16_t connectionID;
     struct pico_socket *sck;
+    uint32_t addr;      /* remote address, for rate limiting */
+    void (*wakeup)(uint16_t ev, uint16_t conn);  /* server.wakeup unless taken over */
+    void *tctx;         /* transport context, e.g. the TLS session */
     void *buffer;
     uint16_t buffer_size;
     uint16_t buffer_sent;
+    char chunk_hdr[HTTP_CHUNK_HDR_MAX + 1];
+    uint16_t chunk_hdr_len;
+    uint32_t chunk_wire_len;    /* size line + payload + trail */
+    uint32_t chunk_wire_sent;
+    uint8_t stage[HTTP_CHUNK_STAGE_SIZE];
+    uint16_t stage_len;
+    uint16_t stage_sent;
     char *resource;
     uint16_t state;
     uint16_t method;
     char *body;
+    uint32_t body_len;  /* body bytes that arrived together with the header */
+    uint32_t body_read; /* of which already handed to the application */
+    uint32_t content_length;    /* announced request body size, 0 if none */
+    char hdr_field[HTTP_HDR_FIELD_KEEP];    /* start of the header line being read */
+    uint32_t hdr_line_len;
+    uint8_t chunked_body;       /* the body has no Content-Length, the server does not take it */
+    char *fields;               /* the header fields, if kept */
+    uint16_t fields_len;
+    uint8_t fields_cut;         /* they did not fit */
+    struct pico_http2 *h2;              /* HTTP/2 connection */
+    struct http_client *h2_parent;      /* for a stream: its connection, NULL once that is gone */
+    uint32_t h2_stream;                 /* stream id, 0 for a real connection */
 };
 
 /* Local states for clients */
@@ -90,9 +208,25 @@ struct http_client
 #define HTTP_SENDING_FINAL          8
 #define HTTP_ERROR                  9
 #define HTTP_CLOSED                 10
+#define HTTP_HANDSHAKE              11
+#define HTTP_H2                     12
+
+struct http_method_name
+{
+    const char *name;
+    uint16_t method;
+};
+
+static const struct http_method_name http_methods[] = {
+    { "GET", HTTP_METHOD_GET },
+    { "POST", HTTP_METHOD_POST },
+    { "HEAD", HTTP_METHOD_HEAD },
+    { "OPTIONS", HTTP_METHOD_OPTIONS }
+};
 
 static struct http_server server = {
-    0
+    .rate_burst = HTTP_RATE_BURST,
+    .rate_refill_ms = HTTP_RATE_REFILL_MS
 };
 
 /*
@@ -102,10 +236,147 @@ static int16_t parse_request(struct http_client *client);
 //static int read_remaining_reader(struct http_client *client);
 static void send_data(struct http_client *client);
 static void send_final(struct http_client *client);
+static int16_t frame_chunk(struct http_client *client, void *buffer, uint16_t len);
+static int32_t write_chunk(struct http_client *client);
+static void chunk_failed(struct http_client *client);
 static inline int32_t read_data(struct http_client *client);  /* used only in a place */
 static inline struct http_client *find_client(uint16_t conn);
 
+/*
+ * Plain TCP transport, the context is the socket itself.
+ */
+static void *tcp_accept(struct pico_socket *s)
+{
+    return s;
+}
+
+static int32_t tcp_read(void *ctx, void *buf, uint32_t len)
+{
+    return pico_socket_read((struct pico_socket *)ctx, buf, (int)len);
+}
+
+static int32_t tcp_write(void *ctx, const void *buf, uint32_t len)
+{
+    return pico_socket_write((struct pico_socket *)ctx, buf, (int)len);
+}
+
+static const struct pico_http_transport http_tcp_transport = {
+    .accept = tcp_accept,
+    .handshake = NULL,
+    .read = tcp_read,
+    .write = tcp_write,
+    .close = NULL
+};
+
+static inline int32_t transport_read(struct http_client *client, void *buf, uint32_t len)
+{
+    if (!client->tctx)
+        return HTTP_RETURN_ERROR;
 
+    return server.transport->read(client->tctx, buf, len);
+}
+
+static inline int32_t transport_write(struct http_client *client, const void *buf, uint32_t len)
+{
+    if (!client->tctx)
+        return HTTP_RETURN_ERROR;
+
+    return server.transport->write(client->tctx, buf, len);
+}
+
+/*
+ * Returns the up to date bucket of addr, claiming a free or idle slot
+ * (or the least recently used one) if the address is not known yet.
+ */
+static struct http_rate_bucket *rate_bucket(uint32_t addr)
+{
+    struct http_rate_bucket *victim = NULL;
+    pico_time now = PICO_TIME_MS();
+    uint32_t idx = (addr * 2654435761u) % HTTP_RATE_TABLE_SIZE;
+    uint32_t i;
+
+    for (i = 0; i < HTTP_RATE_TABLE_SIZE; i++)
+    {
+        struct http_rate_bucket *b = &server.rate[(idx + i) % HTTP_RATE_TABLE_SIZE];
+
+        if (b->addr == addr)
+        {
+            pico_time refill = (now - b->last) / server.rate_refill_ms;
+
+            if (refill + b->tokens >= server.rate_burst)
+            {
+                b->tokens = server.rate_burst;
+                b->last = now;
+            }
+            else
+            {
+                b->tokens = (uint16_t)(b->tokens + refill);
+                b->last += refill * server.rate_refill_ms;
+            }
+
+            return b;
+        }
+
+        if (!b->addr || (now - b->last) >= (pico_time)server.rate_burst * server.rate_refill_ms)
+        {
+            if (!victim || victim->addr)
+                victim = b;
+        }
+        else if (!victim || (victim->addr && b->last < victim->last))
+        {
+            victim = b;
+        }
+    }
+
+    victim->addr = addr;
+    victim->tokens = server.rate_burst;
+    victim->last = now;
+    return victim;
+}
+
+/* returns 1 if the address may not make another request now */
+static uint8_t rate_limited(uint32_t addr, uint8_t consume)
+{
+    struct http_rate_bucket *b;
+
+    if (!server.rate_burst || !addr)
+        return 0;
+
+    b = rate_bucket(addr);
+    if (!b->tokens)
+        return 1;
+
+    if (consume)
+        b->tokens--;
+
+    return 0;
+}
+
+/* ends the transport session, the socket itself is closed by the caller */
+static void transport_close(struct http_client *client)
+{
+    if (client->tctx && server.transport->close)
+        server.transport->close(client->tctx);
+
+    client->tctx = NULL;
+}
+
+
+
+/* answers a request the application never sees, the client is freed */
+static void answer_and_close(struct http_client *client, const char *answer, uint16_t len)
+{
+    transport_write(client, answer, len);
+    pico_http_close(client->connectionID);
+}
+
+/* answers without a body, e.g. to HEAD, end with the header */
+static void finish_head(struct http_client *client)
+{
+    transport_close(client);
+    pico_socket_close(client->sck);
+    client->state = HTTP_CLOSED;
+}
 
 static int32_t compare_clients(void *ka, void *kb)
 {
@@ -114,6 +385,272 @@ static int32_t compare_clients(void *ka, void *kb)
 
 PICO_TREE_DECLARE(pico_http_clients, compare_clients);
 
+/*
+ * HTTP/2 streams
+ */
+static struct http_client *http2_find_stream(struct http_client *parent, uint32_t stream)
+{
+    struct pico_tree_node *index;
+    struct http_client *client;
+
+    pico_tree_foreach(index, &pico_http_clients)
+    {
+        client = index->keyValue;
+        if (client->h2_parent == parent && client->h2_stream == stream)
+            return client;
+    }
+    return NULL;
+}
+
+/* the engine does not know the stream anymore, neither does user memory */
+static void http2_stream_gone(struct http_client *client)
+{
+    if (client->state == HTTP_SENDING_DATA && client->buffer)
+        PICO_FREE(client->buffer);
+
+    client->buffer = NULL;
+    client->state = HTTP_CLOSED;
+}
+
+static int32_t http2_write(void *arg, const void *buf, uint32_t len)
+{
+    int32_t ret = transport_write((struct http_client *)arg, buf, len);
+
+    return (ret < 0) ? 0 : ret;
+}
+
+static int8_t http2_request(void *arg, uint32_t stream, uint16_t method, const char *path, uint32_t content_length)
+{
+    struct http_client *parent = arg;
+    struct http_client *client;
+
+    /* answered here, like on HTTP/1.1; OPTIONS gets no CORS fields on HTTP/2 */
+    if (rate_limited(parent->addr, 1u))
+        return pico_http2_respond(parent->h2, stream, HTTP_TOO_MANY_REQ, NULL, 0, 1u);
+
+    if (method == HTTP_METHOD_OPTIONS)
+        return pico_http2_respond(parent->h2, stream, HTTP_NO_CONTENT, NULL, 0, 1u);
+
+    client = PICO_ZALLOC(sizeof(struct http_client));
+    if (!client)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    client->resource = PICO_ZALLOC(strlen(path) + 1u);
+    if (!client->resource)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        PICO_FREE(client);
+        return HTTP_RETURN_ERROR;
+    }
+
+    strcpy(client->resource, path);
+    client->addr = parent->addr;
+    client->wakeup = parent->wakeup;
+    client->state = HTTP_WAIT_RESPONSE;
+    client->method = method;
+    client->content_length = content_length;
+    client->h2_parent = parent;
+    client->h2_stream = stream;
+    client->connectionID = pico_rand() & 0x7FFF;
+    while (pico_tree_insert(&pico_http_clients, client) != NULL)
+        client->connectionID = pico_rand() & 0x7FFF;
+
+    /* the hook may hand the stream to another handler */
+    if (server.request_hook)
+        server.request_hook(client->connectionID);
+
+    client->wakeup(EV_HTTP_REQ, client->connectionID);
+    return HTTP_RETURN_OK;
+}
+
+static void http2_body(void *arg, uint32_t stream)
+{
+    struct http_client *client = http2_find_stream(arg, stream);
+
+    if (client && client->state != HTTP_CLOSED)
+        client->wakeup(EV_HTTP_BODY, client->connectionID);
+}
+
+static void http2_sent(void *arg, uint32_t stream, uint32_t sent)
+{
+    struct http_client *client = http2_find_stream(arg, stream);
+
+    if (!client || (client->state != HTTP_SENDING_DATA && client->state != HTTP_SENDING_STATIC_DATA))
+        return;
+
+    client->buffer_sent = (uint16_t)sent;
+    client->wakeup(EV_HTTP_PROGRESS, client->connectionID);
+    if (client->buffer_sent < client->buffer_size || find_client(client->connectionID) != client)
+        return;
+
+    if (client->state == HTTP_SENDING_DATA)
+        PICO_FREE(client->buffer);
+
+    client->buffer = NULL;
+    client->state = (client->state == HTTP_SENDING_DATA) ? HTTP_WAIT_DATA : HTTP_WAIT_STATIC_DATA;
+    client->wakeup(EV_HTTP_SENT, client->connectionID);
+}
+
+static void http2_closed(void *arg, uint32_t stream)
+{
+    struct http_client *client = http2_find_stream(arg, stream);
+
+    if (!client)
+        return;
+
+    http2_stream_gone(client);
+    client->wakeup(EV_HTTP_CLOSE, client->connectionID);
+}
+
+static const struct pico_http2_cb http2_callbacks = {
+    .write = http2_write,
+    .request = http2_request,
+    .body = http2_body,
+    .sent = http2_sent,
+    .closed = http2_closed
+};
+
+/* the consumed preface line is handed to the engine, the rest follows from the transport */
+static int16_t http2_start(struct http_client *client, const char *line, uint32_t len)
+{
+    client->h2 = pico_http2_create(&http2_callbacks, client);
+    if (!client->h2)
+        return HTTP_RETURN_ERROR;
+
+    client->state = HTTP_H2;
+    return (pico_http2_feed(client->h2, (const uint8_t *)line, len) < 0) ? HTTP_RETURN_ERROR : HTTP_RETURN_OK;
+}
+
+/* connection error: GOAWAY is sent as far as possible and the connection closed */
+static void http2_fail(struct http_client *client)
+{
+    pico_http2_flush(client->h2);
+    transport_close(client);
+    pico_socket_close(client->sck);
+    client->state = HTTP_CLOSED;
+    client->wakeup(EV_HTTP_ERROR, client->connectionID);
+}
+
+static int32_t http2_input(struct http_client *client)
+{
+    uint8_t buf[HTTP2_READ_CHUNK];
+    uint16_t conn = client->connectionID;
+    int32_t len;
+
+    while ((len = transport_read(client, buf, sizeof(buf))) > 0)
+    {
+        if (pico_http2_feed(client->h2, buf, (uint32_t)len) < 0)
+        {
+            http2_fail(client);
+            break;
+        }
+
+        /* the application may have closed the connection from a stream event */
+        if (find_client(conn) != client)
+            break;
+    }
+
+    return HTTP_RETURN_OK;
+}
+
+/* the streams of a closed connection end with EV_HTTP_CLOSE */
+static void http2_detach_streams(struct http_client *parent)
+{
+    struct pico_tree_node *index, *tmp;
+    struct http_client *client;
+
+    pico_tree_foreach_safe(index, &pico_http_clients, tmp)
+    {
+        client = index->keyValue;
+        if (client->h2_parent != parent)
+            continue;
+
+        client->h2_parent = NULL;
+        if (client->state != HTTP_CLOSED)
+        {
+            http2_stream_gone(client);
+            client->wakeup(EV_HTTP_CLOSE, client->connectionID);
+        }
+    }
+}
+
+static int32_t http2_respond(struct http_client *client, uint16_t code, const char *mimetype)
+{
+    struct pico_http2 *h2 = client->h2_parent ? client->h2_parent->h2 : NULL;
+    uint32_t stream = client->h2_stream;
+    uint8_t head = (client->method == HTTP_METHOD_HEAD);
+    int8_t ret;
+
+    /* the state is set first: the engine may close the stream right away */
+    if (code & HTTP_RESOURCE_FOUND)
+    {
+        client->state = head ? HTTP_CLOSED : ((code & HTTP_STATIC_RESOURCE) ? HTTP_WAIT_STATIC_DATA : HTTP_WAIT_DATA);
+        return pico_http2_respond(h2, stream, HTTP_OK, mimetype, (code & HTTP_CACHEABLE_RESOURCE) ? 1u : 0u, head);
+    }
+
+    client->state = HTTP_CLOSED;
+    if (code & HTTP_RESOURCE_BAD_GATEWAY)
+        return pico_http2_respond(h2, stream, HTTP_BAD_GATEWAY, NULL, 0, 1u);
+
+    ret = pico_http2_respond(h2, stream, HTTP_NOT_FOUND, "text/html", 0, head);
+    if (ret == HTTP_RETURN_OK && !head)
+        ret = pico_http2_send(h2, stream, (const uint8_t *)HTTP_FAIL_BODY, sizeof(HTTP_FAIL_BODY) - 1u, 1u);
+
+    return ret;
+}
+
+static int16_t http2_submit(struct http_client *client, void *buffer, uint16_t len)
+{
+    struct pico_http2 *h2 = client->h2_parent ? client->h2_parent->h2 : NULL;
+    uint16_t state = client->state;
+    int8_t ret;
+
+    if (!h2)
+        return HTTP_RETURN_ERROR;
+
+    if (!buffer || !len)
+    {
+        client->state = HTTP_CLOSED;
+        return pico_http2_send(h2, client->h2_stream, NULL, 0, 1u);
+    }
+
+    if (state == HTTP_WAIT_DATA)
+    {
+        client->buffer = PICO_ZALLOC(len);
+        if (!client->buffer)
+        {
+            pico_err = PICO_ERR_ENOMEM;
+            return HTTP_RETURN_ERROR;
+        }
+
+        memcpy(client->buffer, buffer, len);
+        client->state = HTTP_SENDING_DATA;
+    }
+    else
+    {
+        client->buffer = buffer;
+        client->state = HTTP_SENDING_STATIC_DATA;
+    }
+
+    client->buffer_size = len;
+    client->buffer_sent = 0;
+    ret = pico_http2_send(h2, client->h2_stream, client->buffer, len, 0);
+    if (ret < 0)
+    {
+        /* refused before anything happened */
+        if (state == HTTP_WAIT_DATA)
+            PICO_FREE(client->buffer);
+
+        client->buffer = NULL;
+        client->state = state;
+    }
+
+    return ret;
+}
+
 void http_server_cbk(uint16_t ev, struct pico_socket *s)
 {
     struct pico_tree_node *index;
@@ -141,15 +678,30 @@ void http_server_cbk(uint16_t ev, struct pico_socket *s)
         return;
     }
 
+    /* no data is exchanged before the transport handshake is complete */
+    if (client && client->state == HTTP_HANDSHAKE && (ev & (PICO_SOCK_EV_RD | PICO_SOCK_EV_WR)))
+    {
+        if (server.transport->handshake(client->tctx) == 0)
+            client->state = HTTP_WAIT_HDR;
+        else
+            ev = (uint16_t)(ev & ~(PICO_SOCK_EV_RD | PICO_SOCK_EV_WR));
+    }
+
     if (ev & PICO_SOCK_EV_RD)
     {
+        uint16_t conn = client->connectionID;
+        int32_t ret = read_data(client);
+
+        /* answered by the server itself or closed from the callback */
+        if (find_client(conn) != client)
+            return;
 
-        if (read_data(client) == HTTP_RETURN_ERROR)
+        if (ret == HTTP_RETURN_ERROR)
         {
             /* send out error */
             client->state = HTTP_ERROR;
-            pico_socket_write(client->sck, (const char *)error_header, sizeof(error_header) - 1);
-            server.wakeup(EV_HTTP_ERROR, client->connectionID);
+            transport_write(client, error_header, sizeof(error_header) - 1);
+            client->wakeup(EV_HTTP_ERROR, client->connectionID);
         }
     }
 
@@ -163,6 +715,10 @@ void http_server_cbk(uint16_t ev, struct pico_socket *s)
         {
             send_final(client);
         }
+        else if (client->state == HTTP_H2)
+        {
+            pico_http2_flush(client->h2);
+        }
     }
 
     if (ev & PICO_SOCK_EV_CONN)
@@ -171,18 +727,35 @@ void http_server_cbk(uint16_t ev, struct pico_socket *s)
         server.wakeup(EV_HTTP_CON, HTTP_SERVER_ID);
         if (!server.accepted)
         {
-            pico_socket_close(s); /* reject socket */
+            /* reject the new connection, s is the listening socket */
+            struct pico_ip4 orig;
+            uint16_t port;
+            struct pico_socket *sck = pico_socket_accept(s, &orig, &port);
+
+            if (sck)
+                pico_socket_close(sck);
         }
     }
 
     if ((ev & PICO_SOCK_EV_CLOSE) || (ev & PICO_SOCK_EV_FIN))
     {
-        server.wakeup(EV_HTTP_CLOSE, (uint16_t)(server_event ? HTTP_SERVER_ID : (client->connectionID)));
+        if (server_event)
+            server.wakeup(EV_HTTP_CLOSE, HTTP_SERVER_ID);
+        else
+            client->wakeup(EV_HTTP_CLOSE, client->connectionID);
     }
 
     if (ev & PICO_SOCK_EV_ERR)
     {
-        server.wakeup(EV_HTTP_ERROR, (uint16_t)(server_event ? HTTP_SERVER_ID : (client->connectionID)));
+        if (server_event)
+        {
+            server.wakeup(EV_HTTP_ERROR, HTTP_SERVER_ID);
+        }
+        else
+        {
+            transport_close(client);
+            client->wakeup(EV_HTTP_ERROR, client->connectionID);
+        }
     }
 }
 
@@ -191,6 +764,17 @@ void http_server_cbk(uint16_t ev, struct pico_socket *s)
  * will be used.
  */
 int16_t pico_http_server_start(uint16_t port, void (*wakeup)(uint16_t ev, uint16_t conn))
+{
+    return pico_http_server_start_transport(port, wakeup, &http_tcp_transport);
+}
+
+/*
+ * Same as pico_http_server_start, but every connection is read and
+ * written through the given transport (e.g. TLS). The transport must
+ * outlive the server.
+ */
+int16_t pico_http_server_start_transport(uint16_t port, void (*wakeup)(uint16_t ev, uint16_t conn),
+                                         const struct pico_http_transport *transport)
 {
     struct pico_ip4 anything = {
         0
@@ -198,7 +782,7 @@ int16_t pico_http_server_start(uint16_t port, void (*wakeup)(uint16_t ev, uint16
 
     server.port = (uint16_t)(port ? short_be(port) : short_be(80u));
 
-    if (!wakeup)
+    if (!wakeup || !transport || !transport->accept || !transport->read || !transport->write)
     {
         pico_err = PICO_ERR_EINVAL;
         return HTTP_RETURN_ERROR;
@@ -224,11 +808,124 @@ int16_t pico_http_server_start(uint16_t port, void (*wakeup)(uint16_t ev, uint16
         return HTTP_RETURN_ERROR;
     }
 
+    if (!server.options_len)
+        pico_http_server_set_options(HTTP_OPTIONS_DEFAULT_ALLOW, NULL);
+
     server.wakeup = wakeup;
+    server.transport = transport;
     server.state = HTTP_SERVER_LISTEN;
     return HTTP_RETURN_OK;
 }
 
+/*
+ * Configures the answer to OPTIONS requests (e.g. CORS preflights),
+ * which the server sends without waking the application.
+ * methods is the allow-list, e.g. "GET, POST, HEAD, OPTIONS".
+ * origin is sent as Access-Control-Allow-Origin; pass NULL to allow
+ * no cross-origin requests.
+ */
+int16_t pico_http_server_set_options(const char *methods, const char *origin)
+{
+    static const char status[] = "HTTP/1.1 204 No Content\r\nHost: localhost\r\nAllow: ";
+    static const char cors_methods[] = "\r\nAccess-Control-Allow-Methods: ";
+    static const char cors_origin[] = "\r\nAccess-Control-Allow-Origin: ";
+    static const char cors_headers[] = "\r\nAccess-Control-Allow-Headers: Content-Type";
+    static const char trail[] = "\r\nAccess-Control-Max-Age: 86400\r\nConnection: close\r\n\r\n";
+    uint32_t len;
+
+    if (!methods)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    len = (uint32_t)(sizeof(status) + sizeof(cors_methods) + sizeof(trail) - 3u + 2u * strlen(methods));
+    if (origin)
+        len += (uint32_t)(sizeof(cors_origin) + sizeof(cors_headers) - 2u + strlen(origin));
+
+    if (len >= HTTP_OPTIONS_HEADER_SIZE)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    strcpy(server.options_header, status);
+    strcat(server.options_header, methods);
+    strcat(server.options_header, cors_methods);
+    strcat(server.options_header, methods);
+    if (origin)
+    {
+        strcat(server.options_header, cors_origin);
+        strcat(server.options_header, origin);
+        strcat(server.options_header, cors_headers);
+    }
+
+    strcat(server.options_header, trail);
+    server.options_len = (uint16_t)len;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Installs a hook that sees every request once its header is complete,
+ * right before EV_HTTP_REQ. The hook may take the connection over with
+ * pico_http_set_wakeup (e.g. the reverse proxy does so for its routes),
+ * the events of that connection then go to the new wakeup instead of the
+ * one given to pico_http_server_start. Pass NULL to remove the hook.
+ */
+int16_t pico_http_server_set_request_hook(void (*hook)(uint16_t conn))
+{
+    server.request_hook = hook;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Sets the wakeup that receives the events of one connection.
+ */
+int16_t pico_http_set_wakeup(uint16_t conn, void (*wakeup)(uint16_t ev, uint16_t conn))
+{
+    struct http_client *client = find_client(conn);
+
+    if (!client || !wakeup)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    client->wakeup = wakeup;
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Sets the per client address rate limit: a client may make burst
+ * requests at once, after that one request per refill_ms.
+ * Passing 0 as burst disables the limit. Clients over the limit are
+ * answered with 429 Too Many Requests by the server itself.
+ */
+int16_t pico_http_server_set_rate_limit(uint16_t burst, uint32_t refill_ms)
+{
+    if (burst && !refill_ms)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    server.rate_burst = burst;
+    server.rate_refill_ms = refill_ms;
+    memset(server.rate, 0, sizeof(server.rate));
+    return HTTP_RETURN_OK;
+}
+
+/*
+ * Makes the server keep up to size bytes of the header fields of each
+ * request (HTTP/1.x only), for pico_http_get_fields. 0, the default,
+ * keeps none.
+ */
+int16_t pico_http_server_keep_fields(uint16_t size)
+{
+    server.keep_fields = size;
+    return HTTP_RETURN_OK;
+}
+
 /*
  * API for accepting new connections. This function should be
  * called when the event EV_HTTP_CON is triggered, if not called
@@ -251,6 +948,8 @@ int32_t pico_http_server_accept(void)
     }
 
     client->sck = pico_socket_accept(server.sck, &orig, &port);
+    /* the connection is dealt with here, even when it is refused below */
+    server.accepted = 1u;
 
     if (!client->sck)
     {
@@ -259,9 +958,27 @@ int32_t pico_http_server_accept(void)
         return HTTP_RETURN_ERROR;
     }
 
-    server.accepted = 1u;
+    /* an address that is out of tokens is not even set up */
+    client->addr = orig.addr;
+    if (rate_limited(client->addr, 0u))
+    {
+        pico_socket_close(client->sck);
+        PICO_FREE(client);
+        pico_err = PICO_ERR_EAGAIN;
+        return HTTP_RETURN_ERROR;
+    }
+
+    client->tctx = server.transport->accept(client->sck);
+    if (!client->tctx)
+    {
+        pico_socket_close(client->sck);
+        PICO_FREE(client);
+        return HTTP_RETURN_ERROR;
+    }
+
+    client->wakeup = server.wakeup;
     /* buffer used for async sending */
-    client->state = HTTP_WAIT_HDR;
+    client->state = server.transport->handshake ? HTTP_HANDSHAKE : HTTP_WAIT_HDR;
     client->buffer = NULL;
     client->buffer_size = 0;
     client->body = NULL;
@@ -289,6 +1006,22 @@ char *pico_http_get_resource(uint16_t conn)
         return client->resource;
 }
 
+/*
+ * Returns the header field lines of the request, each ended by CRLF,
+ * after EV_HTTP_REQ. NULL if the fields are not kept (see
+ * pico_http_server_keep_fields) or did not fit. HTTP/2 requests keep
+ * none, they give "".
+ */
+const char *pico_http_get_fields(uint16_t conn)
+{
+    struct http_client *client = find_client(conn);
+
+    if (!client || !server.keep_fields || client->fields_cut)
+        return NULL;
+
+    return (client->fields && !client->h2_stream) ? client->fields : "";
+}
+
 /*
  * Function used for getting the method coming from client
  * (e.g. POST, GET...)
@@ -320,6 +1053,64 @@ char *pico_http_get_body(uint16_t conn)
         return client->body;
 }
 
+/*
+ * Returns the Content-Length announced by the request, 0 if there was
+ * none. Useful after EV_HTTP_REQ to know how much pico_http_read_body
+ * will deliver.
+ */
+uint32_t pico_http_get_content_length(uint16_t conn)
+{
+    struct http_client *client = find_client(conn);
+
+    if (!client)
+        return 0;
+    else
+        return client->content_length;
+}
+
+/*
+ * Function used for streaming the body of the request.
+ * Bytes that came in together with the header are returned
+ * first, then the socket is read. Call it after EV_HTTP_REQ
+ * and on every EV_HTTP_BODY, so large uploads never have to
+ * be stored as a whole.
+ *
+ * Returns the number of bytes copied to buf, or -1.
+ */
+int32_t pico_http_read_body(uint16_t conn, void *buf, uint32_t len)
+{
+    struct http_client *client = find_client(conn);
+    uint32_t stored = 0;
+    int32_t ret;
+
+    if (!client || !buf)
+    {
+        dbg("Wrong connection ID\n");
+        return HTTP_RETURN_ERROR;
+    }
+
+    if (client->h2_stream)
+        return client->h2_parent ? pico_http2_read_body(client->h2_parent->h2, client->h2_stream, buf, len) : HTTP_RETURN_ERROR;
+
+    if (client->body_read < client->body_len)
+    {
+        stored = client->body_len - client->body_read;
+        if (stored > len)
+            stored = len;
+
+        memcpy(buf, client->body + client->body_read, stored);
+        client->body_read += stored;
+        if (stored == len)
+            return (int32_t)stored;
+    }
+
+    ret = transport_read(client, (uint8_t *)buf + stored, len - stored);
+    if (ret < 0)
+        return HTTP_RETURN_ERROR;
+
+    return (int32_t)stored + ret;
+}
+
 
 /*
  * After the resource was asked by the client (EV_HTTP_REQ)
@@ -333,7 +1124,11 @@ char *pico_http_get_body(uint16_t conn)
  *
  * If a resource is reported not found the 404 header will be sent and the connection
  * will be closed , otherwise the 200 header is sent and the user should
- * immediately submit (static) data.
+ * immediately submit (static) data. HTTP_RESOURCE_BAD_GATEWAY sends a 502
+ * instead of the 404, for handlers that could not reach the real origin.
+ * A HEAD request (see pico_http_get_method) is complete with the header:
+ * the connection is closed and pico_http_submit_data drops the body, the
+ * client is freed with pico_http_close as usual.
  *
  */
 int32_t pico_http_respond_mimetype(uint16_t conn, uint16_t code, const char* mimetype)
@@ -346,7 +1141,11 @@ int32_t pico_http_respond_mimetype(uint16_t conn, uint16_t code, const char* mim
         return HTTP_RETURN_ERROR;
     }
 
-    if (client->state == HTTP_WAIT_RESPONSE)
+    if (client->state == HTTP_WAIT_RESPONSE && client->h2_stream)
+    {
+        return http2_respond(client, code, mimetype);
+    }
+    else if (client->state == HTTP_WAIT_RESPONSE)
     {
         if (code & HTTP_RESOURCE_FOUND)
         {
@@ -363,22 +1162,35 @@ int32_t pico_http_respond_mimetype(uint16_t conn, uint16_t code, const char* mim
             if (code & HTTP_CACHEABLE_RESOURCE)
             {
                 int32_t length = construct_return_ok_header(retheader, HTTP_CACHEABLE_RESOURCE, mimetype);
-                uint8_t rv = pico_socket_write(client->sck, retheader, length ); /* remove \0 */
+                int32_t rv = transport_write(client, retheader, (uint32_t)length);
                 PICO_FREE(retheader);
+                if (client->method == HTTP_METHOD_HEAD)
+                    finish_head(client);
                 return rv;
             }
             else
             {
                 int32_t length = construct_return_ok_header(retheader, HTTP_STATIC_RESOURCE, mimetype);
-                uint8_t rv = pico_socket_write(client->sck, retheader, length ); /* remove \0 */
+                int32_t rv = transport_write(client, retheader, (uint32_t)length);
                 PICO_FREE(retheader);
+                if (client->method == HTTP_METHOD_HEAD)
+                    finish_head(client);
                 return rv;
             }
         }
         else
         {
             int32_t length;
-            length = pico_socket_write(client->sck, (const uint8_t *)return_fail_header, sizeof(return_fail_header) - 1); /* remove \0 */
+            uint32_t fail_len = sizeof(return_fail_header) - 1; /* remove \0 */
+
+            if (client->method == HTTP_METHOD_HEAD)
+                fail_len -= (uint32_t)(sizeof(HTTP_FAIL_BODY) - 1);
+
+            if (code & HTTP_RESOURCE_BAD_GATEWAY)
+                length = transport_write(client, bad_gateway_header, sizeof(bad_gateway_header) - 1);
+            else
+                length = transport_write(client, return_fail_header, fail_len);
+            transport_close(client);
             pico_socket_close(client->sck);
             client->state = HTTP_CLOSED;
             return length;
@@ -404,70 +1216,76 @@ int32_t pico_http_respond_mimetype(uint16_t conn, uint16_t code, const char* mim
  * If a resource is reported not found the 404 header will be sent and the connection
  * will be closed , otherwise the 200 header is sent and the user should
  * immediately submit (static) data.
- *
-*/
-int32_t pico_http_respond(uint16_t conn, uint16_t code)
-{
-    struct http_client *client = find_client(conn);
-
-    if (!client)
-    {
-        dbg("Client not found !\n");
-        return HTTP_RETURN_ERROR;
-    }
-
-    if (client->state == HTTP_WAIT_RESPONSE)
-    {
-        if (code & HTTP_RESOURCE_FOUND)
-        {
-            client->state = (code & HTTP_STATIC_RESOURCE) ? HTTP_WAIT_STATIC_DATA : HTTP_WAIT_DATA;
-
-            /* Try to guess MIME type */
-            const char* mimetype = pico_http_get_mimetype(client->resource);
-
-            uint16_t len = HTTP_OK_HEADER_FIXED;
-            if (mimetype != NULL)
-                len += (uint16_t)strlen(mimetype);
-            char *retheader = PICO_ZALLOC(len);
-            if (!retheader)
-            {
-                pico_err = PICO_ERR_ENOMEM;
-                return HTTP_RETURN_ERROR;
-            }
-
-            if (code & HTTP_CACHEABLE_RESOURCE)
-            {
-                int32_t length = construct_return_ok_header(retheader, HTTP_CACHEABLE_RESOURCE, mimetype);
-                uint8_t rv = pico_socket_write(client->sck, retheader, length ); /* remove \0 */
-                PICO_FREE(retheader);
-                retheader = NULL;
-                return rv;
-            }
-            else
-            {
-                int32_t length = construct_return_ok_header(retheader, HTTP_STATIC_RESOURCE, mimetype);
-                uint8_t rv = pico_socket_write(client->sck, retheader, length ); /* remove \0 */
-                PICO_FREE(retheader);
-                retheader = NULL;
-                return rv;
-            }
-        }
-        else
-        {
-            int32_t length;
+ *
+*/
+int32_t pico_http_respond(uint16_t conn, uint16_t code)
+{
+    struct http_client *client = find_client(conn);
 
-            length = pico_socket_write(client->sck, (const uint8_t *)return_fail_header, sizeof(return_fail_header) - 1); /* remove \0 */
-            pico_socket_close(client->sck);
-            client->state = HTTP_CLOSED;
-            return length;
+    if (!client)
+    {
+        dbg("Client not found !\n");
+        return HTTP_RETURN_ERROR;
+    }
 
-        }
+    /* Try to guess MIME type */
+    return pico_http_respond_mimetype(conn, code, pico_http_get_mimetype(client->resource));
+}
+
+/*
+ * Like pico_http_respond, with any status and the given header fields
+ * (lines ended by CRLF, or NULL), e.g. to relay the answer of another
+ * server. The body is sent with pico_http_submit_data, so the fields
+ * must not carry Content-Length or Transfer-Encoding. The answer to HEAD
+ * and 204 and 304 answers end with the header instead, their fields may
+ * carry Content-Length. On HTTP/2 only the status is sent.
+ */
+int32_t pico_http_respond_status(uint16_t conn, uint16_t status, const char *reason, const char *fields)
+{
+    struct http_client *client = find_client(conn);
+    struct pico_http2 *h2;
+    uint8_t nobody;
+    char *header;
+    int32_t ret;
+
+    if (!client || !reason)
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
     }
-    else
+
+    if (client->state != HTTP_WAIT_RESPONSE)
     {
         dbg("Bad state for the client \n");
         return HTTP_RETURN_ERROR;
     }
+
+    nobody = (client->method == HTTP_METHOD_HEAD || status == HTTP_NO_CONTENT || status == HTTP_NOT_MODIFIED);
+    if (client->h2_stream)
+    {
+        /* the state is set first: the engine may close the stream right away */
+        h2 = client->h2_parent ? client->h2_parent->h2 : NULL;
+        client->state = nobody ? HTTP_CLOSED : HTTP_WAIT_DATA;
+        return pico_http2_respond(h2, client->h2_stream, status, NULL, 0, nobody);
+    }
+
+    header = PICO_ZALLOC(HTTP_STATUS_HEADER_FIXED + strlen(reason) + (fields ? strlen(fields) : 0u));
+    if (!header)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
+
+    sprintf(header, "HTTP/1.1 %u %s\r\n%s%sConnection: close\r\n\r\n", (unsigned int)status, reason,
+            fields ? fields : "", nobody ? "" : "Transfer-Encoding: chunked\r\n");
+    ret = transport_write(client, header, (uint32_t)strlen(header));
+    PICO_FREE(header);
+    if (nobody)
+        finish_head(client);
+    else
+        client->state = HTTP_WAIT_DATA;
+
+    return ret;
 }
 
 /*
@@ -476,20 +1294,26 @@ int32_t pico_http_respond(uint16_t conn, uint16_t code)
  *
  * With this function the user will submit a data chunk to
  * be sent. If it's static data the function will not allocate a buffer.
- * The function will send the chunk size in hex and the rest will
- * be sent using WR event from sockets.
- * After each transmision EV_HTTP_PROGRESS is called and at the
- * end of the chunk EV_HTTP_SENT is called.
+ * The chunk size line and trail are framed around the data so that the
+ * chunk is written in one go; whatever the socket does not take right
+ * away is sent using WR event from sockets.
+ * After each transmision EV_HTTP_PROGRESS is called, also from within
+ * this call, and at the end of the chunk EV_HTTP_SENT is called.
  *
  * To let the client know this is the last chunk, the user
  * should pass a NULL buffer.
+ *
+ * If the socket fails, the connection is closed: from here the call
+ * returns an error, from the WR event EV_HTTP_ERROR is raised.
+ *
+ * The answer to HEAD has no body: the data is dropped and EV_HTTP_SENT
+ * is called from within this call, the final chunk does nothing.
  */
 int16_t pico_http_submit_data(uint16_t conn, void *buffer, uint16_t len)
 {
 
     struct http_client *client = find_client(conn);
-    char chunk_str[10];
-    int16_t chunk_count;
+    int32_t ret;
 
     if (!client)
     {
@@ -497,6 +1321,16 @@ int16_t pico_http_submit_data(uint16_t conn, void *buffer, uint16_t len)
         return HTTP_RETURN_ERROR;
     }
 
+    /* the answer to HEAD is complete with the header, there is no body to send */
+    if (client->method == HTTP_METHOD_HEAD && client->state == HTTP_CLOSED)
+    {
+        /* the client may be closed from here */
+        if (buffer && len)
+            client->wakeup(EV_HTTP_SENT, client->connectionID);
+
+        return HTTP_RETURN_OK;
+    }
+
     if (client->state != HTTP_WAIT_DATA && client->state != HTTP_WAIT_STATIC_DATA)
     {
         dbg("Client is in a different state than accepted\n");
@@ -509,48 +1343,38 @@ int16_t pico_http_submit_data(uint16_t conn, void *buffer, uint16_t len)
         return HTTP_RETURN_ERROR;
     }
 
+    if (client->h2_stream)
+        return http2_submit(client, buffer, len);
+
     if (!buffer)
     {
         len = 0;
     }
 
-    if (len > 0)
-    {
-        if (client->state == HTTP_WAIT_STATIC_DATA)
-        {
-            client->buffer = buffer;
-        }
-        else
-        {
-            client->buffer = PICO_ZALLOC(len);
-            if (!client->buffer)
-            {
-                pico_err = PICO_ERR_ENOMEM;
-                return HTTP_RETURN_ERROR;
-            }
-
-            /* taking over the buffer */
-            memcpy(client->buffer, buffer, len);
-        }
-    }
-    else
-        client->buffer = NULL;
-
-
     client->buffer_size = len;
     client->buffer_sent = 0;
 
-    /* create the chunk size and send it */
     if (len > 0)
     {
+        if (frame_chunk(client, buffer, len) < 0)
+            return HTTP_RETURN_ERROR;
+
         client->state = (client->state == HTTP_WAIT_DATA) ? HTTP_SENDING_DATA : HTTP_SENDING_STATIC_DATA;
-        chunk_count = pico_itoaHex(client->buffer_size, chunk_str);
-        chunk_str[chunk_count++] = '\r';
-        chunk_str[chunk_count++] = '\n';
-        pico_socket_write(client->sck, chunk_str, chunk_count);
+        /* push out what the socket takes now, the rest goes on the WR event */
+        ret = write_chunk(client);
+        if (ret < 0)
+        {
+            chunk_failed(client);
+            return HTTP_RETURN_ERROR;
+        }
+
+        /* the client may be closed from here, it is not used anymore */
+        if (ret > 0)
+            client->wakeup(EV_HTTP_PROGRESS, client->connectionID);
     }
     else
     {
+        client->buffer = NULL;
         send_final(client);
     }
 
@@ -605,7 +1429,19 @@ int16_t pico_http_close(uint16_t conn)
                 if (client->body)
                     PICO_FREE(client->body);
 
-                pico_socket_close(client->sck);
+                if (client->fields)
+                    PICO_FREE(client->fields);
+
+                if (client->h2)
+                    pico_http2_destroy(client->h2);
+
+                /* streams have no transport of their own */
+                if (!client->h2_stream)
+                {
+                    transport_close(client);
+                    pico_socket_close(client->sck);
+                }
+
                 pico_tree_delete(&pico_http_clients, client);
             }
 
@@ -627,6 +1463,16 @@ int16_t pico_http_close(uint16_t conn)
 
         pico_tree_delete(&pico_http_clients, client);
 
+        /* an unfinished response is cancelled, a finished one still goes out */
+        if (client->h2_parent && client->state != HTTP_CLOSED)
+            pico_http2_reset(client->h2_parent->h2, client->h2_stream);
+
+        if (client->h2)
+        {
+            http2_detach_streams(client);
+            pico_http2_destroy(client->h2);
+        }
+
         if (client->resource)
             PICO_FREE(client->resource);
 
@@ -636,6 +1482,16 @@ int16_t pico_http_close(uint16_t conn)
         if (client->body)
             PICO_FREE(client->body);
 
+        if (client->fields)
+            PICO_FREE(client->fields);
+
+        if (client->h2_stream)
+        {
+            PICO_FREE(client);
+            return HTTP_RETURN_OK;
+        }
+
+        transport_close(client);
         if (client->state != HTTP_CLOSED || !client->sck)
             pico_socket_close(client->sck);
 
@@ -707,79 +1563,138 @@ static int16_t parse_request_read_resource(struct http_client *client, uint32_t
     return 0;
 }
 
-static int32_t parse_request_get(struct http_client *client, char *line)
+static int32_t parse_request_method(struct http_client *client, char *line, uint8_t index, const struct http_method_name *m)
 {
     int32_t ret;
 
-    ret = parse_request_consume_full_line(client, line);
-    if (ret < 0)
-        return ret;
-
-    ret = parse_request_extract_function(line, ret, "GET");
+    ret = parse_request_extract_function(line, index, m->name);
     if (ret)
         return ret;
 
-    ret = parse_request_read_resource(client, strlen("GET"), line);
+    ret = parse_request_read_resource(client, strlen(m->name), line);
     if (ret)
         return ret;
 
     client->state = HTTP_WAIT_EOF_HDR;
-    client->method = HTTP_METHOD_GET;
+    client->method = m->method;
     return HTTP_RETURN_OK;
 }
 
-static int32_t parse_request_post(struct http_client *client, char *line)
+/* check the integrity of the request */
+int16_t parse_request(struct http_client *client)
 {
-    int32_t ret;
+    uint8_t c = 0;
+    char *line;
+    int32_t index;
+    uint32_t i;
+    int16_t rv = HTTP_RETURN_ERROR;
 
-    ret = parse_request_consume_full_line(client, line);
-    if (ret < 0)
-        return ret;
+    /* nothing to parse yet, e.g. a TLS record without application data */
+    if (consume_char(c) <= 0)
+        return HTTP_RETURN_OK;
 
-    ret = parse_request_extract_function(line, ret, "POST");
-    if (ret)
-        return ret;
+    line = (char *)PICO_ZALLOC(HTTP_HEADER_MAX_LINE + 1u);
+    if (!line)
+    {
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
+    }
 
-    ret = parse_request_read_resource(client, strlen("POST"), line);
-    if (ret)
-        return ret;
+    /* read first line */
+    line[0] = (char)c;
+    index = parse_request_consume_full_line(client, line);
+    if (index < 0)
+    {
+        PICO_FREE(line);
+        return HTTP_RETURN_ERROR;
+    }
 
-    client->state = HTTP_WAIT_EOF_HDR;
-    client->method = HTTP_METHOD_POST;
-    return HTTP_RETURN_OK;
+    if ((uint32_t)index + 1u == HTTP2_PREFACE_LINE_LEN && !memcmp(line, HTTP2_PREFACE, HTTP2_PREFACE_LINE_LEN))
+    {
+        rv = http2_start(client, line, HTTP2_PREFACE_LINE_LEN);
+    }
+    else
+    {
+        for (i = 0; i < sizeof(http_methods) / sizeof(http_methods[0]); i++)
+        {
+            uint32_t len = (uint32_t)strlen(http_methods[i].name);
+
+            /* the whole token, methods may share a prefix */
+            if (!memcmp(line, http_methods[i].name, len) && line[len] == ' ')
+            {
+                rv = (int16_t)parse_request_method(client, line, (uint8_t)index, &http_methods[i]);
+                break;
+            }
+        }
+    }
+
+    PICO_FREE(line);
+    return rv;
 }
 
-/* check the integrity of the request */
-int16_t parse_request(struct http_client *client)
+/* the length of name if the header line starts with it, 0 if not */
+static uint32_t header_field_is(struct http_client *client, uint32_t len, const char *name)
 {
-    uint8_t c = 0;
-    char *line = (char *)PICO_ZALLOC(HTTP_HEADER_MAX_LINE);
-    if (!line)
+    uint32_t i;
+
+    /* field names are case insensitive, the name only has letters, '-' and ':' */
+    for (i = 0; name[i]; i++)
+    {
+        if (i >= len || (client->hdr_field[i] | 0x20) != name[i])
+            return 0;
+    }
+    return i;
+}
+
+/* picks the fields the server needs out of a complete header line */
+static void parse_header_field(struct http_client *client)
+{
+    uint32_t len = (client->hdr_line_len < HTTP_HDR_FIELD_KEEP) ? client->hdr_line_len : HTTP_HDR_FIELD_KEEP;
+    uint32_t i;
+
+    if (header_field_is(client, len, HTTP_TRANSFER_ENCODING))
+    {
+        client->chunked_body = 1u;
+        return;
+    }
+
+    i = header_field_is(client, len, HTTP_CONTENT_LENGTH);
+    if (!i)
+        return;
+
+    while (i < len && client->hdr_field[i] == ' ')
+        i++;
+
+    client->content_length = 0;
+    while (i < len && client->hdr_field[i] >= '0' && client->hdr_field[i] <= '9')
+        client->content_length = client->content_length * 10u + (uint32_t)(client->hdr_field[i++] - '0');
+}
+
+/* adds c to the kept header fields, once they are cut nothing is kept */
+static void keep_field(struct http_client *client, char c)
+{
+    if (!server.keep_fields || client->fields_cut)
+        return;
+
+    if (!client->fields)
+    {
+        client->fields = PICO_ZALLOC((uint32_t)server.keep_fields + 1u);
+        if (!client->fields)
         {
-            pico_err = PICO_ERR_ENOMEM;
-            return HTTP_RETURN_ERROR;
+            client->fields_cut = 1u;
+            return;
         }
-
-    /* read first line */
-    consume_char(c);
-    line[0] = c;
-    if (c == 'G')
-    { /* possible GET */
-        uint8_t rv = parse_request_get(client, line);
-        PICO_FREE(line);
-        line = NULL;
-        return rv;
     }
-    else if (c == 'P')
-    { /* possible POST */
-        uint8_t rv = parse_request_post(client, line);
-        PICO_FREE(line);
-        line = NULL;
-        return rv;
+
+    if (client->fields_len >= server.keep_fields)
+    {
+        PICO_FREE(client->fields);
+        client->fields = NULL;
+        client->fields_cut = 1u;
+        return;
     }
-    PICO_FREE(line);
-    line = NULL;
-    return HTTP_RETURN_ERROR;
+
+    client->fields[client->fields_len++] = c;
 }
 
 int16_t read_remaining_header(struct http_client *client)
@@ -790,35 +1705,39 @@ int16_t read_remaining_header(struct http_client *client)
             pico_err = PICO_ERR_ENOMEM;
             return HTTP_RETURN_ERROR;
         }
-    int32_t count = 0;
     int32_t len;
 
-    while ((len = pico_socket_read(client->sck, line, 1000u)) > 0)
+    while ((len = transport_read(client, line, 1000u)) > 0)
     {
         uint8_t c;
         int32_t index = 0;
-        uint32_t body_len = 0;
         /* parse the response */
         while (index < len)
         {
             c = line[index++];
             if (c != '\r' && c != '\n')
-                count++;
+            {
+                if (client->hdr_line_len < HTTP_HDR_FIELD_KEEP)
+                    client->hdr_field[client->hdr_line_len] = (char)c;
+
+                client->hdr_line_len++;
+                keep_field(client, (char)c);
+            }
 
             if (c == '\n')
             {
-                if (!count)
+                if (!client->hdr_line_len)
                 {
                     client->state = HTTP_EOF_HDR;
                     /*dbg("End of header !\n");*/
 
-                    body_len = (uint32_t)(len - index);
-                    if (body_len > 0)
+                    client->body_len = (uint32_t)(len - index);
+                    if (client->body_len > 0)
                     {
-                        client->body = PICO_ZALLOC(body_len + 1u);
+                        client->body = PICO_ZALLOC(client->body_len + 1u);
                         if (client->body)
                         {
-                            memcpy(client->body, line + index, body_len);
+                            memcpy(client->body, line + index, client->body_len);
                         }
                         else
                         {
@@ -831,50 +1750,196 @@ int16_t read_remaining_header(struct http_client *client)
                     break;
                 }
 
-                count = 0;
+                parse_header_field(client);
+                client->hdr_line_len = 0;
+                keep_field(client, '\r');
+                keep_field(client, '\n');
 
             }
         }
+
+        /* the rest belongs to the body, leave it in the socket */
+        if (client->state == HTTP_EOF_HDR)
+            break;
     }
     PICO_FREE(line);
     line = NULL;
     return HTTP_RETURN_OK;
 }
 
-void send_data(struct http_client *client)
+/*
+ * Lays out a chunk as size line + payload + CRLF.
+ *
+ * Dynamic data is copied once anyway, so the framing goes in the same
+ * allocation and the chunk is a single contiguous write. Static data is
+ * not copied up front: the framed chunk goes out through the stage, a
+ * full stage per write, so a chunk that fits leaves in one write too.
+ */
+static int16_t frame_chunk(struct http_client *client, void *buffer, uint16_t len)
 {
-    uint16_t length;
-    while (client->buffer_sent < client->buffer_size &&
-           (length = (uint16_t)pico_socket_write(client->sck, (uint8_t *)client->buffer + client->buffer_sent, \
-                                                 client->buffer_size - client->buffer_sent)) > 0 )
+    uint16_t hdr_len;
+    uint8_t *frame;
+
+    hdr_len = (uint16_t)pico_itoaHex(len, client->chunk_hdr);
+    client->chunk_hdr[hdr_len++] = '\r';
+    client->chunk_hdr[hdr_len++] = '\n';
+
+    client->chunk_hdr_len = hdr_len;
+    client->chunk_wire_len = (uint32_t)hdr_len + len + HTTP_CHUNK_TRAIL_LEN;
+    client->chunk_wire_sent = 0;
+    client->stage_len = 0;
+    client->stage_sent = 0;
+
+    if (client->state != HTTP_WAIT_DATA)
+    {
+        client->buffer = buffer;
+        return HTTP_RETURN_OK;
+    }
+
+    frame = PICO_ZALLOC(client->chunk_wire_len);
+    if (!frame)
     {
-        client->buffer_sent = (uint16_t)(client->buffer_sent + length);
-        server.wakeup(EV_HTTP_PROGRESS, client->connectionID);
+        pico_err = PICO_ERR_ENOMEM;
+        return HTTP_RETURN_ERROR;
     }
-    if (client->buffer_sent == client->buffer_size && client->buffer_size)
+
+    /* taking over the buffer */
+    memcpy(frame, client->chunk_hdr, hdr_len);
+    memcpy(frame + hdr_len, buffer, len);
+    memcpy(frame + hdr_len + len, "\r\n", HTTP_CHUNK_TRAIL_LEN);
+    client->buffer = frame;
+    return HTTP_RETURN_OK;
+}
+
+/* copies the next stage full of the framed static chunk */
+static void fill_stage(struct http_client *client)
+{
+    const struct http_chunk_piece pieces[HTTP_CHUNK_PIECES] = {
+        { (const uint8_t *)client->chunk_hdr, client->chunk_hdr_len },
+        { (const uint8_t *)client->buffer, client->buffer_size },
+        { (const uint8_t *)"\r\n", HTTP_CHUNK_TRAIL_LEN }
+    };
+    uint32_t skip = client->chunk_wire_sent;
+    uint32_t i, n;
+
+    client->stage_len = 0;
+    client->stage_sent = 0;
+    for (i = 0; i < HTTP_CHUNK_PIECES && client->stage_len < HTTP_CHUNK_STAGE_SIZE; i++)
     {
-        /* send chunk trail */
-        if (pico_socket_write(client->sck, "\r\n", 2) > 0)
+        if (skip >= pieces[i].len)
         {
-            /* free the buffer */
-            if (client->state == HTTP_SENDING_DATA)
-            {
-                PICO_FREE(client->buffer);
-            }
+            skip -= pieces[i].len;
+            continue;
+        }
+
+        n = pieces[i].len - skip;
+        if (n > HTTP_CHUNK_STAGE_SIZE - client->stage_len)
+            n = HTTP_CHUNK_STAGE_SIZE - client->stage_len;
+
+        memcpy(client->stage + client->stage_len, pieces[i].ptr + skip, n);
+        client->stage_len = (uint16_t)(client->stage_len + n);
+        skip = 0;
+    }
+}
+
+/*
+ * Writes the rest of the current chunk until the socket stops accepting
+ * data. Returns the number of bytes written, or HTTP_RETURN_ERROR if the
+ * transport failed.
+ */
+static int32_t write_chunk(struct http_client *client)
+{
+    int32_t written = 0;
+    int32_t length;
+    uint32_t payload_sent;
+
+    while (client->chunk_wire_sent < client->chunk_wire_len)
+    {
+        const uint8_t *ptr;
+        uint32_t avail;
 
-            client->buffer = NULL;
+        if (client->state == HTTP_SENDING_DATA)
+        {
+            ptr = (const uint8_t *)client->buffer + client->chunk_wire_sent;
+            avail = client->chunk_wire_len - client->chunk_wire_sent;
+        }
+        else
+        {
+            if (client->stage_sent == client->stage_len)
+                fill_stage(client);
 
-            client->state = HTTP_WAIT_DATA;
-            server.wakeup(EV_HTTP_SENT, client->connectionID);
+            ptr = client->stage + client->stage_sent;
+            avail = (uint32_t)(client->stage_len - client->stage_sent);
         }
+
+        length = transport_write(client, ptr, avail);
+        if (length < 0)
+            return HTTP_RETURN_ERROR;
+
+        if (length == 0)
+            break;
+
+        client->chunk_wire_sent += (uint32_t)length;
+        if (client->state != HTTP_SENDING_DATA)
+            client->stage_sent = (uint16_t)(client->stage_sent + length);
+
+        written += length;
+        if ((uint32_t)length < avail)
+            break;
     }
 
+    /* progress is reported in payload bytes, without the framing */
+    payload_sent = (client->chunk_wire_sent > client->chunk_hdr_len) ? (client->chunk_wire_sent - client->chunk_hdr_len) : 0u;
+    client->buffer_sent = (uint16_t)((payload_sent > client->buffer_size) ? client->buffer_size : payload_sent);
+    return written;
+}
+
+/* the chunk can not go out, neither can anything after it */
+static void chunk_failed(struct http_client *client)
+{
+    if (client->state == HTTP_SENDING_DATA)
+        PICO_FREE(client->buffer);
+
+    client->buffer = NULL;
+    transport_close(client);
+    pico_socket_close(client->sck);
+    client->state = HTTP_CLOSED;
+}
+
+void send_data(struct http_client *client)
+{
+    int32_t ret = write_chunk(client);
+
+    if (ret < 0)
+    {
+        chunk_failed(client);
+        client->wakeup(EV_HTTP_ERROR, client->connectionID);
+        return;
+    }
+
+    if (ret > 0)
+        client->wakeup(EV_HTTP_PROGRESS, client->connectionID);
+
+    if (client->chunk_wire_sent == client->chunk_wire_len)
+    {
+        /* free the buffer */
+        if (client->state == HTTP_SENDING_DATA)
+        {
+            PICO_FREE(client->buffer);
+        }
+
+        client->buffer = NULL;
+
+        client->state = HTTP_WAIT_DATA;
+        client->wakeup(EV_HTTP_SENT, client->connectionID);
+    }
 }
 
 void send_final(struct http_client *client)
 {
-    if (pico_socket_write(client->sck, "0\r\n\r\n", 5u) != 0)
+    if (transport_write(client, "0\r\n\r\n", 5u) != 0)
     {
+        transport_close(client);
         pico_socket_close(client->sck);
         client->state = HTTP_CLOSED;
     }
@@ -894,21 +1959,58 @@ int32_t read_data(struct http_client *client)
 
     if (client->state == HTTP_WAIT_HDR)
     {
-        if (parse_request(client) < 0 || read_remaining_header(client) < 0)
-        {
+        if (parse_request(client) < 0)
             return HTTP_RETURN_ERROR;
-        }
-    } /* continue with this in case the header comes line by line not a big chunk */
-    else if (client->state == HTTP_WAIT_EOF_HDR)
+
+        if (client->state == HTTP_H2)
+            return http2_input(client);
+    }
+    else if (client->state == HTTP_H2)
     {
-        if (read_remaining_header(client) < 0 )
-            return HTTP_RETURN_ERROR;
+        return http2_input(client);
+    }
+    else if (client->state != HTTP_WAIT_EOF_HDR)
+    {
+        /* header is done, whatever arrives now is request body */
+        if (client->state != HTTP_ERROR && client->state != HTTP_CLOSED)
+            client->wakeup(EV_HTTP_BODY, client->connectionID);
+
+        return HTTP_RETURN_OK;
     }
 
+    /* continue with this in case the header comes line by line not a big chunk */
+    if (client->state == HTTP_WAIT_EOF_HDR && read_remaining_header(client) < 0)
+        return HTTP_RETURN_ERROR;
+
     if (client->state == HTTP_EOF_HDR)
     {
+        if (rate_limited(client->addr, 1u))
+        {
+            /* answered here, the application never sees the request */
+            answer_and_close(client, too_many_header, sizeof(too_many_header) - 1);
+            return HTTP_RETURN_OK;
+        }
+
+        if (client->chunked_body)
+        {
+            /* the body could not be told from the next request */
+            answer_and_close(client, length_required_header, sizeof(length_required_header) - 1);
+            return HTTP_RETURN_OK;
+        }
+
+        if (client->method == HTTP_METHOD_OPTIONS)
+        {
+            /* prebuilt answer, the application is not involved */
+            answer_and_close(client, server.options_header, server.options_len);
+            return HTTP_RETURN_OK;
+        }
+
         client->state = HTTP_WAIT_RESPONSE;
-        server.wakeup(EV_HTTP_REQ, client->connectionID);
+        /* the hook may hand the connection to another handler */
+        if (server.request_hook)
+            server.request_hook(client->connectionID);
+
+        client->wakeup(EV_HTTP_REQ, client->connectionID);
     }
 
     return HTTP_RETURN_OK;
@@ -16,15 +16,46 @@
 #define HTTP_RESOURCE_FOUND         2u
 #define HTTP_STATIC_RESOURCE        4u
 #define HTTP_CACHEABLE_RESOURCE      8u
+#define HTTP_RESOURCE_BAD_GATEWAY   16u
 
 /* Generic id for the server */
 #define HTTP_SERVER_ID                  0u
 
+struct pico_socket;
+
+/*
+ * Transport used by the server for every connection. Plain TCP is used
+ * by default, other transports (e.g. TLS) are given to
+ * pico_http_server_start_transport.
+ *
+ * accept:    sets up an accepted socket, returns the context passed to
+ *            the other functions or NULL to reject the connection
+ * handshake: optional, returns 0 once complete. Until then no request
+ *            data is read; it is called again on the next socket event
+ * read/write: same semantics as pico_socket_read/pico_socket_write
+ * close:     optional, ends and frees the context. The socket is closed
+ *            by the server
+ */
+struct pico_http_transport
+{
+    void *(*accept)(struct pico_socket *s);
+    int32_t (*handshake)(void *ctx);
+    int32_t (*read)(void *ctx, void *buf, uint32_t len);
+    int32_t (*write)(void *ctx, const void *buf, uint32_t len);
+    void (*close)(void *ctx);
+};
+
 /*
  * Server functions
  */
 int16_t pico_http_server_start(uint16_t port, void (*wakeup)(uint16_t ev, uint16_t conn));
+int16_t pico_http_server_start_transport(uint16_t port, void (*wakeup)(uint16_t ev, uint16_t conn),
+                                         const struct pico_http_transport *transport);
 int32_t pico_http_server_accept(void);
+int16_t pico_http_server_set_rate_limit(uint16_t burst, uint32_t refill_ms);
+int16_t pico_http_server_set_options(const char *methods, const char *origin);
+int16_t pico_http_server_set_request_hook(void (*hook)(uint16_t conn));
+int16_t pico_http_server_keep_fields(uint16_t size);
 
 /*
  * Client functions
@@ -32,6 +63,9 @@ int32_t pico_http_server_accept(void);
 char *pico_http_get_resource(uint16_t conn);
 int16_t pico_http_get_method(uint16_t conn);
 char *pico_http_get_body(uint16_t conn);
+uint32_t pico_http_get_content_length(uint16_t conn);
+const char *pico_http_get_fields(uint16_t conn);
+int32_t pico_http_read_body(uint16_t conn, void *buf, uint32_t len);
 int16_t pico_http_get_progress(uint16_t conn, uint16_t *sent, uint16_t *total);
 
 /*
@@ -39,7 +73,9 @@ int16_t pico_http_get_progress(uint16_t conn, uint16_t *sent, uint16_t *total);
  */
 int32_t pico_http_respond_mimetype(uint16_t conn, uint16_t code, const char* mimetype);
 int32_t pico_http_respond(uint16_t conn, uint16_t code);
+int32_t pico_http_respond_status(uint16_t conn, uint16_t status, const char *reason, const char *fields);
 int16_t pico_http_submit_data(uint16_t conn, void *buffer, uint16_t len);
 int16_t pico_http_close(uint16_t conn);
+int16_t pico_http_set_wakeup(uint16_t conn, void (*wakeup)(uint16_t ev, uint16_t conn));
 
 #endif /* PICO_HTTP_SERVER_H_ */
@@ -107,35 +107,48 @@ uint32_t pico_itoa(uint32_t port, char *ptr)
     return size;
 }
 
+/* value of a hex digit, 0xFF for any other character */
+static const uint8_t http_hex_value[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+#define HTTP_PARAM_HASH_INIT    2166136261u
+
+/* FNV-1a, lets lookups skip most keys without a string compare */
+static inline uint32_t param_hash_step(uint32_t hash, uint8_t c)
+{
+    return (hash ^ c) * 16777619u;
+}
+
 /*
  * The function decodes a percent-encoded url (src).
- * The result is saved to dst.
+ * The result is saved to dst, which may be src itself.
  */
 void pico_http_url_decode(char *dst, const char *src)
 {
-    char a, b;
     while (*src) {
+        uint8_t hi, lo;
+
         if ((*src == '%') &&
-            ((a = src[1]) && (b = src[2])) &&
-            (pico_is_hex(a) && pico_is_hex(b)))
+            ((hi = http_hex_value[(uint8_t)src[1]]) != 0xFFu) &&
+            ((lo = http_hex_value[(uint8_t)src[2]]) != 0xFFu))
         {
-            if (a >= 'a')
-                a = (char)(a - 'a' - 'A');
-
-            if (a >= 'A')
-                a = (char)(a - 'A' - 10);
-            else
-                a = (char)(a - '0');
-
-            if (b >= 'a')
-                b = (char)(b - 'a' - 'A');
-
-            if (b >= 'A')
-                b = (char)(b - ('A' - 10));
-            else
-                b = (char)(b - '0');
-
-            *dst++ = (char)(16 * a + b);
+            *dst++ = (char)((hi << 4u) | lo);
             src += 3;
         }
         else
@@ -145,6 +158,147 @@ void pico_http_url_decode(char *dst, const char *src)
     }
     *dst++ = '\0';
 }
+
+/*
+ * Decodes one key or value in place, '+' becomes a space.
+ * Stops at '&', '#', the end of the string or, for keys, at '='.
+ * Returns the position of the character that stopped it.
+ */
+static char *param_decode(char **dst, char *src, uint8_t is_key, uint32_t *hash)
+{
+    char *out = *dst;
+    uint32_t h = HTTP_PARAM_HASH_INIT;
+
+    while (*src && *src != '&' && *src != '#' && !(is_key && *src == '='))
+    {
+        uint8_t c = (uint8_t)*src++;
+
+        if (c == '+')
+        {
+            c = ' ';
+        }
+        else if (c == '%' && http_hex_value[(uint8_t)src[0]] != 0xFFu && http_hex_value[(uint8_t)src[1]] != 0xFFu)
+        {
+            c = (uint8_t)((http_hex_value[(uint8_t)src[0]] << 4u) | http_hex_value[(uint8_t)src[1]]);
+            src += 2;
+        }
+
+        *out++ = (char)c;
+        h = param_hash_step(h, c);
+    }
+
+    *dst = out;
+    if (hash)
+        *hash = h;
+
+    return src;
+}
+
+/*
+ * Splits the query off a resource: the resource is cut at the '?'
+ * and the query string behind it is returned, or NULL if there is none.
+ */
+char *pico_http_split_query(char *resource)
+{
+    char *query;
+
+    if (!resource)
+        return NULL;
+
+    query = strchr(resource, '?');
+    if (!query)
+        return NULL;
+
+    *query++ = '\0';
+    return query;
+}
+
+/*
+ * Parses a query string or an application/x-www-form-urlencoded body
+ * in one pass. The string is decoded in place and params point into it,
+ * nothing is allocated. Pairs without '=' get an empty value.
+ *
+ * Returns the number of pairs stored, at most max_params.
+ */
+int32_t pico_http_parse_params(char *str, struct pico_http_param *params, uint32_t max_params)
+{
+    char *src = str;
+    char *dst = str;
+    uint32_t count = 0;
+
+    if (!str || (!params && max_params))
+    {
+        pico_err = PICO_ERR_EINVAL;
+        return HTTP_RETURN_ERROR;
+    }
+
+    while (*src && *src != '#' && count < max_params)
+    {
+        struct pico_http_param *param;
+        char stop;
+
+        if (*src == '&')
+        {
+            src++;
+            continue;
+        }
+
+        param = &params[count++];
+        param->key = dst;
+        src = param_decode(&dst, src, 1u, &param->hash);
+        /* taken before the key is terminated, dst may still be src */
+        stop = *src;
+        *dst++ = '\0';
+
+        if (stop != '=')
+        {
+            /* no value, point at the terminator of the key */
+            param->value = dst - 1;
+            if (stop == '&')
+            {
+                src++;
+                continue;
+            }
+            break;
+        }
+
+        param->value = dst;
+        src = param_decode(&dst, src + 1, 0u, NULL);
+        stop = *src;
+        *dst++ = '\0';
+        if (stop == '&')
+            src++;
+        else
+            break;
+    }
+
+    return (int32_t)count;
+}
+
+/*
+ * Looks up the value of key among the parsed params.
+ * Returns NULL if the key is not present.
+ */
+char *pico_http_get_param(const struct pico_http_param *params, uint32_t count, const char *key)
+{
+    uint32_t hash = HTTP_PARAM_HASH_INIT;
+    const char *k;
+    uint32_t i;
+
+    if (!params || !key)
+        return NULL;
+
+    for (k = key; *k; k++)
+        hash = param_hash_step(hash, (uint8_t)*k);
+
+    for (i = 0; i < count; i++)
+    {
+        if (params[i].hash == hash && strcmp(params[i].key, key) == 0)
+            return params[i].value;
+    }
+    return NULL;
+}
+
 /*
     Function for guessing the mimetype based on the last part of the filename supplied (the file extension).
     If no good guess can be made (none of the supported extensions is found as a substring of the filename), NULL is returned. Otherwise the MIME-type string is returned.
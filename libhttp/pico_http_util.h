@@ -90,6 +90,8 @@
 /* HTTP Methods */
 #define HTTP_METHOD_GET     1u
 #define HTTP_METHOD_POST    2u
+#define HTTP_METHOD_HEAD    3u
+#define HTTP_METHOD_OPTIONS 4u
 
 /* List of events - shared between client and server */
 #define EV_HTTP_CON                     1u
@@ -104,6 +106,8 @@
 #define EV_HTTP_WRITE_FAILED            512u
 #define EV_HTTP_WRITE_PROGRESS_MADE     1024u
 #define EV_HTTP_LONG_POLL_ERROR         2048u
+#define EV_HTTP_DONE                    4096u   /* client: a response has been read completely */
+#define EV_HTTP_TIMEOUT                 8192u   /* client: a deadline passed, the connection is closed */
 
 struct pico_mime_map {
     const char * extension;
@@ -120,10 +124,21 @@ struct pico_http_uri
     char *resource;         /* resource , ignoring the other possible parameters */
 };
 
+/* key/value pair of a query string or urlencoded form, decoded in place */
+struct pico_http_param
+{
+    char *key;
+    char *value;
+    uint32_t hash;  /* of the key, speeds up lookups */
+};
+
 /* used for chunks */
 int pico_itoaHex(uint16_t port, char *ptr);
 uint32_t pico_itoa(uint32_t port, char *ptr);
 void pico_http_url_decode(char *dst, const char *src);
+char *pico_http_split_query(char *resource);
+int32_t pico_http_parse_params(char *str, struct pico_http_param *params, uint32_t max_params);
+char *pico_http_get_param(const struct pico_http_param *params, uint32_t count, const char *key);
 const char* pico_http_get_mimetype(char* resourcename);
 
 #endif /* PICO_HTTP_UTIL_H_ */
@@ -29,6 +29,7 @@
     #include "polarssl/ctr_drbg.h"
     #include "polarssl/x509.h"
     #include "polarssl/ssl.h"
+    #include "polarssl/net.h"
     #include "polarssl/error.h"
     #include "polarssl/debug.h"
 
@@ -37,6 +38,7 @@
 
     #define SSL_WRITE       ssl_write           // We expect a function with signature SSL_{READ/WRITE}(SSL_CONTEXT* , unsigned char* buf, int len)
     #define SSL_READ        ssl_read            // Both return num bytes successfully read/written
+    #define SSL_WOULD_BLOCK(ssl, ret)   ((ret) == POLARSSL_ERR_NET_WANT_READ || (ret) == POLARSSL_ERR_NET_WANT_WRITE)
 
     #define SSL_HANDSHAKE   ssl_handshake       // We expect int SSL_HANDSHAKE(SSL_CONTEXT*), returning 0 for "Handshake complete".
     
@@ -55,6 +57,7 @@
     #define SSL_CONTEXT     WOLFSSL
     #define SSL_WRITE       wolfSSL_write
     #define SSL_READ        wolfSSL_read
+    int SSL_WOULD_BLOCK(WOLFSSL* ssl, int ret); // Nonzero if a failed read/write only has to wait for the socket
     int SSL_HANDSHAKE(WOLFSSL* ssl); // We need to tweak retvals, can't directly map
     #define SSL_FREE        wolfSSL_free
     #define SSL_SHUTDOWN    wolfSSL_shutdown
@@ -36,6 +36,11 @@ int pico_https_ssl_init(const unsigned char* certificate_buffer,
     return 0;
 }
 
+#ifdef POLARSSL_SSL_ALPN
+// Offered so that browsers use HTTP/2, see pico_https_glue_wolfssl.c
+static const char *alpn_protocols[] = { "h2", "http/1.1", NULL };
+#endif
+
 /* PER-CONNECTION initialisation */
 ssl_context* pico_https_ssl_accept(struct pico_socket* sck){
 
@@ -48,6 +53,9 @@ ssl_context* pico_https_ssl_accept(struct pico_socket* sck){
 	ssl_set_rng( ret, ctr_drbg_random, &ctr_drbg );
     ssl_set_bio( ret, pico_polar_recv, sck,
                       pico_polar_send, sck );
+#ifdef POLARSSL_SSL_ALPN
+    ssl_set_alpn_protocols( ret, alpn_protocols );
+#endif
 	return ret;
 }
     
@@ -62,7 +70,7 @@ int pico_polar_send(void * pico_sock, const unsigned char * buf, size_t sz)
 	if (sent != 0)
 		return sent;
 	else
-		return -2; // WANT_WRITE. For non_blocking writes
+		return POLARSSL_ERR_NET_WANT_WRITE; // For non_blocking writes
 }
 
 int pico_polar_recv(void * pico_sock, unsigned char * buf, size_t sz)
@@ -75,7 +83,7 @@ int pico_polar_recv(void * pico_sock, unsigned char * buf, size_t sz)
 	if (read != 0)
 		return read;
 	else
-		return -2; // WANT_READ. Needed for non_blocking reads
+		return POLARSSL_ERR_NET_WANT_READ; // Needed for non_blocking reads
 }
 
 #endif // ifdef LIBHTTPS_USE_POLARSSL
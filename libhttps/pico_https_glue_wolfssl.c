@@ -34,13 +34,24 @@ int pico_https_ssl_init(const unsigned char* certificate_buffer,
     return 0;
 }
 
+#ifdef HAVE_ALPN
+// Browsers only speak HTTP/2 over TLS when "h2" was negotiated; the server
+// recognizes HTTP/2 by its preface, so nothing else depends on the outcome
+static char alpn_protocols[] = "h2,http/1.1";
+#endif
+
 /* PER-CONNECTION initialisation */
 WOLFSSL* pico_https_ssl_accept(struct pico_socket* sck){
     // Register sockets and metadata as Context for the glue
     WOLFSSL* ret = wolfSSL_new(SSL_Context);
+    if (!ret)
+        return NULL;
     wolfSSL_set_using_nonblock(ret, 1);
     wolfSSL_SetIOReadCtx(ret, sck);
     wolfSSL_SetIOWriteCtx(ret, sck);
+#ifdef HAVE_ALPN
+    wolfSSL_UseALPN(ret, alpn_protocols, sizeof(alpn_protocols) - 1, WOLFSSL_ALPN_CONTINUE_ON_MISMATCH);
+#endif
     return ret;
 }
 
@@ -78,4 +89,9 @@ int SSL_HANDSHAKE(WOLFSSL* ssl){
     return -1;
 }
 
+int SSL_WOULD_BLOCK(WOLFSSL* ssl, int ret){
+    int err = wolfSSL_get_error(ssl, ret);
+    return (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE);
+}
+
 #endif // ifdef LIBHTTPS_USE_WOLFSSL
@@ -88,6 +88,8 @@
 /* HTTP Methods */
 #define HTTPS_METHOD_GET     1u
 #define HTTPS_METHOD_POST    2u
+#define HTTPS_METHOD_HEAD    3u
+#define HTTPS_METHOD_OPTIONS 4u
 
 /* List of events - shared between client and server */
 #define EV_HTTPS_CON         1u
@@ -1,5 +1,8 @@
 #include "pico_websocket_client.h"
 #include "../libhttp/pico_http_util.h"
+#ifdef PICO_WEBSOCKET_DNS_CACHE
+#include "../libhttp/pico_http_dns.h"
+#endif
 #include <stdint.h>
 #include <string.h>
 #include "pico_tree.h"
@@ -540,6 +543,9 @@ static void cleanup_websocket_client(pico_time now, void* args)
 {
         struct pico_websocket_client* client = (struct pico_websocket_client*) args;
 
+#ifdef PICO_WEBSOCKET_DNS_CACHE
+        pico_http_dns_cancel(client);
+#endif
         pico_websocket_client_cleanup(client);
 }
 
@@ -1296,7 +1302,17 @@ int pico_websocket_client_open(char* uri, void (*wakeup)(uint16_t ev, uint16_t c
         if(pico_string_to_ipv4(client->uriKey->host, &ip) == -1)
         {
                 dbg("Querying : %s \n", client->uriKey->host);
+#ifdef PICO_WEBSOCKET_DNS_CACHE
+                /* shares the answers with the HTTP client */
+                if (pico_http_dns_getaddr(client->uriKey->host, dnsCallback, client) < 0)
+                {
+                        dbg("DNS query could not be started.\n");
+                        pico_websocket_client_cleanup(client);
+                        return -1;
+                }
+#else
                 pico_dns_client_getaddr(client->uriKey->host, dnsCallback, client);
+#endif
         }
         else
         {
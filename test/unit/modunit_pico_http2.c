@@ -0,0 +1,536 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_util.h"
+
+#include "pico_http2.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+
+/* MOCKS */
+static uint8_t wire[8192];
+static uint32_t wire_len;
+static uint32_t wire_room;      /* what write takes before it blocks */
+static uint32_t req_sid;
+static uint16_t req_method;
+static char req_path[64];
+static uint32_t req_clen;
+static uint32_t body_sid;
+static uint32_t sent_total;
+static uint32_t closed_sid;
+
+static int32_t mock_write(void *arg, const void *buf, uint32_t len)
+{
+    if (len > wire_room)
+        len = wire_room;
+
+    memcpy(wire + wire_len, buf, len);
+    wire_len += len;
+    wire_room -= len;
+    return (int32_t)len;
+}
+
+static int8_t mock_request(void *arg, uint32_t stream, uint16_t method, const char *path, uint32_t content_length)
+{
+    req_sid = stream;
+    req_method = method;
+    strcpy(req_path, path);
+    req_clen = content_length;
+    return 0;
+}
+
+static void mock_body(void *arg, uint32_t stream)
+{
+    body_sid = stream;
+}
+
+static void mock_sent(void *arg, uint32_t stream, uint32_t sent)
+{
+    sent_total = sent;
+}
+
+static void mock_closed(void *arg, uint32_t stream)
+{
+    closed_sid = stream;
+}
+
+static const struct pico_http2_cb mock_cb = {
+    .write = mock_write,
+    .request = mock_request,
+    .body = mock_body,
+    .sent = mock_sent,
+    .closed = mock_closed
+};
+
+static void reset_mocks(void)
+{
+    wire_len = 0;
+    wire_room = sizeof(wire);
+    req_sid = 0;
+    req_method = 0;
+    req_path[0] = 0;
+    req_clen = 0;
+    body_sid = 0;
+    sent_total = 0;
+    closed_sid = 0;
+}
+
+static uint32_t put_frame(uint8_t *p, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid, const uint8_t *payload)
+{
+    p[0] = (uint8_t)(len >> 16);
+    p[1] = (uint8_t)(len >> 8);
+    p[2] = (uint8_t)len;
+    p[3] = type;
+    p[4] = flags;
+    http2_put32(p + 5, sid);
+    if (payload)
+        memcpy(p + HTTP2_FRAME_HDR, payload, len);
+    return HTTP2_FRAME_HDR + len;
+}
+
+/* feeds one frame from the client */
+static int32_t feed_frame(struct pico_http2 *h2, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid, const uint8_t *payload)
+{
+    uint8_t f[HTTP2_FRAME_HDR + 512];
+
+    return pico_http2_feed(h2, f, put_frame(f, len, type, flags, sid, payload));
+}
+
+/* looks for the next frame of the given type the server wrote */
+static const uint8_t *find_frame(uint32_t *pos, uint8_t type, uint32_t *len, uint8_t *flags, uint32_t *sid)
+{
+    while (*pos + HTTP2_FRAME_HDR <= wire_len)
+    {
+        const uint8_t *f = wire + *pos;
+        uint32_t flen = ((uint32_t)f[0] << 16) | ((uint32_t)f[1] << 8) | f[2];
+
+        *pos += HTTP2_FRAME_HDR + flen;
+        if (f[3] != type)
+            continue;
+
+        *len = flen;
+        *flags = f[4];
+        *sid = http2_get32(f + 5);
+        return f + HTTP2_FRAME_HDR;
+    }
+    return NULL;
+}
+
+/* GET / on stream 1, RFC 7541 C.4.1 */
+static const uint8_t get_block[] = {
+    0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff
+};
+
+static struct pico_http2 *open_connection(void)
+{
+    struct pico_http2 *h2 = pico_http2_create(&mock_cb, NULL);
+
+    fail_if(h2 == NULL);
+    fail_unless(pico_http2_feed(h2, (const uint8_t *)HTTP2_PREFACE, HTTP2_PREFACE_LEN) == (int32_t)HTTP2_PREFACE_LEN);
+    fail_unless(feed_frame(h2, 0, HTTP2_SETTINGS, 0, 0, NULL) == HTTP2_FRAME_HDR);
+    return h2;
+}
+
+START_TEST(tc_hpack_huffman)
+{
+    static const uint8_t www[] = {
+        0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff
+    };
+    static const uint8_t no_cache[] = {
+        0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf
+    };
+    static const uint8_t bad_padding[] = {
+        0xf1, 0xe0
+    };
+    static const uint8_t eos[] = {
+        0xff, 0xff, 0xff, 0xfc
+    };
+    uint8_t out[32];
+
+    fail_unless(hpack_huffman(www, sizeof(www), out, sizeof(out)) == 15);
+    fail_unless(memcmp(out, "www.example.com", 15) == 0);
+    fail_unless(hpack_huffman(no_cache, sizeof(no_cache), out, sizeof(out)) == 8);
+    fail_unless(memcmp(out, "no-cache", 8) == 0);
+    /* does not fit */
+    fail_unless(hpack_huffman(www, sizeof(www), out, 10) < 0);
+    /* padding must be ones, EOS may not appear */
+    fail_unless(hpack_huffman(bad_padding, sizeof(bad_padding), out, sizeof(out)) < 0);
+    fail_unless(hpack_huffman(eos, sizeof(eos), out, sizeof(out)) < 0);
+}
+END_TEST
+
+START_TEST(tc_hpack_decode)
+{
+    /* RFC 7541 C.4, three requests sharing the dynamic table */
+    static const uint8_t second[] = {
+        0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf
+    };
+    static const uint8_t third[] = {
+        0x82, 0x87, 0x85, 0xbf, 0x40, 0x88, 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xa9, 0x7d, 0x7f,
+        0x89, 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xb8, 0xe8, 0xb4, 0xbf
+    };
+    static const uint8_t post[] = {
+        0x83, 0x44, 0x04, '/', 'u', 'p', 'd', 0x0f, 0x0d, 0x03, '1', '2', '3'
+    };
+    static const uint8_t shrink[] = {
+        0x20
+    };
+    static const uint8_t bad_index[] = {
+        0xc5
+    };
+    static const uint8_t grow[] = {
+        0x3f, 0x22
+    };
+    struct http2_hpack hp;
+    struct http2_request req;
+    const char *name, *value;
+    uint32_t name_len, value_len;
+
+    memset(&hp, 0, sizeof(hp));
+    hp.max_size = HTTP2_HPACK_TABLE_SIZE;
+    hp.limit = HTTP2_HPACK_TABLE_SIZE;
+    fail_unless(!strcmp(http2_static_table[HTTP2_HPACK_STATIC - 1u].name, "www-authenticate"));
+
+    memset(&req, 0, sizeof(req));
+    fail_unless(hpack_decode(&hp, get_block, sizeof(get_block), &req) == 0);
+    fail_unless(req.has_method && req.method == HTTP_METHOD_GET);
+    fail_unless(!strcmp(req.path, "/"));
+    fail_unless(hp.count == 1 && hp.size == 57);
+    PICO_FREE(req.path);
+
+    memset(&req, 0, sizeof(req));
+    fail_unless(hpack_decode(&hp, second, sizeof(second), &req) == 0);
+    fail_unless(hp.count == 2 && hp.size == 110);
+    fail_unless(hpack_lookup(&hp, 62, &name, &name_len, &value, &value_len) == 0);
+    fail_unless(name_len == 13 && !memcmp(name, "cache-control", 13));
+    fail_unless(value_len == 8 && !memcmp(value, "no-cache", 8));
+    PICO_FREE(req.path);
+
+    memset(&req, 0, sizeof(req));
+    fail_unless(hpack_decode(&hp, third, sizeof(third), &req) == 0);
+    fail_unless(!strcmp(req.path, "/index.html"));
+    fail_unless(hp.count == 3 && hp.size == 164);
+    fail_unless(hpack_lookup(&hp, 62, &name, &name_len, &value, &value_len) == 0);
+    fail_unless(name_len == 10 && !memcmp(name, "custom-key", 10));
+    fail_unless(hpack_lookup(&hp, 64, &name, &name_len, &value, &value_len) == 0);
+    fail_unless(value_len == 15 && !memcmp(value, "www.example.com", 15));
+    fail_unless(hpack_lookup(&hp, 65, &name, &name_len, &value, &value_len) < 0);
+    PICO_FREE(req.path);
+
+    /* plain literals, indexed name */
+    memset(&req, 0, sizeof(req));
+    fail_unless(hpack_decode(&hp, post, sizeof(post), &req) == 0);
+    fail_unless(req.method == HTTP_METHOD_POST && req.content_length == 123);
+    fail_unless(!strcmp(req.path, "/upd"));
+    PICO_FREE(req.path);
+
+    /* the table is bounded: size update to 0 empties it */
+    memset(&req, 0, sizeof(req));
+    fail_unless(hpack_decode(&hp, shrink, sizeof(shrink), &req) == 0);
+    fail_unless(hp.count == 0 && hp.size == 0);
+    /* not past what we advertised */
+    hp.limit = 64;
+    fail_unless(hpack_decode(&hp, grow, sizeof(grow), &req) < 0);
+    hp.limit = 65;
+    fail_unless(hpack_decode(&hp, grow, sizeof(grow), &req) == 0 && hp.max_size == 65);
+    fail_unless(hpack_decode(&hp, bad_index, sizeof(bad_index), &req) < 0);
+    hp.max_size = 64;
+    fail_unless(hpack_decode(&hp, get_block, sizeof(get_block), &req) == 0);
+    fail_unless(hp.count == 1);
+    fail_unless(hpack_decode(&hp, third + 4, sizeof(third) - 4, &req) == 0);
+    fail_unless(hp.count == 1 && hp.size == 54);
+    PICO_FREE(req.path);
+    hpack_clear(&hp);
+}
+END_TEST
+
+START_TEST(tc_http2_request)
+{
+    static const uint8_t ping[8] = {
+        1, 2, 3, 4, 5, 6, 7, 8
+    };
+    struct pico_http2 *h2;
+    const uint8_t *p;
+    uint32_t pos = 0, len, sid;
+    uint8_t flags;
+
+    reset_mocks();
+    h2 = open_connection();
+
+    /* our SETTINGS come first, then the ACK of theirs */
+    p = find_frame(&pos, HTTP2_SETTINGS, &len, &flags, &sid);
+    fail_unless(p && !flags && len == HTTP2_OUR_SETTINGS * HTTP2_SETTING_LEN);
+    fail_unless(p[1] == HTTP2_SET_MAX_CONCURRENT && http2_get32(p + 2) == HTTP2_MAX_STREAMS);
+    p += 3 * HTTP2_SETTING_LEN;
+    fail_unless(p[1] == HTTP2_SET_HEADER_TABLE_SIZE && http2_get32(p + 2) == HTTP2_HPACK_TABLE_SIZE);
+    fail_unless(h2->hpack.max_size == HTTP2_HPACK_DEFAULT_SIZE);
+    p = find_frame(&pos, HTTP2_SETTINGS, &len, &flags, &sid);
+    fail_unless(p && flags == HTTP2_FLAG_ACK && len == 0);
+
+    feed_frame(h2, 8, HTTP2_PING, 0, 0, ping);
+    p = find_frame(&pos, HTTP2_PING, &len, &flags, &sid);
+    fail_unless(p && flags == HTTP2_FLAG_ACK && !memcmp(p, ping, 8));
+
+    /* header block split over HEADERS and CONTINUATION */
+    feed_frame(h2, 5, HTTP2_HEADERS, HTTP2_FLAG_END_STREAM, 1, get_block);
+    fail_unless(req_sid == 0);
+    feed_frame(h2, sizeof(get_block) - 5, HTTP2_CONTINUATION, HTTP2_FLAG_END_HEADERS, 1, get_block + 5);
+    fail_unless(req_sid == 1 && req_method == HTTP_METHOD_GET && !strcmp(req_path, "/"));
+
+    fail_unless(pico_http2_respond(h2, 1, 200, "text/html", 1, 0) == 0);
+    fail_unless(pico_http2_respond(h2, 1, 200, "text/html", 1, 0) < 0);
+    p = find_frame(&pos, HTTP2_HEADERS, &len, &flags, &sid);
+    fail_unless(p && sid == 1 && flags == HTTP2_FLAG_END_HEADERS);
+    fail_unless(p[0] == 0x88 && p[1] == 0x0f && p[2] == 0x10 && p[3] == 9 && !memcmp(p + 4, "text/html", 9));
+    fail_unless(p[13] == 0x0f && p[14] == 0x09 && p[15] == sizeof(HTTP2_HPACK_CACHE_CONTROL) - 1);
+
+    fail_unless(pico_http2_send(h2, 1, (const uint8_t *)"hello", 5, 0) == 0);
+    fail_unless(sent_total == 5);
+    p = find_frame(&pos, HTTP2_DATA, &len, &flags, &sid);
+    fail_unless(p && sid == 1 && len == 5 && !flags && !memcmp(p, "hello", 5));
+    fail_unless(pico_http2_send(h2, 1, NULL, 0, 1) == 0);
+    p = find_frame(&pos, HTTP2_DATA, &len, &flags, &sid);
+    fail_unless(p && len == 0 && flags == HTTP2_FLAG_END_STREAM);
+    fail_unless(closed_sid == 1);
+    fail_unless(pico_http2_send(h2, 1, NULL, 0, 1) < 0);
+
+    /* stream ids only go up, and a status outside the static table is a literal */
+    feed_frame(h2, sizeof(get_block), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM, 3, get_block);
+    fail_unless(req_sid == 3);
+    fail_unless(pico_http2_respond(h2, 3, 502, NULL, 0, 1) == 0);
+    p = find_frame(&pos, HTTP2_HEADERS, &len, &flags, &sid);
+    fail_unless(p && sid == 3 && flags == (HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM));
+    fail_unless(len == 5 && p[0] == 0x08 && p[1] == 3 && !memcmp(p + 2, "502", 3));
+    fail_unless(closed_sid == 3);
+    fail_unless(feed_frame(h2, 1, HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS, 2, get_block) < 0);
+    p = find_frame(&pos, HTTP2_GOAWAY, &len, &flags, &sid);
+    fail_unless(p && http2_get32(p) == 3 && http2_get32(p + 4) == HTTP2_PROTOCOL_ERROR);
+    pico_http2_destroy(h2);
+}
+END_TEST
+
+START_TEST(tc_http2_flow_control)
+{
+    static const uint8_t small_window[6] = {
+        0, HTTP2_SET_INITIAL_WINDOW, 0, 0, 0, 4
+    };
+    static const uint8_t post_block[] = {
+        0x83, 0x44, 0x04, '/', 'u', 'p', 'd'
+    };
+    static uint8_t body[HTTP2_STREAM_WINDOW + 1];
+    uint8_t inc[4];
+    uint8_t buf[600];
+    struct pico_http2 *h2;
+    const uint8_t *p;
+    uint32_t pos, len, sid, i;
+    uint8_t flags;
+
+    reset_mocks();
+    h2 = open_connection();
+    feed_frame(h2, 6, HTTP2_SETTINGS, 0, 0, small_window);
+    feed_frame(h2, 0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, NULL);
+    feed_frame(h2, sizeof(post_block), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS, 1, post_block);
+    fail_unless(req_sid == 1 && req_method == HTTP_METHOD_POST);
+
+    /* the request body is buffered up to the stream window */
+    for (i = 0; i < sizeof(body); i++)
+        body[i] = (uint8_t)i;
+
+    feed_frame(h2, 500, HTTP2_DATA, 0, 1, body);
+    fail_unless(body_sid == 1);
+    pos = wire_len;
+    fail_unless(pico_http2_read_body(h2, 1, buf, 300) == 300);
+    fail_unless(!memcmp(buf, body, 300));
+    fail_unless(find_frame(&pos, HTTP2_WINDOW_UPDATE, &len, &flags, &sid) == NULL);
+    fail_unless(pico_http2_read_body(h2, 1, buf, sizeof(buf)) == 200);
+    fail_unless(!memcmp(buf, body + 300, 200));
+    /* drained, so the stream window is opened again */
+    p = find_frame(&pos, HTTP2_WINDOW_UPDATE, &len, &flags, &sid);
+    fail_unless(p && sid == 1 && http2_get32(p) == 500);
+
+    /* their window for our data is 4 bytes */
+    fail_unless(pico_http2_respond(h2, 1, 200, NULL, 0, 0) == 0);
+    pos = wire_len;
+    fail_unless(pico_http2_send(h2, 1, (const uint8_t *)"0123456789", 10, 1) == 0);
+    p = find_frame(&pos, HTTP2_DATA, &len, &flags, &sid);
+    fail_unless(p && len == 4 && !flags && !memcmp(p, "0123", 4));
+    fail_unless(sent_total == 4);
+    fail_unless(find_frame(&pos, HTTP2_DATA, &len, &flags, &sid) == NULL);
+
+    http2_put32(inc, 100);
+    feed_frame(h2, 4, HTTP2_WINDOW_UPDATE, 0, 1, inc);
+    p = find_frame(&pos, HTTP2_DATA, &len, &flags, &sid);
+    fail_unless(p && len == 6 && flags == HTTP2_FLAG_END_STREAM && !memcmp(p, "456789", 6));
+    fail_unless(sent_total == 10);
+    fail_unless(closed_sid == 1);
+    /* the rest of the body is not wanted anymore */
+    p = find_frame(&pos, HTTP2_RST_STREAM, &len, &flags, &sid);
+    fail_unless(p && sid == 1 && http2_get32(p) == HTTP2_NO_ERROR);
+
+    /* more than the window: the stream is reset */
+    feed_frame(h2, sizeof(post_block), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS, 3, post_block);
+    fail_unless(req_sid == 3);
+    feed_frame(h2, 500, HTTP2_DATA, 0, 3, body);
+    feed_frame(h2, 500, HTTP2_DATA, 0, 3, body);
+    feed_frame(h2, 500, HTTP2_DATA, 0, 3, body);
+    feed_frame(h2, 500, HTTP2_DATA, 0, 3, body);
+    fail_unless(closed_sid == 1);
+    fail_unless(feed_frame(h2, 100, HTTP2_DATA, 0, 3, body) > 0);
+    fail_unless(closed_sid == 3);
+    p = find_frame(&pos, HTTP2_RST_STREAM, &len, &flags, &sid);
+    fail_unless(p && sid == 3 && http2_get32(p) == HTTP2_FLOW_CONTROL);
+    /* everything dropped is given back to the connection */
+    p = find_frame(&pos, HTTP2_WINDOW_UPDATE, &len, &flags, &sid);
+    fail_unless(p && sid == 0);
+    pico_http2_destroy(h2);
+
+    /* until our SETTINGS are acknowledged the peer may fill the default window */
+    reset_mocks();
+    h2 = open_connection();
+    feed_frame(h2, sizeof(post_block), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS, 1, post_block);
+    for (i = 0; i < 6; i++)
+        feed_frame(h2, 500, HTTP2_DATA, 0, 1, body);
+    fail_unless(closed_sid == 0);
+    fail_unless(pico_http2_read_body(h2, 1, buf, sizeof(buf)) == sizeof(buf));
+    fail_unless(!memcmp(buf, body, 500) && !memcmp(buf + 500, body, 100));
+    fail_unless(http2_find_stream(h2, 1)->rx_len == 2400);
+    /* then the window is ours, less what is in flight already */
+    feed_frame(h2, 0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, NULL);
+    fail_unless(http2_find_stream(h2, 1)->recv_window < 0);
+    pos = wire_len;
+    feed_frame(h2, 1, HTTP2_DATA, 0, 1, body);
+    fail_unless(closed_sid == 1);
+    p = find_frame(&pos, HTTP2_RST_STREAM, &len, &flags, &sid);
+    fail_unless(p && sid == 1 && http2_get32(p) == HTTP2_FLOW_CONTROL);
+    pico_http2_destroy(h2);
+}
+END_TEST
+
+START_TEST(tc_http2_padding)
+{
+    static const uint8_t post_block[] = {
+        0x83, 0x44, 0x04, '/', 'u', 'p', 'd'
+    };
+    static const uint8_t padded[5] = {
+        2, 'a', 'b', 0, 0
+    };
+    struct pico_http2 *h2;
+    const uint8_t *p;
+    uint32_t pos, len, sid;
+    uint8_t flags;
+    uint8_t buf[8];
+
+    reset_mocks();
+    h2 = open_connection();
+    feed_frame(h2, sizeof(post_block), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS, 1, post_block);
+    fail_unless(req_sid == 1);
+
+    /* the pad length and the padding are not part of the body */
+    feed_frame(h2, sizeof(padded), HTTP2_DATA, HTTP2_FLAG_PADDED, 1, padded);
+    fail_unless(body_sid == 1);
+    fail_unless(pico_http2_read_body(h2, 1, buf, sizeof(buf)) == 2);
+    fail_unless(!memcmp(buf, "ab", 2));
+
+    /* a window update on a stream that was never opened */
+    http2_put32(buf, 100);
+    pos = wire_len;
+    fail_unless(feed_frame(h2, 4, HTTP2_WINDOW_UPDATE, 0, 5, buf) < 0);
+    p = find_frame(&pos, HTTP2_GOAWAY, &len, &flags, &sid);
+    fail_unless(p && http2_get32(p + 4) == HTTP2_PROTOCOL_ERROR);
+    pico_http2_destroy(h2);
+
+    reset_mocks();
+    h2 = open_connection();
+    feed_frame(h2, sizeof(post_block), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS, 1, post_block);
+
+    /* a padded frame without room for the pad length */
+    pos = wire_len;
+    fail_unless(feed_frame(h2, 0, HTTP2_DATA, HTTP2_FLAG_PADDED, 1, NULL) < 0);
+    p = find_frame(&pos, HTTP2_GOAWAY, &len, &flags, &sid);
+    fail_unless(p && http2_get32(p + 4) == HTTP2_PROTOCOL_ERROR);
+    pico_http2_destroy(h2);
+}
+END_TEST
+
+START_TEST(tc_http2_backpressure)
+{
+    static const uint8_t big[3000];
+    struct pico_http2 *h2;
+    const uint8_t *p;
+    uint32_t pos = 0, len, sid, total = 0;
+    uint8_t flags;
+
+    reset_mocks();
+    wire_room = 10;
+    h2 = open_connection();
+    fail_unless(wire_len == 10);
+
+    feed_frame(h2, sizeof(get_block), HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS | HTTP2_FLAG_END_STREAM, 1, get_block);
+    fail_unless(req_sid == 1);
+    fail_unless(pico_http2_respond(h2, 1, 200, NULL, 0, 0) == 0);
+    fail_unless(pico_http2_send(h2, 1, big, sizeof(big), 1) == 0);
+    fail_unless(wire_len == 10);
+
+    /* the transport takes data again */
+    wire_room = sizeof(wire);
+    fail_unless(pico_http2_flush(h2) == 0);
+    fail_unless(closed_sid == 1 && sent_total == sizeof(big));
+    while ((p = find_frame(&pos, HTTP2_DATA, &len, &flags, &sid)) != NULL)
+    {
+        fail_unless(len <= HTTP2_OUT_BUF_SIZE - HTTP2_FRAME_HDR);
+        total += len;
+    }
+    fail_unless(total == sizeof(big) && flags == HTTP2_FLAG_END_STREAM);
+    pico_http2_destroy(h2);
+
+    /* not the preface */
+    reset_mocks();
+    h2 = pico_http2_create(&mock_cb, NULL);
+    fail_unless(pico_http2_feed(h2, (const uint8_t *)"GET / HTTP/1.1\r\n", 16) < 0);
+    pos = 0;
+    p = find_frame(&pos, HTTP2_GOAWAY, &len, &flags, &sid);
+    fail_unless(p && http2_get32(p + 4) == HTTP2_PROTOCOL_ERROR);
+    fail_unless(pico_http2_flush(h2) < 0);
+    pico_http2_destroy(h2);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB http2");
+
+    TCase *TCase_hpack_huffman = tcase_create("Unit test for tc_hpack_huffman");
+    TCase *TCase_hpack_decode = tcase_create("Unit test for tc_hpack_decode");
+    TCase *TCase_http2_request = tcase_create("Unit test for tc_http2_request");
+    TCase *TCase_http2_flow_control = tcase_create("Unit test for tc_http2_flow_control");
+    TCase *TCase_http2_padding = tcase_create("Unit test for tc_http2_padding");
+    TCase *TCase_http2_backpressure = tcase_create("Unit test for tc_http2_backpressure");
+
+    tcase_add_test(TCase_hpack_huffman, tc_hpack_huffman);
+    suite_add_tcase(s, TCase_hpack_huffman);
+    tcase_add_test(TCase_hpack_decode, tc_hpack_decode);
+    suite_add_tcase(s, TCase_hpack_decode);
+    tcase_add_test(TCase_http2_request, tc_http2_request);
+    suite_add_tcase(s, TCase_http2_request);
+    tcase_add_test(TCase_http2_flow_control, tc_http2_flow_control);
+    suite_add_tcase(s, TCase_http2_flow_control);
+    tcase_add_test(TCase_http2_padding, tc_http2_padding);
+    suite_add_tcase(s, TCase_http2_padding);
+    tcase_add_test(TCase_http2_backpressure, tc_http2_backpressure);
+    suite_add_tcase(s, TCase_http2_backpressure);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
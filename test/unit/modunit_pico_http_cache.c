@@ -0,0 +1,398 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_client.h"
+
+#include "pico_http_cache.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+volatile pico_time pico_tick = 0;
+
+/* MOCKS */
+#define CLIENTS 16
+
+struct mock_client
+{
+    uint8_t open;
+    uint8_t get_sent;
+    const char *headers;
+    void (*sink)(uint16_t conn, const uint8_t *data, uint32_t len, void *arg);
+    struct pico_http_header header;
+};
+
+static struct mock_client clients[CLIENTS];
+static void (*client_wakeup)(uint16_t ev, uint16_t conn) = NULL;
+static int open_cnt = 0;
+
+int32_t pico_http_client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn))
+{
+    int32_t conn = open_cnt++;
+
+    fail_if(conn >= CLIENTS);
+    memset(&clients[conn], 0, sizeof(clients[conn]));
+    clients[conn].open = 1;
+    client_wakeup = wakeup;
+    return conn;
+}
+
+int8_t pico_http_client_close(uint16_t conn)
+{
+    fail_if(!clients[conn].open);
+    clients[conn].open = 0;
+    return 0;
+}
+
+int8_t pico_http_client_set_headers(uint16_t conn, const char *headers)
+{
+    clients[conn].headers = headers;
+    return 0;
+}
+
+int8_t pico_http_client_set_body_sink(uint16_t conn, void (*sink)(uint16_t conn, const uint8_t *data, uint32_t len, void *arg), void *arg)
+{
+    clients[conn].sink = sink;
+    return 0;
+}
+
+int8_t pico_http_client_send_get(uint16_t conn, char *resource, uint8_t connection_type)
+{
+    clients[conn].get_sent = 1;
+    return 0;
+}
+
+struct pico_http_header *pico_http_client_read_header(uint16_t conn)
+{
+    return &clients[conn].header;
+}
+
+static void (*timer_cb)(pico_time, void *);
+
+struct pico_timer *pico_timer_add(pico_time expire, void (*timer)(pico_time, void *), void *arg)
+{
+    timer_cb = timer;
+    return (struct pico_timer *)1;
+}
+
+static void run_timer(void)
+{
+    void (*cb)(pico_time, void *) = timer_cb;
+
+    timer_cb = NULL;
+    if (cb)
+        cb(0, NULL);
+}
+
+static char body_got[3u * HTTP_CACHE_BUDGET];
+static uint32_t body_len = 0;
+static int done_cnt = 0;
+static int8_t done_result = 0;
+static struct pico_http_cache_request *abort_req = NULL;
+static uint8_t respond_control = 0;
+
+static void data(struct pico_http_cache_request *req, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg)
+{
+    fail_if(offset + len > sizeof(body_got));
+    memcpy(&body_got[offset], buf, len);
+    body_len = offset + len;
+    if (req == abort_req)
+        pico_http_cache_abort(req);
+}
+
+static void done(struct pico_http_cache_request *req, int8_t result, void *arg)
+{
+    done_cnt++;
+    done_result = result;
+}
+
+static void reset(void)
+{
+    memset(clients, 0, sizeof(clients));
+    open_cnt = 0;
+    timer_cb = NULL;
+    body_len = 0;
+    done_cnt = 0;
+    done_result = 0;
+    abort_req = NULL;
+    memset(body_got, 0, sizeof(body_got));
+}
+
+/* the response header of conn, validators and max-age are left out if NULL or 0 */
+static void respond(uint16_t conn, uint16_t code, const char *etag, const char *last_modified, uint32_t max_age, uint32_t length)
+{
+    struct pico_http_header *h = &clients[conn].header;
+
+    h->response_code = code;
+    h->etag = (char *)etag;
+    h->last_modified = (char *)last_modified;
+    h->max_age = max_age;
+    h->cache_control = (uint8_t)((max_age ? HTTP_CACHE_CONTROL_MAX_AGE : 0u) | respond_control);
+    h->transfer_coding = length ? HTTP_TRANSFER_FULL : HTTP_TRANSFER_CHUNKED;
+    h->content_length_or_chunk = length;
+    client_wakeup(EV_HTTP_CON, conn);
+    fail_if(!clients[conn].get_sent);
+    client_wakeup(EV_HTTP_REQ, conn);
+}
+
+/* body of conn in pieces of at most piece bytes, then the end of the response */
+static void body(uint16_t conn, const char *text, uint32_t len, uint32_t piece)
+{
+    uint32_t pos;
+
+    for (pos = 0; pos < len; pos += piece)
+        clients[conn].sink(conn, (const uint8_t *)text + pos, (len - pos < piece) ? len - pos : piece, NULL);
+    client_wakeup(EV_HTTP_DONE, conn);
+}
+
+/* a GET that is answered from the cache */
+static int8_t get_local(const char *uri)
+{
+    int opened = open_cnt;
+
+    body_len = 0;
+    done_cnt = 0;
+    fail_if(!pico_http_cache_get(uri, data, done, NULL));
+    fail_if(open_cnt != opened);
+    fail_if(done_cnt != 0);
+    run_timer();
+    fail_if(done_cnt != 1);
+    return done_result;
+}
+
+START_TEST(tc_pico_http_cache_revalidate)
+{
+    const char *config = "{\"interval\": 60}";
+    uint32_t len = (uint32_t)strlen(config);
+
+    reset();
+    pico_http_cache_flush();
+    fail_if(pico_http_cache_get(NULL, data, done, NULL) != NULL);
+
+    /* a miss is fetched and stored */
+    fail_if(!pico_http_cache_get("http://example.org/config", data, done, NULL));
+    fail_if(clients[0].headers[0]);
+    respond(0, HTTP_OK, "\"v1\"", NULL, 60, len);
+    body(0, config, len, 5);
+    run_timer();
+    fail_if(done_cnt != 1 || done_result != HTTP_CACHE_FETCHED);
+    fail_if(clients[0].open);
+    fail_if(body_len != len || memcmp(body_got, config, len));
+
+    /* fresh: no request at all */
+    fail_if(get_local("http://example.org/config") != HTTP_CACHE_FRESH);
+    fail_if(body_len != len || memcmp(body_got, config, len));
+
+    /* stale: asked again with the validator, a 304 serves the stored body */
+    pico_tick += 60000u;
+    body_len = 0;
+    done_cnt = 0;
+    fail_if(!pico_http_cache_get("http://example.org/config", data, done, NULL));
+    fail_if(open_cnt != 2);
+    fail_if(strcmp(clients[1].headers, "If-None-Match: \"v1\"\r\n"));
+    respond(1, HTTP_NOT_MODIFIED, NULL, NULL, 120, 0);
+    client_wakeup(EV_HTTP_DONE, 1);
+    fail_if(body_len != 0);
+    run_timer();
+    fail_if(done_cnt != 1 || done_result != HTTP_CACHE_REVALIDATED);
+    fail_if(clients[1].open);
+    fail_if(body_len != len || memcmp(body_got, config, len));
+
+    /* fresh for the max-age of the 304 */
+    pico_tick += 119000u;
+    fail_if(get_local("http://example.org/config") != HTTP_CACHE_FRESH);
+
+    /* a changed resource replaces the stored one */
+    pico_tick += 1000u;
+    body_len = 0;
+    done_cnt = 0;
+    pico_http_cache_get("http://example.org/config", data, done, NULL);
+    respond(2, HTTP_OK, NULL, "Tue, 20 Oct 2026 10:00:00 GMT", 0, 7);
+    body(2, "changed", 7, 7);
+    run_timer();
+    fail_if(done_result != HTTP_CACHE_FETCHED);
+
+    /* no max-age: checked each time, now with If-Modified-Since */
+    done_cnt = 0;
+    pico_http_cache_get("http://example.org/config", data, done, NULL);
+    fail_if(open_cnt != 4);
+    fail_if(strcmp(clients[3].headers, "If-Modified-Since: Tue, 20 Oct 2026 10:00:00 GMT\r\n"));
+    respond(3, HTTP_NOT_FOUND, NULL, NULL, 0, 5);
+    run_timer();
+    fail_if(done_cnt != 1 || done_result != HTTP_CACHE_FAILED);
+    fail_if(clients[3].open);
+    pico_http_cache_flush();
+}
+END_TEST
+
+START_TEST(tc_pico_http_cache_budget)
+{
+    static char big[HTTP_CACHE_BUDGET / 2u];
+    uint32_t i;
+
+    reset();
+    pico_http_cache_flush();
+    memset(big, 'b', sizeof(big));
+
+    /* not stored: no-store, nothing to check against, or bigger than the budget */
+    pico_http_cache_get("http://example.org/a", data, done, NULL);
+    respond_control = HTTP_CACHE_CONTROL_NO_STORE;
+    respond(0, HTTP_OK, "\"a\"", NULL, 60, 1);
+    respond_control = 0;
+    body(0, "a", 1, 1);
+    pico_http_cache_get("http://example.org/b", data, done, NULL);
+    respond(1, HTTP_OK, NULL, NULL, 0, 1);
+    body(1, "b", 1, 1);
+    run_timer();
+    fail_if(done_cnt != 2);
+    fail_if(cache_bytes != 0);
+
+    /* a chunked body that grows beyond the budget is passed on, not stored */
+    body_len = 0;
+    pico_http_cache_get("http://example.org/huge", data, done, NULL);
+    respond(2, HTTP_OK, "\"h\"", NULL, 60, 0);
+    for (i = 0; i < 3u; i++)
+        clients[2].sink(2, (const uint8_t *)big, sizeof(big), NULL);
+    client_wakeup(EV_HTTP_DONE, 2);
+    run_timer();
+    fail_if(body_len != 3u * sizeof(big));
+    fail_if(cache_bytes != 0);
+    fail_if(cache_find("http://example.org/huge"));
+
+    /* the least recently used one makes room */
+    pico_http_cache_get("http://example.org/1", data, done, NULL);
+    respond(3, HTTP_OK, "\"1\"", NULL, 60, sizeof(big));
+    body(3, big, sizeof(big), 500);
+    pico_http_cache_get("http://example.org/2", data, done, NULL);
+    respond(4, HTTP_OK, "\"2\"", NULL, 60, 0);
+    body(4, big, sizeof(big), 300);
+    run_timer();
+    fail_if(cache_bytes != HTTP_CACHE_BUDGET);
+    fail_if(get_local("http://example.org/1") != HTTP_CACHE_FRESH);
+    pico_http_cache_get("http://example.org/3", data, done, NULL);
+    respond(5, HTTP_OK, "\"3\"", NULL, 60, 10);
+    body(5, big, 10, 10);
+    run_timer();
+    fail_if(!cache_find("http://example.org/1"));
+    fail_if(cache_find("http://example.org/2"));
+    fail_if(!cache_find("http://example.org/3"));
+
+    /* a request aborted while served, and one aborted while fetching */
+    reset();
+    abort_req = pico_http_cache_get("http://example.org/1", data, done, NULL);
+    run_timer();
+    fail_if(done_cnt != 0);
+    fail_if(body_len == 0);
+    abort_req = NULL;
+    pico_http_cache_abort(pico_http_cache_get("http://example.org/4", data, done, NULL));
+    fail_if(clients[0].open);
+    run_timer();
+    fail_if(done_cnt != 0);
+
+    pico_http_cache_flush();
+    fail_if(cache_bytes != 0);
+}
+END_TEST
+
+/* flash store mock: slots of 1 kB */
+static uint8_t flash[HTTP_CACHE_ENTRIES][1024];
+static uint32_t flash_len[HTTP_CACHE_ENTRIES];
+static int flash_reads = 0;
+
+static int32_t flash_write(uint8_t slot, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg)
+{
+    fail_if(offset != flash_len[slot]);
+    if (offset + len > sizeof(flash[slot]))
+        return -1;
+    memcpy(&flash[slot][offset], buf, len);
+    flash_len[slot] += len;
+    return (int32_t)len;
+}
+
+static int32_t flash_read(uint8_t slot, uint32_t offset, uint8_t *buf, uint32_t len, void *arg)
+{
+    flash_reads++;
+    fail_if(offset + len > flash_len[slot]);
+    memcpy(buf, &flash[slot][offset], len);
+    return (int32_t)len;
+}
+
+static void flash_erase(uint8_t slot, void *arg)
+{
+    flash_len[slot] = 0;
+}
+
+START_TEST(tc_pico_http_cache_store)
+{
+    struct pico_http_cache_store store = { flash_write, flash_read, flash_erase, NULL };
+    struct pico_http_cache_store bad = { flash_write, NULL, flash_erase, NULL };
+    char text[300];
+    uint32_t i;
+
+    reset();
+    for (i = 0; i < sizeof(text); i++)
+        text[i] = (char)('a' + i % 26u);
+    fail_if(pico_http_cache_set_store(&bad) != HTTP_RETURN_ERROR);
+    fail_if(pico_http_cache_set_store(&store) != HTTP_RETURN_OK);
+
+    /* no changing the store while requests run */
+    fail_if(!pico_http_cache_get("http://example.org/fw.json", data, done, NULL));
+    fail_if(pico_http_cache_set_store(NULL) != HTTP_RETURN_ERROR);
+    respond(0, HTTP_OK, "\"f\"", NULL, 30, sizeof(text));
+    body(0, text, sizeof(text), 100);
+    run_timer();
+    fail_if(done_result != HTTP_CACHE_FETCHED);
+    fail_if(flash_len[0] != sizeof(text) || memcmp(flash[0], text, sizeof(text)));
+
+    /* served from the store in pieces */
+    fail_if(get_local("http://example.org/fw.json") != HTTP_CACHE_FRESH);
+    fail_if(flash_reads != (int)((sizeof(text) + HTTP_CACHE_READ_SIZE - 1u) / HTTP_CACHE_READ_SIZE));
+    fail_if(body_len != sizeof(text) || memcmp(body_got, text, sizeof(text)));
+
+    /* flushed while it is being checked: the 304 is still served */
+    pico_tick += 30000u;
+    body_len = 0;
+    done_cnt = 0;
+    pico_http_cache_get("http://example.org/fw.json", data, done, NULL);
+    pico_http_cache_flush();
+    fail_if(flash_len[0] == 0);
+    respond(1, HTTP_NOT_MODIFIED, NULL, NULL, 30, 0);
+    client_wakeup(EV_HTTP_DONE, 1);
+    run_timer();
+    fail_if(done_result != HTTP_CACHE_REVALIDATED);
+    fail_if(body_len != sizeof(text));
+    fail_if(flash_len[0] != 0);
+    fail_if(cache_bytes != 0);
+
+    fail_if(pico_http_cache_set_store(NULL) != HTTP_RETURN_OK);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB cache");
+
+    TCase *TCase_pico_http_cache_revalidate = tcase_create("Unit test for tc_pico_http_cache_revalidate");
+    TCase *TCase_pico_http_cache_budget = tcase_create("Unit test for tc_pico_http_cache_budget");
+    TCase *TCase_pico_http_cache_store = tcase_create("Unit test for tc_pico_http_cache_store");
+
+    tcase_add_test(TCase_pico_http_cache_revalidate, tc_pico_http_cache_revalidate);
+    suite_add_tcase(s, TCase_pico_http_cache_revalidate);
+    tcase_add_test(TCase_pico_http_cache_budget, tc_pico_http_cache_budget);
+    suite_add_tcase(s, TCase_pico_http_cache_budget);
+    tcase_add_test(TCase_pico_http_cache_store, tc_pico_http_cache_store);
+    suite_add_tcase(s, TCase_pico_http_cache_store);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -0,0 +1,232 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_dns_client.h"
+
+#include "pico_http_dns.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+volatile pico_time pico_tick = 0;
+
+/* MOCKS */
+static int query_cnt = 0;
+static void (*query_cb)(char *ip, void *arg) = NULL;
+static void *query_arg = NULL;
+
+int pico_dns_client_getaddr(const char *url, void (*callback)(char *ip, void *arg), void *arg)
+{
+    query_cnt++;
+    query_cb = callback;
+    query_arg = arg;
+    return 0;
+}
+
+static void (*timer_cb)(pico_time, void *) = NULL;
+
+struct pico_timer *pico_timer_add(pico_time expire, void (*timer)(pico_time, void *), void *arg)
+{
+    timer_cb = timer;
+    return (struct pico_timer *)1;
+}
+
+static void run_timer(void)
+{
+    void (*cb)(pico_time, void *) = timer_cb;
+
+    timer_cb = NULL;
+    if (cb)
+        cb(PICO_TIME_MS(), NULL);
+}
+
+static int answer_cnt = 0;
+static char answer_ip[16];
+static void *answer_arg = NULL;
+
+static void answer(char *ip, void *arg)
+{
+    answer_cnt++;
+    answer_arg = arg;
+    if (ip)
+        strcpy(answer_ip, ip);
+    else
+        answer_ip[0] = '\0';
+}
+
+static void reset(void)
+{
+    memset(dns_cache, 0, sizeof(dns_cache));
+    memset(dns_waiters, 0, sizeof(dns_waiters));
+    dns_deliver_pending = 0;
+    query_cnt = 0;
+    query_cb = NULL;
+    timer_cb = NULL;
+    answer_cnt = 0;
+    answer_arg = NULL;
+    pico_tick = 1000;
+}
+
+START_TEST(tc_pico_http_dns_coalesce)
+{
+    int a, b;
+
+    reset();
+    fail_if(pico_http_dns_getaddr("example.com", answer, &a) != 0);
+    fail_if(pico_http_dns_getaddr("example.com", answer, &b) != 0);
+    /* the second lookup waits for the first query */
+    fail_if(query_cnt != 1);
+    fail_if(answer_cnt != 0);
+
+    query_cb("10.0.0.1", query_arg);
+    fail_if(answer_cnt != 2);
+    fail_if(strcmp(answer_ip, "10.0.0.1"));
+}
+END_TEST
+
+START_TEST(tc_pico_http_dns_hit)
+{
+    int a;
+
+    reset();
+    pico_http_dns_getaddr("example.com", answer, &a);
+    query_cb("10.0.0.1", query_arg);
+    answer_cnt = 0;
+
+    /* a cached answer is not delivered from within getaddr */
+    fail_if(pico_http_dns_getaddr("example.com", answer, &a) != 0);
+    fail_if(query_cnt != 1);
+    fail_if(answer_cnt != 0);
+    run_timer();
+    fail_if(answer_cnt != 1);
+    fail_if(answer_arg != &a);
+    fail_if(strcmp(answer_ip, "10.0.0.1"));
+
+    /* expired answers are asked again */
+    pico_tick += HTTP_DNS_TTL_MS;
+    pico_http_dns_getaddr("example.com", answer, &a);
+    fail_if(query_cnt != 2);
+    query_cb("10.0.0.2", query_arg);
+    fail_if(answer_cnt != 2);
+    fail_if(strcmp(answer_ip, "10.0.0.2"));
+}
+END_TEST
+
+START_TEST(tc_pico_http_dns_negative)
+{
+    int a;
+
+    reset();
+    pico_http_dns_getaddr("nowhere.example", answer, &a);
+    query_cb(NULL, query_arg);
+    fail_if(answer_cnt != 1);
+    fail_if(answer_ip[0]);
+
+    pico_http_dns_getaddr("nowhere.example", answer, &a);
+    run_timer();
+    fail_if(query_cnt != 1);
+    fail_if(answer_cnt != 2);
+    fail_if(answer_ip[0]);
+
+    pico_tick += HTTP_DNS_NEGATIVE_TTL_MS;
+    pico_http_dns_getaddr("nowhere.example", answer, &a);
+    fail_if(query_cnt != 2);
+}
+END_TEST
+
+START_TEST(tc_pico_http_dns_cancel)
+{
+    int a, b;
+
+    reset();
+    pico_http_dns_getaddr("example.com", answer, &a);
+    pico_http_dns_getaddr("example.com", answer, &b);
+    pico_http_dns_cancel(&a);
+
+    query_cb("10.0.0.1", query_arg);
+    fail_if(answer_cnt != 1);
+    fail_if(answer_arg != &b);
+
+    /* the answer stays cached for the next lookups */
+    pico_http_dns_getaddr("example.com", answer, &a);
+    pico_http_dns_cancel(&a);
+    run_timer();
+    fail_if(answer_cnt != 1);
+
+    pico_http_dns_flush();
+    pico_http_dns_getaddr("example.com", answer, &a);
+    fail_if(query_cnt != 2);
+}
+END_TEST
+
+START_TEST(tc_pico_http_dns_busy)
+{
+    char name[HTTP_DNS_NAME_MAX + 1];
+    int args[HTTP_DNS_WAITERS];
+    uint32_t i;
+
+    reset();
+
+    /* the longest name that fits, one more does not */
+    memset(name, 'a', sizeof(name));
+    name[HTTP_DNS_NAME_MAX - 1] = '\0';
+    fail_if(pico_http_dns_getaddr(name, answer, &args[0]) != 0);
+    fail_if(query_cnt != 1);
+    name[HTTP_DNS_NAME_MAX - 1] = 'a';
+    name[HTTP_DNS_NAME_MAX] = '\0';
+    pico_err = 0;
+    fail_if(pico_http_dns_getaddr(name, answer, &args[0]) != -1);
+    fail_if(pico_err != PICO_ERR_EINVAL);
+    fail_if(query_cnt != 1);
+
+    /* no waiter left: no query behind the cache's back */
+    for (i = 1; i < HTTP_DNS_WAITERS; i++)
+        fail_if(pico_http_dns_getaddr("example.com", answer, &args[i]) != 0);
+    fail_if(query_cnt != 2);
+    pico_err = 0;
+    fail_if(pico_http_dns_getaddr("example.org", answer, &args[0]) != -1);
+    fail_if(pico_err != PICO_ERR_EAGAIN);
+    fail_if(query_cnt != 2);
+
+    /* cancelled lookups free their waiters */
+    for (i = 0; i < HTTP_DNS_WAITERS; i++)
+        pico_http_dns_cancel(&args[i]);
+    fail_if(pico_http_dns_getaddr("example.org", answer, &args[0]) != 0);
+    fail_if(query_cnt != 3);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB dns");
+
+    TCase *TCase_pico_http_dns_coalesce = tcase_create("Unit test for tc_pico_http_dns_coalesce");
+    TCase *TCase_pico_http_dns_hit = tcase_create("Unit test for tc_pico_http_dns_hit");
+    TCase *TCase_pico_http_dns_negative = tcase_create("Unit test for tc_pico_http_dns_negative");
+    TCase *TCase_pico_http_dns_cancel = tcase_create("Unit test for tc_pico_http_dns_cancel");
+    TCase *TCase_pico_http_dns_busy = tcase_create("Unit test for tc_pico_http_dns_busy");
+
+    tcase_add_test(TCase_pico_http_dns_coalesce, tc_pico_http_dns_coalesce);
+    suite_add_tcase(s, TCase_pico_http_dns_coalesce);
+    tcase_add_test(TCase_pico_http_dns_hit, tc_pico_http_dns_hit);
+    suite_add_tcase(s, TCase_pico_http_dns_hit);
+    tcase_add_test(TCase_pico_http_dns_negative, tc_pico_http_dns_negative);
+    suite_add_tcase(s, TCase_pico_http_dns_negative);
+    tcase_add_test(TCase_pico_http_dns_cancel, tc_pico_http_dns_cancel);
+    suite_add_tcase(s, TCase_pico_http_dns_cancel);
+    tcase_add_test(TCase_pico_http_dns_busy, tc_pico_http_dns_busy);
+    suite_add_tcase(s, TCase_pico_http_dns_busy);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
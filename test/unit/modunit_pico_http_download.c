@@ -0,0 +1,319 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_client.h"
+
+#include "pico_http_download.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+
+/* MOCKS */
+#define CLIENTS 8
+
+struct mock_client
+{
+    uint8_t open;
+    uint8_t get_sent;
+    const char *headers;
+    void (*sink)(uint16_t conn, const uint8_t *data, uint32_t len, void *arg);
+    struct pico_http_header header;
+};
+
+static struct mock_client clients[CLIENTS];
+static void (*client_wakeup)(uint16_t ev, uint16_t conn) = NULL;
+static int open_cnt = 0;
+
+int32_t pico_http_client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn))
+{
+    int32_t conn = open_cnt++;
+
+    fail_if(conn >= CLIENTS);
+    memset(&clients[conn], 0, sizeof(clients[conn]));
+    clients[conn].open = 1;
+    client_wakeup = wakeup;
+    return conn;
+}
+
+int8_t pico_http_client_close(uint16_t conn)
+{
+    fail_if(!clients[conn].open);
+    clients[conn].open = 0;
+    return 0;
+}
+
+int8_t pico_http_client_set_headers(uint16_t conn, const char *headers)
+{
+    clients[conn].headers = headers;
+    return 0;
+}
+
+int8_t pico_http_client_set_body_sink(uint16_t conn, void (*sink)(uint16_t conn, const uint8_t *data, uint32_t len, void *arg), void *arg)
+{
+    clients[conn].sink = sink;
+    return 0;
+}
+
+int8_t pico_http_client_send_get(uint16_t conn, char *resource, uint8_t connection_type)
+{
+    clients[conn].get_sent = 1;
+    return 0;
+}
+
+struct pico_http_header *pico_http_client_read_header(uint16_t conn)
+{
+    return &clients[conn].header;
+}
+
+static void (*timer_cb[2])(pico_time, void *);
+
+struct pico_timer *pico_timer_add(pico_time expire, void (*timer)(pico_time, void *), void *arg)
+{
+    /* slot 0 for immediate timers, slot 1 for the delayed ones */
+    timer_cb[expire ? 1 : 0] = timer;
+    return (struct pico_timer *)1;
+}
+
+static void run_timer(int slot)
+{
+    void (*cb)(pico_time, void *) = timer_cb[slot];
+
+    timer_cb[slot] = NULL;
+    if (cb)
+        cb(0, NULL);
+}
+
+static uint8_t file[65536];
+static uint32_t data_cnt = 0;
+static int done_cnt = 0;
+static int8_t done_result = 0;
+
+static void data(struct pico_http_download *dl, uint32_t offset, const uint8_t *buf, uint32_t len, void *arg)
+{
+    fail_if(offset + len > sizeof(file));
+    memcpy(&file[offset], buf, len);
+    data_cnt += len;
+}
+
+static void done(struct pico_http_download *dl, int8_t result, void *arg)
+{
+    done_cnt++;
+    done_result = result;
+}
+
+static void reset(void)
+{
+    memset(clients, 0, sizeof(clients));
+    memset(file, 0, sizeof(file));
+    open_cnt = 0;
+    timer_cb[0] = NULL;
+    timer_cb[1] = NULL;
+    data_cnt = 0;
+    done_cnt = 0;
+    done_result = 0;
+}
+
+/* response header of conn, then the body bytes from..to of a resource where byte i is (uint8_t)i */
+static void respond(uint16_t conn, uint16_t code, uint32_t first, uint32_t total, const char *etag)
+{
+    clients[conn].header.response_code = code;
+    clients[conn].header.etag = (char *)etag;
+    clients[conn].header.range_first = first;
+    clients[conn].header.range_total = (code == HTTP_PARTIAL_CONTENT) ? total : 0;
+    clients[conn].header.content_length_or_chunk = total - first;
+    client_wakeup(EV_HTTP_REQ, conn);
+}
+
+static void body(uint16_t conn, uint32_t from, uint32_t to)
+{
+    uint8_t buf[256];
+    uint32_t i, len;
+
+    while (from < to && clients[conn].open)
+    {
+        len = (to - from > sizeof(buf)) ? (uint32_t)sizeof(buf) : to - from;
+        for (i = 0; i < len; i++)
+            buf[i] = (uint8_t)(from + i);
+        clients[conn].sink(conn, buf, len, NULL);
+        from += len;
+    }
+}
+
+static int file_ok(uint32_t from, uint32_t to)
+{
+    uint32_t i;
+
+    for (i = from; i < to; i++)
+    {
+        if (file[i] != (uint8_t)i)
+            return 0;
+    }
+    return 1;
+}
+
+START_TEST(tc_pico_http_download_resume)
+{
+    struct pico_http_download *dl;
+    uint32_t total = 0;
+
+    reset();
+    /* continues where an earlier download stopped */
+    dl = pico_http_download_start("http://example.org/fw.bin", 100, "\"v1\"", 1, data, done, NULL);
+    fail_if(!dl);
+    fail_if(strcmp(clients[0].headers, "Range: bytes=100-\r\nIf-Range: \"v1\"\r\n"));
+    client_wakeup(EV_HTTP_CON, 0);
+    fail_if(!clients[0].get_sent);
+    respond(0, HTTP_PARTIAL_CONTENT, 100, 1000, "\"v1\"");
+    body(0, 100, 600);
+    fail_if(pico_http_download_progress(dl, &total) != 600);
+    fail_if(total != 1000);
+
+    /* the connection drops, the rest is asked for after a while */
+    client_wakeup(EV_HTTP_CLOSE, 0);
+    run_timer(0);
+    fail_if(clients[0].open);
+    fail_if(open_cnt != 1);
+    run_timer(1);
+    fail_if(open_cnt != 2);
+    fail_if(strcmp(clients[1].headers, "Range: bytes=600-\r\nIf-Range: \"v1\"\r\n"));
+    client_wakeup(EV_HTTP_CON, 1);
+    respond(1, HTTP_PARTIAL_CONTENT, 600, 1000, "\"v1\"");
+    body(1, 600, 1000);
+    client_wakeup(EV_HTTP_DONE, 1);
+    fail_if(done_cnt != 0);
+    run_timer(0);
+    fail_if(done_cnt != 1 || done_result != 0);
+    fail_if(clients[1].open);
+    fail_if(data_cnt != 900);
+    fail_if(!file_ok(100, 1000));
+}
+END_TEST
+
+START_TEST(tc_pico_http_download_changed)
+{
+    struct pico_http_download *dl;
+
+    reset();
+    dl = pico_http_download_start("http://example.org/fw.bin", 0, NULL, 1, data, done, NULL);
+    fail_if(clients[0].headers[0]);
+    client_wakeup(EV_HTTP_CON, 0);
+    respond(0, HTTP_OK, 0, 1000, "\"v1\"");
+    body(0, 0, 300);
+    fail_if(strcmp(pico_http_download_etag(dl), "\"v1\""));
+    client_wakeup(EV_HTTP_ERROR, 0);
+    run_timer(0);
+    run_timer(1);
+    fail_if(strcmp(clients[1].headers, "Range: bytes=300-\r\nIf-Range: \"v1\"\r\n"));
+
+    /* the resource changed, it comes again from the start */
+    client_wakeup(EV_HTTP_CON, 1);
+    respond(1, HTTP_OK, 0, 1000, "\"v2\"");
+    fail_if(pico_http_download_progress(dl, NULL) != 0);
+    body(1, 0, 1000);
+    client_wakeup(EV_HTTP_DONE, 1);
+    run_timer(0);
+    fail_if(done_cnt != 1 || done_result != 0);
+    fail_if(data_cnt != 1300);
+    fail_if(!file_ok(0, 1000));
+}
+END_TEST
+
+START_TEST(tc_pico_http_download_parallel)
+{
+    struct pico_http_download *dl;
+    uint32_t part = 40000u / 2u;
+
+    reset();
+    dl = pico_http_download_start("http://example.org/fw.bin", 0, NULL, 2, data, done, NULL);
+    /* asks for a range to learn the size */
+    fail_if(strcmp(clients[0].headers, "Range: bytes=0-\r\n"));
+    client_wakeup(EV_HTTP_CON, 0);
+    respond(0, HTTP_PARTIAL_CONTENT, 0, 40000, "\"v1\"");
+    fail_if(open_cnt != 2);
+    fail_if(strcmp(clients[1].headers, "Range: bytes=20000-39999\r\nIf-Range: \"v1\"\r\n"));
+    client_wakeup(EV_HTTP_CON, 1);
+    respond(1, HTTP_PARTIAL_CONTENT, part, 40000, "\"v1\"");
+    body(1, part, 40000);
+    client_wakeup(EV_HTTP_DONE, 1);
+    run_timer(0);
+    fail_if(pico_http_download_progress(dl, NULL) != 0);
+
+    /* the first connection is cut where the second part begins */
+    body(0, 0, 40000);
+    fail_if(data_cnt != 40000);
+    run_timer(0);
+    fail_if(clients[0].open);
+    fail_if(done_cnt != 1 || done_result != 0);
+    fail_if(!file_ok(0, 40000));
+}
+END_TEST
+
+START_TEST(tc_pico_http_download_fail)
+{
+    struct pico_http_download *dl;
+    int i;
+
+    reset();
+    fail_if(pico_http_download_start(NULL, 0, NULL, 1, data, done, NULL) != NULL);
+
+    pico_http_download_start("http://example.org/none", 0, NULL, 1, data, done, NULL);
+    client_wakeup(EV_HTTP_CON, 0);
+    respond(0, HTTP_NOT_FOUND, 0, 10, NULL);
+    run_timer(0);
+    fail_if(done_cnt != 1 || done_result != -1);
+    fail_if(clients[0].open);
+
+    /* gives up after HTTP_DOWNLOAD_RETRIES reconnects without progress */
+    reset();
+    pico_http_download_start("http://example.org/fw.bin", 0, NULL, 1, data, done, NULL);
+    for (i = 0; i <= (int)HTTP_DOWNLOAD_RETRIES; i++)
+    {
+        client_wakeup(EV_HTTP_ERROR, (uint16_t)i);
+        run_timer(0);
+        run_timer(1);
+    }
+    fail_if(done_cnt != 1 || done_result != -1);
+    fail_if(open_cnt != (int)HTTP_DOWNLOAD_RETRIES + 1);
+
+    /* abort closes the clients, done is not called */
+    reset();
+    dl = pico_http_download_start("http://example.org/fw.bin", 0, NULL, 1, data, done, NULL);
+    pico_http_download_abort(dl);
+    fail_if(clients[0].open);
+    run_timer(0);
+    fail_if(done_cnt != 0);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB download");
+
+    TCase *TCase_pico_http_download_resume = tcase_create("Unit test for tc_pico_http_download_resume");
+    TCase *TCase_pico_http_download_changed = tcase_create("Unit test for tc_pico_http_download_changed");
+    TCase *TCase_pico_http_download_parallel = tcase_create("Unit test for tc_pico_http_download_parallel");
+    TCase *TCase_pico_http_download_fail = tcase_create("Unit test for tc_pico_http_download_fail");
+
+    tcase_add_test(TCase_pico_http_download_resume, tc_pico_http_download_resume);
+    suite_add_tcase(s, TCase_pico_http_download_resume);
+    tcase_add_test(TCase_pico_http_download_changed, tc_pico_http_download_changed);
+    suite_add_tcase(s, TCase_pico_http_download_changed);
+    tcase_add_test(TCase_pico_http_download_parallel, tc_pico_http_download_parallel);
+    suite_add_tcase(s, TCase_pico_http_download_parallel);
+    tcase_add_test(TCase_pico_http_download_fail, tc_pico_http_download_fail);
+    suite_add_tcase(s, TCase_pico_http_download_fail);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -0,0 +1,179 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+
+#include "pico_http_inflate.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+
+/* 20 lines of "line NN of a body that compresses well", gzip with a dynamic block */
+static const uint8_t gzip_lines[] =
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\xff\x8d\xd1\xcd\x0d\x40\x40"
+    "\x14\x46\xd1\xbd\x2a\x5e\x09\x3e\xff\xca\x19\x8c\x90\x0c\x23\x46"
+    "\x22\xba\x97\x68\xc0\xdd\x9f\xdd\x09\xeb\xee\x2d\xcf\x2d\xce\xe6"
+    "\x6c\x88\xd3\x63\xd7\xe2\x2e\x1b\xe3\x76\x9c\x3e\x25\x9f\xec\xf6"
+    "\x21\x64\xe1\x63\x62\xac\x60\xac\x64\xac\x62\xac\x66\xac\x61\xac"
+    "\x65\xac\x63\xac\x47\x4c\x6c\x41\x6c\x41\x6c\x41\x6c\x41\x6c\x41"
+    "\x6c\x41\x6c\x41\x6c\x41\x6c\x41\xbf\x0b\x2f\x2d\xcf\x10\xd3\x0c"
+    "\x03\x00\x00";
+
+/* "hello hello hello hello deflate\n", zlib with a fixed block */
+static const uint8_t zlib_hello[] =
+    "\x78\xda\xcb\x48\xcd\xc9\xc9\x57\xc8\xc0\x20\x53\x52\xd3\x72\x12"
+    "\x4b\x52\xb9\x00\xc5\x73\x0b\xb0";
+
+/* the same without the zlib wrapper */
+static const uint8_t raw_hello[] =
+    "\xcb\x48\xcd\xc9\xc9\x57\xc8\xc0\x20\x53\x52\xd3\x72\x12\x4b\x52"
+    "\xb9\x00";
+
+/* "stored", raw deflate in a stored block */
+static const uint8_t raw_stored[] =
+    "\x01\x06\x00\xf9\xff\x73\x74\x6f\x72\x65\x64";
+
+static const char hello[] = "hello hello hello hello deflate\n";
+
+static char lines[1024];
+
+static void make_lines(void)
+{
+    int i;
+
+    lines[0] = '\0';
+    for (i = 0; i < 20; i++)
+    {
+        sprintf(lines + strlen(lines), "line %02d of a body that compresses well\n", i);
+    }
+}
+
+/* feeds in pieces of feed bytes, takes the output in pieces of max bytes */
+static int32_t inflate_all(uint8_t format, const uint8_t *in, uint32_t in_len, uint32_t feed, uint32_t max, char *out, uint32_t size)
+{
+    struct pico_http_inflate *inf = pico_http_inflate_create(format);
+    const uint8_t *data;
+    uint32_t out_len = 0;
+    uint32_t room;
+    uint8_t *buf;
+    int32_t len;
+
+    fail_if(!inf);
+    while (!pico_http_inflate_done(inf))
+    {
+        len = pico_http_inflate_output(inf, &data, max);
+        if (len < 0)
+        {
+            pico_http_inflate_destroy(inf);
+            return -1;
+        }
+        if (len > 0)
+        {
+            fail_if((uint32_t)len > max);
+            fail_if(out_len + (uint32_t)len > size);
+            memcpy(out + out_len, data, (size_t)len);
+            out_len += (uint32_t)len;
+            continue;
+        }
+        if (pico_http_inflate_done(inf))
+        {
+            break;
+        }
+        if (!in_len)
+        {
+            /* cut short */
+            pico_http_inflate_destroy(inf);
+            return -1;
+        }
+        buf = pico_http_inflate_space(inf, &room);
+        if (room > feed)
+            room = feed;
+        if (room > in_len)
+            room = in_len;
+        memcpy(buf, in, room);
+        pico_http_inflate_commit(inf, room);
+        in += room;
+        in_len -= room;
+    }
+    pico_http_inflate_destroy(inf);
+    return (int32_t)out_len;
+}
+
+START_TEST(tc_pico_http_inflate_gzip)
+{
+    char out[1024];
+
+    make_lines();
+    fail_if(inflate_all(HTTP_INFLATE_GZIP, gzip_lines, sizeof(gzip_lines) - 1, 1024, 1024, out, sizeof(out)) != (int32_t)strlen(lines));
+    fail_if(memcmp(out, lines, strlen(lines)));
+
+    /* a byte at a time, every step undone when the input runs out */
+    fail_if(inflate_all(HTTP_INFLATE_GZIP, gzip_lines, sizeof(gzip_lines) - 1, 1, 7, out, sizeof(out)) != (int32_t)strlen(lines));
+    fail_if(memcmp(out, lines, strlen(lines)));
+}
+END_TEST
+
+START_TEST(tc_pico_http_inflate_deflate)
+{
+    char out[64];
+
+    fail_if(inflate_all(HTTP_INFLATE_DEFLATE, zlib_hello, sizeof(zlib_hello) - 1, 5, 64, out, sizeof(out)) != (int32_t)strlen(hello));
+    fail_if(memcmp(out, hello, strlen(hello)));
+
+    /* servers sending deflate without the zlib wrapper */
+    fail_if(inflate_all(HTTP_INFLATE_DEFLATE, raw_hello, sizeof(raw_hello) - 1, 64, 64, out, sizeof(out)) != (int32_t)strlen(hello));
+    fail_if(memcmp(out, hello, strlen(hello)));
+    fail_if(inflate_all(HTTP_INFLATE_DEFLATE, raw_stored, sizeof(raw_stored) - 1, 2, 64, out, sizeof(out)) != 6);
+    fail_if(memcmp(out, "stored", 6));
+}
+END_TEST
+
+START_TEST(tc_pico_http_inflate_corrupt)
+{
+    uint8_t bad[sizeof(gzip_lines)];
+    char out[1024];
+
+    fail_if(pico_http_inflate_create(0) != NULL);
+    fail_if(pico_err != PICO_ERR_EINVAL);
+
+    /* wrong crc */
+    memcpy(bad, gzip_lines, sizeof(bad));
+    bad[sizeof(bad) - 9] ^= 0x01u;
+    fail_if(inflate_all(HTTP_INFLATE_GZIP, bad, sizeof(bad) - 1, 1024, 1024, out, sizeof(out)) != -1);
+
+    /* not gzip */
+    fail_if(inflate_all(HTTP_INFLATE_GZIP, zlib_hello, sizeof(zlib_hello) - 1, 1024, 1024, out, sizeof(out)) != -1);
+
+    /* cut short */
+    fail_if(inflate_all(HTTP_INFLATE_DEFLATE, zlib_hello, sizeof(zlib_hello) - 5, 1024, 1024, out, sizeof(out)) != -1);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB inflate");
+
+    TCase *TCase_pico_http_inflate_gzip = tcase_create("Unit test for tc_pico_http_inflate_gzip");
+    TCase *TCase_pico_http_inflate_deflate = tcase_create("Unit test for tc_pico_http_inflate_deflate");
+    TCase *TCase_pico_http_inflate_corrupt = tcase_create("Unit test for tc_pico_http_inflate_corrupt");
+
+    tcase_add_test(TCase_pico_http_inflate_gzip, tc_pico_http_inflate_gzip);
+    suite_add_tcase(s, TCase_pico_http_inflate_gzip);
+    tcase_add_test(TCase_pico_http_inflate_deflate, tc_pico_http_inflate_deflate);
+    suite_add_tcase(s, TCase_pico_http_inflate_deflate);
+    tcase_add_test(TCase_pico_http_inflate_corrupt, tc_pico_http_inflate_corrupt);
+    suite_add_tcase(s, TCase_pico_http_inflate_corrupt);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -0,0 +1,192 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_util.h"
+#include "pico_http_multipart.h"
+
+#include "pico_http_multipart.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+
+/* MOCKS */
+static char data_out[256];
+static uint32_t data_out_len = 0;
+static char headers_out[256];
+static int part_end_cnt = 0;
+static int abort_on_data = 0;
+
+static const char form_body[] =
+    "preamble\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"a\"\r\n"
+    "\r\n"
+    "hello\r\n"
+    "--XyZ\r\n"
+    "Content-Disposition: form-data; name=\"f\"; filename=\"x.bin\"\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "\r\n"
+    "\r\n--X\r\n--Xy\r\n"
+    "\r\n"
+    "--XyZ--\r\n"
+    "epilogue";
+
+static int8_t cb_part_header(void *arg, const char *name, const char *value)
+{
+    strcat(headers_out, name);
+    strcat(headers_out, "=");
+    strcat(headers_out, value);
+    strcat(headers_out, "|");
+    return 0;
+}
+
+static int8_t cb_part_data(void *arg, const uint8_t *data, uint32_t len)
+{
+    if (abort_on_data)
+        return -1;
+
+    memcpy(data_out + data_out_len, data, len);
+    data_out_len += len;
+    return 0;
+}
+
+static int8_t cb_part_end(void *arg)
+{
+    data_out[data_out_len++] = '#';
+    part_end_cnt++;
+    return 0;
+}
+
+static const struct pico_http_multipart_cb test_cb = {
+    cb_part_header, cb_part_data, cb_part_end
+};
+
+static void reset_mocks(void)
+{
+    memset(data_out, 0, sizeof(data_out));
+    memset(headers_out, 0, sizeof(headers_out));
+    data_out_len = 0;
+    part_end_cnt = 0;
+    abort_on_data = 0;
+}
+
+START_TEST(tc_pico_http_multipart_param)
+{
+    char out[32];
+
+    fail_unless(pico_http_multipart_param("multipart/form-data; boundary=abc", "boundary", out, sizeof(out)) == 3);
+    fail_unless(strcmp(out, "abc") == 0);
+    fail_unless(pico_http_multipart_param("form-data; name=\"f\"; FILENAME=\"x y.bin\"", "filename", out, sizeof(out)) == 7);
+    fail_unless(strcmp(out, "x y.bin") == 0);
+    fail_unless(pico_http_multipart_param("form-data; name=\"f\"", "filename", out, sizeof(out)) == HTTP_RETURN_ERROR);
+    fail_unless(pico_http_multipart_param("form-data; name=0123456789", "name", out, 4u) == HTTP_RETURN_ERROR);
+}
+END_TEST
+
+START_TEST(tc_pico_http_multipart_create)
+{
+    struct pico_http_multipart *mp;
+
+    fail_unless(pico_http_multipart_create("multipart/form-data", &test_cb, NULL) == NULL);
+    fail_unless(pico_http_multipart_create("multipart/form-data; boundary=abc", NULL, NULL) == NULL);
+    mp = pico_http_multipart_create("multipart/form-data; boundary=abc", &test_cb, NULL);
+    fail_if(mp == NULL);
+    fail_unless(pico_http_multipart_done(mp) == 0);
+    pico_http_multipart_destroy(mp);
+}
+END_TEST
+
+START_TEST(tc_pico_http_multipart_feed)
+{
+    uint32_t step;
+    uint32_t len = (uint32_t)strlen(form_body);
+
+    /* every slice size must give the same result, also when the boundary is learned */
+    for (step = 1; step <= len; step++)
+    {
+        int learn;
+        for (learn = 0; learn < 2; learn++)
+        {
+            const char *body = learn ? (form_body + 10) : form_body;
+            uint32_t body_len = (uint32_t)strlen(body);
+            struct pico_http_multipart *mp;
+            uint32_t i;
+
+            reset_mocks();
+            mp = pico_http_multipart_create(learn ? NULL : "multipart/form-data; boundary=XyZ", &test_cb, NULL);
+            fail_if(mp == NULL);
+            for (i = 0; i < body_len; i += step)
+            {
+                uint32_t n = (body_len - i < step) ? (body_len - i) : step;
+                fail_unless(pico_http_multipart_feed(mp, (const uint8_t *)body + i, n) == (int32_t)n);
+            }
+            fail_unless(strcmp(data_out, "hello#\r\n--X\r\n--Xy\r\n#") == 0);
+            fail_unless(strcmp(headers_out, "Content-Disposition=form-data; name=\"a\"|"
+                               "Content-Disposition=form-data; name=\"f\"; filename=\"x.bin\"|"
+                               "Content-Type=application/octet-stream|") == 0);
+            fail_unless(part_end_cnt == 2);
+            fail_unless(pico_http_multipart_done(mp) == 1);
+            pico_http_multipart_destroy(mp);
+        }
+    }
+}
+END_TEST
+
+START_TEST(tc_pico_http_multipart_feed_error)
+{
+    const char bad[] = "--XyZ\r\n\r\nhello\r\n--XyZ wrong\r\n";
+    struct pico_http_multipart *mp;
+    uint32_t i;
+    int32_t ret = 0;
+
+    /* garbage after a delimiter */
+    reset_mocks();
+    mp = pico_http_multipart_create("multipart/form-data; boundary=XyZ", &test_cb, NULL);
+    for (i = 0; i < strlen(bad) && ret >= 0; i++)
+        ret = pico_http_multipart_feed(mp, (const uint8_t *)bad + i, 1u);
+    fail_unless(ret == HTTP_RETURN_ERROR);
+    fail_unless(pico_http_multipart_done(mp) == HTTP_RETURN_ERROR);
+    fail_unless(pico_http_multipart_feed(mp, (const uint8_t *)"x", 1u) == HTTP_RETURN_ERROR);
+    pico_http_multipart_destroy(mp);
+
+    /* callback aborts */
+    reset_mocks();
+    abort_on_data = 1;
+    mp = pico_http_multipart_create("multipart/form-data; boundary=XyZ", &test_cb, NULL);
+    fail_unless(pico_http_multipart_feed(mp, (const uint8_t *)form_body, (uint32_t)strlen(form_body)) == HTTP_RETURN_ERROR);
+    pico_http_multipart_destroy(mp);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB multipart");
+
+    TCase *TCase_pico_http_multipart_param = tcase_create("Unit test for tc_pico_http_multipart_param");
+    TCase *TCase_pico_http_multipart_create = tcase_create("Unit test for tc_pico_http_multipart_create");
+    TCase *TCase_pico_http_multipart_feed = tcase_create("Unit test for tc_pico_http_multipart_feed");
+    TCase *TCase_pico_http_multipart_feed_error = tcase_create("Unit test for tc_pico_http_multipart_feed_error");
+
+    tcase_add_test(TCase_pico_http_multipart_param, tc_pico_http_multipart_param);
+    suite_add_tcase(s, TCase_pico_http_multipart_param);
+    tcase_add_test(TCase_pico_http_multipart_create, tc_pico_http_multipart_create);
+    suite_add_tcase(s, TCase_pico_http_multipart_create);
+    tcase_add_test(TCase_pico_http_multipart_feed, tc_pico_http_multipart_feed);
+    suite_add_tcase(s, TCase_pico_http_multipart_feed);
+    tcase_add_test(TCase_pico_http_multipart_feed_error, tc_pico_http_multipart_feed_error);
+    suite_add_tcase(s, TCase_pico_http_multipart_feed_error);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -0,0 +1,575 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_tree.h"
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_server.h"
+#include "pico_http_client.h"
+#include "pico_http_util.h"
+
+#include "pico_http_proxy.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+
+#define RED     0
+#define BLACK 1
+/* By default the null leafs are black */
+struct pico_tree_node LEAF = {
+    NULL, /* key */
+    &LEAF, &LEAF, &LEAF, /* parent, left,right */
+    BLACK, /* color */
+};
+
+/* MOCKS */
+#define UPSTREAM_CONN   7u
+#define DOWNSTREAM_CONN 3u
+
+/* a single session is enough for these tests */
+static struct pico_tree_node session_node;
+
+void *pico_tree_insert(struct pico_tree *tree, void *key)
+{
+    if (session_node.keyValue)
+        return session_node.keyValue;
+
+    session_node.keyValue = key;
+    return NULL;
+}
+
+void *pico_tree_findKey(struct pico_tree *tree, void *key)
+{
+    if (session_node.keyValue && !tree->compare(session_node.keyValue, key))
+        return session_node.keyValue;
+
+    return NULL;
+}
+
+void *pico_tree_delete(struct pico_tree *tree, void *key)
+{
+    if (session_node.keyValue != key)
+        return NULL;
+
+    session_node.keyValue = NULL;
+    return key;
+}
+
+struct pico_tree_node *pico_tree_firstNode(struct pico_tree_node *node)
+{
+    return session_node.keyValue ? &session_node : &LEAF;
+}
+
+struct pico_tree_node *pico_tree_next(struct pico_tree_node *node)
+{
+    return &LEAF;
+}
+
+static void (*timer_cb)(pico_time, void *) = NULL;
+static int timer_dummy;
+
+struct pico_timer *pico_timer_add(pico_time expire, void (*timer)(pico_time, void *), void *arg)
+{
+    timer_cb = timer;
+    return (struct pico_timer *)&timer_dummy;
+}
+
+/* server side */
+static void (*server_hook)(uint16_t conn) = NULL;
+static void (*server_wakeup)(uint16_t ev, uint16_t conn) = NULL;
+static char srv_resource[64];
+static uint16_t srv_method;
+static uint32_t srv_content_length;
+static const char *srv_body;
+static uint32_t srv_body_avail;
+static uint16_t srv_code;
+static const char *srv_fields;
+static char srv_reason[64];
+static char srv_status_fields[512];
+static uint16_t srv_keep;
+static char down_out[2048];
+static uint32_t down_out_len;
+static int down_chunks;
+static int down_final;
+static int down_closed;
+
+int16_t pico_http_server_set_request_hook(void (*hook)(uint16_t conn))
+{
+    server_hook = hook;
+    return HTTP_RETURN_OK;
+}
+
+int16_t pico_http_set_wakeup(uint16_t conn, void (*wakeup)(uint16_t ev, uint16_t conn))
+{
+    server_wakeup = wakeup;
+    return HTTP_RETURN_OK;
+}
+
+char *pico_http_get_resource(uint16_t conn)
+{
+    return srv_resource;
+}
+
+int16_t pico_http_get_method(uint16_t conn)
+{
+    return (int16_t)srv_method;
+}
+
+uint32_t pico_http_get_content_length(uint16_t conn)
+{
+    return srv_content_length;
+}
+
+int32_t pico_http_read_body(uint16_t conn, void *buf, uint32_t len)
+{
+    if (len > srv_body_avail)
+        len = srv_body_avail;
+
+    memcpy(buf, srv_body, len);
+    srv_body += len;
+    srv_body_avail -= len;
+    return (int32_t)len;
+}
+
+const char *pico_http_get_fields(uint16_t conn)
+{
+    return srv_fields;
+}
+
+int16_t pico_http_server_keep_fields(uint16_t size)
+{
+    srv_keep = size;
+    return HTTP_RETURN_OK;
+}
+
+int32_t pico_http_respond(uint16_t conn, uint16_t code)
+{
+    srv_code = code;
+    return 0;
+}
+
+int32_t pico_http_respond_status(uint16_t conn, uint16_t status, const char *reason, const char *fields)
+{
+    srv_code = status;
+    strcpy(srv_reason, reason);
+    strcpy(srv_status_fields, fields ? fields : "");
+    return 0;
+}
+
+int16_t pico_http_submit_data(uint16_t conn, void *buffer, uint16_t len)
+{
+    fail_if(conn != DOWNSTREAM_CONN);
+    if (!buffer)
+    {
+        down_final++;
+        return HTTP_RETURN_OK;
+    }
+
+    fail_if(len > HTTP_PROXY_BUF_SIZE);
+    memcpy(down_out + down_out_len, buffer, len);
+    down_out_len += len;
+    down_chunks++;
+    return HTTP_RETURN_OK;
+}
+
+int16_t pico_http_close(uint16_t conn)
+{
+    fail_if(conn != DOWNSTREAM_CONN);
+    down_closed++;
+    return HTTP_RETURN_OK;
+}
+
+/* client side */
+static void (*client_wakeup)(uint16_t ev, uint16_t conn) = NULL;
+static struct pico_http_uri up_uri;
+static struct pico_http_header up_header;
+static char up_request[256];
+static int up_opened;
+static int up_closed;
+static char up_out[2048];
+static uint32_t up_out_len;
+static uint32_t up_window;
+static const char *up_body;
+static uint32_t up_body_avail;
+static uint32_t up_body_left;
+
+static void (*field_sink)(uint16_t conn, const char *line, void *arg) = NULL;
+static void *field_sink_arg;
+
+int8_t pico_http_client_set_field_sink(uint16_t conn, void (*sink)(uint16_t conn, const char *line, void *arg), void *arg)
+{
+    fail_if(conn != UPSTREAM_CONN);
+    field_sink = sink;
+    field_sink_arg = arg;
+    return HTTP_RETURN_OK;
+}
+
+/* the upstream sends its header lines */
+static void upstream_lines(const char **lines)
+{
+    fail_if(field_sink == NULL);
+    for (; *lines; lines++)
+        field_sink(UPSTREAM_CONN, (*lines)[0] ? *lines : NULL, field_sink_arg);
+}
+
+int32_t pico_http_client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn))
+{
+    fail_if(strcmp(uri, "http://10.0.0.2:8080/api") != 0);
+    client_wakeup = wakeup;
+    up_opened++;
+    return UPSTREAM_CONN;
+}
+
+struct pico_http_uri *pico_http_client_read_uri_data(uint16_t conn)
+{
+    return &up_uri;
+}
+
+int8_t pico_http_client_send_raw(uint16_t conn, char *request)
+{
+    fail_if(conn != UPSTREAM_CONN);
+    strcpy(up_request, request);
+    return HTTP_RETURN_OK;
+}
+
+int32_t pico_http_client_write_body(uint16_t conn, const uint8_t *data, uint32_t len)
+{
+    if (len > up_window)
+        len = up_window;
+
+    memcpy(up_out + up_out_len, data, len);
+    up_out_len += len;
+    up_window -= len;
+    return (int32_t)len;
+}
+
+struct pico_http_header *pico_http_client_read_header(uint16_t conn)
+{
+    return &up_header;
+}
+
+int32_t pico_http_client_read_body(uint16_t conn, unsigned char *data, uint16_t size, uint8_t *body_read_done)
+{
+    uint32_t len = (size < up_body_avail) ? size : up_body_avail;
+
+    memcpy(data, up_body, len);
+    up_body += len;
+    up_body_avail -= len;
+    up_body_left -= len;
+    if (!up_body_left)
+        *body_read_done = 1;
+
+    return (int32_t)len;
+}
+
+int8_t pico_http_client_close(uint16_t conn)
+{
+    fail_if(conn != UPSTREAM_CONN);
+    up_closed++;
+    return HTTP_RETURN_OK;
+}
+
+static char big_body[1200];
+
+static void reset_mocks(void)
+{
+    uint32_t i;
+
+    pico_http_proxy_close();
+    memset(&session_node, 0, sizeof(session_node));
+    timer_cb = NULL;
+    proxy_reap_pending = 0;
+    server_wakeup = NULL;
+    srv_method = HTTP_METHOD_GET;
+    srv_content_length = 0;
+    srv_body_avail = 0;
+    srv_code = 0;
+    srv_fields = "";
+    srv_reason[0] = 0;
+    srv_status_fields[0] = 0;
+    down_out_len = 0;
+    down_chunks = down_final = down_closed = 0;
+    client_wakeup = NULL;
+    field_sink = NULL;
+    up_uri.host = "10.0.0.2";
+    up_uri.port = 8080;
+    memset(&up_header, 0, sizeof(up_header));
+    up_header.response_code = 200;
+    up_request[0] = 0;
+    up_opened = up_closed = 0;
+    up_out_len = 0;
+    up_window = 0;
+    up_body_avail = up_body_left = 0;
+    for (i = 0; i < sizeof(big_body); i++)
+        big_body[i] = (char)('a' + i % 26);
+}
+
+/* takes a request through the hook up to the request sent upstream */
+static void start_request(const char *resource)
+{
+    strcpy(srv_resource, resource);
+    server_hook(DOWNSTREAM_CONN);
+    fail_if(server_wakeup == NULL);
+    server_wakeup(EV_HTTP_REQ, DOWNSTREAM_CONN);
+}
+
+START_TEST(tc_pico_http_proxy_add_route)
+{
+    reset_mocks();
+    fail_unless(pico_http_proxy_add_route(NULL, "http://10.0.0.2/") == HTTP_RETURN_ERROR);
+    fail_unless(pico_http_proxy_add_route("svc", "http://10.0.0.2/") == HTTP_RETURN_ERROR);
+    fail_unless(pico_http_proxy_add_route("/svc", "https://10.0.0.2/") == HTTP_RETURN_ERROR);
+    fail_unless(pico_http_proxy_add_route("/svc", "http://10.0.0.2:8080/api") == HTTP_RETURN_OK);
+    fail_unless(pico_http_proxy_add_route("/files/", "http://10.0.0.3") == HTTP_RETURN_OK);
+    fail_if(server_hook == NULL);
+
+    fail_unless(find_route("/svc") == &proxy_routes[0]);
+    fail_unless(find_route("/svc/a") == &proxy_routes[0]);
+    fail_unless(find_route("/svc?x=1") == &proxy_routes[0]);
+    fail_unless(find_route("/svcx") == NULL);
+    fail_unless(find_route("/files/x") == &proxy_routes[1]);
+    fail_unless(find_route("/") == NULL);
+    fail_unless(strcmp(proxy_routes[0].path, "/api") == 0);
+    fail_unless(strcmp(proxy_routes[1].path, "") == 0);
+
+    /* not proxied, the application keeps the request */
+    strcpy(srv_resource, "/index.html");
+    server_hook(DOWNSTREAM_CONN);
+    fail_unless(server_wakeup == NULL);
+
+    fail_unless(pico_http_proxy_add_route("/c", "http://10.0.0.2/") == HTTP_RETURN_OK);
+    fail_unless(pico_http_proxy_add_route("/d", "http://10.0.0.2/") == HTTP_RETURN_OK);
+    fail_unless(pico_http_proxy_add_route("/e", "http://10.0.0.2/") == HTTP_RETURN_ERROR);
+    reset_mocks();
+}
+END_TEST
+
+START_TEST(tc_pico_http_proxy_get)
+{
+    reset_mocks();
+    fail_unless(pico_http_proxy_add_route("/svc", "http://10.0.0.2:8080/api") == HTTP_RETURN_OK);
+
+    start_request("/svc/a?b=1");
+    fail_unless(up_opened == 1);
+    client_wakeup(EV_HTTP_CON, UPSTREAM_CONN);
+    fail_unless(strcmp(up_request, "GET /api/a?b=1 HTTP/1.1\r\nHost: 10.0.0.2:8080\r\nConnection: Keep-Alive\r\n\r\n") == 0);
+    client_wakeup(EV_HTTP_WRITE_SUCCESS, UPSTREAM_CONN);
+
+    /* 1200 bytes of body, 700 of them there already */
+    up_body = big_body;
+    up_body_avail = 700;
+    up_body_left = sizeof(big_body);
+    client_wakeup(EV_HTTP_REQ | EV_HTTP_BODY, UPSTREAM_CONN);
+    fail_unless(srv_code == 200);
+    fail_unless(down_chunks == 1);
+
+    /* nothing more is read before the chunk was sent */
+    client_wakeup(EV_HTTP_BODY, UPSTREAM_CONN);
+    fail_unless(down_chunks == 1);
+    server_wakeup(EV_HTTP_SENT, DOWNSTREAM_CONN);
+    fail_unless(down_chunks == 2);
+    server_wakeup(EV_HTTP_SENT, DOWNSTREAM_CONN);
+    fail_unless(down_chunks == 2);
+
+    up_body_avail = 500;
+    client_wakeup(EV_HTTP_BODY, UPSTREAM_CONN);
+    fail_unless(down_chunks == 3);
+    server_wakeup(EV_HTTP_SENT, DOWNSTREAM_CONN);
+    fail_unless(down_final == 1);
+    fail_unless(down_out_len == sizeof(big_body));
+    fail_unless(memcmp(down_out, big_body, sizeof(big_body)) == 0);
+    fail_unless(proxy_routes[0].pool[0].state == HTTP_PROXY_UP_IDLE);
+
+    /* the next request goes over the pooled connection */
+    up_request[0] = 0;
+    start_request("/svc");
+    fail_unless(up_opened == 1);
+    fail_unless(strcmp(up_request, "GET /api HTTP/1.1\r\nHost: 10.0.0.2:8080\r\nConnection: Keep-Alive\r\n\r\n") == 0);
+
+    /* the client goes away halfway, the upstream is not reused */
+    client_wakeup(EV_HTTP_WRITE_SUCCESS, UPSTREAM_CONN);
+    up_body = big_body;
+    up_body_avail = 10;
+    up_body_left = 20;
+    client_wakeup(EV_HTTP_REQ | EV_HTTP_BODY, UPSTREAM_CONN);
+    server_wakeup(EV_HTTP_CLOSE, DOWNSTREAM_CONN);
+    fail_unless(down_closed == 1);
+    fail_unless(proxy_routes[0].pool[0].state == HTTP_PROXY_UP_DEAD);
+    fail_if(timer_cb == NULL);
+    timer_cb(0, NULL);
+    fail_unless(up_closed == 1);
+    fail_unless(proxy_routes[0].pool[0].state == HTTP_PROXY_UP_FREE);
+    reset_mocks();
+}
+END_TEST
+
+START_TEST(tc_pico_http_proxy_post)
+{
+    reset_mocks();
+    fail_unless(pico_http_proxy_add_route("/svc/", "http://10.0.0.2:8080/api") == HTTP_RETURN_OK);
+
+    srv_method = HTTP_METHOD_POST;
+    srv_content_length = 1000;
+    srv_body = big_body;
+    srv_body_avail = 300;
+    start_request("/svc/up");
+    client_wakeup(EV_HTTP_CON, UPSTREAM_CONN);
+    fail_unless(strcmp(up_request, "POST /api/up HTTP/1.1\r\nHost: 10.0.0.2:8080\r\nContent-Length: 1000\r\nConnection: Keep-Alive\r\n\r\n") == 0);
+
+    /* the upstream takes 100 bytes, the rest waits in the buffer */
+    up_window = 100;
+    client_wakeup(EV_HTTP_WRITE_SUCCESS, UPSTREAM_CONN);
+    fail_unless(up_out_len == 100);
+    fail_unless(srv_body_avail == 0);
+
+    /* more request data does not get read while the buffer is full */
+    srv_body_avail = 700;
+    server_wakeup(EV_HTTP_BODY, DOWNSTREAM_CONN);
+    fail_unless(srv_body_avail == 700);
+
+    up_window = 2000;
+    client_wakeup(EV_HTTP_WRITE_PROGRESS_MADE, UPSTREAM_CONN);
+    fail_unless(up_out_len == 1000);
+    fail_unless(memcmp(up_out, big_body, 1000) == 0);
+
+    /* an error answer goes back as it is */
+    up_header.response_code = 500;
+    up_body = big_body;
+    client_wakeup(EV_HTTP_REQ, UPSTREAM_CONN);
+    fail_unless(srv_code == 500);
+    fail_unless(down_final == 1);
+    fail_unless(proxy_routes[0].pool[0].state == HTTP_PROXY_UP_IDLE);
+    reset_mocks();
+}
+END_TEST
+
+START_TEST(tc_pico_http_proxy_upstream_error)
+{
+    reset_mocks();
+    fail_unless(pico_http_proxy_add_route("/svc", "http://10.0.0.2:8080/api") == HTTP_RETURN_OK);
+
+    /* before the response: 502 */
+    start_request("/svc/x");
+    client_wakeup(EV_HTTP_CLOSE, UPSTREAM_CONN);
+    fail_unless(srv_code == HTTP_RESOURCE_BAD_GATEWAY);
+    fail_unless(find_session(DOWNSTREAM_CONN) == NULL);
+    timer_cb(0, NULL);
+    fail_unless(up_closed == 1);
+
+    /* during the response: the client connection is closed */
+    srv_code = 0;
+    start_request("/svc/x");
+    fail_unless(up_opened == 2);
+    client_wakeup(EV_HTTP_CON, UPSTREAM_CONN);
+    client_wakeup(EV_HTTP_WRITE_SUCCESS, UPSTREAM_CONN);
+    up_body = big_body;
+    up_body_avail = 10;
+    up_body_left = 100;
+    client_wakeup(EV_HTTP_REQ | EV_HTTP_BODY, UPSTREAM_CONN);
+    fail_unless(srv_code == 200);
+    client_wakeup(EV_HTTP_ERROR, UPSTREAM_CONN);
+    fail_unless(down_closed == 0);
+    timer_cb(0, NULL);
+    fail_unless(down_closed == 1);
+    fail_unless(up_closed == 2);
+    fail_unless(find_session(DOWNSTREAM_CONN) == NULL);
+    reset_mocks();
+}
+END_TEST
+
+START_TEST(tc_pico_http_proxy_fields)
+{
+    const char *answer[] = {
+        "HTTP/1.1 100 Continue", "X-Old: 1",
+        "HTTP/1.1 404 Not Here", "Content-Type: text/plain", "Content-Length: 3",
+        "Connection: keep-alive, X-Hop", "X-Hop: 1", "Keep-Alive: timeout=5", "ETag: \"x\"", NULL
+    };
+    const char *too_long[] = {
+        "HTTP/1.1 200 OK", "", NULL
+    };
+
+    reset_mocks();
+    fail_unless(pico_http_proxy_add_route("/svc", "http://10.0.0.2:8080/api") == HTTP_RETURN_OK);
+    fail_unless(srv_keep == HTTP_PROXY_HEADER_SIZE);
+
+    /* end-to-end fields go upstream, hop-by-hop ones and those Connection names do not */
+    srv_fields = "Host: me\r\nAccept: text/*\r\nconnection: close, X-Private\r\nx-private: 1\r\n"
+                 "TE: trailers\r\nCookie: a=b\r\nContent-Length: 9\r\n";
+    start_request("/svc/a");
+    client_wakeup(EV_HTTP_CON, UPSTREAM_CONN);
+    fail_unless(strcmp(up_request, "GET /api/a HTTP/1.1\r\nHost: 10.0.0.2:8080\r\nAccept: text/*\r\n"
+                       "Cookie: a=b\r\nConnection: Keep-Alive\r\n\r\n") == 0);
+    client_wakeup(EV_HTTP_WRITE_SUCCESS, UPSTREAM_CONN);
+
+    /* the status and the end-to-end fields come back, the body follows */
+    upstream_lines(answer);
+    up_header.response_code = 404;
+    up_body = "abc";
+    up_body_avail = up_body_left = 3;
+    client_wakeup(EV_HTTP_REQ | EV_HTTP_BODY, UPSTREAM_CONN);
+    fail_unless(srv_code == 404);
+    fail_unless(strcmp(srv_reason, "Not Here") == 0);
+    fail_unless(strcmp(srv_status_fields, "Content-Type: text/plain\r\nETag: \"x\"\r\n") == 0);
+    fail_unless(down_chunks == 1);
+    server_wakeup(EV_HTTP_SENT, DOWNSTREAM_CONN);
+    fail_unless(down_final == 1);
+
+    /* an answer header the proxy can not keep: 502 */
+    srv_fields = "";
+    start_request("/svc/b");
+    client_wakeup(EV_HTTP_WRITE_SUCCESS, UPSTREAM_CONN);
+    upstream_lines(too_long);
+    client_wakeup(EV_HTTP_REQ, UPSTREAM_CONN);
+    fail_unless(srv_code == HTTP_RESOURCE_BAD_GATEWAY);
+    fail_unless(find_session(DOWNSTREAM_CONN) == NULL);
+    timer_cb(0, NULL);
+
+    /* request fields the server could not keep: 431, nothing goes upstream */
+    srv_code = 0;
+    srv_fields = NULL;
+    up_opened = 0;
+    start_request("/svc/c");
+    fail_unless(srv_code == HTTP_HEDER_FIELD_LARGE);
+    fail_unless(down_final == 2);
+    fail_unless(up_opened == 0);
+    fail_unless(find_session(DOWNSTREAM_CONN) == NULL);
+
+    pico_http_proxy_close();
+    fail_unless(srv_keep == 0);
+    reset_mocks();
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB proxy");
+
+    TCase *TCase_pico_http_proxy_add_route = tcase_create("Unit test for tc_pico_http_proxy_add_route");
+    TCase *TCase_pico_http_proxy_get = tcase_create("Unit test for tc_pico_http_proxy_get");
+    TCase *TCase_pico_http_proxy_post = tcase_create("Unit test for tc_pico_http_proxy_post");
+    TCase *TCase_pico_http_proxy_upstream_error = tcase_create("Unit test for tc_pico_http_proxy_upstream_error");
+    TCase *TCase_pico_http_proxy_fields = tcase_create("Unit test for tc_pico_http_proxy_fields");
+
+    tcase_add_test(TCase_pico_http_proxy_add_route, tc_pico_http_proxy_add_route);
+    suite_add_tcase(s, TCase_pico_http_proxy_add_route);
+    tcase_add_test(TCase_pico_http_proxy_get, tc_pico_http_proxy_get);
+    suite_add_tcase(s, TCase_pico_http_proxy_get);
+    tcase_add_test(TCase_pico_http_proxy_post, tc_pico_http_proxy_post);
+    suite_add_tcase(s, TCase_pico_http_proxy_post);
+    tcase_add_test(TCase_pico_http_proxy_upstream_error, tc_pico_http_proxy_upstream_error);
+    suite_add_tcase(s, TCase_pico_http_proxy_upstream_error);
+    tcase_add_test(TCase_pico_http_proxy_fields, tc_pico_http_proxy_fields);
+    suite_add_tcase(s, TCase_pico_http_proxy_fields);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -0,0 +1,233 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_client.h"
+
+#include "pico_http_sched.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+volatile pico_time pico_tick = 0;
+
+/* MOCKS */
+#define CLIENTS 16
+
+struct mock_client
+{
+    uint8_t open;
+    const char *uri;
+};
+
+static struct mock_client clients[CLIENTS];
+static void (*client_wakeup)(uint16_t ev, uint16_t conn) = NULL;
+static int open_cnt = 0;
+static int open_fail = 0;
+
+int32_t pico_http_client_open(char *uri, void (*wakeup)(uint16_t ev, uint16_t conn))
+{
+    int32_t conn = open_cnt++;
+
+    if (open_fail)
+        return HTTP_RETURN_ERROR;
+    fail_if(conn >= CLIENTS);
+    clients[conn].open = 1;
+    clients[conn].uri = uri;
+    client_wakeup = wakeup;
+    return conn;
+}
+
+int8_t pico_http_client_close(uint16_t conn)
+{
+    fail_if(!clients[conn].open);
+    clients[conn].open = 0;
+    return 0;
+}
+
+static void (*timer_cb)(pico_time, void *);
+
+struct pico_timer *pico_timer_add(pico_time expire, void (*timer)(pico_time, void *), void *arg)
+{
+    timer_cb = timer;
+    return (struct pico_timer *)1;
+}
+
+static void run_timer(void)
+{
+    void (*cb)(pico_time, void *) = timer_cb;
+
+    timer_cb = NULL;
+    if (cb)
+        cb(0, NULL);
+}
+
+static int con_cnt = 0;
+static int done_cnt = 0;
+static int8_t done_result = 0;
+static struct pico_http_sched_request *cancel_req = NULL;
+
+static void wakeup(struct pico_http_sched_request *req, uint16_t ev, uint16_t conn, void *arg)
+{
+    if (ev & EV_HTTP_CON)
+        con_cnt++;
+    if (req == cancel_req)
+        pico_http_sched_cancel(req);
+}
+
+static void done(struct pico_http_sched_request *req, int8_t result, void *arg)
+{
+    done_cnt++;
+    done_result = result;
+}
+
+static void reset(void)
+{
+    memset(clients, 0, sizeof(clients));
+    open_cnt = 0;
+    open_fail = 0;
+    timer_cb = NULL;
+    con_cnt = 0;
+    done_cnt = 0;
+    done_result = 0;
+    cancel_req = NULL;
+}
+
+/* the uri the client conn was opened for, NULL if it is not open */
+static const char *opened(int conn)
+{
+    return clients[conn].open ? clients[conn].uri : NULL;
+}
+
+START_TEST(tc_pico_http_sched_priority)
+{
+    reset();
+    fail_if(pico_http_sched_submit("http://a.org/x", HTTP_SCHED_CLASSES, wakeup, done, NULL) != NULL);
+    fail_if(pico_http_sched_submit("http://a.org/x", HTTP_SCHED_BULK, NULL, done, NULL) != NULL);
+
+    /* nothing starts from within submit, urgent first, bulk leaves the reserved slot */
+    pico_http_sched_submit("http://a.org/bulk1", HTTP_SCHED_BULK, wakeup, done, NULL);
+    pico_http_sched_submit("http://a.org/bulk2", HTTP_SCHED_BULK, wakeup, done, NULL);
+    pico_http_sched_submit("http://user@b.org:8080/telemetry", HTTP_SCHED_NORMAL, wakeup, done, NULL);
+    pico_http_sched_submit("http://a.org/cmd", HTTP_SCHED_URGENT, wakeup, done, NULL);
+    fail_if(open_cnt != 0);
+    run_timer();
+    fail_if(open_cnt != 3);
+    fail_if(strcmp(opened(0), "http://a.org/cmd"));
+    fail_if(strcmp(opened(1), "http://user@b.org:8080/telemetry"));
+    fail_if(strcmp(opened(2), "http://a.org/bulk1"));
+    fail_if(sched_active != 3);
+
+    /* the events go to the user */
+    client_wakeup(EV_HTTP_CON, 0);
+    fail_if(con_cnt != 1);
+
+    /* an urgent request takes the reserved slot, a.org is at its limit */
+    pico_http_sched_submit("http://a.org/urgent", HTTP_SCHED_URGENT, wakeup, done, NULL);
+    pico_http_sched_submit("http://c.org/urgent", HTTP_SCHED_URGENT, wakeup, done, NULL);
+    run_timer();
+    fail_if(open_cnt != 4);
+    fail_if(strcmp(opened(3), "http://c.org/urgent"));
+
+    /* a response read completely frees its slot for the next in line */
+    client_wakeup(EV_HTTP_DONE, 0);
+    fail_if(!opened(0));
+    run_timer();
+    fail_if(done_cnt != 1 || done_result != HTTP_SCHED_DONE);
+    fail_if(opened(0));
+    fail_if(open_cnt != 5);
+    fail_if(strcmp(opened(4), "http://a.org/urgent"));
+
+    /* a dropped connection fails the request, bulk2 does not take the reserved slot */
+    client_wakeup(EV_HTTP_CLOSE, 3);
+    run_timer();
+    fail_if(done_cnt != 2 || done_result != HTTP_SCHED_FAILED);
+    fail_if(open_cnt != 5);
+    client_wakeup(EV_HTTP_DONE, 4);
+    run_timer();
+    fail_if(strcmp(opened(5), "http://a.org/bulk2"));
+    client_wakeup(EV_HTTP_DONE, 2);
+    client_wakeup(EV_HTTP_DONE, 1);
+    client_wakeup(EV_HTTP_TIMEOUT, 5);
+    run_timer();
+    fail_if(done_cnt != 6);
+    fail_if(sched_active != 0);
+    fail_if(sched_running || sched_queue[HTTP_SCHED_BULK]);
+}
+END_TEST
+
+START_TEST(tc_pico_http_sched_cancel)
+{
+    struct pico_http_sched_request *req;
+    char uri[] = "http://a.org/u";
+    int i;
+
+    reset();
+
+    /* queued: gone at once */
+    req = pico_http_sched_submit("http://a.org/1", HTTP_SCHED_NORMAL, wakeup, done, NULL);
+    pico_http_sched_cancel(req);
+    run_timer();
+    fail_if(open_cnt != 0);
+
+    /* running, from its own callback: closed from the stack, no done */
+    cancel_req = pico_http_sched_submit("http://a.org/2", HTTP_SCHED_NORMAL, wakeup, done, NULL);
+    run_timer();
+    client_wakeup(EV_HTTP_CON, 0);
+    fail_if(!opened(0));
+    run_timer();
+    fail_if(opened(0));
+    fail_if(done_cnt != 0);
+
+    /* urgent requests do not go beyond the cap either */
+    for (i = 0; i < 10; i++)
+    {
+        uri[7] = (char)('a' + i);
+        pico_http_sched_submit(uri, HTTP_SCHED_URGENT, wakeup, done, NULL);
+    }
+    run_timer();
+    fail_if(open_cnt != 1 + HTTP_SCHED_MAX_ACTIVE);
+    fail_if(sched_active != HTTP_SCHED_MAX_ACTIVE);
+    for (i = 1; i <= 10; i++)
+    {
+        client_wakeup(EV_HTTP_DONE, (uint16_t)i);
+        run_timer();
+        fail_if(sched_active > HTTP_SCHED_MAX_ACTIVE);
+    }
+    fail_if(open_cnt != 11 || done_cnt != 10 || sched_active != 0);
+    done_cnt = 0;
+
+    /* a client that can not be opened */
+    open_fail = 1;
+    pico_http_sched_submit("http://a.org/3", HTTP_SCHED_URGENT, wakeup, done, NULL);
+    run_timer();
+    run_timer();
+    fail_if(done_cnt != 1 || done_result != HTTP_SCHED_FAILED);
+    fail_if(sched_active != 0);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB scheduler");
+
+    TCase *TCase_pico_http_sched_priority = tcase_create("Unit test for tc_pico_http_sched_priority");
+    TCase *TCase_pico_http_sched_cancel = tcase_create("Unit test for tc_pico_http_sched_cancel");
+
+    tcase_add_test(TCase_pico_http_sched_priority, tc_pico_http_sched_priority);
+    suite_add_tcase(s, TCase_pico_http_sched_priority);
+    tcase_add_test(TCase_pico_http_sched_cancel, tc_pico_http_sched_cancel);
+    suite_add_tcase(s, TCase_pico_http_sched_cancel);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
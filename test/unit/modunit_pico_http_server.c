@@ -0,0 +1,515 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_tree.h"
+#include "pico_config.h"
+#include "pico_socket.h"
+#include "pico_tcp.h"
+#include "pico_ipv4.h"
+#include "pico_stack.h"
+#include "pico_http_server.h"
+
+#include "pico_http_server.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+volatile pico_time pico_tick = 0;
+
+#define RED     0
+#define BLACK 1
+/* By default the null leafs are black */
+struct pico_tree_node LEAF = {
+    NULL, /* key */
+    &LEAF, &LEAF, &LEAF, /* parent, left,right */
+    BLACK, /* color */
+};
+
+/* MOCKS */
+#define SOCKETS 6
+#define NODES   8
+
+static struct pico_socket listen_socket;
+static struct pico_socket sockets[SOCKETS];
+static const char *sck_in[SOCKETS];      /* what the peer sends, read once */
+static char sck_out[SOCKETS][2048];      /* what the server wrote */
+static int sck_writes[SOCKETS];
+static int sck_closed[SOCKETS];
+static int sck_write_ret = 1;            /* 1 takes everything, else what writes return */
+static int sck_write_max = 0;            /* if set, takes at most this much per write */
+static int listen_closed = 0;
+static int accept_cnt = 0;
+static uint32_t accept_addr = 0;
+
+static int sck_idx(struct pico_socket *s)
+{
+    int i = (int)(s - sockets);
+
+    fail_if(i < 0 || i >= accept_cnt);
+    return i;
+}
+
+struct pico_socket *pico_socket_open(uint16_t net, uint16_t proto, void (*wakeup)(uint16_t ev, struct pico_socket *s))
+{
+    return &listen_socket;
+}
+
+int pico_socket_bind(struct pico_socket *s, void *local_addr, uint16_t *port)
+{
+    return 0;
+}
+
+int pico_socket_listen(struct pico_socket *s, const int backlog)
+{
+    return 0;
+}
+
+struct pico_socket *pico_socket_accept(struct pico_socket *s, void *orig, uint16_t *port)
+{
+    fail_if(s != &listen_socket);
+    fail_if(accept_cnt >= SOCKETS);
+    ((struct pico_ip4 *)orig)->addr = accept_addr;
+    *port = 1024;
+    return &sockets[accept_cnt++];
+}
+
+int pico_socket_read(struct pico_socket *s, void *buf, int len)
+{
+    int i = sck_idx(s);
+    int n;
+
+    if (!sck_in[i])
+        return 0;
+
+    n = (int)strlen(sck_in[i]);
+    if (n > len)
+        n = len;
+
+    memcpy(buf, sck_in[i], (size_t)n);
+    sck_in[i] += n;
+    if (!*sck_in[i])
+        sck_in[i] = NULL;
+
+    return n;
+}
+
+int pico_socket_write(struct pico_socket *s, const void *buf, int len)
+{
+    int i = sck_idx(s);
+
+    if (sck_write_ret != 1)
+        return sck_write_ret;
+
+    if (sck_write_max && len > sck_write_max)
+        len = sck_write_max;
+
+    strncat(sck_out[i], buf, (size_t)len);
+    sck_writes[i]++;
+    return len;
+}
+
+int pico_socket_close(struct pico_socket *s)
+{
+    if (s == &listen_socket)
+        listen_closed++;
+    else
+        sck_closed[sck_idx(s)]++;
+
+    return 0;
+}
+
+static uint32_t rand_cnt = 0;
+
+uint32_t pico_rand(void)
+{
+    return ++rand_cnt;
+}
+
+/* the clients in insertion order */
+static void *tree_keys[NODES];
+static struct pico_tree_node tree_nodes[NODES];
+static int tree_cnt = 0;
+
+void *pico_tree_insert(struct pico_tree *tree, void *key)
+{
+    int i;
+
+    for (i = 0; i < tree_cnt; i++)
+    {
+        if (!tree->compare(tree_keys[i], key))
+            return tree_keys[i];
+    }
+    fail_if(tree_cnt >= NODES);
+    tree_keys[tree_cnt++] = key;
+    return NULL;
+}
+
+void *pico_tree_findKey(struct pico_tree *tree, void *key)
+{
+    int i;
+
+    for (i = 0; i < tree_cnt; i++)
+    {
+        if (!tree->compare(tree_keys[i], key))
+            return tree_keys[i];
+    }
+    return NULL;
+}
+
+void *pico_tree_delete(struct pico_tree *tree, void *key)
+{
+    void *found = pico_tree_findKey(tree, key);
+    int i, j;
+
+    for (i = 0, j = 0; i < tree_cnt; i++)
+    {
+        if (tree_keys[i] != found)
+            tree_keys[j++] = tree_keys[i];
+    }
+    tree_cnt = j;
+    return found;
+}
+
+struct pico_tree_node *pico_tree_firstNode(struct pico_tree_node *node)
+{
+    if (!tree_cnt)
+        return &LEAF;
+
+    tree_nodes[0].keyValue = tree_keys[0];
+    return &tree_nodes[0];
+}
+
+struct pico_tree_node *pico_tree_next(struct pico_tree_node *node)
+{
+    int i = (int)(node - tree_nodes) + 1;
+
+    if (i >= tree_cnt)
+        return &LEAF;
+
+    tree_nodes[i].keyValue = tree_keys[i];
+    return &tree_nodes[i];
+}
+
+static int accept_on_con = 1;
+static int32_t last_conn = 0;
+static int req_cnt = 0;
+static int err_cnt = 0;
+static int progress_cnt = 0;
+static int sent_cnt = 0;
+
+static void cb(uint16_t ev, uint16_t conn)
+{
+    if ((ev & EV_HTTP_CON) && accept_on_con)
+        last_conn = pico_http_server_accept();
+
+    if (ev & EV_HTTP_REQ)
+        req_cnt++;
+
+    if (ev & EV_HTTP_ERROR)
+        err_cnt++;
+
+    if (ev & EV_HTTP_PROGRESS)
+        progress_cnt++;
+
+    if (ev & EV_HTTP_SENT)
+        sent_cnt++;
+}
+
+static void reset(void)
+{
+    memset(sockets, 0, sizeof(sockets));
+    memset(sck_in, 0, sizeof(sck_in));
+    memset(sck_out, 0, sizeof(sck_out));
+    memset(sck_closed, 0, sizeof(sck_closed));
+    memset(sck_writes, 0, sizeof(sck_writes));
+    listen_closed = 0;
+    accept_cnt = 0;
+    accept_addr = 0x0100000au;
+    tree_cnt = 0;
+    accept_on_con = 1;
+    last_conn = 0;
+    req_cnt = 0;
+    err_cnt = 0;
+    progress_cnt = 0;
+    sent_cnt = 0;
+    sck_write_ret = 1;
+    sck_write_max = 0;
+    pico_tick = 1000;
+    memset(&server, 0, sizeof(server));
+    server.rate_burst = HTTP_RATE_BURST;
+    server.rate_refill_ms = HTTP_RATE_REFILL_MS;
+    fail_if(pico_http_server_start(80, cb) != HTTP_RETURN_OK);
+}
+
+START_TEST(tc_pico_http_server_reject)
+{
+    reset();
+
+    /* the application does not take the connection: it is dropped, the server stays */
+    accept_on_con = 0;
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    fail_if(accept_cnt != 1);
+    fail_if(sck_closed[0] != 1);
+    fail_if(listen_closed);
+    fail_if(tree_cnt != 0);
+
+    accept_on_con = 1;
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    fail_if(last_conn < 0);
+    fail_if(sck_closed[1] || listen_closed);
+    fail_if(!find_client((uint16_t)last_conn));
+}
+END_TEST
+
+START_TEST(tc_pico_http_server_rate_limit)
+{
+    int32_t first, second;
+
+    reset();
+
+    /* off unless asked for */
+    fail_if(server.rate_burst != 0);
+    fail_if(pico_http_server_set_rate_limit(1, 0) != HTTP_RETURN_ERROR);
+    fail_if(pico_http_server_set_rate_limit(1, 1000) != HTTP_RETURN_OK);
+
+    /* two connections while the address has a token, the second request gets 429 */
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    first = last_conn;
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    second = last_conn;
+    fail_if(first < 0 || second < 0);
+
+    sck_in[0] = "GET /a HTTP/1.1\r\n\r\n";
+    http_server_cbk(PICO_SOCK_EV_RD, &sockets[0]);
+    fail_if(req_cnt != 1);
+
+    sck_in[1] = "GET /b HTTP/1.1\r\n\r\n";
+    http_server_cbk(PICO_SOCK_EV_RD, &sockets[1]);
+    fail_if(req_cnt != 1);
+    fail_if(strncmp(sck_out[1], "HTTP/1.1 429", 12));
+    fail_if(sck_closed[1] != 1);
+    fail_if(find_client((uint16_t)second));
+    fail_if(!find_client((uint16_t)first));
+
+    /* out of tokens: the new connection is refused, not the server */
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    fail_if(last_conn >= 0);
+    fail_if(sck_closed[2] != 1);
+    fail_if(listen_closed);
+    fail_if(tree_cnt != 1);
+
+    /* another address is not affected, the first one gets its token back */
+    accept_addr = 0x0200000au;
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    fail_if(last_conn < 0);
+    accept_addr = 0x0100000au;
+    pico_tick += 1000;
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    fail_if(last_conn < 0);
+    fail_if(sck_closed[4]);
+}
+END_TEST
+
+/* a new connection that sends req, returns its id */
+static int32_t request(const char *req)
+{
+    http_server_cbk(PICO_SOCK_EV_CONN, &listen_socket);
+    fail_if(last_conn < 0);
+    sck_in[accept_cnt - 1] = req;
+    http_server_cbk(PICO_SOCK_EV_RD, &sockets[accept_cnt - 1]);
+    return last_conn;
+}
+
+START_TEST(tc_pico_http_server_methods)
+{
+    int32_t conn;
+
+    reset();
+
+    /* OPTIONS is answered and freed by the server */
+    conn = request("OPTIONS * HTTP/1.1\r\n\r\n");
+    fail_if(req_cnt != 0);
+    fail_if(strncmp(sck_out[0], "HTTP/1.1 204", 12));
+    fail_if(!strstr(sck_out[0], "Allow: GET, POST, HEAD, OPTIONS"));
+    fail_if(sck_closed[0] != 1);
+    fail_if(find_client((uint16_t)conn));
+
+    /* the whole method token has to match */
+    request("HEADER / HTTP/1.1\r\n\r\n");
+    request("GE / HTTP/1.1\r\n\r\n");
+    request("PUT / HTTP/1.1\r\n\r\n");
+    fail_if(req_cnt != 0);
+
+    /* HEAD gets the header alone, there is no body to submit */
+    conn = request("HEAD /index.html HTTP/1.1\r\n\r\n");
+    fail_if(req_cnt != 1);
+    fail_if(pico_http_get_method((uint16_t)conn) != HTTP_METHOD_HEAD);
+    fail_if(strcmp(pico_http_get_resource((uint16_t)conn), "/index.html"));
+    fail_if(pico_http_respond_mimetype((uint16_t)conn, HTTP_RESOURCE_FOUND, "text/html") <= 0);
+    fail_if(strncmp(sck_out[4], "HTTP/1.1 200", 12));
+    fail_if(sck_closed[4] != 1);
+    /* the body is dropped, the chunk is done right away */
+    fail_if(pico_http_submit_data((uint16_t)conn, "body", 4) != HTTP_RETURN_OK);
+    fail_if(sent_cnt != 1);
+    fail_if(pico_http_submit_data((uint16_t)conn, NULL, 0) != HTTP_RETURN_OK);
+    fail_if(sent_cnt != 1);
+    fail_if(strstr(sck_out[4], "body") || strstr(sck_out[4], "0\r\n\r\n"));
+    fail_if(pico_http_close((uint16_t)conn) != HTTP_RETURN_OK);
+    fail_if(sck_closed[4] != 1);
+}
+END_TEST
+
+START_TEST(tc_pico_http_server_fields)
+{
+    int32_t conn;
+
+    reset();
+
+    /* not kept unless asked for */
+    conn = request("GET /a HTTP/1.1\r\nAccept: */*\r\n\r\n");
+    fail_if(pico_http_get_fields((uint16_t)conn) != NULL);
+
+    fail_if(pico_http_server_keep_fields(64) != HTTP_RETURN_OK);
+    conn = request("GET /b HTTP/1.1\r\nAccept: */*\r\nX-Id: 7\r\n\r\n");
+    fail_if(strcmp(pico_http_get_fields((uint16_t)conn), "Accept: */*\r\nX-Id: 7\r\n"));
+
+    /* any status, with the given fields */
+    fail_if(pico_http_respond_status((uint16_t)conn, 404, "Not Here", "ETag: 1\r\n") <= 0);
+    fail_if(strcmp(sck_out[1], "HTTP/1.1 404 Not Here\r\nETag: 1\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n"));
+    fail_if(pico_http_submit_data((uint16_t)conn, "x", 1) != HTTP_RETURN_OK);
+
+    /* 204 ends with the header */
+    conn = request("GET /c HTTP/1.1\r\n\r\n");
+    fail_if(strcmp(pico_http_get_fields((uint16_t)conn), ""));
+    fail_if(pico_http_respond_status((uint16_t)conn, 204, "No Content", NULL) <= 0);
+    fail_if(strcmp(sck_out[2], "HTTP/1.1 204 No Content\r\nConnection: close\r\n\r\n"));
+    fail_if(sck_closed[2] != 1);
+
+    /* too many to keep */
+    conn = request("GET /d HTTP/1.1\r\nX-Long: 0123456789012345678901234567890123456789012345678901234567890123\r\n\r\n");
+    fail_if(req_cnt != 4);
+    fail_if(pico_http_get_fields((uint16_t)conn) != NULL);
+
+    /* a body without a length is refused */
+    conn = request("POST /e HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+    fail_if(req_cnt != 4);
+    fail_if(strncmp(sck_out[4], "HTTP/1.1 411", 12));
+    fail_if(sck_closed[4] != 1);
+    fail_if(find_client((uint16_t)conn));
+}
+END_TEST
+
+START_TEST(tc_pico_http_server_write_error)
+{
+    static char data[] = "hello";
+    int32_t conn;
+
+    reset();
+
+    /* the socket fails while the chunk is submitted */
+    conn = request("GET /a HTTP/1.1\r\n\r\n");
+    fail_if(pico_http_respond((uint16_t)conn, HTTP_RESOURCE_FOUND) <= 0);
+    sck_write_ret = -1;
+    fail_if(pico_http_submit_data((uint16_t)conn, data, 5) != HTTP_RETURN_ERROR);
+    fail_if(sck_closed[0] != 1);
+    fail_if(pico_http_submit_data((uint16_t)conn, data, 5) != HTTP_RETURN_ERROR);
+    fail_if(pico_http_close((uint16_t)conn) != HTTP_RETURN_OK);
+    fail_if(sck_closed[0] != 1);
+
+    /* or later, on the WR event */
+    sck_write_ret = 1;
+    conn = request("GET /b HTTP/1.1\r\n\r\n");
+    fail_if(pico_http_respond((uint16_t)conn, HTTP_RESOURCE_FOUND) <= 0);
+    sck_write_ret = 0;
+    fail_if(pico_http_submit_data((uint16_t)conn, data, 5) != HTTP_RETURN_OK);
+    fail_if(err_cnt);
+    sck_write_ret = -1;
+    http_server_cbk(PICO_SOCK_EV_WR, &sockets[1]);
+    fail_if(err_cnt != 1);
+    fail_if(sck_closed[1] != 1);
+    fail_if(pico_http_close((uint16_t)conn) != HTTP_RETURN_OK);
+    fail_if(sck_closed[1] != 1);
+}
+END_TEST
+
+START_TEST(tc_pico_http_server_chunks)
+{
+    static char big[1000];
+    char expect[1100];
+    int32_t conn;
+    uint16_t sent, total;
+
+    reset();
+    memset(big, 'x', sizeof(big));
+    strcpy(expect, "3e8\r\n");
+    strncat(expect, big, sizeof(big));
+    strcat(expect, "\r\n");
+
+    /* a static chunk goes out a full stage per write, progress is told at once */
+    conn = request("GET /a HTTP/1.1\r\n\r\n");
+    fail_if(pico_http_respond((uint16_t)conn, HTTP_RESOURCE_FOUND | HTTP_STATIC_RESOURCE) <= 0);
+    sck_out[0][0] = 0;
+    sck_writes[0] = 0;
+    fail_if(pico_http_submit_data((uint16_t)conn, big, sizeof(big)) != HTTP_RETURN_OK);
+    fail_if(sck_writes[0] != 2);
+    fail_if(strcmp(sck_out[0], expect));
+    fail_if(progress_cnt != 1);
+    fail_if(pico_http_get_progress((uint16_t)conn, &sent, &total) != HTTP_RETURN_OK || sent != total);
+
+    /* a small one in a single write, dynamic or static */
+    conn = request("GET /b HTTP/1.1\r\n\r\n");
+    fail_if(pico_http_respond((uint16_t)conn, HTTP_RESOURCE_FOUND) <= 0);
+    sck_out[1][0] = 0;
+    sck_writes[1] = 0;
+    fail_if(pico_http_submit_data((uint16_t)conn, "hello", 5) != HTTP_RETURN_OK);
+    fail_if(sck_writes[1] != 1);
+    fail_if(strcmp(sck_out[1], "5\r\nhello\r\n"));
+
+    /* the socket takes part of the stage, the rest follows on WR */
+    conn = request("GET /c HTTP/1.1\r\n\r\n");
+    fail_if(pico_http_respond((uint16_t)conn, HTTP_RESOURCE_FOUND | HTTP_STATIC_RESOURCE) <= 0);
+    sck_out[2][0] = 0;
+    sck_write_max = 300;
+    fail_if(pico_http_submit_data((uint16_t)conn, big, sizeof(big)) != HTTP_RETURN_OK);
+    fail_if(strlen(sck_out[2]) != 300);
+    sck_write_max = 0;
+    http_server_cbk(PICO_SOCK_EV_WR, &sockets[2]);
+    fail_if(strcmp(sck_out[2], expect));
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB server");
+
+    TCase *TCase_pico_http_server_reject = tcase_create("Unit test for tc_pico_http_server_reject");
+    TCase *TCase_pico_http_server_rate_limit = tcase_create("Unit test for tc_pico_http_server_rate_limit");
+    TCase *TCase_pico_http_server_methods = tcase_create("Unit test for tc_pico_http_server_methods");
+    TCase *TCase_pico_http_server_fields = tcase_create("Unit test for tc_pico_http_server_fields");
+    TCase *TCase_pico_http_server_write_error = tcase_create("Unit test for tc_pico_http_server_write_error");
+    TCase *TCase_pico_http_server_chunks = tcase_create("Unit test for tc_pico_http_server_chunks");
+
+    tcase_add_test(TCase_pico_http_server_reject, tc_pico_http_server_reject);
+    suite_add_tcase(s, TCase_pico_http_server_reject);
+    tcase_add_test(TCase_pico_http_server_rate_limit, tc_pico_http_server_rate_limit);
+    suite_add_tcase(s, TCase_pico_http_server_rate_limit);
+    tcase_add_test(TCase_pico_http_server_methods, tc_pico_http_server_methods);
+    suite_add_tcase(s, TCase_pico_http_server_methods);
+    tcase_add_test(TCase_pico_http_server_fields, tc_pico_http_server_fields);
+    suite_add_tcase(s, TCase_pico_http_server_fields);
+    tcase_add_test(TCase_pico_http_server_write_error, tc_pico_http_server_write_error);
+    suite_add_tcase(s, TCase_pico_http_server_write_error);
+    tcase_add_test(TCase_pico_http_server_chunks, tc_pico_http_server_chunks);
+    suite_add_tcase(s, TCase_pico_http_server_chunks);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -0,0 +1,146 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+
+#include "pico_http_util.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+
+START_TEST(tc_pico_http_url_decode)
+{
+    char buf[64];
+
+    /* both cases of hex digits */
+    pico_http_url_decode(buf, "a%20b%2fc%2Fd");
+    fail_if(strcmp(buf, "a b/c/d"));
+
+    /* a bad or cut escape is kept as it is, '+' is not a space in a path */
+    pico_http_url_decode(buf, "%zz%4g%%41+%4");
+    fail_if(strcmp(buf, "%zz%4g%A+%4"));
+
+    /* in place */
+    strcpy(buf, "%7e%7Euser");
+    pico_http_url_decode(buf, buf);
+    fail_if(strcmp(buf, "~~user"));
+
+    pico_http_url_decode(buf, "");
+    fail_if(strcmp(buf, ""));
+}
+END_TEST
+
+START_TEST(tc_pico_http_split_query)
+{
+    char res1[] = "/index.html";
+    char res2[] = "/form?a=1&b=2";
+    char res3[] = "/form?";
+    char *query;
+
+    fail_if(pico_http_split_query(NULL) != NULL);
+
+    /* no '?', the resource is left alone */
+    fail_if(pico_http_split_query(res1) != NULL);
+    fail_if(strcmp(res1, "/index.html"));
+
+    query = pico_http_split_query(res2);
+    fail_if(strcmp(res2, "/form"));
+    fail_if(!query || strcmp(query, "a=1&b=2"));
+
+    query = pico_http_split_query(res3);
+    fail_if(strcmp(res3, "/form"));
+    fail_if(!query || strcmp(query, ""));
+}
+END_TEST
+
+START_TEST(tc_pico_http_parse_params)
+{
+    char str1[] = "name=J%c3%a9r%C3%B4me+Doe&empty=&flag&&=anon&x%3Dy=a%26b#frag=1";
+    char str2[] = "a=1&b=2&c=3";
+    char str3[] = "bad=%zz%4";
+    char str4[] = "flag&b=2";
+    char str5[] = "a=1&b&c=3";
+    struct pico_http_param params[8];
+
+    fail_if(pico_http_parse_params(NULL, params, 8) != HTTP_RETURN_ERROR);
+    fail_if(pico_http_parse_params(str1, NULL, 8) != HTTP_RETURN_ERROR);
+
+    /* '+', escapes of both cases, empty values and keys, empty pairs, the fragment */
+    fail_if(pico_http_parse_params(str1, params, 8) != 5);
+    fail_if(strcmp(params[0].key, "name") || strcmp(params[0].value, "J\xc3\xa9r\xc3\xb4me Doe"));
+    fail_if(strcmp(params[1].key, "empty") || strcmp(params[1].value, ""));
+    fail_if(strcmp(params[2].key, "flag") || strcmp(params[2].value, ""));
+    fail_if(strcmp(params[3].key, "") || strcmp(params[3].value, "anon"));
+    fail_if(strcmp(params[4].key, "x=y") || strcmp(params[4].value, "a&b"));
+
+    /* at most max_params */
+    fail_if(pico_http_parse_params(str2, params, 2) != 2);
+    fail_if(strcmp(params[1].key, "b") || strcmp(params[1].value, "2"));
+
+    /* a key without a value, nothing decoded before it */
+    fail_if(pico_http_parse_params(str4, params, 8) != 2);
+    fail_if(strcmp(params[0].key, "flag") || strcmp(params[0].value, ""));
+    fail_if(strcmp(params[1].key, "b") || strcmp(params[1].value, "2"));
+    fail_if(pico_http_parse_params(str5, params, 8) != 3);
+    fail_if(strcmp(params[1].key, "b") || strcmp(params[1].value, ""));
+    fail_if(strcmp(params[2].key, "c") || strcmp(params[2].value, "3"));
+
+    /* bad escapes are kept */
+    fail_if(pico_http_parse_params(str3, params, 8) != 1);
+    fail_if(strcmp(params[0].value, "%zz%4"));
+}
+END_TEST
+
+START_TEST(tc_pico_http_get_param)
+{
+    char str[] = "a=1&ab=2&b=&%41=4&=5";
+    struct pico_http_param params[8];
+    int32_t count = pico_http_parse_params(str, params, 8);
+
+    fail_if(count != 5);
+    fail_if(strcmp(pico_http_get_param(params, (uint32_t)count, "a"), "1"));
+    fail_if(strcmp(pico_http_get_param(params, (uint32_t)count, "ab"), "2"));
+    fail_if(strcmp(pico_http_get_param(params, (uint32_t)count, "b"), ""));
+    fail_if(strcmp(pico_http_get_param(params, (uint32_t)count, "A"), "4"));
+    fail_if(strcmp(pico_http_get_param(params, (uint32_t)count, ""), "5"));
+    fail_if(pico_http_get_param(params, (uint32_t)count, "%41") != NULL);
+    fail_if(pico_http_get_param(params, (uint32_t)count, "c") != NULL);
+
+    /* only the first count params are searched */
+    fail_if(pico_http_get_param(params, 1, "ab") != NULL);
+    fail_if(pico_http_get_param(NULL, 1, "a") != NULL);
+    fail_if(pico_http_get_param(params, (uint32_t)count, NULL) != NULL);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPLIB util");
+
+    TCase *TCase_pico_http_url_decode = tcase_create("Unit test for tc_pico_http_url_decode");
+    TCase *TCase_pico_http_split_query = tcase_create("Unit test for tc_pico_http_split_query");
+    TCase *TCase_pico_http_parse_params = tcase_create("Unit test for tc_pico_http_parse_params");
+    TCase *TCase_pico_http_get_param = tcase_create("Unit test for tc_pico_http_get_param");
+
+    tcase_add_test(TCase_pico_http_url_decode, tc_pico_http_url_decode);
+    suite_add_tcase(s, TCase_pico_http_url_decode);
+    tcase_add_test(TCase_pico_http_split_query, tc_pico_http_split_query);
+    suite_add_tcase(s, TCase_pico_http_split_query);
+    tcase_add_test(TCase_pico_http_parse_params, tc_pico_http_parse_params);
+    suite_add_tcase(s, TCase_pico_http_parse_params);
+    tcase_add_test(TCase_pico_http_get_param, tc_pico_http_get_param);
+    suite_add_tcase(s, TCase_pico_http_get_param);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -0,0 +1,164 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "pico_config.h"
+#include "pico_stack.h"
+#include "pico_http_server.h"
+
+#include "pico_https_server.c"
+#include "check.h"
+
+volatile pico_err_t pico_err;
+
+/* MOCKS */
+static const struct pico_http_transport *transport = NULL;
+
+int16_t pico_http_server_start_transport(uint16_t port, void (*wakeup)(uint16_t ev, uint16_t conn),
+                                         const struct pico_http_transport *t)
+{
+    transport = t;
+    return HTTP_RETURN_OK;
+}
+
+int32_t pico_http_server_accept(void)
+{
+    return 0;
+}
+
+char *pico_http_get_resource(uint16_t conn)
+{
+    return NULL;
+}
+
+int16_t pico_http_get_method(uint16_t conn)
+{
+    return 0;
+}
+
+char *pico_http_get_body(uint16_t conn)
+{
+    return NULL;
+}
+
+int16_t pico_http_get_progress(uint16_t conn, uint16_t *sent, uint16_t *total)
+{
+    return 0;
+}
+
+int32_t pico_http_respond(uint16_t conn, uint16_t code)
+{
+    return 0;
+}
+
+int16_t pico_http_submit_data(uint16_t conn, void *buffer, uint16_t len)
+{
+    return 0;
+}
+
+int16_t pico_http_close(uint16_t conn)
+{
+    return 0;
+}
+
+int pico_https_ssl_init(const unsigned char *certificate_buffer, const unsigned int certificate_buffer_size,
+                        const unsigned char *privkey_buffer, const unsigned int privkey_buffer_size)
+{
+    return 0;
+}
+
+static WOLFSSL ssl;
+
+WOLFSSL *pico_https_ssl_accept(struct pico_socket *sck)
+{
+    return &ssl;
+}
+
+int SSL_HANDSHAKE(WOLFSSL *s)
+{
+    return 0;
+}
+
+/* what the next read or write returns, and whether a failure is WANT_READ/WANT_WRITE */
+static int ssl_ret = 0;
+static int ssl_would_block = 0;
+
+int SSL_WOULD_BLOCK(WOLFSSL *s, int ret)
+{
+    fail_if(s != &ssl);
+    fail_if(ret >= 0);
+    return ssl_would_block;
+}
+
+int wolfSSL_read(WOLFSSL *s, void *buf, int len)
+{
+    return ssl_ret;
+}
+
+int wolfSSL_write(WOLFSSL *s, const void *buf, int len)
+{
+    return ssl_ret;
+}
+
+void wolfSSL_free(WOLFSSL *s)
+{
+}
+
+int wolfSSL_shutdown(WOLFSSL *s)
+{
+    return 0;
+}
+
+static void cb(uint16_t ev, uint16_t conn)
+{
+}
+
+START_TEST(tc_pico_https_transport_errors)
+{
+    uint8_t buf[16];
+    void *ctx;
+
+    fail_if(pico_https_server_start(0, cb) != HTTP_RETURN_OK);
+    fail_if(!transport);
+    ctx = transport->accept(NULL);
+    fail_if(ctx != &ssl);
+
+    /* data goes through as is */
+    ssl_ret = 10;
+    fail_if(transport->read(ctx, buf, sizeof(buf)) != 10);
+    fail_if(transport->write(ctx, buf, sizeof(buf)) != 10);
+
+    /* waiting for the socket is not an error */
+    ssl_ret = -1;
+    ssl_would_block = 1;
+    fail_if(transport->read(ctx, buf, sizeof(buf)) != 0);
+    fail_if(transport->write(ctx, buf, sizeof(buf)) != 0);
+
+    /* anything else ends the connection */
+    ssl_ret = -308;
+    ssl_would_block = 0;
+    fail_if(transport->read(ctx, buf, sizeof(buf)) != -1);
+    fail_if(transport->write(ctx, buf, sizeof(buf)) != -1);
+}
+END_TEST
+
+Suite *pico_suite(void)
+{
+    Suite *s = suite_create("PicoTCP-modules HTTPSLIB server");
+
+    TCase *TCase_pico_https_transport_errors = tcase_create("Unit test for tc_pico_https_transport_errors");
+
+    tcase_add_test(TCase_pico_https_transport_errors, tc_pico_https_transport_errors);
+    suite_add_tcase(s, TCase_pico_https_transport_errors);
+    return s;
+}
+
+int main(void)
+{
+    int fails;
+    Suite *s = pico_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    fails = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return fails;
+}
@@ -2,6 +2,17 @@
 rm -f /tmp/pico-modules-mem-report-*
 
 ./build/test/units/modunit_libhttp_client.elf || exit 1
+./build/test/units/modunit_libhttp_multipart.elf || exit 1
+./build/test/units/modunit_libhttp_util.elf || exit 1
+./build/test/units/modunit_libhttp_proxy.elf || exit 1
+./build/test/units/modunit_libhttp_http2.elf || exit 1
+./build/test/units/modunit_libhttp_dns.elf || exit 1
+./build/test/units/modunit_libhttp_inflate.elf || exit 1
+./build/test/units/modunit_libhttp_download.elf || exit 1
+./build/test/units/modunit_libhttp_cache.elf || exit 1
+./build/test/units/modunit_libhttp_sched.elf || exit 1
+./build/test/units/modunit_libhttp_server.elf || exit 1
+./build/test/units/modunit_libhttps_server.elf || exit 1
 
 MAXMEM=`cat /tmp/pico-modules-mem-report-* | sort -r -n |head -1`
 echo